@@ -0,0 +1,54 @@
+// include/beam-weight-table.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "include/beam-weight-table.h"
+
+namespace kaldi {
+
+BeamWeightTable::BeamWeightTable(const std::string &weight_rspecifier, int32 cache_size):
+        cache_size_(cache_size), num_loads_(0) {
+    KALDI_ASSERT(cache_size_ >= 1);
+    if (!weight_reader_.Open(weight_rspecifier))
+        KALDI_ERR << "Failed to open beam weights: " << weight_rspecifier;
+}
+
+const CMatrix<BaseFloat> *BeamWeightTable::Value(const std::string &weight_id) {
+    auto iter = index_.find(weight_id);
+    if (iter != index_.end()) {
+        // move to front
+        entries_.splice(entries_.begin(), entries_, iter->second);
+        return &(entries_.front().second);
+    }
+    if (!weight_reader_.HasKey(weight_id))
+        return NULL;
+    if (static_cast<int32>(entries_.size()) == cache_size_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+    entries_.emplace_front(weight_id, CMatrix<BaseFloat>());
+    entries_.front().second = weight_reader_.Value(weight_id);
+    index_[weight_id] = entries_.begin();
+    num_loads_++;
+    return &(entries_.front().second);
+}
+
+}
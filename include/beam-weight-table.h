@@ -0,0 +1,67 @@
+// include/beam-weight-table.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef BEAM_WEIGHT_TABLE_H
+#define BEAM_WEIGHT_TABLE_H
+
+#include <list>
+#include <unordered_map>
+
+#include "util/common-utils.h"
+#include "include/complex-matrix.h"
+
+namespace kaldi {
+
+typedef KaldiObjectHolder<CMatrix<BaseFloat> > CMatrixHolder;
+
+// Random access to pre-computed beam weights(num_bins, num_channels), keyed by
+// weight id(egs. utterance, speaker position or session). Deserialized weights
+// are kept in a LRU cache of cache_size entries, so with enough entries each
+// weight is loaded once, no matter what order utterances come in.
+// NOTE: use scp for weight_rspecifier, unsorted archives are buffered by kaldi's
+// table reader itself.
+class BeamWeightTable {
+public:
+    BeamWeightTable(const std::string &weight_rspecifier, int32 cache_size);
+
+    // Returns NULL if weight_id is not found, the pointer is valid until
+    // next call of Value()
+    const CMatrix<BaseFloat> *Value(const std::string &weight_id);
+
+    // Number of weights deserialized so far, egs. for cache misses
+    int32 NumLoads() const { return num_loads_; }
+
+    int32 NumCached() const { return entries_.size(); }
+
+private:
+    typedef std::list<std::pair<std::string, CMatrix<BaseFloat> > > EntryList;
+
+    RandomAccessTableReader<CMatrixHolder> weight_reader_;
+    int32 cache_size_, num_loads_;
+    // most recently used first
+    EntryList entries_;
+    std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+}
+
+#endif
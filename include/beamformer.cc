@@ -20,9 +20,15 @@
 
 
 #include "include/beamformer.h"
+#include "include/setk-profile.h"
+#include "include/setk-allocator.h"
+#include "include/thread-pool.h"
 
 namespace kaldi {
 
+// work of each bin is small, group some of them into one task
+const int32 kBinsPerTask = 8;
+
 // Cast CMatrix into Matrix(in Realfft format), for speech reconstrucion
 // The Realfft format is space efficient, so I refused to use CMatrix in stft.h
 void CastIntoRealfft(const CMatrixBase<BaseFloat> &cstft,
@@ -50,30 +56,31 @@ void CastIntoRealfft(const CMatrixBase<BaseFloat> &cstft,
 void TrimStft(const int32 num_bins, const int32 num_channels, 
               const CMatrixBase<BaseFloat> &src_stft,
               CMatrix<BaseFloat> *dst_stft) {
+    SETK_PROFILE("trim-stft");
     if (num_channels * num_bins != src_stft.NumCols() && num_bins != src_stft.NumCols())
         KALDI_ERR << "Check dimention of short-time fourier transform";
 
     int32 num_frames = (num_bins == src_stft.NumCols() ? 
                         src_stft.NumRows() / num_channels: 
                         src_stft.NumRows());
-    dst_stft->Resize(num_bins * num_frames, num_channels);
+    // every element is written, by the same partition of bins as the
+    // following per-bin stages, which keeps pages on their NUMA nodes
+    dst_stft->Resize(num_bins * num_frames, num_channels, kUndefined);
 
-    if (num_channels * num_bins == src_stft.NumCols()) {
-        for (int32 c = 0; c < num_channels; c++) {
-            for (int32 f = 0; f < num_bins; f++) {
+    bool packed = (num_channels * num_bins == src_stft.NumCols());
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        for (int32 f = fbeg; f < fend; f++) {
+            for (int32 c = 0; c < num_channels; c++) {
                 // D[f * T: f * T + T, c: c + 1] = S[:, F * c + f: F * c + f + 1]
-                dst_stft->Range(f * num_frames, num_frames, c, 1)
-                    .CopyFromMat(src_stft.ColRange(num_bins * c + f, 1));
-            }
-        }
-    } else {
-        for (int32 c = 0; c < num_channels; c++) {
-            for (int32 f = 0; f < num_bins; f++) {
-                dst_stft->Range(f * num_frames, num_frames, c, 1)
-                    .CopyFromMat(src_stft.Range(num_frames * c, num_frames, f, 1));
+                if (packed)
+                    dst_stft->Range(f * num_frames, num_frames, c, 1)
+                        .CopyFromMat(src_stft.ColRange(num_bins * c + f, 1));
+                else
+                    dst_stft->Range(f * num_frames, num_frames, c, 1)
+                        .CopyFromMat(src_stft.Range(num_frames * c, num_frames, f, 1));
             }
         }
-    }
+    }, kBinsPerTask);
 }
 
 //
@@ -89,28 +96,163 @@ void TrimStft(const int32 num_bins, const int32 num_channels,
 void EstimatePsd(const CMatrixBase<BaseFloat> &src_stft, 
                  const MatrixBase<BaseFloat> &target_mask,
                  CMatrix<BaseFloat> *target_psd,
-                 CMatrix<BaseFloat> *second_psd) {
+                 CMatrix<BaseFloat> *second_psd,
+                 BaseFloat mask_floor) {
+    SETK_PROFILE("psd");
     int32 num_channels = src_stft.NumCols(), num_frames = target_mask.NumRows(),
           num_bins = target_mask.NumCols();
     KALDI_ASSERT(num_frames == src_stft.NumRows() / num_bins);
     KALDI_ASSERT(target_psd);
-    target_psd->Resize(num_bins * num_channels, num_channels);
+    // zeroed by tasks, see TrimStft()
+    target_psd->Resize(num_bins * num_channels, num_channels, kUndefined);
     if (second_psd)
-        second_psd->Resize(num_bins * num_channels, num_channels);
+        second_psd->Resize(num_bins * num_channels, num_channels, kUndefined);
 
-    for (int32 f = 0; f < num_bins; f++) {
-        BaseFloat mask_sum = 0.0, mask = 0.0;
-        for (int32 t = 0; t < num_frames; t++) {
-            SubCVector<BaseFloat> obs(src_stft, f * num_frames + t);
-            mask = target_mask(t, f);
-            target_psd->RowRange(f * num_channels, num_channels).AddVecVec(mask, 0, obs, obs, kConj);
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        target_psd->RowRange(fbeg * num_channels, (fend - fbeg) * num_channels).SetZero();
+        if (second_psd)
+            second_psd->RowRange(fbeg * num_channels, (fend - fbeg) * num_channels).SetZero();
+        for (int32 f = fbeg; f < fend; f++) {
+            BaseFloat mask_sum = 0.0, mask = 0.0;
+            for (int32 t = 0; t < num_frames; t++) {
+                SubCVector<BaseFloat> obs(src_stft, f * num_frames + t);
+                mask = target_mask(t, f);
+                if (mask_floor <= 0 || mask > mask_floor)
+                    target_psd->RowRange(f * num_channels, num_channels).AddVecVec(mask, 0, obs, obs, kConj);
+                if (second_psd && (mask_floor <= 0 || 1 - mask > mask_floor))
+                    second_psd->RowRange(f * num_channels, num_channels).AddVecVec(1 - mask, 0, obs, obs, kConj);
+                mask_sum += mask;
+            }
+            target_psd->RowRange(f * num_channels, num_channels).Scale(1.0 / mask_sum, 0);
             if (second_psd)
-                second_psd->RowRange(f * num_channels, num_channels).AddVecVec(1 - mask, 0, obs, obs, kConj);
-            mask_sum += mask;
+                second_psd->RowRange(f * num_channels, num_channels).Scale(1.0 / (num_frames - mask_sum), 0);
         }
-        target_psd->RowRange(f * num_channels, num_channels).Scale(1.0 / mask_sum, 0);
-        if (second_psd)
-            second_psd->RowRange(f * num_channels, num_channels).Scale(1.0 / (num_frames - mask_sum), 0);
+    }, kBinsPerTask);
+}
+
+// Batched version of EstimatePsd(), psd of each (utterance, bin) pair is computed
+// by one gemm instead of rank-1 updates frame by frame, i.e.
+//      conj(covar) = X^H * (m .* X)
+void EstimatePsd(const CMatrixBase<BaseFloat> &src_stft,
+                 const MatrixBase<BaseFloat> &target_mask,
+                 const std::vector<int32> &frame_offsets,
+                 CMatrix<BaseFloat> *target_psd,
+                 CMatrix<BaseFloat> *second_psd,
+                 BaseFloat mask_floor) {
+    SETK_PROFILE("psd");
+    int32 num_channels = src_stft.NumCols(), num_frames = target_mask.NumRows(),
+          num_bins = target_mask.NumCols(), num_utts = frame_offsets.size() - 1;
+    KALDI_ASSERT(num_utts >= 1 && frame_offsets.back() == num_frames);
+    KALDI_ASSERT(num_frames == src_stft.NumRows() / num_bins);
+    KALDI_ASSERT(target_psd);
+    target_psd->Resize(num_utts * num_bins * num_channels, num_channels, kUndefined);
+    if (second_psd)
+        second_psd->Resize(num_utts * num_bins * num_channels, num_channels, kUndefined);
+
+    ParallelFor(0, num_utts * num_bins, [&](int32 beg, int32 end) {
+        CMatrix<BaseFloat> weighted;
+        for (int32 i = beg; i < end; i++) {
+            int32 u = i / num_bins, f = i % num_bins, offset = frame_offsets[u],
+                  utt_frames = frame_offsets[u + 1] - offset;
+            SubCMatrix<BaseFloat> obs(src_stft, f * num_frames + offset, utt_frames, 0, num_channels),
+                                  target(*target_psd, i * num_channels, num_channels, 0, num_channels);
+            weighted.Resize(utt_frames, num_channels, kUndefined);
+            weighted.CopyFromMat(obs);
+            BaseFloat mask_sum = 0.0;
+            for (int32 t = 0; t < utt_frames; t++) {
+                BaseFloat mask = target_mask(offset + t, f);
+                // frames skipped by mask_floor are zeroed
+                weighted.Row(t).Scale(mask_floor <= 0 || mask > mask_floor ? mask: 0, 0);
+                mask_sum += mask;
+            }
+            target.AddMatMat(1, 0, obs, kConjTrans, weighted, kNoTrans, 0, 0);
+            target.Conjugate();
+            target.Scale(1.0 / mask_sum, 0);
+            if (second_psd) {
+                SubCMatrix<BaseFloat> second(*second_psd, i * num_channels, num_channels, 0, num_channels);
+                // (1 - m) .* X
+                if (mask_floor <= 0) {
+                    weighted.Scale(-1, 0);
+                    weighted.AddMat(1, 0, obs);
+                } else {
+                    weighted.CopyFromMat(obs);
+                    for (int32 t = 0; t < utt_frames; t++) {
+                        BaseFloat mask = 1 - target_mask(offset + t, f);
+                        weighted.Row(t).Scale(mask > mask_floor ? mask: 0, 0);
+                    }
+                }
+                second.AddMatMat(1, 0, obs, kConjTrans, weighted, kNoTrans, 0, 0);
+                second.Conjugate();
+                second.Scale(1.0 / (utt_frames - mask_sum), 0);
+            }
+        }
+    }, kBinsPerTask);
+}
+
+PsdAccumulator::PsdAccumulator(int32 num_bins, int32 num_channels, BaseFloat mask_floor):
+        num_bins_(num_bins), num_channels_(num_channels), num_frames_(0), mask_floor_(mask_floor) {
+    target_psd_.Resize(num_bins_ * num_channels_, num_channels_);
+    noise_psd_.Resize(num_bins_ * num_channels_, num_channels_);
+    mask_sum_.Resize(num_bins_);
+}
+
+void PsdAccumulator::Accumulate(const CMatrixBase<BaseFloat> &src_stft, int32 start_frame,
+                                const MatrixBase<BaseFloat> &mask) {
+    SETK_PROFILE("psd");
+    int32 num_frames = src_stft.NumRows() / num_bins_, chunk_frames = mask.NumRows();
+    KALDI_ASSERT(src_stft.NumCols() == num_channels_ && mask.NumCols() == num_bins_);
+    KALDI_ASSERT(start_frame >= 0 && start_frame + chunk_frames <= num_frames);
+
+    ParallelFor(0, num_bins_, [&](int32 fbeg, int32 fend) {
+        for (int32 f = fbeg; f < fend; f++) {
+            SubCMatrix<BaseFloat> target(target_psd_, f * num_channels_, num_channels_, 0, num_channels_),
+                                  noise(noise_psd_, f * num_channels_, num_channels_, 0, num_channels_);
+            for (int32 t = 0; t < chunk_frames; t++) {
+                SubCVector<BaseFloat> obs(src_stft, f * num_frames + start_frame + t);
+                BaseFloat m = mask(t, f);
+                if (mask_floor_ <= 0 || m > mask_floor_)
+                    target.AddVecVec(m, 0, obs, obs, kConj);
+                if (mask_floor_ <= 0 || 1 - m > mask_floor_)
+                    noise.AddVecVec(1 - m, 0, obs, obs, kConj);
+                mask_sum_(f) += m;
+            }
+        }
+    }, kBinsPerTask);
+    num_frames_ += chunk_frames;
+}
+
+void PsdAccumulator::GetPsd(CMatrix<BaseFloat> *target_psd, CMatrix<BaseFloat> *noise_psd) const {
+    KALDI_ASSERT(num_frames_ > 0);
+    target_psd->Resize(num_bins_ * num_channels_, num_channels_, kUndefined);
+    noise_psd->Resize(num_bins_ * num_channels_, num_channels_, kUndefined);
+    target_psd->CopyFromMat(target_psd_);
+    noise_psd->CopyFromMat(noise_psd_);
+    for (int32 f = 0; f < num_bins_; f++) {
+        target_psd->RowRange(f * num_channels_, num_channels_).Scale(1.0 / mask_sum_(f), 0);
+        noise_psd->RowRange(f * num_channels_, num_channels_).Scale(1.0 / (num_frames_ - mask_sum_(f)), 0);
+    }
+}
+
+void PsdAccumulator::Reset() {
+    target_psd_.SetZero();
+    noise_psd_.SetZero();
+    mask_sum_.SetZero();
+    num_frames_ = 0;
+}
+
+// With decimation, only bins f % decimation == 0 and the last one are computed
+inline bool IsComputedBin(int32 f, int32 num_bins, int32 decimation) {
+    return decimation <= 1 || f % decimation == 0 || f == num_bins - 1;
+}
+
+// Copy rows of skipped bins from the nearest computed ones
+void FillDecimatedBins(int32 decimation, CMatrixBase<BaseFloat> *bins) {
+    int32 num_bins = bins->NumRows();
+    if (decimation <= 1) return;
+    for (int32 f = 0; f < num_bins; f++) {
+        if (IsComputedBin(f, num_bins, decimation)) continue;
+        int32 lower = f - f % decimation, upper = std::min(lower + decimation, num_bins - 1);
+        bins->Row(f).CopyFromVec(bins->Row(f - lower <= upper - f ? lower: upper));
     }
 }
 
@@ -121,20 +263,30 @@ void EstimatePsd(const CMatrixBase<BaseFloat> &src_stft,
 //  A. * V^H = D * V^H 
 // see test_cmatrix_hed() in test/test-complex.cc
 void EstimateSteerVector(const CMatrixBase<BaseFloat> &target_psd,
-                         CMatrix<BaseFloat> *steer_vector) {
+                         CMatrix<BaseFloat> *steer_vector,
+                         int32 decimation) {
+    SETK_PROFILE("steer-vector");
     int32 num_channels = target_psd.NumCols();
     KALDI_ASSERT(target_psd.NumRows() % num_channels == 0);
     int32 num_bins = target_psd.NumRows() / num_channels;
     steer_vector->Resize(num_bins, num_channels);
     
-    CMatrix<BaseFloat> V(num_channels, num_channels); Vector<BaseFloat> D(num_channels);
-    for (int32 f = 0; f < num_bins; f++) {
-        target_psd.RowRange(f * num_channels, num_channels).Hed(&D, &V);
-        KALDI_VLOG(3) << "Compute eigen-dcomposition for matrix: " << target_psd.RowRange(f * num_channels, num_channels);
-        KALDI_VLOG(3) << "Computed eigen values:" << D;
-        KALDI_VLOG(3) << "Computed eigen vectors(row-major):" << V;
-        steer_vector->Row(f).CopyFromVec(V.Row(num_channels - 1), kConj); 
-    }
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        CMatrix<BaseFloat> V(num_channels, num_channels);
+        // from workspace, not heap, as online beamformer updates weights periodically
+        SubVector<BaseFloat> D(static_cast<BaseFloat*>(ThreadWorkspace(kEigenValues,
+                               sizeof(BaseFloat) * num_channels)), num_channels);
+        for (int32 f = fbeg; f < fend; f++) {
+            if (!IsComputedBin(f, num_bins, decimation)) continue;
+            SETK_NO_ALLOC("steer-vector");
+            target_psd.RowRange(f * num_channels, num_channels).Hed(&D, &V);
+            KALDI_VLOG(3) << "Compute eigen-dcomposition for matrix: " << target_psd.RowRange(f * num_channels, num_channels);
+            KALDI_VLOG(3) << "Computed eigen values:" << D;
+            KALDI_VLOG(3) << "Computed eigen vectors(row-major):" << V;
+            steer_vector->Row(f).CopyFromVec(V.Row(num_channels - 1), kConj); 
+        }
+    }, kBinsPerTask);
+    FillDecimatedBins(decimation, steer_vector);
 }
 
 
@@ -145,27 +297,34 @@ void EstimateSteerVector(const CMatrixBase<BaseFloat> &target_psd,
 //      w = \frac{R^{-1} * d}{d^H * R^{-1} * d}
 void ComputeMvdrBeamWeights(const CMatrixBase<BaseFloat> &noise_psd,
                             const CMatrixBase<BaseFloat> &steer_vector,
-                            CMatrix<BaseFloat> *beam_weights) {
+                            CMatrix<BaseFloat> *beam_weights,
+                            int32 decimation) {
+    SETK_PROFILE("mvdr-weights");
     KALDI_ASSERT(noise_psd.NumCols() == steer_vector.NumCols());
     KALDI_ASSERT(noise_psd.NumRows() % steer_vector.NumCols() == 0);
     int32 num_bins = steer_vector.NumRows(), num_channels = steer_vector.NumCols();
 
-    CMatrix<BaseFloat> psd_inv(num_channels, num_channels);
     beam_weights->Resize(num_bins, num_channels);
-    for (int32 f = 0; f < num_bins; f++) {
-        SubCVector<BaseFloat> numerator(*beam_weights, f), steer(steer_vector, f);
-        psd_inv.CopyFromMat(noise_psd.RowRange(f * num_channels, num_channels));
-        KALDI_VLOG(3) << "Noise power spectrum matrix: " << psd_inv;
-        KALDI_VLOG(3) << "Using steer vector: " << steer;
-        psd_inv.Invert(); // may be singular, using diag loading to avoid
-        numerator.AddMatVec(1, 0, psd_inv, kNoTrans, steer, 0, 0); 
-        KALDI_VLOG(3) << "R^{-1} * d: " << numerator;
-        std::complex<BaseFloat> s = std::complex<BaseFloat>(1.0, 0) / VecVec(numerator, steer, kConj);
-        KALDI_VLOG(3) << "1 / (d^H * R^{-1} * d): " << "(" << std::real(s) 
-                      << (std::imag(s) >= 0 ? "+": "") << std::imag(s) << ")" << std::endl;
-        numerator.Scale(std::real(s), std::imag(s));
-        KALDI_VLOG(3) << "R^{-1} * d / (d^H * R^{-1} * d): " << numerator;
-    }
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        CMatrix<BaseFloat> psd_inv(num_channels, num_channels);
+        for (int32 f = fbeg; f < fend; f++) {
+            if (!IsComputedBin(f, num_bins, decimation)) continue;
+            SETK_NO_ALLOC("mvdr-weights");
+            SubCVector<BaseFloat> numerator(*beam_weights, f), steer(steer_vector, f);
+            psd_inv.CopyFromMat(noise_psd.RowRange(f * num_channels, num_channels));
+            KALDI_VLOG(3) << "Noise power spectrum matrix: " << psd_inv;
+            KALDI_VLOG(3) << "Using steer vector: " << steer;
+            psd_inv.Invert(); // may be singular, using diag loading to avoid
+            numerator.AddMatVec(1, 0, psd_inv, kNoTrans, steer, 0, 0); 
+            KALDI_VLOG(3) << "R^{-1} * d: " << numerator;
+            std::complex<BaseFloat> s = std::complex<BaseFloat>(1.0, 0) / VecVec(numerator, steer, kConj);
+            KALDI_VLOG(3) << "1 / (d^H * R^{-1} * d): " << "(" << std::real(s) 
+                          << (std::imag(s) >= 0 ? "+": "") << std::imag(s) << ")" << std::endl;
+            numerator.Scale(std::real(s), std::imag(s));
+            KALDI_VLOG(3) << "R^{-1} * d / (d^H * R^{-1} * d): " << numerator;
+        }
+    }, kBinsPerTask);
+    FillDecimatedBins(decimation, beam_weights);
     // using beam_weights in Beamform
 }
 
@@ -175,20 +334,29 @@ void ComputeMvdrBeamWeights(const CMatrixBase<BaseFloat> &noise_psd,
 // beam_weights:(num_bins, num_channels)
 void ComputeGevdBeamWeights(const CMatrixBase<BaseFloat> &target_psd,
                             const CMatrixBase<BaseFloat> &noise_psd,
-                            CMatrix<BaseFloat> *beam_weights) {
+                            CMatrix<BaseFloat> *beam_weights,
+                            int32 decimation) {
+    SETK_PROFILE("gevd-weights");
     KALDI_ASSERT(target_psd.NumCols() == noise_psd.NumCols() && target_psd.NumRows() == noise_psd.NumRows()); 
     KALDI_ASSERT(target_psd.NumRows() % target_psd.NumRows() == 0);
     int32 num_channels = target_psd.NumCols(), num_bins = target_psd.NumRows() / target_psd.NumCols();
 
     beam_weights->Resize(num_bins, num_channels);
-    CMatrix<BaseFloat> V(num_channels, num_channels); Vector<BaseFloat> D(num_channels);
-    for (int32 f = 0; f < num_bins; f++) {
-        SubCMatrix<BaseFloat> B(noise_psd, f * num_channels, num_channels, 0, num_channels);
-        target_psd.RowRange(f * num_channels, num_channels).Hged(&B, &D, &V);     
-        KALDI_VLOG(3) << "Computed eigen values:" << D;
-        KALDI_VLOG(3) << "Computed eigen vectors(row-major):" << V;
-        beam_weights->Row(f).CopyFromVec(V.Row(num_channels - 1), kConj);
-    }
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        CMatrix<BaseFloat> V(num_channels, num_channels);
+        // from workspace, not heap, as online beamformer updates weights periodically
+        SubVector<BaseFloat> D(static_cast<BaseFloat*>(ThreadWorkspace(kEigenValues,
+                               sizeof(BaseFloat) * num_channels)), num_channels);
+        for (int32 f = fbeg; f < fend; f++) {
+            if (!IsComputedBin(f, num_bins, decimation)) continue;
+            SubCMatrix<BaseFloat> B(noise_psd, f * num_channels, num_channels, 0, num_channels);
+            target_psd.RowRange(f * num_channels, num_channels).Hged(&B, &D, &V);     
+            KALDI_VLOG(3) << "Computed eigen values:" << D;
+            KALDI_VLOG(3) << "Computed eigen vectors(row-major):" << V;
+            beam_weights->Row(f).CopyFromVec(V.Row(num_channels - 1), kConj);
+        }
+    }, kBinsPerTask);
+    FillDecimatedBins(decimation, beam_weights);
 }
 
 
@@ -203,6 +371,7 @@ void ComputeGevdBeamWeights(const CMatrixBase<BaseFloat> &target_psd,
 void Beamform(const CMatrixBase<BaseFloat> &src_stft, 
               const CMatrixBase<BaseFloat> &weights,
               CMatrix<BaseFloat> *enh_stft) {
+    SETK_PROFILE("beamform");
     KALDI_ASSERT(src_stft.NumCols() == weights.NumCols());
     KALDI_ASSERT(src_stft.NumRows() % weights.NumRows() == 0);
     int32 num_bins = weights.NumRows(), num_channels = weights.NumCols(),
@@ -210,10 +379,334 @@ void Beamform(const CMatrixBase<BaseFloat> &src_stft,
 
     enh_stft->Resize(num_frames, num_bins);
     // enh_stft[f] = src_stft[f * t: f * t + t] * w^H
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        for (int32 f = fbeg; f < fend; f++)
+            enh_stft->ColRange(f, 1).AddMatMat(1, 0, src_stft.RowRange(f * num_frames, num_frames), 
+                                               kNoTrans, weights.RowRange(f, 1), kConjTrans, 0, 0);
+    }, kBinsPerTask);
+}
+
+
+
+// weights:     (num_utts x num_bins, num_channels)
+// enh_stft:    (num_frames, num_bins)
+void Beamform(const CMatrixBase<BaseFloat> &src_stft,
+              const CMatrixBase<BaseFloat> &weights,
+              const std::vector<int32> &frame_offsets,
+              CMatrix<BaseFloat> *enh_stft) {
+    SETK_PROFILE("beamform");
+    int32 num_utts = frame_offsets.size() - 1, num_channels = weights.NumCols(),
+          num_bins = weights.NumRows() / num_utts, num_frames = frame_offsets.back();
+    KALDI_ASSERT(num_utts >= 1 && weights.NumRows() == num_utts * num_bins);
+    KALDI_ASSERT(src_stft.NumCols() == num_channels && src_stft.NumRows() == num_bins * num_frames);
+
+    enh_stft->Resize(num_frames, num_bins);
+    ParallelFor(0, num_utts * num_bins, [&](int32 beg, int32 end) {
+        for (int32 i = beg; i < end; i++) {
+            int32 u = i / num_bins, f = i % num_bins, offset = frame_offsets[u],
+                  utt_frames = frame_offsets[u + 1] - offset;
+            enh_stft->Range(offset, utt_frames, f, 1).AddMatMat(1, 0,
+                src_stft.Range(f * num_frames + offset, utt_frames, 0, num_channels), kNoTrans,
+                weights.RowRange(i, 1), kConjTrans, 0, 0);
+        }
+    }, kBinsPerTask);
+}
+
+
+// stft:        (num_frames, num_bins)
+// stacked:     (num_bins x num_frames, order)
+void StackFrames(const CMatrixBase<BaseFloat> &stft, int32 order,
+                 CMatrix<BaseFloat> *stacked) {
+    SETK_PROFILE("stack-frames");
+    KALDI_ASSERT(order >= 1);
+    int32 num_frames = stft.NumRows(), num_bins = stft.NumCols();
+    stacked->Resize(num_bins * num_frames, order);
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        for (int32 f = fbeg; f < fend; f++) {
+            for (int32 k = 0; k < order && k < num_frames; k++)
+                // stacked[f * t + t', k] = stft[t' - k, f]
+                stacked->Range(f * num_frames + k, num_frames - k, k, 1).CopyFromMat(
+                    stft.Range(0, num_frames - k, f, 1));
+        }
+    }, kBinsPerTask);
+}
+
+
+void EstimateInterframeCorrelation(const CMatrixBase<BaseFloat> &target_psd,
+                                   CMatrix<BaseFloat> *correlation) {
+    KALDI_ASSERT(target_psd.NumRows() % target_psd.NumCols() == 0);
+    int32 order = target_psd.NumCols(), num_bins = target_psd.NumRows() / order;
+    correlation->Resize(num_bins, order);
+    for (int32 f = 0; f < num_bins; f++) {
+        BaseFloat power = target_psd(f * order, 0, kReal);
+        // no target on this bin, pass through current frame
+        if (power <= FLT_EPSILON) {
+            (*correlation)(f, 0, kReal) = 1.0;
+            continue;
+        }
+        for (int32 k = 0; k < order; k++) {
+            (*correlation)(f, k, kReal) = target_psd(f * order + k, 0, kReal) / power;
+            (*correlation)(f, k, kImag) = target_psd(f * order + k, 0, kImag) / power;
+        }
+    }
+}
+
+
+// Solve R * x = d by cholesky decomposition(R = L * L^H) for hermitian positive definite
+// R of fixed size N, everything stays on stack. Returns false if R is not positive definite
+template<int32 N>
+static bool CholeskySolve(const CMatrixBase<BaseFloat> &R, const CVectorBase<BaseFloat> &d,
+                          CVectorBase<BaseFloat> *x) {
+    typedef std::complex<double> Complex;
+    Complex L[N][N], y[N];
+    for (int32 j = 0; j < N; j++) {
+        double diag = R(j, j, kReal);
+        for (int32 k = 0; k < j; k++)
+            diag -= std::norm(L[j][k]);
+        if (diag <= 0) return false;
+        L[j][j] = std::sqrt(diag);
+        for (int32 i = j + 1; i < N; i++) {
+            Complex s(R(i, j, kReal), R(i, j, kImag));
+            for (int32 k = 0; k < j; k++)
+                s -= L[i][k] * std::conj(L[j][k]);
+            L[i][j] = s / L[j][j];
+        }
+    }
+    // L * y = d
+    for (int32 i = 0; i < N; i++) {
+        Complex s(d(i, kReal), d(i, kImag));
+        for (int32 k = 0; k < i; k++)
+            s -= L[i][k] * y[k];
+        y[i] = s / L[i][i];
+    }
+    // L^H * x = y
+    for (int32 i = N - 1; i >= 0; i--) {
+        for (int32 k = i + 1; k < N; k++)
+            y[i] -= std::conj(L[k][i]) * y[k];
+        y[i] /= L[i][i];
+        (*x)(i, kReal) = std::real(y[i]), (*x)(i, kImag) = std::imag(y[i]);
+    }
+    return true;
+}
+
+static bool FixedSizeSolve(const CMatrixBase<BaseFloat> &R, const CVectorBase<BaseFloat> &d,
+                           CVectorBase<BaseFloat> *x) {
+    switch (R.NumRows()) {
+        case 1: return CholeskySolve<1>(R, d, x);
+        case 2: return CholeskySolve<2>(R, d, x);
+        case 3: return CholeskySolve<3>(R, d, x);
+        case 4: return CholeskySolve<4>(R, d, x);
+        case 5: return CholeskySolve<5>(R, d, x);
+        case 6: return CholeskySolve<6>(R, d, x);
+        case 7: return CholeskySolve<7>(R, d, x);
+        case 8: return CholeskySolve<8>(R, d, x);
+        default: return false;
+    }
+}
+
+// NOTE mfmvdr beam weights computation:
+//      w = \frac{R_n^{-1} * \gamma}{\gamma^H * R_n^{-1} * \gamma}
+void ComputeMultiFrameMvdrWeights(const CMatrixBase<BaseFloat> &noise_psd,
+                                  const CMatrixBase<BaseFloat> &correlation,
+                                  CMatrix<BaseFloat> *beam_weights) {
+    SETK_PROFILE("mfmvdr-weights");
+    KALDI_ASSERT(noise_psd.NumCols() == correlation.NumCols());
+    KALDI_ASSERT(noise_psd.NumRows() == correlation.NumRows() * correlation.NumCols());
+    int32 num_bins = correlation.NumRows(), order = correlation.NumCols();
+
+    beam_weights->Resize(num_bins, order);
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        CMatrix<BaseFloat> psd_inv;
+        for (int32 f = fbeg; f < fend; f++) {
+            SubCVector<BaseFloat> numerator(*beam_weights, f), gamma(correlation, f);
+            SubCMatrix<BaseFloat> noise(noise_psd, f * order, order, 0, order);
+            if (!FixedSizeSolve(noise, gamma, &numerator)) {
+                // order > 8 or not positive definite
+                psd_inv = noise;
+                psd_inv.Invert();
+                numerator.AddMatVec(1, 0, psd_inv, kNoTrans, gamma, 0, 0);
+            }
+            std::complex<BaseFloat> s = std::complex<BaseFloat>(1.0, 0) / VecVec(numerator, gamma, kConj);
+            numerator.Scale(std::real(s), std::imag(s));
+        }
+    }, kBinsPerTask);
+}
+
+
+void MultiFrameMvdr(const CMatrixBase<BaseFloat> &stft,
+                    const MatrixBase<BaseFloat> &target_mask,
+                    int32 order, CMatrix<BaseFloat> *enh_stft,
+                    BaseFloat mask_floor, BaseFloat diag_loading) {
+    SETK_PROFILE("mfmvdr");
+    KALDI_ASSERT(stft.NumRows() == target_mask.NumRows() && stft.NumCols() == target_mask.NumCols());
+    int32 num_bins = stft.NumCols();
+    CMatrix<BaseFloat> stacked, target_psd, noise_psd, correlation, weights;
+    StackFrames(stft, order, &stacked);
+    EstimatePsd(stacked, target_mask, &target_psd, &noise_psd, mask_floor);
     for (int32 f = 0; f < num_bins; f++) {
-        enh_stft->ColRange(f, 1).AddMatMat(1, 0, src_stft.RowRange(f * num_frames, num_frames), 
-                                           kNoTrans, weights.RowRange(f, 1), kConjTrans, 0, 0);
+        SubCMatrix<BaseFloat> noise(noise_psd, f * order, order, 0, order);
+        BaseFloat trace = 0;
+        for (int32 k = 0; k < order; k++)
+            trace += noise(k, k, kReal);
+        noise.AddToDiag(diag_loading * trace / order + FLT_EPSILON, 0);
+    }
+    EstimateInterframeCorrelation(target_psd, &correlation);
+    ComputeMultiFrameMvdrWeights(noise_psd, correlation, &weights);
+    Beamform(stacked, weights, enh_stft);
+}
+
+
+// number of frames to initialize noise psd of wiener post-filter
+const int32 kNoiseInitFrames = 10;
+
+void EstimateWienerGain(const CMatrixBase<BaseFloat> &stft,
+                        BaseFloat smooth_factor, BaseFloat gain_floor,
+                        Matrix<BaseFloat> *gain) {
+    SETK_PROFILE("wiener-gain");
+    KALDI_ASSERT(smooth_factor >= 0 && smooth_factor < 1);
+    int32 num_frames = stft.NumRows(), num_bins = stft.NumCols();
+    gain->Resize(num_frames, num_bins, kUndefined);
+    if (!num_frames)
+        return;
+    // fixed a priori snr under speech presence(15dB), minimum a priori snr(-25dB)
+    const BaseFloat xi_h1 = 31.62, xi_min = 3.16e-3, alpha = 0.8;
+    int32 num_init = std::min(num_frames, kNoiseInitFrames);
+    ParallelFor(0, num_bins, [&](int32 fbeg, int32 fend) {
+        int32 n = fend - fbeg;
+        // noise psd, smoothed spp and |G|^2 x posteriori snr of last frame
+        std::vector<BaseFloat> noise(n, 0), spp(n, 0), last(n, 1);
+        for (int32 t = 0; t < num_init; t++)
+            for (int32 f = fbeg; f < fend; f++)
+                noise[f - fbeg] += (stft(t, f, kReal) * stft(t, f, kReal) +
+                                    stft(t, f, kImag) * stft(t, f, kImag)) / num_init;
+        for (int32 t = 0; t < num_frames; t++) {
+            for (int32 f = fbeg; f < fend; f++) {
+                int32 i = f - fbeg;
+                BaseFloat power = stft(t, f, kReal) * stft(t, f, kReal) + stft(t, f, kImag) * stft(t, f, kImag);
+                BaseFloat post_snr = power / (noise[i] + FLT_EPSILON);
+                // a priori snr & gain
+                BaseFloat xi = smooth_factor * last[i] + (1 - smooth_factor) * std::max(post_snr - 1, 0.0f);
+                xi = std::max(xi, xi_min);
+                BaseFloat g = xi / (1 + xi);
+                last[i] = g * g * post_snr;
+                (*gain)(t, f) = std::max(g, gain_floor);
+                // speech presence, avoid stagnation of noise update
+                BaseFloat p = 1 / (1 + (1 + xi_h1) * Exp(-post_snr * xi_h1 / (1 + xi_h1)));
+                spp[i] = 0.9 * spp[i] + 0.1 * p;
+                if (spp[i] > 0.99)
+                    p = std::min(p, 0.99f);
+                noise[i] = alpha * noise[i] + (1 - alpha) * ((1 - p) * power + p * noise[i]);
+            }
+        }
+    }, kBinsPerTask);
+}
+
+void ApplyPostFilter(const PostFilterOptions &opts,
+                     const MatrixBase<BaseFloat> *target_mask,
+                     CMatrixBase<BaseFloat> *enh_stft) {
+    if (opts.post_filter == "none")
+        return;
+    SETK_PROFILE("post-filter");
+    int32 num_frames = enh_stft->NumRows(), num_bins = enh_stft->NumCols();
+    Matrix<BaseFloat> gain;
+    if (opts.post_filter == "mask") {
+        if (!target_mask)
+            KALDI_ERR << "Mask post-filter requires target mask";
+        KALDI_ASSERT(target_mask->NumRows() == num_frames && target_mask->NumCols() == num_bins);
+        gain = *target_mask;
+        gain.ApplyFloor(opts.gain_floor);
+    } else if (opts.post_filter == "wiener") {
+        EstimateWienerGain(*enh_stft, opts.smooth_factor, opts.gain_floor, &gain);
+    } else {
+        KALDI_ERR << "Unknown type of post-filter: " << opts.post_filter;
+    }
+    for (int32 t = 0; t < num_frames; t++) {
+        for (int32 f = 0; f < num_bins; f++) {
+            (*enh_stft)(t, f, kReal) *= gain(t, f);
+            (*enh_stft)(t, f, kImag) *= gain(t, f);
+        }
+    }
+}
+
+
+
+OnlineBeamformer::OnlineBeamformer(const OnlineBeamformerOptions &opts,
+                                   int32 num_bins, int32 num_channels):
+        opts_(opts), num_bins_(num_bins), num_channels_(num_channels), num_frames_(0) {
+    if (opts_.beamformer != "fixed" && opts_.beamformer != "mvdr" &&
+        opts_.beamformer != "gevd" && opts_.beamformer != "mfmvdr")
+        KALDI_ERR << "Unknown type of online beamformer: " << opts_.beamformer;
+    KALDI_ASSERT(opts_.forget_factor > 0 && opts_.forget_factor < 1);
+    KALDI_ASSERT(opts_.update_periods >= 1);
+    target_psd_.Resize(num_bins_ * num_channels_, num_channels_);
+    noise_psd_.Resize(num_bins_ * num_channels_, num_channels_);
+    loaded_noise_psd_.Resize(num_bins_ * num_channels_, num_channels_);
+    steer_vector_.Resize(num_bins_, num_channels_);
+    // pass through the reference channel
+    weights_.Resize(num_bins_, num_channels_);
+    for (int32 f = 0; f < num_bins_; f++)
+        weights_(f, 0, kReal) = 1.0;
+}
+
+void OnlineBeamformer::SetWeights(const CMatrixBase<BaseFloat> &weights) {
+    KALDI_ASSERT(weights.NumRows() == num_bins_ && weights.NumCols() == num_channels_);
+    weights_.CopyFromMat(weights);
+}
+
+void OnlineBeamformer::Process(const CMatrixBase<BaseFloat> &obs,
+                               const VectorBase<BaseFloat> *mask,
+                               CVectorBase<BaseFloat> *enh, bool adapt) {
+    SETK_PROFILE("online-beamform");
+    KALDI_ASSERT(obs.NumRows() == num_bins_ && obs.NumCols() == num_channels_);
+    KALDI_ASSERT(enh->Dim() == num_bins_);
+    if (opts_.beamformer != "fixed" && adapt) {
+        if (!mask)
+            KALDI_ERR << "Online " << opts_.beamformer << " beamformer needs target masks";
+        KALDI_ASSERT(mask->Dim() == num_bins_);
+        BaseFloat alpha = opts_.forget_factor;
+        for (int32 f = 0; f < num_bins_; f++) {
+            SETK_NO_ALLOC("online-beamform");
+            SubCVector<BaseFloat> x(obs, f);
+            SubCMatrix<BaseFloat> target(target_psd_, f * num_channels_, num_channels_, 0, num_channels_),
+                                  noise(noise_psd_, f * num_channels_, num_channels_, 0, num_channels_);
+            target.Scale(alpha, 0);
+            target.AddVecVec((1 - alpha) * (*mask)(f), 0, x, x, kConj);
+            noise.Scale(alpha, 0);
+            noise.AddVecVec((1 - alpha) * (1 - (*mask)(f)), 0, x, x, kConj);
+        }
+        num_frames_++;
+        if (num_frames_ % opts_.update_periods == 0)
+            UpdateWeights();
+    }
+    // enh[f] = w[f]^H * x[f]
+    for (int32 f = 0; f < num_bins_; f++) {
+        SETK_NO_ALLOC("online-beamform");
+        std::complex<BaseFloat> s = VecVec(weights_.Row(f), obs.Row(f), kConj);
+        (*enh)(f, kReal) = std::real(s);
+        (*enh)(f, kImag) = std::imag(s);
+    }
+}
+
+void OnlineBeamformer::UpdateWeights() {
+    // make sure psd is positive definite
+    loaded_noise_psd_.CopyFromMat(noise_psd_);
+    for (int32 f = 0; f < num_bins_; f++) {
+        SubCMatrix<BaseFloat> noise(loaded_noise_psd_, f * num_channels_, num_channels_, 0, num_channels_);
+        BaseFloat trace = 0;
+        for (int32 c = 0; c < num_channels_; c++)
+            trace += noise(c, c, kReal);
+        noise.AddToDiag(opts_.diag_loading * trace / num_channels_ + FLT_EPSILON, 0);
+    }
+    if (opts_.beamformer == "mvdr") {
+        EstimateSteerVector(target_psd_, &steer_vector_);
+        ComputeMvdrBeamWeights(loaded_noise_psd_, steer_vector_, &weights_);
+    } else if (opts_.beamformer == "mfmvdr") {
+        EstimateInterframeCorrelation(target_psd_, &steer_vector_);
+        ComputeMultiFrameMvdrWeights(loaded_noise_psd_, steer_vector_, &weights_);
+    } else {
+        ComputeGevdBeamWeights(target_psd_, loaded_noise_psd_, &weights_);
     }
+    KALDI_VLOG(3) << "Update beam weights after " << num_frames_ << " frames";
 }
 
 }
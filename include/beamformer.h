@@ -22,6 +22,7 @@
 #ifndef BEAMFORMER_H
 #define BEAMFORMER_H
 
+#include "util/common-utils.h"
 #include "include/complex-base.h"
 #include "include/complex-vector.h"
 #include "include/complex-matrix.h"
@@ -47,17 +48,67 @@ void TrimStft(const int32 num_bins, const int32 num_channels,
 // src_stft:    (num_bins x num_frames, num_channels)
 // target_mask: (num_frames, num_bins)
 // target_psd:  (num_bins x num_channels, num_channels)
+// mask_floor:  if positive, skip frames whose mask(or 1 - mask for second_psd)
+//              is not larger than it, an approximation to speed up(sparse psd)
 //
 void EstimatePsd(const CMatrixBase<BaseFloat> &src_stft, 
                  const MatrixBase<BaseFloat> &target_mask,
                  CMatrix<BaseFloat> *target_psd,
-                 CMatrix<BaseFloat> *second_psd);
+                 CMatrix<BaseFloat> *second_psd,
+                 BaseFloat mask_floor = 0);
+
+// Batched version of EstimatePsd() for short utterances, whose frames are concatenated,
+// egs. by batched ShortTimeFTComputer::ShortTimeFT() & TrimStft()
+// src_stft:        (num_bins x num_frames, num_channels)
+// target_mask:     (num_frames, num_bins)
+// frame_offsets:   (num_utts + 1), frames of utterance u are [offsets[u], offsets[u + 1])
+// target_psd:      (num_utts x num_bins x num_channels, num_channels)
+// mask_floor:      same as EstimatePsd()
+// As psd of each utterance is a block of num_bins bins, steer vector & beam weights of
+// the batch could be computed by the unbatched functions below(without decimation)
+void EstimatePsd(const CMatrixBase<BaseFloat> &src_stft,
+                 const MatrixBase<BaseFloat> &target_mask,
+                 const std::vector<int32> &frame_offsets,
+                 CMatrix<BaseFloat> *target_psd,
+                 CMatrix<BaseFloat> *second_psd,
+                 BaseFloat mask_floor = 0);
+
+// Same as EstimatePsd(), but masks arrive chunk by chunk(egs. from nnet3
+// forward), so psd of both target & noise could be accumulated while the
+// masks of next chunk are being computed
+class PsdAccumulator {
+public:
+    PsdAccumulator(int32 num_bins, int32 num_channels, BaseFloat mask_floor = 0);
+
+    // src_stft:    (num_bins x num_frames, num_channels), the whole utterance
+    // mask:        (num_chunk_frames, num_bins), target mask of frames
+    //              [start_frame, start_frame + num_chunk_frames)
+    void Accumulate(const CMatrixBase<BaseFloat> &src_stft, int32 start_frame,
+                    const MatrixBase<BaseFloat> &mask);
+
+    // target_psd, noise_psd:  (num_bins x num_channels, num_channels)
+    void GetPsd(CMatrix<BaseFloat> *target_psd, CMatrix<BaseFloat> *noise_psd) const;
+
+    int32 NumFrames() const { return num_frames_; }
+
+    void Reset();
+
+private:
+    int32 num_bins_, num_channels_, num_frames_;
+    BaseFloat mask_floor_;
+    // unnormalized psd & sum of target masks on each bin
+    CMatrix<BaseFloat> target_psd_, noise_psd_;
+    Vector<BaseFloat> mask_sum_;
+};
 
 // target_psd:  (num_bins x num_channels, num_channels)
 // steer_vector:(num_bins, num_channels)
 // using maximum eigen vector as estimation of steer vector
+// decimation:  if larger than 1, only compute on every decimation bins(and the last one), 
+//              other bins copy from the nearest computed one, an approximation to speed up
 void EstimateSteerVector(const CMatrixBase<BaseFloat> &target_psd,
-                         CMatrix<BaseFloat> *steer_vector);
+                         CMatrix<BaseFloat> *steer_vector,
+                         int32 decimation = 1);
 
 
 // target_psd:  (num_bins x num_channels, num_channels)
@@ -67,17 +118,21 @@ void EstimateSteerVector(const CMatrixBase<BaseFloat> &target_psd,
 // numerator = psd_inv * steer_vector
 // denumerator = numerator * steer_vector^H
 // weight    = numerator / denumerator
+// decimation is same as EstimateSteerVector()
 void ComputeMvdrBeamWeights(const CMatrixBase<BaseFloat> &noise_psd,
                             const CMatrixBase<BaseFloat> &steer_vector,
-                            CMatrix<BaseFloat> *beam_weights);
+                            CMatrix<BaseFloat> *beam_weights,
+                            int32 decimation = 1);
 
 
 // target_psd:  (num_bins x num_channels, num_channels)
 // noise_psd:   (num_bins x num_channels, num_channels)
 // beam_weights:(num_bins, num_channels)
+// decimation is same as EstimateSteerVector()
 void ComputeGevdBeamWeights(const CMatrixBase<BaseFloat> &target_psd,
                             const CMatrixBase<BaseFloat> &noise_psd,
-                            CMatrix<BaseFloat> *beam_weights);
+                            CMatrix<BaseFloat> *beam_weights,
+                            int32 decimation = 1);
 
 
 // src_stft:    (num_bins x num_frames, num_channels)
@@ -94,6 +149,152 @@ void Beamform(const CMatrixBase<BaseFloat> &src_stft,
               const CMatrixBase<BaseFloat> &weights,
               CMatrix<BaseFloat> *enh_stft);
 
+// Batched version of Beamform(), frame_offsets is same as batched EstimatePsd()
+// src_stft:    (num_bins x num_frames, num_channels)
+// weights:     (num_utts x num_bins, num_channels)
+// enh_stft:    (num_frames, num_bins)
+void Beamform(const CMatrixBase<BaseFloat> &src_stft,
+              const CMatrixBase<BaseFloat> &weights,
+              const std::vector<int32> &frame_offsets,
+              CMatrix<BaseFloat> *enh_stft);
+
+
+// Multi-frame MVDR(MFMVDR) for single channel input: the last order frames of each
+// bin are stacked as a virtual array, y(t) = [Y(t), Y(t - 1), ..., Y(t - order + 1)]^T,
+// and the inter-frame correlation of target takes the place of steer vector.
+
+// stft:        (num_frames, num_bins)
+// stacked:     (num_bins x num_frames, order), frames before the first one are zero,
+//              in same layout as TrimStft(), so EstimatePsd() & Beamform() apply
+void StackFrames(const CMatrixBase<BaseFloat> &stft, int32 order,
+                 CMatrix<BaseFloat> *stacked);
+
+// target_psd:  (num_bins x order, order), psd of stacked frames
+// correlation: (num_bins, order)
+// NOTE: first column of target psd normalized by its first element
+//      \gamma = \frac{E[y(t) Y(t)^*]}{E[|Y(t)|^2]}
+void EstimateInterframeCorrelation(const CMatrixBase<BaseFloat> &target_psd,
+                                   CMatrix<BaseFloat> *correlation);
+
+// noise_psd:   (num_bins x order, order), diagonal loaded if needed
+// correlation: (num_bins, order)
+// beam_weights:(num_bins, order)
+// Same as ComputeMvdrBeamWeights(), but systems with order <= 8 are solved
+// by fixed-size cholesky kernels on stack instead of CMatrix::Invert()
+void ComputeMultiFrameMvdrWeights(const CMatrixBase<BaseFloat> &noise_psd,
+                                  const CMatrixBase<BaseFloat> &correlation,
+                                  CMatrix<BaseFloat> *beam_weights);
+
+// Offline MFMVDR, calls above internal
+// stft:        (num_frames, num_bins)
+// target_mask: (num_frames, num_bins)
+// enh_stft:    (num_frames, num_bins)
+// mask_floor is same as EstimatePsd(), diag_loading is relative to trace of noise psd
+void MultiFrameMvdr(const CMatrixBase<BaseFloat> &stft,
+                    const MatrixBase<BaseFloat> &target_mask,
+                    int32 order, CMatrix<BaseFloat> *enh_stft,
+                    BaseFloat mask_floor = 0, BaseFloat diag_loading = 1.0e-3);
+
+
+struct PostFilterOptions {
+    std::string post_filter;
+    BaseFloat gain_floor;
+    BaseFloat smooth_factor;
+
+    PostFilterOptions(): post_filter("none"), gain_floor(0.1), smooth_factor(0.98) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("post-filter", &post_filter, "Type(\"none\"|\"mask\"|\"wiener\") of single channel "
+                       "post-filter on beamformer output, \"mask\" uses target mask as gain, \"wiener\" "
+                       "estimates gain from speech presence on beamformer output");
+        opts->Register("post-filter-floor", &gain_floor, "Lower bound of post-filter gain");
+        opts->Register("post-filter-smooth", &smooth_factor, "Smoothing factor of decision-directed "
+                       "a priori snr estimation, for wiener post-filter");
+    }
+};
+
+// Wiener gain of single channel stft, noise psd is tracked by speech presence
+// probability(SPP), egs. on beamformer output:
+//  1. SPP p = 1 / (1 + (1 + \xi_1) exp(-\frac{|Y|^2}{\lambda} \frac{\xi_1}{1 + \xi_1})), fixed \xi_1 = 15dB
+//  2. noise psd \lambda = \alpha \lambda + (1 - \alpha)((1 - p)|Y|^2 + p \lambda)
+//  3. a priori snr by decision-directed approach, gain G = \xi / (1 + \xi)
+// noise psd is initialized by first frames(assumed to be non-speech)
+// stft:        (num_frames, num_bins)
+// gain:        (num_frames, num_bins)
+void EstimateWienerGain(const CMatrixBase<BaseFloat> &stft,
+                        BaseFloat smooth_factor, BaseFloat gain_floor,
+                        Matrix<BaseFloat> *gain);
+
+// Apply post-filter gain on each time-frequency bin in place, before synthesis
+// enh_stft:    (num_frames, num_bins)
+// target_mask: (num_frames, num_bins), required by mask post-filter
+void ApplyPostFilter(const PostFilterOptions &opts,
+                     const MatrixBase<BaseFloat> *target_mask,
+                     CMatrixBase<BaseFloat> *enh_stft);
+
+
+struct OnlineBeamformerOptions {
+    std::string beamformer;
+    BaseFloat forget_factor;
+    int32 update_periods;
+    BaseFloat diag_loading;
+    int32 num_stacked_frames;
+
+    OnlineBeamformerOptions(): beamformer("mvdr"), forget_factor(0.98),
+        update_periods(20), diag_loading(1.0e-3), num_stacked_frames(4) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("beamformer", &beamformer, "Type(\"fixed\"|\"mvdr\"|\"gevd\"|\"mfmvdr\") of online beamformer");
+        opts->Register("forget-factor", &forget_factor, "Forgetting factor of recursive psd estimation");
+        opts->Register("update-periods", &update_periods, "Number of frames between two updates of beam weights");
+        opts->Register("diag-loading", &diag_loading, "Diagonal loading(relative to trace) of noise psd");
+        opts->Register("num-stacked-frames", &num_stacked_frames, "Number of frames stacked as virtual "
+                                                                  "array for multi-frame mvdr(\"mfmvdr\")");
+    }
+};
+
+// Frame-wise beamformer for streaming usage. For "fixed" type, weights come from SetWeights(),
+// otherwise psd of target & noise are updated recursively by masks, and beam weights are
+// re-estimated every update_periods frames. Before the first update, reference channel
+// (the first one) is passed through. For "mfmvdr" type, channels of obs are the stacked
+// frames of single channel input, current one first.
+class OnlineBeamformer {
+public:
+    OnlineBeamformer(const OnlineBeamformerOptions &opts, 
+                     int32 num_bins, int32 num_channels);
+
+    // weights: (num_bins, num_channels)
+    void SetWeights(const CMatrixBase<BaseFloat> &weights);
+
+    // obs:     (num_bins, num_channels), one frame
+    // mask:    (num_bins), target mask of this frame, NULL for fixed beamformer
+    // enh:     (num_bins)
+    // adapt:   if false, apply current weights without updating statistics,
+    //          mask is not needed then, egs. for frames flushed without masks
+    void Process(const CMatrixBase<BaseFloat> &obs, 
+                 const VectorBase<BaseFloat> *mask,
+                 CVectorBase<BaseFloat> *enh, bool adapt = true);
+
+    const CMatrix<BaseFloat> &Weights() const { return weights_; }
+
+    int32 NumBins() const { return num_bins_; }
+
+    int32 NumChannels() const { return num_channels_; }
+
+private:
+    OnlineBeamformerOptions opts_;
+    int32 num_bins_, num_channels_, num_frames_;
+
+    // (num_bins x num_channels, num_channels)
+    CMatrix<BaseFloat> target_psd_, noise_psd_;
+    // (num_bins, num_channels)
+    CMatrix<BaseFloat> weights_;
+    // scratch of UpdateWeights(): diagonal loaded noise psd & steer vector
+    CMatrix<BaseFloat> loaded_noise_psd_, steer_vector_;
+
+    void UpdateWeights();
+};
+
 }
 
 #endif
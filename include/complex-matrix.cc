@@ -20,8 +20,23 @@
 
 
 #include "include/complex-matrix.h"
+#include "include/setk-profile.h"
+#include "include/setk-allocator.h"
+#include "include/setk-simd.h"
 
 namespace kaldi {
+
+// Use dispatched kernels for BaseFloat, return false for other types
+template<typename Real>
+static bool SimdComplexMul(Real *a, const Real *b, MatrixIndexT n, bool conj) {
+    return false;
+}
+
+template<>
+bool SimdComplexMul<BaseFloat>(BaseFloat *a, const BaseFloat *b, MatrixIndexT n, bool conj) {
+    Simd().complex_mul(a, b, n, conj);
+    return true;
+}
     
 // Implement for CMatrixBase
 
@@ -144,6 +159,10 @@ void CMatrixBase<Real>::MulElements(const CMatrixBase<Real> &A,
                                     ConjugateType conj, bool mul_abs) {
     KALDI_ASSERT(num_cols_ == A.NumCols() && num_rows_ == A.NumRows());
     for (MatrixIndexT i = 0; i < num_rows_; i++) {
+        // kernels assume no aliasing
+        if (!mul_abs && A.Data() != data_ &&
+                SimdComplexMul(this->RowData(i), A.RowData(i), num_cols_, conj == kConj))
+            continue;
         for (MatrixIndexT j = 0; j < num_cols_; j++) {
             if (!mul_abs)
                 ComplexMul(A(i, j, kReal), (conj == kNoConj ? A(i, j, kImag): -A(i, j, kImag)), 
@@ -341,23 +360,21 @@ void CMatrixBase<Real>::AddMat(const Real alpha_r, const Real alpha_i,
 // using clapack
 template<typename Real>
 void CMatrixBase<Real>::Invert() {
+    SETK_PROFILE("invert");
     KaldiBlasInt M = num_rows_, N = num_cols_;
     // NOTE: stride_ / 2
     KaldiBlasInt stride = stride_ / 2, result = -1;
     // NOTE: double it
     KaldiBlasInt lwork = std::max<KaldiBlasInt>(1, N * 2);
 
-    Real *work; void *temp;
-    if ((work = static_cast<Real*>(KALDI_MEMALIGN(16, 
-            sizeof(Real) * lwork, &temp))) == NULL)
-        throw std::bad_alloc();
-
-    KaldiBlasInt *pivot = new KaldiBlasInt[num_rows_];
+    // workspace of current thread, no allocation in steady state
+    // NOTE: work is complex
+    Real *work = static_cast<Real*>(ThreadWorkspace(kLapackWork, 2 * sizeof(Real) * lwork));
+    KaldiBlasInt *pivot = static_cast<KaldiBlasInt*>(ThreadWorkspace(kLapackPivot,
+                                                     sizeof(KaldiBlasInt) * num_rows_));
     clapack_CZgetrf(&M, &N, data_, &stride, pivot, &result);
 
-    // free memory
     if (result != 0) {
-        delete [] pivot;
         if (result < 0)
             KALDI_ERR << "clapack_CZgetrf(): " << -result << "-th parameter had an illegal value";
         else
@@ -365,8 +382,6 @@ void CMatrixBase<Real>::Invert() {
     }
 
     clapack_CZgetri(&M, data_, &stride, pivot, work, &lwork, &result);    
-    delete [] pivot;
-    KALDI_MEMALIGN_FREE(work);
 
     if (result != 0) {
         if (result < 0)
@@ -415,6 +430,7 @@ bool CMatrixBase<Real>::IsHermitianPosDef() {
 //                            void *work, KaldiBlasInt *lwork, float *rwork, KaldiBlasInt *info)
 template<typename Real>
 void CMatrixBase<Real>::Hed(VectorBase<Real> *D, CMatrixBase<Real> *V) {
+    SETK_PROFILE("hed");
     KALDI_ASSERT(IsHermitian());
     KALDI_ASSERT(V->NumCols() == V->NumRows() && num_rows_ == V->NumRows());
     KALDI_ASSERT(D->Dim() == num_rows_);
@@ -423,16 +439,13 @@ void CMatrixBase<Real>::Hed(VectorBase<Real> *D, CMatrixBase<Real> *V) {
     
     V->CopyFromMat(*this);
     KaldiBlasInt lwork = std::max(1, 2 * num_rows - 1);
-    CVector<Real> work(lwork);
-
-    Real *rwork; void *temp;
-    if ((rwork = static_cast<Real*>(KALDI_MEMALIGN(16, 
-            sizeof(Real) * std::max(1, 3 * num_rows - 2), &temp))) == NULL)
-        throw std::bad_alloc();
+    // NOTE: work is complex
+    Real *work = static_cast<Real*>(ThreadWorkspace(kLapackWork, 2 * sizeof(Real) * lwork));
+    Real *rwork = static_cast<Real*>(ThreadWorkspace(kLapackRWork,
+                                     sizeof(Real) * std::max(1, 3 * num_rows - 2)));
 
     clapack_CZheev(&num_rows, V->Data(), &stride, D->Data(),
-                    work.Data(), &lwork, rwork, &result);
-    KALDI_MEMALIGN_FREE(rwork);
+                    work, &lwork, rwork, &result);
 
     if (result != 0) {
         if (result < 0)
@@ -452,6 +465,7 @@ void CMatrixBase<Real>::Hed(VectorBase<Real> *D, CMatrixBase<Real> *V) {
 template<typename Real>
 void CMatrixBase<Real>::Hged(CMatrixBase<Real> *B, VectorBase<Real> *D,
                              CMatrixBase<Real> *V) {
+    SETK_PROFILE("hged");
     KALDI_ASSERT(IsHermitian());
     KALDI_ASSERT(B->IsHermitianPosDef());
     KALDI_ASSERT(V->NumCols() == V->NumRows() && num_rows_ == B->NumRows());
@@ -462,16 +476,13 @@ void CMatrixBase<Real>::Hged(CMatrixBase<Real> *B, VectorBase<Real> *D,
     KaldiBlasInt stride_b = (B->Stride() >> 1), result = -1, itype = 1; 
 
     KaldiBlasInt lwork = std::max(1, 2 * num_rows - 1);
-    CVector<Real> work(lwork);
+    // NOTE: work is complex
+    Real *work = static_cast<Real*>(ThreadWorkspace(kLapackWork, 2 * sizeof(Real) * lwork));
+    Real *rwork = static_cast<Real*>(ThreadWorkspace(kLapackRWork,
+                                     sizeof(Real) * std::max(1, 3 * num_rows - 2)));
 
-    Real *rwork; void *temp;
-    if ((rwork = static_cast<Real*>(KALDI_MEMALIGN(16, 
-            sizeof(Real) * std::max(1, 3 * num_rows - 2), &temp))) == NULL)
-        throw std::bad_alloc();
-    
     clapack_CZhegv(&itype, &num_rows, V->Data(), &stride_a, B->Data(), &stride_b, 
-                   D->Data(), work.Data(), &lwork, rwork, &result);
-    KALDI_MEMALIGN_FREE(rwork);
+                   D->Data(), work, &lwork, rwork, &result);
 
     if (result != 0) {
         if (result < 0)
@@ -619,7 +630,7 @@ CMatrix<Real>::CMatrix(const VectorBase<Real> &v) {
 template<typename Real>
 void CMatrix<Real>::Destroy() {
     if (NULL != CMatrixBase<Real>::data_)
-        KALDI_MEMALIGN_FREE( CMatrixBase<Real>::data_);
+        SetkFree(CMatrixBase<Real>::data_);
     CMatrixBase<Real>::data_ = NULL;
     CMatrixBase<Real>::num_rows_ = CMatrixBase<Real>::num_cols_ = CMatrixBase<Real>::stride_ = 0;
 }
@@ -672,7 +683,6 @@ void CMatrix<Real>::Init(const MatrixIndexT rows, const MatrixIndexT cols,
     MatrixIndexT skip, stride, double_cols = cols * 2;
     size_t size;
     void *data;  // aligned memory block
-    void *temp;  // memory block to be really freed
 
     // compute the size of skip and real cols
     skip = ((16 / sizeof(Real)) - double_cols % (16 / sizeof(Real)))
@@ -680,8 +690,8 @@ void CMatrix<Real>::Init(const MatrixIndexT rows, const MatrixIndexT cols,
     stride = double_cols + skip;
     size = static_cast<size_t>(rows) * static_cast<size_t>(stride) * sizeof(Real);
 
-    // allocate the memory and set the right dimensions and parameters
-    if (NULL != (data = KALDI_MEMALIGN(16, size, &temp))) {
+    // allocate the memory(from scratch pool) and set the right dimensions and parameters
+    if (NULL != (data = SetkMemalign(size))) {
         CMatrixBase<Real>::data_        = static_cast<Real *> (data);
         CMatrixBase<Real>::num_rows_    = rows;
         CMatrixBase<Real>::num_cols_    = cols;
@@ -21,6 +21,7 @@
 
 #include "include/complex-vector.h"
 #include "include/complex-matrix.h"
+#include "include/setk-allocator.h"
 
 namespace kaldi {
 
@@ -225,12 +226,11 @@ inline void CVector<Real>::Init(const MatrixIndexT dim) {
     }
     MatrixIndexT size;
     void *data;
-    void *free_data;
 
     // scale by 2
     size = 2 * dim * sizeof(Real);
 
-    if ((data = KALDI_MEMALIGN(16, size, &free_data)) != NULL) {
+    if ((data = SetkMemalign(size)) != NULL) {
         this->data_ = static_cast<Real*> (data);
         this->dim_ = dim;
     } else {
@@ -241,7 +241,7 @@ inline void CVector<Real>::Init(const MatrixIndexT dim) {
 template<typename Real>
 void CVector<Real>::Destroy() {
     if (this->data_ != NULL)
-        KALDI_MEMALIGN_FREE(this->data_);
+        SetkFree(this->data_);
     this->data_ = NULL;
     this->dim_ = 0;
 }
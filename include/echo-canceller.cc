@@ -0,0 +1,220 @@
+// include/echo-canceller.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/echo-canceller.h"
+#include "include/setk-profile.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
+
+namespace kaldi {
+
+// lower bound of echo-to-error ratio on step size, otherwise the filter
+// never starts to learn(echo estimate is zero at first)
+const BaseFloat kMinStepRatio = 0.3;
+
+// a = a .* b, or a .* conj(b), both in realfft format(n points)
+static void MulSpectra(BaseFloat *a, const BaseFloat *b, int32 n, bool conj) {
+    // dc & nyquist are real
+    a[0] *= b[0], a[1] *= b[1];
+    Simd().complex_mul(a + 2, b + 2, n / 2 - 1, conj);
+}
+
+EchoCanceller::EchoCanceller(const EchoCancellerOptions &opts, int32 num_channels):
+        opts_(opts), num_channels_(num_channels) {
+    int32 B = opts_.block_size;
+    if (B < 2 || (B & (B - 1)) != 0)
+        KALDI_ERR << "Block size of echo canceller must be power of 2, but got " << B;
+    KALDI_ASSERT(num_channels_ >= 1 && opts_.num_partitions >= 1);
+    KALDI_ASSERT(opts_.step_size > 0);
+    KALDI_ASSERT(opts_.forget_factor > 0 && opts_.forget_factor < 1);
+    srfft_ = new SplitRadixRealFft<BaseFloat>(B * 2);
+    Reset();
+}
+
+void EchoCanceller::Reset() {
+    int32 B = opts_.block_size, P = opts_.num_partitions;
+    remainder_.Resize(num_channels_ + 1, 0);
+    ref_frame_.Resize(B * 2);
+    ref_spectra_.Resize(P, B * 2);
+    ref_peaks_.Resize(P);
+    ref_power_.Resize(B + 1);
+    weights_.Resize(num_channels_ * P, B * 2);
+    echo_power_.Resize(num_channels_, B + 1);
+    error_power_.Resize(num_channels_, B + 1);
+    scratch_.Resize(num_channels_, B * 4);
+    step_.Resize(B * 2);
+    head_ = 0, hangover_ = 0, num_blocks_ = 0;
+    double_talk_ = false;
+}
+
+void EchoCanceller::AcceptWaveform(const MatrixBase<BaseFloat> &mic,
+                                   const VectorBase<BaseFloat> &ref,
+                                   Matrix<BaseFloat> *out) {
+    KALDI_ASSERT(mic.NumRows() == num_channels_ && mic.NumCols() == ref.Dim());
+    int32 B = opts_.block_size, num_kept = remainder_.NumCols(),
+          num_samples = num_kept + mic.NumCols(), num_blocks = num_samples / B;
+    // microphones & reference in one matrix, reference last
+    Matrix<BaseFloat> samples(num_channels_ + 1, num_samples, kUndefined);
+    if (num_kept)
+        samples.ColRange(0, num_kept).CopyFromMat(remainder_);
+    samples.Range(0, num_channels_, num_kept, mic.NumCols()).CopyFromMat(mic);
+    samples.Row(num_channels_).Range(num_kept, ref.Dim()).CopyFromVec(ref);
+
+    out->Resize(num_channels_, num_blocks * B, kUndefined);
+    for (int32 b = 0; b < num_blocks; b++) {
+        SubMatrix<BaseFloat> block(samples, 0, num_channels_ + 1, b * B, B);
+        ProcessBlock(&block);
+        out->ColRange(b * B, B).CopyFromMat(block.RowRange(0, num_channels_));
+    }
+    remainder_.Resize(num_channels_ + 1, num_samples - num_blocks * B);
+    if (remainder_.NumCols())
+        remainder_.CopyFromMat(samples.ColRange(num_blocks * B, remainder_.NumCols()));
+}
+
+void EchoCanceller::Flush(Matrix<BaseFloat> *out) {
+    int32 B = opts_.block_size, num_kept = remainder_.NumCols();
+    out->Resize(num_channels_, num_kept);
+    if (!num_kept)
+        return;
+    Matrix<BaseFloat> block(num_channels_ + 1, B);
+    block.ColRange(0, num_kept).CopyFromMat(remainder_);
+    ProcessBlock(&block);
+    out->CopyFromMat(block.Range(0, num_channels_, 0, num_kept));
+    remainder_.Resize(num_channels_ + 1, 0);
+}
+
+void EchoCanceller::ProcessBlock(MatrixBase<BaseFloat> *block) {
+    SETK_PROFILE("echo-cancel");
+    int32 B = opts_.block_size, N = B * 2, P = opts_.num_partitions, num_bins = B + 1;
+    BaseFloat inf = std::numeric_limits<BaseFloat>::infinity();
+    SubVector<BaseFloat> ref(*block, num_channels_);
+
+    // 1. spectrum of last 2B reference samples, X_p is row (head_ + p) % P
+    ref_frame_.Range(0, B).CopyFromVec(ref_frame_.Range(B, B));
+    ref_frame_.Range(B, B).CopyFromVec(ref);
+    head_ = (head_ + P - 1) % P;
+    SubVector<BaseFloat> ref_spectrum(ref_spectra_, head_);
+    ref_spectrum.CopyFromVec(ref_frame_);
+    srfft_->Compute(ref_spectrum.Data(), true);
+    ref_peaks_(head_) = ref.Norm(inf);
+    // power of reference, reuse step_ as scratch
+    BaseFloat alpha = num_blocks_ ? opts_.forget_factor: 0;
+    Simd().power_spectrum(ref_spectrum.Data(), step_.Data(), num_bins);
+    ref_power_.Scale(alpha);
+    ref_power_.AddVec(1 - alpha, step_.Range(0, num_bins));
+
+    // Geigel double talk detector: echo is assumed to be weaker than reference
+    BaseFloat mic_peak = block->RowRange(0, num_channels_).LargestAbsElem();
+    double_talk_ = mic_peak > opts_.double_talk_threshold * ref_peaks_.Max();
+    if (double_talk_)
+        hangover_ = opts_.double_talk_hangover + 1;
+    bool adapt = (hangover_ == 0);
+    if (hangover_ > 0)
+        hangover_--;
+
+    // step size of each bin(in realfft format) except the echo-to-error ratio
+    BaseFloat delta = 1.0e-2 * ref_power_.Sum() / num_bins + FLT_EPSILON;
+    for (int32 k = 0; k < num_bins; k++) {
+        BaseFloat mu = opts_.step_size / (P * ref_power_(k) + delta);
+        if (k == 0)
+            step_(0) = mu;
+        else if (k == B)
+            step_(1) = mu;
+        else
+            step_(k * 2) = step_(k * 2 + 1) = mu;
+    }
+
+    int32 constrained = num_blocks_ % P;
+    ParallelFor(0, num_channels_, [&](int32 cbeg, int32 cend) {
+        std::vector<BaseFloat> fft_buffer;
+        for (int32 c = cbeg; c < cend; c++) {
+            SubVector<BaseFloat> mic(*block, c), echo(scratch_.Row(c), 0, N),
+                                 product(scratch_.Row(c), N, N),
+                                 echo_power(echo_power_, c), error_power(error_power_, c);
+            // 2. echo = last B samples of ifft(sum_p W_p .* X_p)
+            echo.SetZero();
+            for (int32 p = 0; p < P; p++) {
+                product.CopyFromVec(weights_.Row(c * P + p));
+                MulSpectra(product.Data(), ref_spectra_.RowData((head_ + p) % P), N, false);
+                Simd().axpy(1.0, product.Data(), echo.Data(), N);
+            }
+            if (adapt) {
+                Simd().power_spectrum(echo.Data(), product.Data(), num_bins);
+                echo_power.Scale(alpha);
+                echo_power.AddVec(1 - alpha, product.Range(0, num_bins));
+            }
+            srfft_->Compute(echo.Data(), false, &fft_buffer);
+            // error is written back to block
+            mic.AddVec(-1.0 / N, echo.Range(B, B));
+            if (!adapt)
+                continue;
+
+            // 3. error spectrum E = fft([0, e]), scaled by step size of each bin
+            SubVector<BaseFloat> error(echo);
+            error.Range(0, B).SetZero();
+            error.Range(B, B).CopyFromVec(mic);
+            srfft_->Compute(error.Data(), true, &fft_buffer);
+            Simd().power_spectrum(error.Data(), product.Data(), num_bins);
+            error_power.Scale(alpha);
+            error_power.AddVec(1 - alpha, product.Range(0, num_bins));
+            for (int32 k = 0; k < num_bins; k++) {
+                BaseFloat ratio = echo_power(k) / (echo_power(k) + error_power(k) + FLT_EPSILON);
+                ratio = std::max(ratio, kMinStepRatio);
+                if (k == 0)
+                    error(0) *= ratio * step_(0);
+                else if (k == B)
+                    error(1) *= ratio * step_(1);
+                else
+                    error(k * 2) *= ratio * step_(k * 2), error(k * 2 + 1) *= ratio * step_(k * 2 + 1);
+            }
+            // W_p += conj(X_p) .* E
+            for (int32 p = 0; p < P; p++) {
+                product.CopyFromVec(error);
+                MulSpectra(product.Data(), ref_spectra_.RowData((head_ + p) % P), N, true);
+                Simd().axpy(1.0, product.Data(), weights_.RowData(c * P + p), N);
+            }
+            // 4. keep the first B taps of one partition, to avoid circular convolution
+            SubVector<BaseFloat> weight(weights_, c * P + constrained);
+            srfft_->Compute(weight.Data(), false, &fft_buffer);
+            weight.Range(0, B).Scale(1.0 / N);
+            weight.Range(B, B).SetZero();
+            srfft_->Compute(weight.Data(), true, &fft_buffer);
+        }
+    });
+    num_blocks_++;
+}
+
+
+void CancelEcho(const EchoCancellerOptions &opts,
+                const MatrixBase<BaseFloat> &mic,
+                const VectorBase<BaseFloat> &ref,
+                Matrix<BaseFloat> *out) {
+    EchoCanceller echo_canceller(opts, mic.NumRows());
+    Matrix<BaseFloat> head, tail;
+    echo_canceller.AcceptWaveform(mic, ref, &head);
+    echo_canceller.Flush(&tail);
+    out->Resize(mic.NumRows(), mic.NumCols(), kUndefined);
+    out->ColRange(0, head.NumCols()).CopyFromMat(head);
+    if (tail.NumCols())
+        out->ColRange(head.NumCols(), tail.NumCols()).CopyFromMat(tail);
+}
+
+}
@@ -0,0 +1,136 @@
+// include/echo-canceller.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ECHO_CANCELLER_H
+#define ECHO_CANCELLER_H
+
+#include "matrix/matrix-lib.h"
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+struct EchoCancellerOptions {
+    int32 block_size;
+    int32 num_partitions;
+    BaseFloat step_size;
+    BaseFloat forget_factor;
+    BaseFloat double_talk_threshold;
+    int32 double_talk_hangover;
+
+    EchoCancellerOptions(): block_size(256), num_partitions(8), step_size(0.5),
+        forget_factor(0.9), double_talk_threshold(0.5), double_talk_hangover(4) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("aec-block-size", &block_size, "Block size(power of 2) of echo canceller, "
+                       "fft size is twice of it");
+        opts->Register("aec-num-partitions", &num_partitions, "Number of partitions of adaptive filter, "
+                       "echo path up to aec-block-size x aec-num-partitions samples is modeled");
+        opts->Register("aec-step-size", &step_size, "Step size of adaptive filter, normalized by "
+                       "power of far-end reference on each bin");
+        opts->Register("aec-forget-factor", &forget_factor, "Forgetting factor of recursive power estimation");
+        opts->Register("aec-double-talk-threshold", &double_talk_threshold, "Adaptation is frozen if peak "
+                       "of microphone block exceeds this times peak of recent far-end reference(Geigel)");
+        opts->Register("aec-double-talk-hangover", &double_talk_hangover, "Number of blocks to keep "
+                       "adaptation frozen after double talk is detected");
+    }
+};
+
+// Partitioned-block frequency-domain adaptive filter(PBFDAF) echo canceller, in
+// overlap-save form. Samples are processed in blocks of block_size(B), each
+// microphone channel has its own filter of num_partitions(P) partitions, all
+// driven by one far-end reference channel. For each block:
+//  1. fft of last 2B reference samples is pushed into history of P spectra
+//  2. echo = last B samples of ifft(sum_p W_p .* X_p), error e = d - echo
+//  3. W_p += mu_k * conj(X_p) .* fft([0, e]), where step size of bin k is
+//     normalized by power of reference, and scaled by echo-to-error ratio
+//     (so it shrinks when near-end speech dominates error)
+//  4. one partition(round-robin) is constrained to linear convolution
+// which costs 1 + 4 x num_channels real ffts plus O(P x B) per channel.
+// Double talk is detected by Geigel detector, which freezes adaptation.
+class EchoCanceller {
+public:
+    EchoCanceller(const EchoCancellerOptions &opts, int32 num_channels);
+
+    ~EchoCanceller() { delete srfft_; }
+
+    // mic:     (num_channels, num_samples), microphone signals
+    // ref:     (num_samples), far-end reference, aligned with mic
+    // out:     (num_channels, num_samples of complete blocks), echo cancelled,
+    //          samples of the incomplete block are kept until next call
+    void AcceptWaveform(const MatrixBase<BaseFloat> &mic,
+                        const VectorBase<BaseFloat> &ref,
+                        Matrix<BaseFloat> *out);
+
+    // Zero pad the incomplete block and output the rest samples
+    // out:     (num_channels, number of samples kept)
+    void Flush(Matrix<BaseFloat> *out);
+
+    // Forget adaptive filters & history, egs. for a new utterance
+    void Reset();
+
+    int32 NumChannels() const { return num_channels_; }
+
+    int32 BlockSize() const { return opts_.block_size; }
+
+    // If double talk is detected on last block
+    bool DoubleTalk() const { return double_talk_; }
+
+private:
+    EchoCancellerOptions opts_;
+    int32 num_channels_, num_blocks_;
+    SplitRadixRealFft<BaseFloat> *srfft_;
+
+    // samples not consumed yet: (num_channels + 1, < block_size), reference last
+    Matrix<BaseFloat> remainder_;
+    // last 2B reference samples
+    Vector<BaseFloat> ref_frame_;
+    // (num_partitions, 2B) reference spectra in realfft format, head_ is the newest
+    Matrix<BaseFloat> ref_spectra_;
+    int32 head_;
+    // peak of reference in each of last num_partitions blocks
+    Vector<BaseFloat> ref_peaks_;
+    // smoothed power of reference(B + 1)
+    Vector<BaseFloat> ref_power_;
+    // (num_channels x num_partitions, 2B) filters in realfft format
+    Matrix<BaseFloat> weights_;
+    // (num_channels, B + 1) smoothed power of echo estimate & error
+    Matrix<BaseFloat> echo_power_, error_power_;
+    // blocks left to keep adaptation frozen
+    int32 hangover_;
+    bool double_talk_;
+    // (num_channels, 4B) scratch of each channel & (2B) step size of each bin
+    Matrix<BaseFloat> scratch_;
+    Vector<BaseFloat> step_;
+
+    // block: (num_channels + 1, B), processed in place
+    void ProcessBlock(MatrixBase<BaseFloat> *block);
+};
+
+// Offline version, output has the same shape as mic
+void CancelEcho(const EchoCancellerOptions &opts,
+                const MatrixBase<BaseFloat> &mic,
+                const VectorBase<BaseFloat> &ref,
+                Matrix<BaseFloat> *out);
+
+}
+
+#endif
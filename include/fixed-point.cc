@@ -0,0 +1,293 @@
+// include/fixed-point.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/fixed-point.h"
+#include "include/setk-profile.h"
+
+namespace kaldi {
+
+// mantissas are kept under 2^kBlockBits, so that one radix-2 stage
+// (growth < 1 + sqrt(2)) never overflows int32
+static const int32 kBlockBits = 28;
+// 1.0 in Q31, used as multiplier since left shift of negative values is undefined
+static const int64 kQ31One = static_cast<int64>(1) << 31;
+
+static int32 NumBits(int64 x) {
+    int32 n = 0;
+    for (; x; x >>= 1) n++;
+    return n;
+}
+
+static int64 MaxAbs(const int32 *data, int32 n) {
+    int64 m = 0;
+    for (int32 i = 0; i < n; i++)
+        m = std::max(m, std::abs(static_cast<int64>(data[i])));
+    return m;
+}
+
+static void ShiftBlock(int32 *data, int32 n, int32 shift) {
+    for (int32 i = 0; i < n; i++)
+        data[i] = static_cast<int32>(RoundShift(data[i], shift));
+}
+
+// Normalize block so that peak has exactly bits bits
+static void NormalizeBlock(int32 *data, int32 n, int32 bits, int32 *exponent) {
+    int64 m = MaxAbs(data, n);
+    if (!m) return;
+    int32 shift = NumBits(m) - bits;
+    if (shift) {
+        ShiftBlock(data, n, shift);
+        *exponent += shift;
+    }
+}
+
+FixedPointFFT::FixedPointFFT(int32 n): n_(n) {
+    KALDI_ASSERT(n >= 1 && (n & (n - 1)) == 0);
+    twiddles_.resize(n);
+    for (int32 k = 0; k < n / 2; k++) {
+        twiddles_[2 * k] = FloatToQ31(std::cos(M_2PI * k / n));
+        twiddles_[2 * k + 1] = FloatToQ31(-std::sin(M_2PI * k / n));
+    }
+    bit_reverse_.resize(n);
+    int32 log_n = NumBits(n) - 1;
+    for (int32 i = 0; i < n; i++) {
+        int32 r = 0;
+        for (int32 b = 0; b < log_n; b++)
+            r |= ((i >> b) & 1) << (log_n - 1 - b);
+        bit_reverse_[i] = r;
+    }
+}
+
+void FixedPointFFT::Compute(int32 *data, int32 *exponent, bool forward) const {
+    NormalizeBlock(data, 2 * n_, kBlockBits, exponent);
+    for (int32 i = 0; i < n_; i++) {
+        int32 r = bit_reverse_[i];
+        if (r > i) {
+            std::swap(data[2 * i], data[2 * r]);
+            std::swap(data[2 * i + 1], data[2 * r + 1]);
+        }
+    }
+    int64 peak = MaxAbs(data, 2 * n_), limit = static_cast<int64>(1) << kBlockBits;
+    for (int32 len = 2; len <= n_; len <<= 1) {
+        if (peak >= limit) {
+            ShiftBlock(data, 2 * n_, 1);
+            (*exponent)++;
+        }
+        peak = 0;
+        int32 half = len / 2, step = n_ / len;
+        for (int32 i = 0; i < n_; i += len) {
+            for (int32 k = 0; k < half; k++) {
+                // negated in int64, -1.0 in Q31 has no positive counterpart
+                int64 wr = twiddles_[2 * k * step], wi = twiddles_[2 * k * step + 1];
+                if (!forward)
+                    wi = -wi;
+                int32 *a = data + 2 * (i + k), *b = data + 2 * (i + k + half);
+                int64 tr = RoundShift(b[0] * wr - b[1] * wi, 31),
+                      ti = RoundShift(b[0] * wi + b[1] * wr, 31);
+                int64 ar = a[0], ai = a[1];
+                a[0] = static_cast<int32>(ar + tr), a[1] = static_cast<int32>(ai + ti);
+                b[0] = static_cast<int32>(ar - tr), b[1] = static_cast<int32>(ai - ti);
+                peak = std::max(peak, std::max(std::max(std::abs(ar + tr), std::abs(ai + ti)),
+                                               std::max(std::abs(ar - tr), std::abs(ai - ti))));
+            }
+        }
+    }
+}
+
+FixedPointRealFFT::FixedPointRealFFT(int32 n): fft_(n / 2) {
+    KALDI_ASSERT(n >= 2);
+    int32 m = n / 2;
+    twiddles_.resize(2 * (m + 1));
+    for (int32 k = 0; k <= m; k++) {
+        twiddles_[2 * k] = FloatToQ31(std::cos(M_2PI * k / n));
+        twiddles_[2 * k + 1] = FloatToQ31(-std::sin(M_2PI * k / n));
+    }
+    buffer_.resize(n);
+}
+
+// z[m] = x[2m] + j x[2m + 1], Z = fft(z), then
+// X[k] = (Z[k] + Z*[M - k]) / 2 + W^k (Z[k] - Z*[M - k]) / 2j
+void FixedPointRealFFT::Forward(const int32 *frame, int32 exponent,
+                                int32 *spectrum, int32 *spectrum_exponent) {
+    int32 m = fft_.Size();
+    std::copy(frame, frame + 2 * m, buffer_.begin());
+    fft_.Compute(buffer_.data(), &exponent, true);
+    // |X| < 2 max|Z|
+    if (MaxAbs(buffer_.data(), 2 * m) >= (static_cast<int64>(1) << (kBlockBits + 1))) {
+        ShiftBlock(buffer_.data(), 2 * m, 1);
+        exponent++;
+    }
+    for (int32 k = 0; k <= m; k++) {
+        const int32 *z = &buffer_[2 * (k % m)], *zc = &buffer_[2 * ((m - k) % m)];
+        int64 ar = static_cast<int64>(z[0]) + zc[0], ai = static_cast<int64>(z[1]) - zc[1],
+              br = static_cast<int64>(z[0]) - zc[0], bi = static_cast<int64>(z[1]) + zc[1];
+        int64 c = twiddles_[2 * k], s = twiddles_[2 * k + 1];
+        spectrum[2 * k] = static_cast<int32>(RoundShift(ar * kQ31One + c * bi + s * br, 32));
+        spectrum[2 * k + 1] = static_cast<int32>(RoundShift(ai * kQ31One - c * br + s * bi, 32));
+    }
+    *spectrum_exponent = exponent;
+}
+
+// Z[k] = (X[k] + X*[M - k]) / 2 + j W^{-k} (X[k] - X*[M - k]) / 2, z = ifft(Z)
+void FixedPointRealFFT::Inverse(const int32 *spectrum, int32 exponent,
+                                int32 *frame, int32 *frame_exponent) {
+    int32 m = fft_.Size();
+    // normalized copy of spectrum, |Z| < 2 max|X|
+    std::vector<int32> &x = buffer_;
+    x.resize(2 * (m + 1));
+    std::copy(spectrum, spectrum + 2 * (m + 1), x.begin());
+    // imaginary parts of dc & nyquist bins are dropped, as in realfft format
+    x[1] = x[2 * m + 1] = 0;
+    NormalizeBlock(x.data(), 2 * (m + 1), kBlockBits, &exponent);
+    for (int32 k = 0; k < m; k++) {
+        const int32 *y = &x[2 * k], *yc = &x[2 * (m - k)];
+        int64 ar = static_cast<int64>(y[0]) + yc[0], ai = static_cast<int64>(y[1]) - yc[1],
+              br = static_cast<int64>(y[0]) - yc[0], bi = static_cast<int64>(y[1]) + yc[1];
+        // W^{-k} = (c, -s)
+        int64 c = twiddles_[2 * k], s = -static_cast<int64>(twiddles_[2 * k + 1]);
+        frame[2 * k] = static_cast<int32>(RoundShift(ar * kQ31One - (br * s + bi * c), 32));
+        frame[2 * k + 1] = static_cast<int32>(RoundShift(ai * kQ31One + br * c - bi * s, 32));
+    }
+    fft_.Compute(frame, &exponent, false);
+    // ifft of size M gives M x z
+    *frame_exponent = exponent - (NumBits(m) - 1);
+}
+
+FixedPointEnhancer::FixedPointEnhancer(const ShortTimeFTOptions &opts,
+                                       const CMatrixBase<BaseFloat> &weights):
+        frame_length_(static_cast<int32>(opts.frame_length)),
+        frame_shift_(static_cast<int32>(opts.frame_shift)),
+        num_bins_(frame_length_ / 2 + 1), num_channels_(weights.NumCols()),
+        num_samples_(0), fft_(frame_length_) {
+    if ((frame_length_ & (frame_length_ - 1)) || opts.PaddingLength() != frame_length_)
+        KALDI_ERR << "Fixed-point enhancer requires frame length of power of 2, got "
+                  << opts.frame_length;
+    if (frame_length_ % frame_shift_)
+        KALDI_ERR << "Frame length(" << frame_length_ << ") should be multiple of frame shift("
+                  << frame_shift_ << ")";
+    if (opts.enable_scale)
+        KALDI_ERR << "Option --enable-scale is not supported in fixed-point";
+    KALDI_ASSERT(weights.NumRows() == num_bins_);
+
+    ShortTimeFTComputer computer(opts);
+    const Vector<BaseFloat> &window = computer.Window(),
+                            &synthesis_window = computer.SynthesisWindow();
+    synthesis_offset_ = computer.SynthesisOffset();
+    // same gain as OnlineShortTimeFTComputer
+    BaseFloat gain = frame_shift_ / VecVec(window, synthesis_window);
+    window_.resize(frame_length_);
+    synthesis_window_.resize(frame_length_);
+    for (int32 n = 0; n < frame_length_; n++) {
+        window_[n] = FloatToQ15(window(n));
+        BaseFloat w = synthesis_window(n) * gain;
+        if (std::abs(w) >= 2)
+            KALDI_ERR << "Gain of overlapadd is too large for Q14 synthesis window";
+        synthesis_window_[n] = SaturateQ15(std::llround(w * 16384));
+    }
+
+    // shared exponent, so that max |w| < 1
+    BaseFloat max_abs = 0;
+    for (int32 f = 0; f < num_bins_; f++)
+        for (int32 c = 0; c < num_channels_; c++)
+            max_abs = std::max(max_abs, std::max(std::abs(weights(f, c, kReal)),
+                                                 std::abs(weights(f, c, kImag))));
+    weights_exponent_ = max_abs > 0 ? static_cast<int32>(std::floor(std::log2(max_abs))) + 1: 0;
+    BaseFloat scale = std::pow(2.0, -weights_exponent_);
+    weights_.resize(2 * num_channels_ * num_bins_);
+    for (int32 c = 0; c < num_channels_; c++) {
+        for (int32 f = 0; f < num_bins_; f++) {
+            weights_[2 * (c * num_bins_ + f)] = FloatToQ31(weights(f, c, kReal) * scale);
+            weights_[2 * (c * num_bins_ + f) + 1] = FloatToQ31(-weights(f, c, kImag) * scale);
+        }
+    }
+
+    analysis_.resize(num_channels_ * frame_length_);
+    synthesis_.resize(frame_length_);
+    frame_.resize(frame_length_);
+    spectra_.resize(2 * num_channels_ * num_bins_);
+    exponents_.resize(num_channels_);
+    accumulator_.resize(2 * num_bins_);
+    enh_.resize(2 * num_bins_);
+}
+
+// enh[f] = \sum_c x_c[f] w_c[f]^*, in Q31 multiply-accumulate
+void FixedPointEnhancer::Beamform() {
+    int32 max_exponent = *std::max_element(exponents_.begin(), exponents_.end());
+    std::fill(accumulator_.begin(), accumulator_.end(), 0);
+    for (int32 c = 0; c < num_channels_; c++) {
+        // align to the largest exponent
+        int32 align = max_exponent - exponents_[c];
+        const int32 *x = &spectra_[2 * c * num_bins_];
+        const Q31 *w = &weights_[2 * c * num_bins_];
+        for (int32 f = 0; f < num_bins_; f++) {
+            int64 xr = RoundShift(x[2 * f], align), xi = RoundShift(x[2 * f + 1], align),
+                  wr = w[2 * f], wi = w[2 * f + 1];
+            accumulator_[2 * f] += RoundShift(xr * wr - xi * wi, 31);
+            accumulator_[2 * f + 1] += RoundShift(xr * wi + xi * wr, 31);
+        }
+    }
+    int64 peak = 0;
+    for (int32 i = 0; i < 2 * num_bins_; i++)
+        peak = std::max(peak, std::abs(accumulator_[i]));
+    int32 shift = std::max(NumBits(peak) - kBlockBits, 0);
+    for (int32 i = 0; i < 2 * num_bins_; i++)
+        enh_[i] = static_cast<int32>(RoundShift(accumulator_[i], shift));
+    enh_exponent_ = max_exponent + weights_exponent_ + shift;
+}
+
+int32 FixedPointEnhancer::AcceptChunk(const int16 *chunk, int16 *enhanced) {
+    SETK_PROFILE("fixed-point-enhance");
+    // shift analysis buffer of each channel
+    for (int32 c = 0; c < num_channels_; c++) {
+        int16 *buffer = &analysis_[c * frame_length_];
+        std::copy(buffer + frame_shift_, buffer + frame_length_, buffer);
+        std::copy(chunk + c * frame_shift_, chunk + (c + 1) * frame_shift_,
+                  buffer + frame_length_ - frame_shift_);
+    }
+    num_samples_ = std::min(num_samples_ + frame_shift_, frame_length_);
+    if (num_samples_ < frame_length_)
+        return 0;
+
+    // Q15 window, x 2^-15
+    for (int32 c = 0; c < num_channels_; c++) {
+        const int16 *buffer = &analysis_[c * frame_length_];
+        for (int32 n = 0; n < frame_length_; n++)
+            frame_[n] = static_cast<int32>(buffer[n]) * window_[n];
+        fft_.Forward(frame_.data(), -15, &spectra_[2 * c * num_bins_], &exponents_[c]);
+    }
+    Beamform();
+
+    int32 exponent;
+    fft_.Inverse(enh_.data(), enh_exponent_, frame_.data(), &exponent);
+    // Q14 synthesis window, into buffer with kSynthesisFracBits
+    int32 shift = 14 - kSynthesisFracBits - exponent;
+    for (int32 n = 0; n < frame_length_; n++)
+        synthesis_[n] = SaturateQ31(synthesis_[n] + RoundShift(
+            static_cast<int64>(frame_[n]) * synthesis_window_[n], shift));
+    // same output alignment as OnlineShortTimeFTComputer
+    for (int32 n = 0; n < frame_shift_; n++)
+        enhanced[n] = SaturateQ15(RoundShift(synthesis_[synthesis_offset_ + n], kSynthesisFracBits));
+    std::copy(synthesis_.begin() + frame_shift_, synthesis_.end(), synthesis_.begin());
+    std::fill(synthesis_.end() - frame_shift_, synthesis_.end(), 0);
+    return frame_shift_;
+}
+
+}
@@ -0,0 +1,156 @@
+// include/fixed-point.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include "include/stft.h"
+#include "include/complex-base.h"
+#include "include/complex-matrix.h"
+
+namespace kaldi {
+
+// Fixed-point front-end for targets with weak FPU. Only integer arithmetic is
+// used after construction: Q15 window, block floating point fft(int32 mantissa
+// with one exponent shared by the whole block), Q31 beam weights and Q14
+// synthesis window. Float path(OnlineEnhancer) is the reference.
+
+typedef int16 Q15;
+typedef int32 Q31;
+
+inline Q15 SaturateQ15(int64 x) {
+    return static_cast<Q15>(std::max<int64>(std::min<int64>(x, 32767), -32768));
+}
+
+inline Q31 SaturateQ31(int64 x) {
+    return static_cast<Q31>(std::max<int64>(std::min<int64>(x, 2147483647LL), -2147483648LL));
+}
+
+inline Q15 FloatToQ15(double x) { return SaturateQ15(std::llround(x * 32768.0)); }
+
+inline Q31 FloatToQ31(double x) { return SaturateQ31(std::llround(x * 2147483648.0)); }
+
+// x / 2^shift with rounding, or x * 2^(-shift) if shift is negative
+inline int64 RoundShift(int64 x, int32 shift) {
+    if (shift <= 0)
+        return x * (static_cast<int64>(1) << (-shift));
+    return (x + (static_cast<int64>(1) << (shift - 1))) >> shift;
+}
+
+// Radix-2 complex fft of int32 data in block floating point, values are
+// data x 2^exponent. Input is normalized to 28 bits, and scaled by 2 before
+// any stage which may overflow, so error is relative to the block's peak.
+class FixedPointFFT {
+public:
+    // n: power of 2
+    explicit FixedPointFFT(int32 n);
+
+    // data:    n complex, interleaved as (real, imag), in place
+    // forward: e^{-j}, otherwise e^{+j}, not normalized
+    void Compute(int32 *data, int32 *exponent, bool forward) const;
+
+    int32 Size() const { return n_; }
+
+private:
+    int32 n_;
+    // n / 2 complex in Q31, e^{-j 2 pi k / n}
+    std::vector<Q31> twiddles_;
+    std::vector<int32> bit_reverse_;
+};
+
+// Real fft of size n, by complex fft of size n / 2
+class FixedPointRealFFT {
+public:
+    explicit FixedPointRealFFT(int32 n);
+
+    // frame:       n samples, x 2^exponent
+    // spectrum:    n / 2 + 1 bins, interleaved, x 2^spectrum_exponent
+    void Forward(const int32 *frame, int32 exponent, int32 *spectrum, int32 *spectrum_exponent);
+
+    // Inverse of Forward(), normalized by 1 / n, imaginary parts of dc &
+    // nyquist bins are ignored
+    void Inverse(const int32 *spectrum, int32 exponent, int32 *frame, int32 *frame_exponent);
+
+    int32 Size() const { return 2 * fft_.Size(); }
+
+private:
+    FixedPointFFT fft_;
+    // n / 2 + 1 complex in Q31, e^{-j 2 pi k / n}
+    std::vector<Q31> twiddles_;
+    // n / 2 complex
+    std::vector<int32> buffer_;
+};
+
+// Streaming stft, fixed beamformer and overlapadd in fixed-point, frame by frame
+// as on embedded targets. Output is same as OnlineEnhancer with fixed beamformer
+// (normalize_input does not matter), up to quantization noise.
+class FixedPointEnhancer {
+public:
+    // frame_length should be power of 2, and multiple of frame_shift
+    // weights: (num_bins, num_channels), quantized into Q31 with a shared exponent
+    FixedPointEnhancer(const ShortTimeFTOptions &opts, const CMatrixBase<BaseFloat> &weights);
+
+    // chunk:       (num_channels, frame_shift) int16 samples, row major
+    // enhanced:    frame_shift samples, written once analysis buffer is full
+    // returns number of samples written, 0 or frame_shift
+    int32 AcceptChunk(const int16 *chunk, int16 *enhanced);
+
+    int32 NumChannels() const { return num_channels_; }
+
+    int32 FrameShift() const { return frame_shift_; }
+
+    int32 NumBins() const { return num_bins_; }
+
+private:
+    // bits after binary point of overlapadd buffer
+    static const int32 kSynthesisFracBits = 8;
+
+    void Beamform();
+
+    int32 frame_length_, frame_shift_, num_bins_, num_channels_;
+    // samples in analysis buffer
+    int32 num_samples_;
+    FixedPointRealFFT fft_;
+
+    std::vector<Q15> window_;
+    // Q14, synthesis window x gain of overlapadd
+    std::vector<int16> synthesis_window_;
+    // leading zeros of synthesis window, see ShortTimeFTComputer::SynthesisOffset()
+    int32 synthesis_offset_;
+    // (num_channels x num_bins) complex, conjugated
+    std::vector<Q31> weights_;
+    int32 weights_exponent_;
+
+    // (num_channels, frame_length)
+    std::vector<int16> analysis_;
+    // frame_length, with kSynthesisFracBits
+    std::vector<int32> synthesis_;
+
+    // scratch reused between frames
+    std::vector<int32> frame_, spectra_, enh_;
+    std::vector<int32> exponents_;
+    std::vector<int64> accumulator_;
+    int32 enh_exponent_;
+};
+
+}
+
+#endif
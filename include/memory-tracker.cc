@@ -0,0 +1,91 @@
+// include/memory-tracker.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <iomanip>
+
+#include "include/memory-tracker.h"
+
+namespace kaldi {
+
+MemoryTracker::MemoryTracker(): live_total_(0), peak_total_(0),
+        num_utts_(0), max_peak_total_(0), max_peak_utt_("") {
+    for (int32 c = 0; c < kNumMemoryCategories; c++)
+        live_[c] = peak_[c] = max_peak_[c] = 0;
+}
+
+const char *MemoryTracker::CategoryName(MemoryCategory category) {
+    static const char *names[kNumMemoryCategories] = {
+        "wave", "stft", "psd", "weights", "output"
+    };
+    return names[category];
+}
+
+std::string MemoryTracker::FormatBytes(int64 bytes) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << bytes / static_cast<double>(1 << 20) << " MB";
+    return oss.str();
+}
+
+void MemoryTracker::Add(MemoryCategory category, int64 bytes) {
+    KALDI_ASSERT(bytes >= 0);
+    live_[category] += bytes;
+    live_total_ += bytes;
+    peak_[category] = std::max(peak_[category], live_[category]);
+    peak_total_ = std::max(peak_total_, live_total_);
+}
+
+void MemoryTracker::Release(MemoryCategory category, int64 bytes) {
+    KALDI_ASSERT(bytes >= 0 && bytes <= live_[category]);
+    live_[category] -= bytes;
+    live_total_ -= bytes;
+}
+
+void MemoryTracker::EndUtterance(const std::string &utt_key) {
+    std::ostringstream oss;
+    oss << "Memory of utterance " << utt_key << ": peak " << FormatBytes(peak_total_) << " (";
+    for (int32 c = 0; c < kNumMemoryCategories; c++) {
+        MemoryCategory category = static_cast<MemoryCategory>(c);
+        oss << (c ? ", ": "") << CategoryName(category) << " " << FormatBytes(peak_[c]);
+        max_peak_[c] = std::max(max_peak_[c], peak_[c]);
+        live_[c] = peak_[c] = 0;
+    }
+    oss << ")";
+    KALDI_VLOG(1) << oss.str();
+    if (peak_total_ > max_peak_total_) {
+        max_peak_total_ = peak_total_;
+        max_peak_utt_ = utt_key;
+    }
+    live_total_ = peak_total_ = 0;
+    num_utts_++;
+}
+
+std::string MemoryTracker::Report() const {
+    std::ostringstream oss;
+    oss << "Memory high-water over " << num_utts_ << " utterances: " << FormatBytes(max_peak_total_);
+    if (num_utts_)
+        oss << " (utterance " << max_peak_utt_ << ")";
+    oss << ", by category:";
+    for (int32 c = 0; c < kNumMemoryCategories; c++)
+        oss << " " << CategoryName(static_cast<MemoryCategory>(c)) << " " << FormatBytes(max_peak_[c]);
+    return oss.str();
+}
+
+}
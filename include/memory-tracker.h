@@ -0,0 +1,104 @@
+// include/memory-tracker.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "include/complex-matrix.h"
+
+namespace kaldi {
+
+enum MemoryCategory {
+    kMemoryWave = 0,
+    kMemoryStft,
+    kMemoryPsd,
+    kMemoryWeights,
+    kMemoryOutput,
+    kNumMemoryCategories
+};
+
+struct MemoryOptions {
+    BaseFloat memory_cap_mb;
+
+    MemoryOptions(): memory_cap_mb(0) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("memory-cap-mb", &memory_cap_mb, "If positive, estimated memory of each utterance "
+                       "is kept under this cap(in MB) by switching to chunked processing");
+    }
+
+    int64 CapBytes() const {
+        return static_cast<int64>(memory_cap_mb * (1 << 20));
+    }
+};
+
+// Accounting of live & peak bytes of major buffers, by category. Buffers are
+// registered by tools explicitly with Add() and Release(), cause most of them
+// are kaldi's matrices. Peaks of each utterance are logged at verbose level 1
+// by EndUtterance(), and maximum over utterances is summarized by Report().
+class MemoryTracker {
+public:
+    MemoryTracker();
+
+    void Add(MemoryCategory category, int64 bytes);
+
+    void Release(MemoryCategory category, int64 bytes);
+
+    // Release all live buffers and collect peaks of this utterance
+    void EndUtterance(const std::string &utt_key);
+
+    int64 LiveBytes() const { return live_total_; }
+
+    int64 PeakBytes() const { return peak_total_; }
+
+    int64 PeakBytes(MemoryCategory category) const { return peak_[category]; }
+
+    // Summary of all utterances
+    std::string Report() const;
+
+    static const char *CategoryName(MemoryCategory category);
+
+    static int64 Bytes(const MatrixBase<BaseFloat> &m) {
+        return static_cast<int64>(m.NumRows()) * m.NumCols() * sizeof(BaseFloat);
+    }
+
+    static int64 Bytes(const CMatrixBase<BaseFloat> &m) {
+        return static_cast<int64>(m.NumRows()) * m.NumCols() * 2 * sizeof(BaseFloat);
+    }
+
+private:
+    // of current utterance
+    int64 live_[kNumMemoryCategories], peak_[kNumMemoryCategories];
+    int64 live_total_, peak_total_;
+
+    // maximum over utterances
+    int32 num_utts_;
+    int64 max_peak_[kNumMemoryCategories], max_peak_total_;
+    std::string max_peak_utt_;
+
+    static std::string FormatBytes(int64 bytes);
+};
+
+}
+
+#endif
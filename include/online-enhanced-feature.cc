@@ -0,0 +1,106 @@
+// include/online-enhanced-feature.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/online-enhanced-feature.h"
+#include "util/stl-utils.h"
+
+namespace kaldi {
+
+OnlineEnhancedFeature::OnlineEnhancedFeature(const ShortTimeFTOptions &stft_opts,
+                                             const OnlineBeamformerOptions &beamformer_opts,
+                                             const StftFeatureOptions &feature_opts,
+                                             BaseFloat samp_freq, int32 num_channels,
+                                             bool use_masks):
+        stft_computer_(stft_opts), enhancer_(stft_opts, beamformer_opts, num_channels),
+        feature_computer_(feature_opts, &stft_computer_), samp_freq_(samp_freq),
+        use_masks_(use_masks), input_finished_(false) {
+    if (feature_opts.output_feature == "fbank") {
+        std::string reason;
+        if (!feature_computer_.MatchFraming(samp_freq, &reason))
+            KALDI_ERR << "Online fbank requires same framing as stft: " << reason;
+    } else if (feature_opts.output_feature != "log-power") {
+        KALDI_ERR << "Online features should be \"fbank\" or \"log-power\", got "
+                  << feature_opts.output_feature;
+    }
+}
+
+OnlineEnhancedFeature::~OnlineEnhancedFeature() {
+    DeletePointers(&features_);
+}
+
+void OnlineEnhancedFeature::AcceptWaveform(BaseFloat samp_freq,
+                                           const MatrixBase<BaseFloat> &waveform) {
+    if (samp_freq != samp_freq_)
+        KALDI_ERR << "Sample frequency mismatch: " << samp_freq << " vs " << samp_freq_;
+    if (input_finished_)
+        KALDI_ERR << "AcceptWaveform() called after InputFinished()";
+    enhancer_.AcceptWaveform(waveform);
+    ComputeFrames();
+}
+
+void OnlineEnhancedFeature::AcceptMasks(const MatrixBase<BaseFloat> &masks) {
+    if (!use_masks_)
+        KALDI_ERR << "Masks are useless if not created with use_masks = true";
+    if (input_finished_)
+        KALDI_ERR << "AcceptMasks() called after InputFinished()";
+    KALDI_ASSERT(masks.NumCols() == enhancer_.NumBins());
+    int32 num_masks = masks_.NumRows();
+    masks_.Resize(num_masks + masks.NumRows(), masks.NumCols(), kCopyData);
+    masks_.RowRange(num_masks, masks.NumRows()).CopyFromMat(masks);
+    ComputeFrames();
+}
+
+void OnlineEnhancedFeature::InputFinished() {
+    input_finished_ = true;
+    // frames without masks are dropped
+    if (use_masks_ && enhancer_.NumFramesReady() > masks_.NumRows())
+        KALDI_WARN << "Missing masks for last " << enhancer_.NumFramesReady() - masks_.NumRows()
+                   << " frames, dropped";
+}
+
+void OnlineEnhancedFeature::ComputeFrames() {
+    int32 num_frames = enhancer_.NumFramesReady();
+    if (use_masks_)
+        num_frames = std::min(num_frames, masks_.NumRows());
+    if (!num_frames)
+        return;
+    if (use_masks_) {
+        SubMatrix<BaseFloat> masks(masks_, 0, num_frames, 0, masks_.NumCols());
+        enhancer_.PopEnhanced(&masks, &enh_, num_frames);
+        int32 num_rest = masks_.NumRows() - num_frames;
+        Matrix<BaseFloat> rest(masks_.RowRange(num_frames, num_rest));
+        masks_.Swap(&rest);
+    } else {
+        enhancer_.PopEnhanced(NULL, &enh_, num_frames);
+    }
+    CastIntoRealfft(enh_, &rstft_);
+    // fbank framing is checked in constructor, never resynthesized
+    feature_computer_.Compute(&rstft_, samp_freq_, &feats_);
+    for (int32 t = 0; t < feats_.NumRows(); t++)
+        features_.push_back(new Vector<BaseFloat>(feats_.Row(t)));
+}
+
+void OnlineEnhancedFeature::GetFrame(int32 frame, VectorBase<BaseFloat> *feat) {
+    KALDI_ASSERT(frame >= 0 && frame < NumFramesReady());
+    feat->CopyFromVec(*features_[frame]);
+}
+
+}
@@ -0,0 +1,98 @@
+// include/online-enhanced-feature.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ONLINE_ENHANCED_FEATURE_H
+#define ONLINE_ENHANCED_FEATURE_H
+
+#include "itf/online-feature-itf.h"
+
+#include "include/online-enhancer.h"
+#include "include/stft-feature.h"
+
+namespace kaldi {
+
+// Online features(log-power or fbank) on enhanced stft, for Kaldi's online
+// decoders. Multi-channel waveform is accepted in chunks and frames become
+// ready as soon as they are enhanced. If use_masks, each frame waits for its
+// mask given by AcceptMasks().
+// Fbank is only supported if its framing agrees with stft, see
+// StftFeatureComputer::MatchFraming().
+class OnlineEnhancedFeature: public OnlineFeatureInterface {
+public:
+    OnlineEnhancedFeature(const ShortTimeFTOptions &stft_opts,
+                          const OnlineBeamformerOptions &beamformer_opts,
+                          const StftFeatureOptions &feature_opts,
+                          BaseFloat samp_freq, int32 num_channels,
+                          bool use_masks = false);
+
+    // weights: (num_bins, num_channels), for fixed beamformer
+    void SetWeights(const CMatrixBase<BaseFloat> &weights) { enhancer_.SetWeights(weights); }
+
+    // waveform:    (num_channels, num_samples)
+    void AcceptWaveform(BaseFloat samp_freq, const MatrixBase<BaseFloat> &waveform);
+
+    // masks:   (num_frames, num_bins), for frames following those given before
+    void AcceptMasks(const MatrixBase<BaseFloat> &masks);
+
+    // No more waveform(and masks), the frames ready become final
+    void InputFinished();
+
+    // Implements OnlineFeatureInterface
+    virtual int32 Dim() const { return feature_computer_.Dim(); }
+
+    virtual int32 NumFramesReady() const { return features_.size(); }
+
+    virtual bool IsLastFrame(int32 frame) const {
+        return input_finished_ && frame == NumFramesReady() - 1;
+    }
+
+    virtual BaseFloat FrameShiftInSeconds() const {
+        return stft_computer_.FrameShift() / samp_freq_;
+    }
+
+    virtual void GetFrame(int32 frame, VectorBase<BaseFloat> *feat);
+
+    virtual ~OnlineEnhancedFeature();
+
+private:
+    // enhance frames ready(and have masks) and append their features
+    void ComputeFrames();
+
+    ShortTimeFTComputer stft_computer_;
+    OnlineEnhancer enhancer_;
+    StftFeatureComputer feature_computer_;
+    BaseFloat samp_freq_;
+    bool use_masks_, input_finished_;
+
+    // masks not used yet, for frames from enhancer_.NumFramesDone()
+    Matrix<BaseFloat> masks_;
+    std::vector<Vector<BaseFloat>*> features_;
+
+    // scratch reused between calls
+    CMatrix<BaseFloat> enh_;
+    Matrix<BaseFloat> rstft_, feats_;
+
+    KALDI_DISALLOW_COPY_AND_ASSIGN(OnlineEnhancedFeature);
+};
+
+}
+
+#endif
@@ -0,0 +1,152 @@
+// include/online-enhancer.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/online-enhancer.h"
+#include "include/setk-allocator.h"
+
+namespace kaldi {
+
+OnlineEnhancer::OnlineEnhancer(const ShortTimeFTOptions &stft_opts,
+                               const OnlineBeamformerOptions &beamformer_opts,
+                               int32 num_channels):
+        stft_computer_(stft_opts, num_channels), beamformer_(NULL), num_frames_done_(0),
+        stack_frames_(false), echo_canceller_(NULL) {
+    if (beamformer_opts.beamformer == "mfmvdr") {
+        if (num_channels != 1)
+            KALDI_ERR << "Multi-frame mvdr works on single channel input, but got "
+                      << num_channels << " channels";
+        KALDI_ASSERT(beamformer_opts.num_stacked_frames >= 1);
+        // history of frames acts as channels of virtual array
+        beamformer_ = new OnlineBeamformer(beamformer_opts, NumBins(), beamformer_opts.num_stacked_frames);
+        obs_.Resize(NumBins(), beamformer_opts.num_stacked_frames);
+        stack_frames_ = true;
+    } else if (num_channels > 1) {
+        beamformer_ = new OnlineBeamformer(beamformer_opts, NumBins(), num_channels);
+        obs_.Resize(NumBins(), num_channels);
+    }
+}
+
+void OnlineEnhancer::SetWeights(const CMatrixBase<BaseFloat> &weights) {
+    if (!beamformer_)
+        KALDI_ERR << "Beam weights are useless for single channel input";
+    beamformer_->SetWeights(weights);
+}
+
+void OnlineEnhancer::AcceptWaveform(const MatrixBase<BaseFloat> &chunk) {
+    if (echo_canceller_)
+        KALDI_ERR << "Far-end reference is needed as echo canceller is enabled";
+    stft_computer_.AcceptWaveform(chunk);
+}
+
+void OnlineEnhancer::EnableEchoCanceller(const EchoCancellerOptions &opts) {
+    if (echo_canceller_) delete echo_canceller_;
+    echo_canceller_ = new EchoCanceller(opts, NumChannels());
+}
+
+void OnlineEnhancer::AcceptWaveform(const MatrixBase<BaseFloat> &chunk,
+                                    const VectorBase<BaseFloat> &ref) {
+    if (!echo_canceller_)
+        KALDI_ERR << "Echo canceller is not enabled, call EnableEchoCanceller() first";
+    echo_canceller_->AcceptWaveform(chunk, ref, &echo_cancelled_);
+    if (echo_cancelled_.NumCols())
+        stft_computer_.AcceptWaveform(echo_cancelled_);
+}
+
+int32 OnlineEnhancer::PopEnhanced(const MatrixBase<BaseFloat> *masks,
+                                  CMatrix<BaseFloat> *enh, int32 max_frames) {
+    return EnhanceFrames(masks, enh, max_frames, true);
+}
+
+int32 OnlineEnhancer::EnhanceFrames(const MatrixBase<BaseFloat> *masks,
+                                    CMatrix<BaseFloat> *enh, int32 max_frames, bool adapt) {
+    int32 num_frames = stft_computer_.PopFrames(&rstft_, max_frames), num_bins = NumBins(),
+          num_channels = NumChannels();
+    if (masks)
+        KALDI_ASSERT(masks->NumRows() == num_frames && masks->NumCols() == num_bins);
+    enh->Resize(num_frames, num_bins);
+    if (!num_frames)
+        return 0;
+    // (num_channels x num_frames, num_bins), keeps its buffer if number of frames is same
+    cstft_.Resize(num_channels * num_frames, num_bins, kUndefined);
+    cstft_.CopyFromRealfft(rstft_);
+
+    if (!beamformer_) {
+        enh->CopyFromMat(cstft_);
+        if (masks) {
+            cmasks_.Resize(num_frames, num_bins);
+            cmasks_.CopyFromMat(*masks, kReal);
+            enh->MulElements(cmasks_);
+        }
+    } else {
+        for (int32 t = 0; t < num_frames; t++) {
+            SETK_NO_ALLOC("online-enhance");
+            if (stack_frames_) {
+                // shift history, current frame goes first
+                for (int32 k = obs_.NumCols() - 1; k > 0; k--)
+                    obs_.ColRange(k, 1).CopyFromMat(obs_.ColRange(k - 1, 1));
+                obs_.ColRange(0, 1).CopyFromMat(cstft_.RowRange(t, 1), kTrans);
+            } else {
+                for (int32 c = 0; c < num_channels; c++)
+                    obs_.ColRange(c, 1).CopyFromMat(cstft_.RowRange(c * num_frames + t, 1), kTrans);
+            }
+            SubCVector<BaseFloat> enh_frame(*enh, t);
+            if (masks) {
+                SubVector<BaseFloat> mask(*masks, t);
+                beamformer_->Process(obs_, &mask, &enh_frame, adapt);
+            } else {
+                beamformer_->Process(obs_, NULL, &enh_frame, adapt);
+            }
+        }
+    }
+    num_frames_done_ += num_frames;
+    return num_frames;
+}
+
+void OnlineEnhancer::Flush(Matrix<BaseFloat> *samples) {
+    if (!echo_canceller_) {
+        stft_computer_.Flush(samples);
+        return;
+    }
+    // incomplete block kept in echo canceller
+    echo_canceller_->Flush(&echo_cancelled_);
+    Matrix<BaseFloat> head, tail;
+    if (echo_cancelled_.NumCols()) {
+        CMatrix<BaseFloat> enh;
+        stft_computer_.AcceptWaveform(echo_cancelled_);
+        // no masks for these frames, apply current weights without adaptation
+        EnhanceFrames(NULL, &enh, -1, false);
+        Synthesize(enh, &head);
+    }
+    stft_computer_.Flush(&tail);
+    samples->Resize(1, head.NumCols() + tail.NumCols(), kUndefined);
+    if (head.NumCols())
+        samples->ColRange(0, head.NumCols()).CopyFromMat(head);
+    if (tail.NumCols())
+        samples->ColRange(head.NumCols(), tail.NumCols()).CopyFromMat(tail);
+}
+
+void OnlineEnhancer::Synthesize(const CMatrixBase<BaseFloat> &enh,
+                                Matrix<BaseFloat> *samples) {
+    CastIntoRealfft(enh, &enh_rstft_);
+    stft_computer_.OverlapAdd(enh_rstft_, samples);
+}
+
+}
@@ -0,0 +1,114 @@
+// include/online-enhancer.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ONLINE_ENHANCER_H
+#define ONLINE_ENHANCER_H
+
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/echo-canceller.h"
+
+namespace kaldi {
+
+// Streaming enhancement pipeline: chunks of multi-channel waveform in, enhanced
+// stft frames(and waveform, after overlapadd) out. For single channel input,
+// beamformer is skipped and masks(if given) are applied on spectrum directly,
+// unless "mfmvdr" is chosen, which beamforms the stacked history of frames.
+class OnlineEnhancer {
+public:
+    OnlineEnhancer(const ShortTimeFTOptions &stft_opts,
+                   const OnlineBeamformerOptions &beamformer_opts,
+                   int32 num_channels);
+
+    ~OnlineEnhancer() {
+        if (beamformer_) delete beamformer_;
+        if (echo_canceller_) delete echo_canceller_;
+    }
+
+    // weights: (num_bins, num_channels), for fixed beamformer
+    void SetWeights(const CMatrixBase<BaseFloat> &weights);
+
+    // chunk:   (num_channels, num_samples)
+    void AcceptWaveform(const MatrixBase<BaseFloat> &chunk);
+
+    // Cancel echo of each channel ahead of beamformer, then far-end reference
+    // must be given with each chunk
+    void EnableEchoCanceller(const EchoCancellerOptions &opts);
+
+    // chunk:   (num_channels, num_samples)
+    // ref:     (num_samples), far-end reference aligned with chunk
+    void AcceptWaveform(const MatrixBase<BaseFloat> &chunk, const VectorBase<BaseFloat> &ref);
+
+    int32 NumFramesReady() const { return stft_computer_.NumFramesReady(); }
+
+    // Number of frames popped, i.e. index of next frame
+    int32 NumFramesDone() const { return num_frames_done_; }
+
+    // Pop & enhance all ready frames(at most max_frames if it's not negative)
+    // masks:   (num_frames, num_bins), for frames from NumFramesDone(), could be NULL
+    // enh:     (num_frames, num_bins)
+    // returns number of frames enhanced
+    int32 PopEnhanced(const MatrixBase<BaseFloat> *masks, CMatrix<BaseFloat> *enh,
+                      int32 max_frames = -1);
+
+    // enh:     (num_frames, num_bins)
+    // samples: (1, num_frames x frame_shift)
+    void Synthesize(const CMatrixBase<BaseFloat> &enh, Matrix<BaseFloat> *samples);
+
+    // Call after last chunk is accepted and ready frames are popped & synthesized.
+    // If echo canceller is enabled, samples it still keeps are cancelled and
+    // enhanced(by current beam weights, without masks) first, then synthesis
+    // buffer is flushed.
+    // samples: (1, latency - frame_shift) without echo canceller, see
+    //          OnlineShortTimeFTComputer::Latency(), plus samples of those frames
+    void Flush(Matrix<BaseFloat> *samples);
+
+    int32 NumBins() const { return stft_computer_.NumBins(); }
+
+    int32 NumChannels() const { return stft_computer_.NumChannels(); }
+
+    const OnlineShortTimeFTComputer &StftComputer() const { return stft_computer_; }
+
+private:
+    // PopEnhanced(), beamformer is not adapted if adapt is false
+    int32 EnhanceFrames(const MatrixBase<BaseFloat> *masks, CMatrix<BaseFloat> *enh,
+                        int32 max_frames, bool adapt);
+
+    OnlineShortTimeFTComputer stft_computer_;
+    // NULL for single channel, unless multi-frame mvdr is used
+    OnlineBeamformer *beamformer_;
+    int32 num_frames_done_;
+    // true for multi-frame mvdr, obs_ keeps last num_stacked_frames frames
+    bool stack_frames_;
+    // NULL if echo cancellation is not enabled
+    EchoCanceller *echo_canceller_;
+    Matrix<BaseFloat> echo_cancelled_;
+
+    // (num_bins, num_channels), one frame, or (num_bins, num_stacked_frames)
+    CMatrix<BaseFloat> obs_;
+    // scratch reused between calls, popped & enhanced frames are in different shapes
+    Matrix<BaseFloat> rstft_, enh_rstft_;
+    CMatrix<BaseFloat> cstft_, cmasks_;
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+// include/realtime-stats.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cmath>
+#include <algorithm>
+
+#include "include/realtime-stats.h"
+
+namespace kaldi {
+
+RealtimeStats::RealtimeStats(BaseFloat samp_frequency, int32 frame_shift,
+                             BaseFloat deadline_ms):
+        total_compute_ms_(0), num_misses_(0) {
+    KALDI_ASSERT(samp_frequency > 0 && frame_shift > 0);
+    budget_ms_ = frame_shift * 1000.0 / samp_frequency;
+    deadline_ms_ = deadline_ms > 0 ? deadline_ms: budget_ms_;
+}
+
+void RealtimeStats::RecordFrame(BaseFloat compute_ms, BaseFloat latency_ms) {
+    compute_ms_.push_back(compute_ms);
+    latency_ms_.push_back(latency_ms);
+    total_compute_ms_ += compute_ms;
+    if (compute_ms > deadline_ms_)
+        num_misses_++;
+}
+
+void RealtimeStats::Add(const RealtimeStats &other) {
+    KALDI_ASSERT(budget_ms_ == other.budget_ms_);
+    compute_ms_.insert(compute_ms_.end(), other.compute_ms_.begin(), other.compute_ms_.end());
+    latency_ms_.insert(latency_ms_.end(), other.latency_ms_.begin(), other.latency_ms_.end());
+    total_compute_ms_ += other.total_compute_ms_;
+    num_misses_ += other.num_misses_;
+}
+
+void RealtimeStats::Reset() {
+    compute_ms_.clear();
+    latency_ms_.clear();
+    total_compute_ms_ = 0;
+    num_misses_ = 0;
+}
+
+BaseFloat RealtimeStats::RealtimeFactor() const {
+    return NumFrames() ? total_compute_ms_ / AudioMs(): 0;
+}
+
+BaseFloat RealtimeStats::Percentile(const std::vector<BaseFloat> &values, BaseFloat p) {
+    if (values.empty()) return 0;
+    std::vector<BaseFloat> sorted(values);
+    int32 index = static_cast<int32>(std::ceil(p * sorted.size())) - 1;
+    index = std::min(std::max(index, 0), static_cast<int32>(sorted.size()) - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+std::string RealtimeStats::Report() const {
+    std::ostringstream oss;
+    oss << NumFrames() << " frames(" << AudioMs() / 1000 << " s), RTF = " << RealtimeFactor()
+        << ", per-frame compute p50/p99/max = " << ComputePercentile(0.5) << "/"
+        << ComputePercentile(0.99) << "/" << ComputePercentile(1.0) << " ms"
+        << ", latency p50/p90/p99/max = " << LatencyPercentile(0.5) << "/" << LatencyPercentile(0.9)
+        << "/" << LatencyPercentile(0.99) << "/" << MaxLatency() << " ms"
+        << ", " << num_misses_ << " deadline(" << deadline_ms_ << " ms) misses";
+    return oss.str();
+}
+
+void RealtimeStats::WriteJson(std::ostream &os) const {
+    os << "{\"num_frames\": " << NumFrames() << ", \"audio_ms\": " << AudioMs()
+       << ", \"rtf\": " << RealtimeFactor() << ", \"budget_ms\": " << budget_ms_
+       << ", \"deadline_ms\": " << deadline_ms_ << ", \"deadline_misses\": " << num_misses_
+       << ", \"compute_p50_ms\": " << ComputePercentile(0.5)
+       << ", \"compute_p99_ms\": " << ComputePercentile(0.99)
+       << ", \"compute_max_ms\": " << ComputePercentile(1.0)
+       << ", \"latency_p50_ms\": " << LatencyPercentile(0.5)
+       << ", \"latency_p90_ms\": " << LatencyPercentile(0.9)
+       << ", \"latency_p99_ms\": " << LatencyPercentile(0.99)
+       << ", \"latency_max_ms\": " << MaxLatency() << "}\n";
+}
+
+}
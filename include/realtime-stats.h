@@ -0,0 +1,85 @@
+// include/realtime-stats.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REALTIME_STATS_H
+#define REALTIME_STATS_H
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+// Accounting of processing time against audio time for streaming modes.
+// Each frame brings frame_shift new samples, so its budget is
+// frame_shift / samp_frequency, a frame costs more than deadline is a miss.
+class RealtimeStats {
+public:
+    // deadline_ms: if non-positive, use budget of each frame
+    RealtimeStats(BaseFloat samp_frequency, int32 frame_shift,
+                  BaseFloat deadline_ms = 0);
+
+    // compute_ms: processing time of this frame
+    // latency_ms: delay from the arrival of the first sample to the time its
+    //             enhanced output is produced, including algorithmic latency
+    void RecordFrame(BaseFloat compute_ms, BaseFloat latency_ms);
+
+    // Merge frames of other(egs. another utterance)
+    void Add(const RealtimeStats &other);
+
+    void Reset();
+
+    int32 NumFrames() const { return compute_ms_.size(); }
+
+    int32 NumDeadlineMisses() const { return num_misses_; }
+
+    // Audio duration processed, in ms
+    double AudioMs() const { return NumFrames() * budget_ms_; }
+
+    // total processing time / audio duration
+    BaseFloat RealtimeFactor() const;
+
+    BaseFloat ComputePercentile(BaseFloat p) const { return Percentile(compute_ms_, p); }
+
+    BaseFloat LatencyPercentile(BaseFloat p) const { return Percentile(latency_ms_, p); }
+
+    BaseFloat MaxLatency() const { return Percentile(latency_ms_, 1.0); }
+
+    BaseFloat BudgetMs() const { return budget_ms_; }
+
+    BaseFloat DeadlineMs() const { return deadline_ms_; }
+
+    std::string Report() const;
+
+    void WriteJson(std::ostream &os) const;
+
+private:
+    BaseFloat budget_ms_, deadline_ms_;
+    double total_compute_ms_;
+    int32 num_misses_;
+
+    std::vector<BaseFloat> compute_ms_, latency_ms_;
+
+    static BaseFloat Percentile(const std::vector<BaseFloat> &values, BaseFloat p);
+};
+
+}
+
+#endif
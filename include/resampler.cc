@@ -0,0 +1,113 @@
+// include/resampler.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
+
+namespace kaldi {
+
+static int32 Gcd(int32 a, int32 b) {
+    while (b) {
+        int32 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+PolyphaseResampler::PolyphaseResampler(BaseFloat samp_freq_in, BaseFloat samp_freq_out,
+                                       int32 num_zeros, BaseFloat cutoff_ratio) {
+    int32 freq_in = static_cast<int32>(samp_freq_in), freq_out = static_cast<int32>(samp_freq_out);
+    if (freq_in != samp_freq_in || freq_out != samp_freq_out || freq_in <= 0 || freq_out <= 0)
+        KALDI_ERR << "Resample from " << samp_freq_in << " to " << samp_freq_out
+                  << "Hz: sample frequencies should be positive integers";
+    KALDI_ASSERT(num_zeros > 0 && cutoff_ratio > 0 && cutoff_ratio <= 1);
+    int32 gcd = Gcd(freq_in, freq_out);
+    up_ = freq_out / gcd;
+    down_ = freq_in / gcd;
+
+    // cutoff in Hz, and half width of filter in seconds
+    BaseFloat cutoff = cutoff_ratio * 0.5 * std::min(freq_in, freq_out),
+              width = num_zeros / (2.0 * cutoff);
+    num_taps_ = static_cast<int32>(std::ceil(width * freq_in));
+    filters_.Resize(up_, 2 * num_taps_);
+    // output sample of phase p lies at p / up_ after input sample i, tap k
+    // is applied on input sample i - num_taps_ + 1 + k
+    for (int32 p = 0; p < up_; p++) {
+        for (int32 k = 0; k < 2 * num_taps_; k++) {
+            double t = (num_taps_ - 1 - k + static_cast<double>(p) / up_) / freq_in;
+            if (std::abs(t) >= width)
+                continue;
+            double x = 2.0 * M_PI * cutoff * t,
+                   sinc = (x == 0 ? 1.0: std::sin(x) / x),
+                   window = 0.5 + 0.5 * std::cos(M_PI * t / width);
+            filters_(p, k) = 2.0 * cutoff / freq_in * sinc * window;
+        }
+    }
+}
+
+void PolyphaseResampler::Resample(const MatrixBase<BaseFloat> &input,
+                                  Matrix<BaseFloat> *output) const {
+    SETK_PROFILE("resample");
+    int32 num_channels = input.NumRows(), num_samples = input.NumCols(),
+          num_output = static_cast<int32>(NumOutputSamples(num_samples)),
+          filter_length = 2 * num_taps_;
+    // zero padded on both sides, so that output sample n reads from column i
+    Matrix<BaseFloat> padded(num_channels, num_samples + filter_length);
+    padded.ColRange(num_taps_ - 1, num_samples).CopyFromMat(input);
+    output->Resize(num_channels, num_output, kUndefined);
+
+    ParallelFor(0, num_output, [&](int32 nbeg, int32 nend) {
+        Vector<BaseFloat> frame(num_channels, kUndefined);
+        for (int32 n = nbeg; n < nend; n++) {
+            int64 t = static_cast<int64>(n) * down_;
+            int32 i = static_cast<int32>(t / up_), p = static_cast<int32>(t % up_);
+            Simd().multi_dot(filters_.RowData(p), padded.RowData(0) + i, padded.Stride(),
+                             num_channels, filter_length, frame.Data());
+            for (int32 c = 0; c < num_channels; c++)
+                (*output)(c, n) = frame(c);
+        }
+    }, 4096);
+}
+
+WaveResampler::~WaveResampler() {
+    for (auto &r: resamplers_)
+        delete r.second;
+}
+
+const Matrix<BaseFloat> &WaveResampler::Resample(const WaveData &wave_data) {
+    BaseFloat samp_freq = wave_data.SampFreq();
+    if (opts_.target_samp_freq <= 0 || samp_freq == opts_.target_samp_freq)
+        return wave_data.Data();
+    PolyphaseResampler *&resampler = resamplers_[samp_freq];
+    if (!resampler) {
+        KALDI_VLOG(1) << "Resample waves from " << samp_freq << " to "
+                      << opts_.target_samp_freq << "Hz";
+        resampler = new PolyphaseResampler(samp_freq, opts_.target_samp_freq,
+                                           opts_.num_zeros, opts_.cutoff_ratio);
+    }
+    resampler->Resample(wave_data.Data(), &samples_);
+    return samples_;
+}
+
+}
@@ -0,0 +1,103 @@
+// include/resampler.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <map>
+
+#include "matrix/matrix-lib.h"
+#include "base/kaldi-common.h"
+#include "feat/wave-reader.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+struct ResampleOptions {
+    BaseFloat target_samp_freq;
+    int32 num_zeros;
+    BaseFloat cutoff_ratio;
+
+    ResampleOptions(): target_samp_freq(0), num_zeros(16), cutoff_ratio(0.95) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("target-samp-freq", &target_samp_freq, "If positive, resample input waves "
+                       "to this sample frequency on load, so that channels of different rates "
+                       "could be mixed");
+        opts->Register("resample-num-zeros", &num_zeros, "Number of zero crossings on each side "
+                       "of the sinc filter used in resampling, larger is sharper and slower");
+    }
+};
+
+// Rational resampler by polyphase filter, from samp_freq_in to samp_freq_out
+// (both integer). Up/down factor L/M = samp_freq_out/samp_freq_in is reduced,
+// and filters of L phases(hann windowed sinc, cutoff at cutoff_ratio of lower
+// nyquist frequency) are computed in constructor. Each output sample is then
+// a dot product of one phase with input samples, done for all channels at once.
+class PolyphaseResampler {
+public:
+    PolyphaseResampler(BaseFloat samp_freq_in, BaseFloat samp_freq_out,
+                       int32 num_zeros = 16, BaseFloat cutoff_ratio = 0.95);
+
+    // input:   (num_channels, num_samples)
+    // output:  (num_channels, NumOutputSamples(num_samples))
+    void Resample(const MatrixBase<BaseFloat> &input, Matrix<BaseFloat> *output) const;
+
+    int64 NumOutputSamples(int64 num_samples) const {
+        return num_samples * up_ / down_;
+    }
+
+private:
+    int32 up_, down_;
+    // number of taps on each side, filter length is 2 x num_taps_
+    int32 num_taps_;
+    // (up_, 2 x num_taps_), filter of each phase
+    Matrix<BaseFloat> filters_;
+};
+
+// Resamples waves to --target-samp-freq if needed, resamplers are cached for
+// each input sample frequency.
+class WaveResampler {
+public:
+    WaveResampler(const ResampleOptions &opts): opts_(opts) {}
+
+    ~WaveResampler();
+
+    // Returns samples of wave_data at SampFreq(wave_data), which refers to
+    // wave_data itself if not resampled, or internal buffer otherwise(valid until
+    // next call).
+    const Matrix<BaseFloat> &Resample(const WaveData &wave_data);
+
+    BaseFloat SampFreq(const WaveData &wave_data) const {
+        return opts_.target_samp_freq > 0 ? opts_.target_samp_freq: wave_data.SampFreq();
+    }
+
+private:
+    ResampleOptions opts_;
+    std::map<BaseFloat, PolyphaseResampler*> resamplers_;
+    Matrix<BaseFloat> samples_;
+
+    KALDI_DISALLOW_COPY_AND_ASSIGN(WaveResampler);
+};
+
+}
+
+#endif
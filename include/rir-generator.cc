@@ -20,9 +20,30 @@
 
 
 #include "include/rir-generator.h"
+#include "include/setk-profile.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
 
 namespace kaldi {
 
+// Hanning windowed sinc of fractional delay frac, same as
+//   0.5 * (1 - cos(2 * pi * (n + 1 - frac) / Tw)) * Sinc(pi * (n + 1 - frac - Tw / 2))
+// but uses sin(pi * (n + c)) = (-1)^n * sin(pi * c) and rotates the cosine term,
+// so only a few trigonometric calls for each reflection
+static void LowpassTaps(double frac, int32 Tw, BaseFloat *taps) {
+    double c = 1 - frac - Tw / 2, sin_pc = std::sin(M_PI * c);
+    double delta = 2 * M_PI / Tw, cos_d = std::cos(delta), sin_d = std::sin(delta);
+    double cos_t = std::cos(delta * (1 - frac)), sin_t = std::sin(delta * (1 - frac));
+    for (int32 n = 0; n < Tw; n++) {
+        double x = M_PI * (n + c);
+        double sinc = std::abs(x) < 1e-9 ? 1.0: (n % 2 ? -sin_pc: sin_pc) / x;
+        taps[n] = 0.5 * (1 - cos_t) * sinc;
+        double next_cos = cos_t * cos_d - sin_t * sin_d;
+        sin_t = sin_t * cos_d + cos_t * sin_d;
+        cos_t = next_cos;
+    }
+}
+
 void RirGenerator::ComputeDerived() {
     if (!str_to_pattern_.count(opts_.microphone_type))
         KALDI_ERR << "Unknown option values: --microphone-type=" << opts_.microphone_type;
@@ -108,89 +129,96 @@ void RirGenerator::ComputeDerived() {
 
 
 void RirGenerator::GenerateRir(Matrix<BaseFloat> *rir) {
+    SETK_PROFILE("rir");
     rir->Resize(num_mics_, num_samples_);
     const BaseFloat cts = velocity_ / frequency_;
     Point3D S(source_location_), T(room_topo_);
-    Point3D Y;
-    Point3D Rp_plus_Rm, Rm, Refl;
 
     S.Scale(1.0 / cts);
     T.Scale(1.0 / cts);
 
-    BaseFloat dist, fdist, gain;
     int32 Tw = 2 * static_cast<int32>(0.004 * frequency_ + 0.5);
     BaseFloat W = 2 * M_PI * 100 / frequency_;
     BaseFloat R1 = exp(-W), B1 = 2 * R1 * cos(W), B2 = -R1 * R1, A1 = -1 - R1;
 
-    for (int32 m = 0; m < num_mics_; m++) {
-        Point3D R(receiver_location_[m]);
-        R.Scale(1.0 / cts);
+    // each microphone writes its own row, so they are simulated in parallel
+    ParallelFor(0, num_mics_, [&](int32 mbeg, int32 mend) {
+        Point3D Y;
+        Point3D Rp_plus_Rm, Rm, Refl;
+        BaseFloat dist, fdist, gain;
+        Vector<BaseFloat> taps(Tw);
+
+        for (int32 m = mbeg; m < mend; m++) {
+            Point3D R(receiver_location_[m]);
+            R.Scale(1.0 / cts);
         
-        int32 nx = static_cast<int32>(ceil(num_samples_ / (2 * T.x)));
-        int32 ny = static_cast<int32>(ceil(num_samples_ / (2 * T.y)));
-        int32 nz = static_cast<int32>(ceil(num_samples_ / (2 * T.z)));
+            int32 nx = static_cast<int32>(ceil(num_samples_ / (2 * T.x)));
+            int32 ny = static_cast<int32>(ceil(num_samples_ / (2 * T.y)));
+            int32 nz = static_cast<int32>(ceil(num_samples_ / (2 * T.z)));
 
-        for (int32 x = -nx; x <= nx; x++) {
-            Rm.x = 2 * x * T.x;
+            for (int32 x = -nx; x <= nx; x++) {
+                Rm.x = 2 * x * T.x;
 
-            for (int32 y = -ny; y <= ny; y++) {
-                Rm.y = 2 * y * T.y;
+                for (int32 y = -ny; y <= ny; y++) {
+                    Rm.y = 2 * y * T.y;
 
-                for (int32 z = -nz; z <= nz; z++) {
-                    Rm.z = 2 * z * T.z;
+                    for (int32 z = -nz; z <= nz; z++) {
+                        Rm.z = 2 * z * T.z;
 
-                    for (int32 q = 0; q <= 1; q++) {
-                        Rp_plus_Rm.x = (1 - 2 * q) * S.x - R.x + Rm.x;
-                        Refl.x = pow(beta_[0], abs(x - q)) * pow(beta_[1], abs(x));
+                        for (int32 q = 0; q <= 1; q++) {
+                            Rp_plus_Rm.x = (1 - 2 * q) * S.x - R.x + Rm.x;
+                            Refl.x = pow(beta_[0], abs(x - q)) * pow(beta_[1], abs(x));
 
-                        for (int32 j = 0; j <= 1; j++) {
-                            Rp_plus_Rm.y = (1 - 2 * j) * S.y - R.y + Rm.y;
-                            Refl.y = pow(beta_[2], abs(y - j)) * pow(beta_[3], abs(y));
+                            for (int32 j = 0; j <= 1; j++) {
+                                Rp_plus_Rm.y = (1 - 2 * j) * S.y - R.y + Rm.y;
+                                Refl.y = pow(beta_[2], abs(y - j)) * pow(beta_[3], abs(y));
 
-                            for (int32 k = 0; k <= 1; k++) {
-                                Rp_plus_Rm.z = (1 - 2 * k) * S.z - R.z + Rm.z;
-                                Refl.z = pow(beta_[4], abs(z - k)) * pow(beta_[5], abs(z));
+                                for (int32 k = 0; k <= 1; k++) {
+                                    Rp_plus_Rm.z = (1 - 2 * k) * S.z - R.z + Rm.z;
+                                    Refl.z = pow(beta_[4], abs(z - k)) * pow(beta_[5], abs(z));
 
-                                dist = Rp_plus_Rm.L2Norm();
-                                if (abs(2 * x - q) + abs(2 * y - j) + abs(2 * z - k) <= order_ || order_ == -1) {
-                                    fdist = floor(dist);
+                                    dist = Rp_plus_Rm.L2Norm();
+                                    if (abs(2 * x - q) + abs(2 * y - j) + abs(2 * z - k) <= order_ || order_ == -1) {
+                                        fdist = floor(dist);
 
-                                    if (fdist < num_samples_) {
-                                        int32 pos = static_cast<int32>(fdist - (Tw / 2) + 1);
-                                        gain = MicrophoneSim(Rp_plus_Rm) * Refl.V() / (4 * M_PI * dist * cts);
+                                        if (fdist < num_samples_) {
+                                            int32 pos = static_cast<int32>(fdist - (Tw / 2) + 1);
+                                            gain = MicrophoneSim(Rp_plus_Rm) * Refl.V() / (4 * M_PI * dist * cts);
 
-                                        for (int32 n = 0 ; n < Tw ; n++) {
-                                            if (pos + n >= 0 && pos + n < num_samples_)
-                                                (*rir)(m, pos + n) += gain * (0.5 * (1 - cos(2 * M_PI * ((n + 1 - (dist - fdist)) / Tw))) * 
-                                                Sinc(M_PI * (n + 1 - (dist - fdist) - (Tw / 2))));
+                                            LowpassTaps(dist - fdist, Tw, taps.Data());
+                                            // accumulate taps inside [0, num_samples)
+                                            int32 nbeg = std::max(0, -pos), nend = std::min(Tw, num_samples_ - pos);
+                                            if (nend > nbeg)
+                                                Simd().axpy(gain, taps.Data() + nbeg, rir->RowData(m) + pos + nbeg,
+                                                            nend - nbeg);
                                         }
                                     }
-                                }
 
+                                }
                             }
                         }
                     }
                 }
             }
-        }
 
-        if (hp_filter_) {
-            Y.Reset();
-            BaseFloat X0;
-            for (int32 i = 0; i < num_samples_; i++) {
-                X0 = (*rir)(m, i);
-                Y.z = Y.y; Y.y = Y.x;
-                Y.x = B1 * Y.y + B2 * Y.z + X0;
-                (*rir)(m, i) = Y.x + A1 * Y.y + R1 * Y.z;
+            if (hp_filter_) {
+                Y.Reset();
+                BaseFloat X0;
+                for (int32 i = 0; i < num_samples_; i++) {
+                    X0 = (*rir)(m, i);
+                    Y.z = Y.y; Y.y = Y.x;
+                    Y.x = B1 * Y.y + B2 * Y.z + X0;
+                    (*rir)(m, i) = Y.x + A1 * Y.y + R1 * Y.z;
+                }
             }
         }
-    }
+    });
 }
 
 
 BaseFloat RirGenerator::MicrophoneSim(const Point3D &p) {
     BaseFloat rho = 0;
-    switch(str_to_pattern_[opts_.microphone_type]) {
+    switch(str_to_pattern_.at(opts_.microphone_type)) {
         case kBidirectional:
             rho = 0;
             break;
@@ -110,6 +110,10 @@ public:
 
     BaseFloat Frequency() { return frequency_; }
 
+    int32 NumSamples() { return num_samples_; }
+
+    int32 NumMicrophones() { return num_mics_; }
+
 private:
     BaseFloat velocity_, frequency_, revb_time_;
     bool hp_filter_;
@@ -135,11 +139,11 @@ private:
 };
 
 
-double Sinc(double x) {
+inline double Sinc(double x) {
     return x == 0 ? 1.0 : std::sin(x) / x;
 }
 
-BaseFloat Sabine(Point3D &room_topo, std::vector<BaseFloat> &beta, BaseFloat c) {
+inline BaseFloat Sabine(Point3D &room_topo, std::vector<BaseFloat> &beta, BaseFloat c) {
     BaseFloat V = room_topo.x * room_topo.y * room_topo.z;
     BaseFloat alpha = ((1 - pow(beta[0], 2)) + (1 - pow(beta[1], 2))) * room_topo.y * room_topo.z +
                 ((1 - pow(beta[2], 2)) + (1 - pow(beta[3], 2))) * room_topo.x * room_topo.z +
@@ -0,0 +1,307 @@
+// include/setk-allocator.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "include/setk-allocator.h"
+
+namespace kaldi {
+
+const int32 kScratchMagic = 0x5e7c;
+const size_t kMinScratchBytes = 64;
+const size_t kHugePageBytes = 2 << 20;
+
+// Placed before each block, keep user pointer aligned
+struct ScratchHeader {
+    int32 size_class, magic;
+    // size of mapping if mapped by SystemAlloc(), else 0
+    int64 map_bytes;
+    char padding[kScratchAlignment - 2 * sizeof(int32) - sizeof(int64)];
+};
+
+// cached blocks never reach mapped size, which are not recycled
+static_assert((kMinScratchBytes << (kNumScratchClasses - 1)) + sizeof(ScratchHeader) < kArenaMinBytes,
+              "largest size class should be heap allocated");
+
+static std::atomic<bool> &HugePagesFlag() {
+    static std::atomic<bool> huge_pages([] {
+        const char *env = std::getenv("SETK_HUGE_PAGES");
+        return env != NULL && std::string(env) == "1";
+    }());
+    return huge_pages;
+}
+
+// Large blocks are mapped without touching, others come from heap
+static ScratchHeader *SystemAlloc(size_t bytes) {
+#ifdef __linux__
+    if (bytes >= kArenaMinBytes) {
+        bool huge = HugePagesFlag().load(std::memory_order_relaxed);
+        size_t align = huge ? kHugePageBytes: 4096;
+        size_t map_bytes = (bytes + align - 1) / align * align;
+        // over-map and trim to get aligned start
+        size_t over_bytes = map_bytes + (huge ? align: 0);
+        void *addr = mmap(NULL, over_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            throw std::bad_alloc();
+        char *base = static_cast<char*>(addr);
+        if (huge) {
+            char *start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + align - 1) / align * align);
+            if (start > base)
+                munmap(base, start - base);
+            if (base + over_bytes > start + map_bytes)
+                munmap(start + map_bytes, base + over_bytes - start - map_bytes);
+            base = start;
+            madvise(base, map_bytes, MADV_HUGEPAGE);
+        }
+        ScratchHeader *header = reinterpret_cast<ScratchHeader*>(base);
+        header->map_bytes = map_bytes;
+        return header;
+    }
+#endif
+    void *data = NULL;
+    if (posix_memalign(&data, kScratchAlignment, bytes) != 0)
+        throw std::bad_alloc();
+    ScratchHeader *header = static_cast<ScratchHeader*>(data);
+    header->map_bytes = 0;
+    return header;
+}
+
+static void SystemFree(ScratchHeader *header) {
+#ifdef __linux__
+    if (header->map_bytes) {
+        munmap(header, header->map_bytes);
+        return;
+    }
+#endif
+    std::free(header);
+}
+
+struct ScratchBlock {
+    ScratchBlock *next;
+};
+
+// Lifetime of the pool of current thread. It's trivially destructible, so stays
+// valid while thread_local objects(including the pool) are destroyed at thread
+// exit, when blocks freed by other destructors go to system directly.
+enum ScratchPoolState {
+    kPoolUnused = 0,
+    kPoolAlive,
+    kPoolDestroyed
+};
+
+static thread_local int32 scratch_pool_state = kPoolUnused;
+
+struct ScratchPool {
+    ScratchBlock *free_list[kNumScratchClasses];
+    // whether the size class is requested since last ResetScratchPool()
+    bool requested[kNumScratchClasses];
+    // see ThreadWorkspace()
+    void *workspace[kNumWorkspaceSlots];
+    size_t workspace_size[kNumWorkspaceSlots];
+    AllocationStats stats;
+    // name of innermost NoAllocationScope, NULL if not in
+    const char *no_alloc_scope;
+
+    ScratchPool(): no_alloc_scope(NULL) {
+        scratch_pool_state = kPoolAlive;
+        for (int32 c = 0; c < kNumScratchClasses; c++) {
+            free_list[c] = NULL;
+            requested[c] = false;
+        }
+        for (int32 s = 0; s < kNumWorkspaceSlots; s++) {
+            workspace[s] = NULL;
+            workspace_size[s] = 0;
+        }
+    }
+
+    void Release(int32 c) {
+        while (free_list[c]) {
+            ScratchBlock *block = free_list[c];
+            free_list[c] = block->next;
+            SystemFree(reinterpret_cast<ScratchHeader*>(block) - 1);
+            stats.bytes_cached -= (kMinScratchBytes << c);
+        }
+    }
+
+    ~ScratchPool() {
+        scratch_pool_state = kPoolDestroyed;
+        for (int32 s = 0; s < kNumWorkspaceSlots; s++)
+            if (workspace[s])
+                SystemFree(static_cast<ScratchHeader*>(workspace[s]) - 1);
+        for (int32 c = 0; c < kNumScratchClasses; c++)
+            Release(c);
+    }
+};
+
+static thread_local ScratchPool scratch_pool;
+
+static std::atomic<int64> global_system_allocs(0);
+static std::atomic<int64> scratch_pool_limit(static_cast<int64>(256) << 20);
+
+static std::atomic<bool> &AllocationCheckFlag() {
+    static std::atomic<bool> check([] {
+        const char *env = std::getenv("SETK_CHECK_ALLOC");
+        return env != NULL && std::string(env) == "1";
+    }());
+    return check;
+}
+
+static int32 ScratchClass(size_t size) {
+    int32 c = 0;
+    while (c < kNumScratchClasses && (kMinScratchBytes << c) < size)
+        c++;
+    return c < kNumScratchClasses ? c: -1;
+}
+
+// Block of size class c(-1 if oversized) from system
+static void *NewScratchBlock(int32 c, size_t size) {
+    global_system_allocs.fetch_add(1, std::memory_order_relaxed);
+    size_t bytes = (c >= 0 ? (kMinScratchBytes << c): size) + sizeof(ScratchHeader);
+    ScratchHeader *header = SystemAlloc(bytes);
+    header->size_class = c;
+    header->magic = kScratchMagic;
+    return header + 1;
+}
+
+void *SetkMemalign(size_t size) {
+    int32 c = ScratchClass(size);
+    // requested by destructors of other thread_local objects at thread exit
+    if (scratch_pool_state == kPoolDestroyed)
+        return NewScratchBlock(c, size);
+    ScratchPool &pool = scratch_pool;
+    if (pool.no_alloc_scope && AllocationCheckEnabled())
+        KALDI_ERR << "Allocate " << size << " bytes in no-allocation scope \""
+                  << pool.no_alloc_scope << "\"";
+    pool.stats.num_requests++;
+    pool.stats.bytes_requested += size;
+
+    if (c >= 0) {
+        pool.requested[c] = true;
+        if (ScratchBlock *block = pool.free_list[c]) {
+            pool.free_list[c] = block->next;
+            pool.stats.bytes_cached -= (kMinScratchBytes << c);
+            return block;
+        }
+    }
+    pool.stats.num_system_allocs++;
+    return NewScratchBlock(c, size);
+}
+
+void SetkFree(void *ptr) {
+    if (ptr == NULL) return;
+    ScratchHeader *header = static_cast<ScratchHeader*>(ptr) - 1;
+    KALDI_ASSERT(header->magic == kScratchMagic);
+    int32 c = header->size_class;
+    // oversized blocks, or the pool is destroyed(never touch it then)
+    if (c < 0 || scratch_pool_state == kPoolDestroyed) {
+        SystemFree(header);
+        return;
+    }
+    ScratchPool &pool = scratch_pool;
+    if (pool.stats.bytes_cached + (kMinScratchBytes << c) >
+            scratch_pool_limit.load(std::memory_order_relaxed)) {
+        SystemFree(header);
+        return;
+    }
+    ScratchBlock *block = static_cast<ScratchBlock*>(ptr);
+    block->next = pool.free_list[c];
+    pool.free_list[c] = block;
+    pool.stats.bytes_cached += (kMinScratchBytes << c);
+}
+
+void *ThreadWorkspace(WorkspaceSlot slot, size_t size) {
+    KALDI_ASSERT(scratch_pool_state != kPoolDestroyed);
+    ScratchPool &pool = scratch_pool;
+    if (pool.workspace_size[slot] < size) {
+        SetkFree(pool.workspace[slot]);
+        // grows by twice at least to avoid frequent allocations
+        size = std::max(size, pool.workspace_size[slot] * 2);
+        pool.workspace[slot] = SetkMemalign(size);
+        pool.workspace_size[slot] = size;
+    }
+    return pool.workspace[slot];
+}
+
+const AllocationStats &ThreadAllocationStats() {
+    return scratch_pool.stats;
+}
+
+int64 GlobalSystemAllocations() {
+    return global_system_allocs.load(std::memory_order_relaxed);
+}
+
+void ResetScratchPool() {
+    ScratchPool &pool = scratch_pool;
+    KALDI_VLOG(2) << "Allocation statistics: " << pool.stats.num_requests << " requests("
+                  << pool.stats.bytes_requested << " bytes), " << pool.stats.num_system_allocs
+                  << " system allocations, " << pool.stats.bytes_cached << " bytes cached";
+    for (int32 c = 0; c < kNumScratchClasses; c++) {
+        if (!pool.requested[c])
+            pool.Release(c);
+        pool.requested[c] = false;
+    }
+}
+
+void ReleaseScratchPool() {
+    ScratchPool &pool = scratch_pool;
+    for (int32 c = 0; c < kNumScratchClasses; c++)
+        pool.Release(c);
+}
+
+void SetScratchPoolLimit(int64 bytes) {
+    KALDI_ASSERT(bytes >= 0);
+    scratch_pool_limit.store(bytes, std::memory_order_relaxed);
+}
+
+void SetHugePages(bool enable) {
+    HugePagesFlag().store(enable, std::memory_order_relaxed);
+}
+
+bool HugePagesEnabled() {
+    return HugePagesFlag().load(std::memory_order_relaxed);
+}
+
+void SetAllocationCheck(bool enable) {
+    AllocationCheckFlag().store(enable, std::memory_order_relaxed);
+}
+
+bool AllocationCheckEnabled() {
+    return AllocationCheckFlag().load(std::memory_order_relaxed);
+}
+
+NoAllocationScope::NoAllocationScope(const char *name) {
+    prev_name_ = scratch_pool.no_alloc_scope;
+    scratch_pool.no_alloc_scope = name;
+}
+
+NoAllocationScope::~NoAllocationScope() {
+    scratch_pool.no_alloc_scope = prev_name_;
+}
+
+}
@@ -0,0 +1,130 @@
+// include/setk-allocator.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SETK_ALLOCATOR_H
+#define SETK_ALLOCATOR_H
+
+#include <atomic>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// Blocks are rounded up to power of two, from 64 bytes to 2^(kNumScratchClasses + 5),
+// i.e. 512KB, larger ones are served by system in their own size(not cached)
+const int32 kNumScratchClasses = 14;
+// Cache line, so rows of different tasks never share one
+const int32 kScratchAlignment = 64;
+// Blocks not less than this are mapped from system directly, see SetHugePages()
+const size_t kArenaMinBytes = 1 << 20;
+
+// Slots of per-thread workspace, see ThreadWorkspace()
+enum WorkspaceSlot {
+    kLapackWork = 0,
+    kLapackRWork,
+    kLapackPivot,
+    kStftScratch,
+    kEigenValues,
+    kNumWorkspaceSlots
+};
+
+struct AllocationStats {
+    // number of SetkMemalign() calls & bytes requested
+    int64 num_requests, bytes_requested;
+    // number of requests not served by scratch pool
+    int64 num_system_allocs;
+    // bytes cached in scratch pool now
+    int64 bytes_cached;
+
+    AllocationStats(): num_requests(0), bytes_requested(0),
+        num_system_allocs(0), bytes_cached(0) {}
+};
+
+// Aligned memory for CMatrix/CVector and other scratch buffers. Freed blocks are
+// cached in a pool of current thread and reused by later requests of same size
+// class, so each thread never touches the global heap(and its locks) in steady
+// state. Blocks may be freed by other threads, they simply move to their pool.
+void *SetkMemalign(size_t size);
+
+void SetkFree(void *ptr);
+
+// Per-thread workspace of slot, at least size bytes, only grows. Contents are
+// undefined and invalidated by next call on same slot, egs. work/rwork of LAPACK.
+// Do not keep it across ParallelFor() or TaskGroup::Wait(), which run other tasks.
+void *ThreadWorkspace(WorkspaceSlot slot, size_t size);
+
+// Statistics of current thread
+const AllocationStats &ThreadAllocationStats();
+
+// Number of system allocations of all threads
+int64 GlobalSystemAllocations();
+
+// Called per utterance: release cached blocks of size classes not requested since
+// last call, which are left by utterances of different shape
+void ResetScratchPool();
+
+// Release all cached blocks of current thread
+void ReleaseScratchPool();
+
+// Upper limit of bytes cached in the pool of each thread, 256MB by default
+void SetScratchPoolLimit(int64 bytes);
+
+// Large blocks(>= kArenaMinBytes, egs. multichannel STFT & PSD tensors) are
+// fresh anonymous mappings, untouched when returned, so each page lands on the
+// NUMA node of the thread that writes it first. They are unmapped when freed
+// instead of cached, so never reused with placement of another thread. Callers zero or fill them inside
+// the same ParallelFor partition that processes them later. If enabled, these
+// mappings are 2MB aligned and advised to use transparent huge pages. Also
+// enabled by environment variable SETK_HUGE_PAGES=1
+void SetHugePages(bool enable);
+
+bool HugePagesEnabled();
+
+// Test mode: if enabled, SetkMemalign() raises an error inside NoAllocationScope,
+// used to assert that per-frame or per-bin inner loops allocate nothing after
+// warm-up. Also enabled by environment variable SETK_CHECK_ALLOC=1
+void SetAllocationCheck(bool enable);
+
+bool AllocationCheckEnabled();
+
+// Mark a scope where allocation is forbidden in test mode, nested is allowed.
+class NoAllocationScope {
+public:
+    explicit NoAllocationScope(const char *name);
+    ~NoAllocationScope();
+
+private:
+    const char *prev_name_;
+};
+
+}
+
+#define SETK_ALLOC_CONCAT_IMPL(a, b) a##b
+#define SETK_ALLOC_CONCAT(a, b) SETK_ALLOC_CONCAT_IMPL(a, b)
+
+#ifndef SETK_DISABLE_ALLOC_CHECK
+#define SETK_NO_ALLOC(name) \
+    kaldi::NoAllocationScope SETK_ALLOC_CONCAT(setk_no_alloc_, __LINE__)(name)
+#else
+#define SETK_NO_ALLOC(name)
+#endif
+
+#endif
@@ -0,0 +1,517 @@
+// include/setk-c-api.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <deque>
+#include <iomanip>
+#include <stdexcept>
+
+#include "include/setk-c-api.h"
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/srp-phat.h"
+#include "include/rir-generator.h"
+#include "include/thread-pool.h"
+
+using namespace kaldi;
+
+// float* of callers are used as BaseFloat* directly
+static_assert(sizeof(BaseFloat) == sizeof(float), "libsetk C API requires BaseFloat to be float");
+
+static thread_local std::string setk_error_message;
+
+// Catch all exceptions at the boundary, C callers could not handle them
+#define SETK_API_BEGIN try {
+#define SETK_API_END(ret) \
+    } catch (const std::exception &e) { \
+        setk_error_message = e.what(); \
+        return ret; \
+    }
+
+// Bad arguments are reported by setk_last_error(), instead of aborting the
+// host process as KALDI_ASSERT does, used between SETK_API_BEGIN & END
+#define SETK_CHECK_ARG(cond) \
+    do { \
+        if (!(cond)) \
+            throw std::invalid_argument("Invalid argument, expect " #cond); \
+    } while (0)
+
+#define SETK_CHECK_HANDLE(handle, ret) \
+    if (!handle) { \
+        setk_error_message = "Invalid NULL handle"; \
+        return ret; \
+    }
+
+struct setk_stft {
+    OnlineShortTimeFTComputer computer;
+    // for whole utterances, keeps its own fft buffer
+    ShortTimeFTComputer batch;
+    // frames popped from computer, but not pulled by callers
+    Matrix<BaseFloat> pending;
+    int32 num_pending, next_pending;
+
+    setk_stft(const ShortTimeFTOptions &opts, int32 num_channels):
+        computer(opts, num_channels), batch(opts), num_pending(0), next_pending(0) {}
+};
+
+struct setk_beamformer {
+    OnlineBeamformer beamformer;
+    std::string type;
+    // (num_bins, num_channels), one frame
+    CMatrix<BaseFloat> obs;
+    std::deque<CVector<BaseFloat> > enhanced;
+
+    setk_beamformer(const OnlineBeamformerOptions &opts, int32 num_bins, int32 num_channels):
+        beamformer(opts, num_bins, num_channels), type(opts.beamformer), obs(num_bins, num_channels) {}
+};
+
+struct setk_srp {
+    SrpPhatComputor computor;
+    int32 num_bins, resolution;
+    std::deque<Vector<BaseFloat> > spectra;
+
+    setk_srp(const SrpPhatOptions &opts, BaseFloat freq, int32 num_bins):
+        computor(opts, freq, num_bins), num_bins(num_bins), resolution(opts.samp_rate) {}
+};
+
+// Join floats into option strings, as command line tools use
+static std::string JoinFloats(const float *values, int32 num, const char *delim) {
+    std::ostringstream oss;
+    oss << std::setprecision(9);
+    for (int32 i = 0; i < num; i++)
+        oss << (i ? delim: "") << values[i];
+    return oss.str();
+}
+
+static void CastIntoRirOptions(const setk_rir_config_t *conf, RirGeneratorOptions *opts) {
+    SETK_CHECK_ARG(conf->num_receivers >= 1 && conf->receivers);
+    SETK_CHECK_ARG(conf->num_beta == 1 || conf->num_beta == 6);
+    SETK_CHECK_ARG(conf->num_samples >= 0);
+    opts->sound_velocity = conf->sound_velocity;
+    opts->samp_frequency = conf->samp_frequency;
+    opts->hp_filter = (conf->hp_filter != 0);
+    opts->num_samples = conf->num_samples;
+    opts->order = conf->order;
+    if (conf->microphone_type)
+        opts->microphone_type = conf->microphone_type;
+    opts->source_location = JoinFloats(conf->source, 3, ",");
+    opts->room_topo = JoinFloats(conf->room, 3, ",");
+    opts->orientation = JoinFloats(conf->orientation, 2, ",");
+    opts->beta = JoinFloats(conf->beta, conf->num_beta, ",");
+    opts->receiver_location = "";
+    for (int32 i = 0; i < conf->num_receivers; i++)
+        opts->receiver_location += (i ? ";": "") + JoinFloats(conf->receivers + i * 3, 3, ",");
+}
+
+
+extern "C" {
+
+const char *setk_last_error(void) {
+    return setk_error_message.c_str();
+}
+
+int setk_set_num_threads(int num_threads) {
+    SETK_API_BEGIN
+    ThreadPoolOptions opts;
+    opts.num_threads = num_threads;
+    ThreadPool::Get().Configure(opts);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+setk_stft_t *setk_stft_create(int frame_length, int frame_shift,
+                              const char *window, int num_channels) {
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_channels >= 1);
+    ShortTimeFTOptions opts;
+    opts.frame_length = frame_length;
+    opts.frame_shift = frame_shift;
+    if (window)
+        opts.window = window;
+    return new setk_stft(opts, num_channels);
+    SETK_API_END(NULL)
+}
+
+void setk_stft_destroy(setk_stft_t *stft) {
+    delete stft;
+}
+
+int setk_stft_num_bins(const setk_stft_t *stft) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    return stft->computer.NumBins();
+}
+
+int setk_stft_frame_shift(const setk_stft_t *stft) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    return stft->computer.Computer().FrameShift();
+}
+
+int setk_stft_latency(const setk_stft_t *stft) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    return stft->computer.Latency();
+}
+
+int setk_stft_push(setk_stft_t *stft, const float *samples, int num_samples) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_samples >= 0);
+    if (num_samples == 0)
+        return SETK_OK;
+    SETK_CHECK_ARG(samples != NULL);
+    int32 num_channels = stft->computer.NumChannels();
+    // avoid copy if BaseFloat is float
+    SubMatrix<BaseFloat> chunk(const_cast<float*>(samples), num_channels,
+                               num_samples, num_samples);
+    stft->computer.AcceptWaveform(chunk);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_stft_frames_ready(const setk_stft_t *stft) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    return stft->num_pending - stft->next_pending + stft->computer.NumFramesReady();
+}
+
+int setk_stft_pull(setk_stft_t *stft, float *spectrum) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(spectrum != NULL);
+    if (stft->next_pending == stft->num_pending) {
+        if (!stft->computer.NumFramesReady())
+            return 0;
+        stft->num_pending = stft->computer.PopFrames(&stft->pending);
+        stft->next_pending = 0;
+    }
+    int32 num_channels = stft->computer.NumChannels(),
+          num_bins = stft->computer.NumBins();
+    // pending: (num_channels x num_frames, padding) in realfft format
+    for (int32 c = 0; c < num_channels; c++) {
+        SubCVector<BaseFloat> dst(spectrum + c * num_bins * 2, num_bins);
+        dst.CopyFromRealfft(stft->pending.Row(c * stft->num_pending + stft->next_pending));
+    }
+    stft->next_pending++;
+    return 1;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_stft_synthesize(setk_stft_t *stft, const float *spectrum, float *samples) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    // validate before OverlapAdd, a rejected call keeps the streaming state
+    SETK_CHECK_ARG(spectrum != NULL && samples != NULL);
+    int32 num_bins = stft->computer.NumBins(),
+          frame_shift = stft->computer.Computer().FrameShift();
+    SubCMatrix<BaseFloat> frame(const_cast<float*>(spectrum), 1, num_bins, num_bins * 2);
+    Matrix<BaseFloat> rstft, wave;
+    CastIntoRealfft(frame, &rstft);
+    stft->computer.OverlapAdd(rstft, &wave);
+    if (wave.NumCols() != frame_shift)
+        KALDI_ERR << "Expect " << frame_shift << " samples from one frame, got " << wave.NumCols();
+    memcpy(samples, wave.Data(), sizeof(float) * frame_shift);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_stft_flush(setk_stft_t *stft, float *samples) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(samples != NULL);
+    Matrix<BaseFloat> wave;
+    stft->computer.Flush(&wave);
+    memcpy(samples, wave.Data(), sizeof(float) * wave.NumCols());
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_stft_num_frames(const setk_stft_t *stft, int num_samples) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    if (num_samples < stft->batch.FrameLength()) {
+        setk_error_message = "Utterance is shorter than one frame";
+        return SETK_ERROR;
+    }
+    return stft->batch.NumFrames(num_samples);
+}
+
+int setk_stft_forward(setk_stft_t *stft, const float *samples, int num_samples, float *spectrum) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_samples >= stft->batch.FrameLength());
+    SETK_CHECK_ARG(samples != NULL && spectrum != NULL);
+    int32 num_channels = stft->computer.NumChannels(),
+          num_bins = stft->computer.NumBins();
+    SubMatrix<BaseFloat> wave(const_cast<float*>(samples), num_channels,
+                              num_samples, num_samples);
+    Matrix<BaseFloat> rstft;
+    stft->batch.ShortTimeFT(wave, &rstft);
+    // unpack realfft format into caller's buffer directly
+    SubCMatrix<BaseFloat> dst(spectrum, rstft.NumRows(), num_bins, num_bins * 2);
+    dst.CopyFromRealfft(rstft);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_stft_inverse(setk_stft_t *stft, const float *spectrum, int num_frames, float *samples) {
+    SETK_CHECK_HANDLE(stft, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_frames >= 1);
+    SETK_CHECK_ARG(spectrum != NULL && samples != NULL);
+    int32 num_bins = stft->computer.NumBins();
+    SubCMatrix<BaseFloat> src(const_cast<float*>(spectrum), num_frames, num_bins, num_bins * 2);
+    Matrix<BaseFloat> rstft, wave;
+    CastIntoRealfft(src, &rstft);
+    // range < 0: keep the scale of input
+    stft->batch.InverseShortTimeFT(rstft, &wave, -1);
+    memcpy(samples, wave.Data(), sizeof(float) * wave.NumCols());
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+
+setk_beamformer_t *setk_beamformer_create(const char *type, int num_bins, int num_channels,
+                                          float forget_factor, int update_periods) {
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_bins >= 1 && num_channels >= 1);
+    OnlineBeamformerOptions opts;
+    if (type)
+        opts.beamformer = type;
+    opts.forget_factor = forget_factor;
+    opts.update_periods = update_periods;
+    return new setk_beamformer(opts, num_bins, num_channels);
+    SETK_API_END(NULL)
+}
+
+void setk_beamformer_destroy(setk_beamformer_t *beamformer) {
+    delete beamformer;
+}
+
+int setk_beamformer_set_weights(setk_beamformer_t *beamformer, const float *weights) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(weights != NULL);
+    int32 num_bins = beamformer->beamformer.NumBins(),
+          num_channels = beamformer->beamformer.NumChannels();
+    SubCMatrix<BaseFloat> w(const_cast<float*>(weights), num_bins,
+                            num_channels, num_channels * 2);
+    beamformer->beamformer.SetWeights(w);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_beamformer_get_weights(const setk_beamformer_t *beamformer, float *weights) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(weights != NULL);
+    int32 num_bins = beamformer->beamformer.NumBins(),
+          num_channels = beamformer->beamformer.NumChannels();
+    SubCMatrix<BaseFloat> w(weights, num_bins, num_channels, num_channels * 2);
+    w.CopyFromMat(beamformer->beamformer.Weights());
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_beamformer_push(setk_beamformer_t *beamformer, const float *spectrum, const float *mask) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    // mask is optional, NULL for fixed beamformer
+    SETK_CHECK_ARG(spectrum != NULL);
+    int32 num_bins = beamformer->beamformer.NumBins(),
+          num_channels = beamformer->beamformer.NumChannels();
+    // (num_channels, num_bins) => (num_bins, num_channels)
+    SubCMatrix<BaseFloat> src(const_cast<float*>(spectrum), num_channels,
+                              num_bins, num_bins * 2);
+    beamformer->obs.CopyFromMat(src, kTrans);
+    CVector<BaseFloat> enh(num_bins);
+    if (mask) {
+        SubVector<BaseFloat> m(const_cast<float*>(mask), num_bins);
+        beamformer->beamformer.Process(beamformer->obs, &m, &enh);
+    } else {
+        beamformer->beamformer.Process(beamformer->obs, NULL, &enh);
+    }
+    beamformer->enhanced.push_back(enh);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_beamformer_pull(setk_beamformer_t *beamformer, float *enhanced) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(enhanced != NULL);
+    if (beamformer->enhanced.empty())
+        return 0;
+    const CVector<BaseFloat> &enh = beamformer->enhanced.front();
+    memcpy(enhanced, enh.Data(), sizeof(float) * enh.Dim() * 2);
+    beamformer->enhanced.pop_front();
+    return 1;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_beamformer_estimate(setk_beamformer_t *beamformer, const float *spectrum,
+                             const float *mask, int num_frames) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_frames >= 1);
+    SETK_CHECK_ARG(spectrum != NULL && mask != NULL);
+    if (beamformer->type != "mvdr" && beamformer->type != "gevd")
+        KALDI_ERR << "Could not estimate weights of " << beamformer->type << " beamformer";
+    int32 num_bins = beamformer->beamformer.NumBins(),
+          num_channels = beamformer->beamformer.NumChannels();
+    SubCMatrix<BaseFloat> stft(const_cast<float*>(spectrum), num_channels * num_frames,
+                               num_bins, num_bins * 2);
+    SubMatrix<BaseFloat> target_mask(const_cast<float*>(mask), num_frames, num_bins, num_bins);
+    CMatrix<BaseFloat> src_stft, target_psd, noise_psd, steer_vector, weights;
+    TrimStft(num_bins, num_channels, stft, &src_stft);
+    EstimatePsd(src_stft, target_mask, &target_psd, &noise_psd);
+    if (beamformer->type == "mvdr") {
+        EstimateSteerVector(target_psd, &steer_vector);
+        ComputeMvdrBeamWeights(noise_psd, steer_vector, &weights);
+    } else {
+        ComputeGevdBeamWeights(target_psd, noise_psd, &weights);
+    }
+    beamformer->beamformer.SetWeights(weights);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_beamformer_apply(setk_beamformer_t *beamformer, const float *spectrum,
+                          int num_frames, float *enhanced) {
+    SETK_CHECK_HANDLE(beamformer, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_frames >= 1);
+    SETK_CHECK_ARG(spectrum != NULL && enhanced != NULL);
+    int32 num_bins = beamformer->beamformer.NumBins(),
+          num_channels = beamformer->beamformer.NumChannels();
+    SubCMatrix<BaseFloat> stft(const_cast<float*>(spectrum), num_channels * num_frames,
+                               num_bins, num_bins * 2);
+    CMatrix<BaseFloat> src_stft, enh_stft;
+    TrimStft(num_bins, num_channels, stft, &src_stft);
+    Beamform(src_stft, beamformer->beamformer.Weights(), &enh_stft);
+    SubCMatrix<BaseFloat> dst(enhanced, num_frames, num_bins, num_bins * 2);
+    dst.CopyFromMat(enh_stft);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+
+setk_srp_t *setk_srp_create(const float *topo, int num_mics, float samp_frequency,
+                            int num_bins, int resolution, int samp_doa) {
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(topo && num_mics >= 2 && num_bins >= 2);
+    SrpPhatOptions opts;
+    opts.topo_descriptor = JoinFloats(topo, num_mics, ",");
+    opts.samp_rate = resolution;
+    opts.samp_doa = (samp_doa != 0);
+    opts.samp_tdoa = !opts.samp_doa;
+    return new setk_srp(opts, samp_frequency, num_bins);
+    SETK_API_END(NULL)
+}
+
+void setk_srp_destroy(setk_srp_t *srp) {
+    delete srp;
+}
+
+int setk_srp_resolution(const setk_srp_t *srp) {
+    SETK_CHECK_HANDLE(srp, SETK_ERROR);
+    return srp->resolution;
+}
+
+int setk_srp_push(setk_srp_t *srp, const float *spectrum) {
+    SETK_CHECK_HANDLE(srp, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(spectrum != NULL);
+    int32 num_mics = srp->computor.NumChannels();
+    // (num_channels x num_frames, num_bins) with num_frames = 1
+    SubCMatrix<BaseFloat> stft(const_cast<float*>(spectrum), num_mics,
+                               srp->num_bins, srp->num_bins * 2);
+    Matrix<BaseFloat> spectra;
+    srp->computor.Compute(stft, &spectra);
+    SETK_CHECK_ARG(spectra.NumRows() == 1);
+    srp->spectra.push_back(Vector<BaseFloat>(spectra.Row(0)));
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_srp_pull(setk_srp_t *srp, float *spectra) {
+    SETK_CHECK_HANDLE(srp, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(spectra != NULL);
+    if (srp->spectra.empty())
+        return 0;
+    const Vector<BaseFloat> &s = srp->spectra.front();
+    memcpy(spectra, s.Data(), sizeof(float) * s.Dim());
+    srp->spectra.pop_front();
+    return 1;
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_srp_compute(setk_srp_t *srp, const float *spectrum, int num_frames, float *spectra) {
+    SETK_CHECK_HANDLE(srp, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(num_frames >= 1);
+    SETK_CHECK_ARG(spectrum != NULL && spectra != NULL);
+    int32 num_mics = srp->computor.NumChannels();
+    SubCMatrix<BaseFloat> stft(const_cast<float*>(spectrum), num_mics * num_frames,
+                               srp->num_bins, srp->num_bins * 2);
+    Matrix<BaseFloat> angular_spectra;
+    srp->computor.Compute(stft, &angular_spectra);
+    SubMatrix<BaseFloat> dst(spectra, num_frames, srp->resolution, srp->resolution);
+    dst.CopyFromMat(angular_spectra);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+
+void setk_rir_config_init(setk_rir_config_t *conf) {
+    if (!conf) return;
+    memset(conf, 0, sizeof(setk_rir_config_t));
+    RirGeneratorOptions opts;
+    conf->sound_velocity = opts.sound_velocity;
+    conf->samp_frequency = opts.samp_frequency;
+    conf->hp_filter = opts.hp_filter;
+    conf->order = opts.order;
+    conf->num_beta = 1;
+    conf->microphone_type = "omnidirectional";
+}
+
+int setk_rir_num_samples(const setk_rir_config_t *conf) {
+    SETK_CHECK_HANDLE(conf, SETK_ERROR);
+    SETK_API_BEGIN
+    RirGeneratorOptions opts;
+    CastIntoRirOptions(conf, &opts);
+    RirGenerator generator(opts);
+    return generator.NumSamples();
+    SETK_API_END(SETK_ERROR)
+}
+
+int setk_rir_generate(const setk_rir_config_t *conf, float *rir) {
+    SETK_CHECK_HANDLE(conf, SETK_ERROR);
+    SETK_API_BEGIN
+    SETK_CHECK_ARG(rir != NULL);
+    RirGeneratorOptions opts;
+    CastIntoRirOptions(conf, &opts);
+    RirGenerator generator(opts);
+    Matrix<BaseFloat> rir_mat;
+    generator.GenerateRir(&rir_mat);
+    SubMatrix<BaseFloat> dst(rir, rir_mat.NumRows(), rir_mat.NumCols(), rir_mat.NumCols());
+    dst.CopyFromMat(rir_mat);
+    return SETK_OK;
+    SETK_API_END(SETK_ERROR)
+}
+
+}
@@ -0,0 +1,201 @@
+/* include/setk-c-api.h
+ * wujian@2018
+ *
+ * Copyright 2018 Jian Wu
+ *
+ * See ../../COPYING for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+ * WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+ * MERCHANTABLITY OR NON-INFRINGEMENT.
+ * See the Apache 2 License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stable C interface of libsetk. All handles are opaque, and all buffers are owned
+ * by callers, in plain float arrays:
+ *  - waveform: channel-major, num_channels x num_samples
+ *  - complex:  interleaved (real, imag), egs. spectrum of one frame is
+ *              num_channels x num_bins x 2 floats, channel-major
+ * Functions return SETK_OK(0) on success and SETK_ERROR(-1) on failure, or
+ * NULL for constructors. Use setk_last_error() to get the error message.
+ * Each handle must not be used by multiple threads at the same time.
+ * Input buffers are read in place, so arrays of other runtimes(egs. NumPy
+ * float32/complex64 in C order) could be passed without copy.
+ */
+
+#ifndef SETK_C_API_H
+#define SETK_C_API_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SETK_OK     0
+#define SETK_ERROR  -1
+
+/* error message of the last failed call in current thread */
+const char *setk_last_error(void);
+
+/* size of thread pool shared by all engines(0 means number of cores, 1 by
+   default), must not be called while other calls are running */
+int setk_set_num_threads(int num_threads);
+
+
+/* ---------------------- streaming STFT ---------------------- */
+
+typedef struct setk_stft setk_stft_t;
+
+/* window: "hamming"|"hanning"|"blackman"|"rectangular"|"asymmetric", asymmetric
+ * window cuts latency to 2 x frame_shift, output skips the first
+ * frame_length - 2 x frame_shift samples(never synthesized) */
+setk_stft_t *setk_stft_create(int frame_length, int frame_shift,
+                              const char *window, int num_channels);
+
+void setk_stft_destroy(setk_stft_t *stft);
+
+/* number of frequency bins: fft_size / 2 + 1 */
+int setk_stft_num_bins(const setk_stft_t *stft);
+
+int setk_stft_frame_shift(const setk_stft_t *stft);
+
+/* algorithmic latency in samples, frame_length or 2 x frame_shift(asymmetric) */
+int setk_stft_latency(const setk_stft_t *stft);
+
+/* push waveform chunk, samples: num_channels x num_samples */
+int setk_stft_push(setk_stft_t *stft, const float *samples, int num_samples);
+
+/* number of frames which could be pulled */
+int setk_stft_frames_ready(const setk_stft_t *stft);
+
+/* pull one frame, spectrum: num_channels x num_bins complex.
+ * returns 1 if pulled, 0 if no frame is ready */
+int setk_stft_pull(setk_stft_t *stft, float *spectrum);
+
+/* overlapadd one frame(single channel, num_bins complex),
+ * and output frame_shift samples finished */
+int setk_stft_synthesize(setk_stft_t *stft, const float *spectrum, float *samples);
+
+/* output the rest setk_stft_latency() - frame_shift samples in synthesis buffer */
+int setk_stft_flush(setk_stft_t *stft, float *samples);
+
+/* number of frames of a whole utterance, same as command line tools */
+int setk_stft_num_frames(const setk_stft_t *stft, int num_samples);
+
+/* STFT of a whole utterance, independent of streaming state above
+ * samples: num_channels x num_samples, spectrum: num_channels x num_frames x num_bins complex */
+int setk_stft_forward(setk_stft_t *stft, const float *samples, int num_samples, float *spectrum);
+
+/* overlapadd a whole utterance(single channel), samples is not normalized
+ * spectrum: num_frames x num_bins complex, samples: (num_frames - 1) x frame_shift + frame_length */
+int setk_stft_inverse(setk_stft_t *stft, const float *spectrum, int num_frames, float *samples);
+
+
+/* ---------------------- streaming beamformer ---------------------- */
+
+typedef struct setk_beamformer setk_beamformer_t;
+
+/* type: "fixed"|"mvdr"|"gevd", for adaptive ones, psd are updated recursively
+ * using forget_factor and weights are re-estimated every update_periods frames */
+setk_beamformer_t *setk_beamformer_create(const char *type, int num_bins, int num_channels,
+                                          float forget_factor, int update_periods);
+
+void setk_beamformer_destroy(setk_beamformer_t *beamformer);
+
+/* weights: num_bins x num_channels complex */
+int setk_beamformer_set_weights(setk_beamformer_t *beamformer, const float *weights);
+
+int setk_beamformer_get_weights(const setk_beamformer_t *beamformer, float *weights);
+
+/* push one frame, spectrum: num_channels x num_bins complex(as setk_stft_pull() gives)
+ * mask: num_bins target mask, could be NULL for fixed beamformer */
+int setk_beamformer_push(setk_beamformer_t *beamformer, const float *spectrum, const float *mask);
+
+/* pull one enhanced frame, enhanced: num_bins complex.
+ * returns 1 if pulled, 0 if no frame is ready */
+int setk_beamformer_pull(setk_beamformer_t *beamformer, float *enhanced);
+
+/* estimate weights of "mvdr"|"gevd" beamformer on a whole utterance, as
+ * apply-supervised-{mvdr,max-snr} do, and replace current weights
+ * spectrum: num_channels x num_frames x num_bins complex
+ * mask: num_frames x num_bins target mask(noise mask is 1 - mask) */
+int setk_beamformer_estimate(setk_beamformer_t *beamformer, const float *spectrum,
+                             const float *mask, int num_frames);
+
+/* beamform a whole utterance using current weights
+ * spectrum: num_channels x num_frames x num_bins complex, enhanced: num_frames x num_bins complex */
+int setk_beamformer_apply(setk_beamformer_t *beamformer, const float *spectrum,
+                          int num_frames, float *enhanced);
+
+
+/* ---------------------- localization(SRP-PHAT) ---------------------- */
+
+typedef struct setk_srp setk_srp_t;
+
+/* topo: positions(in meters) of linear array, resolution: number of points sampled
+ * on tdoa(or doa if samp_doa != 0) axis */
+setk_srp_t *setk_srp_create(const float *topo, int num_mics, float samp_frequency,
+                            int num_bins, int resolution, int samp_doa);
+
+void setk_srp_destroy(setk_srp_t *srp);
+
+int setk_srp_resolution(const setk_srp_t *srp);
+
+/* push one frame, spectrum: num_mics x num_bins complex */
+int setk_srp_push(setk_srp_t *srp, const float *spectrum);
+
+/* pull angular spectrum of one frame, spectra: resolution floats.
+ * returns 1 if pulled, 0 if no frame is ready */
+int setk_srp_pull(setk_srp_t *srp, float *spectra);
+
+/* angular spectrum of a whole utterance
+ * spectrum: num_mics x num_frames x num_bins complex, spectra: num_frames x resolution */
+int setk_srp_compute(setk_srp_t *srp, const float *spectrum, int num_frames, float *spectra);
+
+
+/* ---------------------- RIR generator ---------------------- */
+
+typedef struct {
+    float sound_velocity;
+    float samp_frequency;
+    float source[3];
+    float room[3];
+    /* num_receivers x 3 */
+    const float *receivers;
+    int num_receivers;
+    /* T60 if num_beta == 1, or 6 reflection coefficients if num_beta == 6 */
+    float beta[6];
+    int num_beta;
+    /* if zero, decided by T60 */
+    int num_samples;
+    /* -1 means maximum order */
+    int order;
+    int hp_filter;
+    /* "omnidirectional"|"subcardioid"|"cardioid"|"hypercardioid"|"bidirectional" */
+    const char *microphone_type;
+    /* azimuth and elevation(in radians) */
+    float orientation[2];
+} setk_rir_config_t;
+
+/* fill config with default values */
+void setk_rir_config_init(setk_rir_config_t *conf);
+
+/* number of samples of each rir, depends on configs */
+int setk_rir_num_samples(const setk_rir_config_t *conf);
+
+/* rir: num_receivers x setk_rir_num_samples() */
+int setk_rir_generate(const setk_rir_config_t *conf, float *rir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+// include/setk-profile.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <iomanip>
+#include <algorithm>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "include/setk-profile.h"
+
+namespace kaldi {
+
+std::atomic<bool> Profiler::enabled_(false);
+std::atomic<bool> Profiler::tracing_(false);
+
+static inline void RelaxedAdd(std::atomic<uint64> *value, uint64 delta) {
+    value->store(value->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+static BaseFloat Percentile(std::vector<BaseFloat> values, BaseFloat p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    int32 index = static_cast<int32>(std::ceil(p * values.size())) - 1;
+    return values[std::min(std::max(index, 0), static_cast<int32>(values.size()) - 1)];
+}
+
+static void ReadPageFaults(int64 *minor, int64 *major) {
+    *minor = *major = 0;
+#ifdef __linux__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        *minor = usage.ru_minflt, *major = usage.ru_majflt;
+#endif
+}
+
+// Loads missed in local NUMA node(served by remote one) of calling thread,
+// may fail in containers or without permission(perf_event_paranoid)
+static int32 OpenRemoteAccessCounter() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int32>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    return -1;
+#endif
+}
+
+static int64 ReadCounter(int32 fd) {
+    uint64 value = 0;
+#ifdef __linux__
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+#endif
+    return static_cast<int64>(value);
+}
+
+int32 Profiler::RegisterStage(const char *name) {
+    Profiler &profiler = Get();
+    std::lock_guard<std::mutex> lock(profiler.mutex_);
+    std::vector<const char*> &names = profiler.stage_names_;
+    for (int32 i = 0; i < names.size(); i++)
+        if (std::strcmp(names[i], name) == 0)
+            return i;
+    if (names.size() == kMaxProfileStages)
+        KALDI_ERR << "Too many profile stages registered, exceed " << kMaxProfileStages;
+    names.push_back(name);
+    profiler.utt_cost_.resize(names.size());
+    profiler.last_ticks_.resize(names.size(), 0);
+    return names.size() - 1;
+}
+
+ProfileThreadBuffer *Profiler::ThreadBuffer() {
+    // never freed, keep statistics of exited threads
+    static thread_local ProfileThreadBuffer *buffer = NULL;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer = new ProfileThreadBuffer(buffers_.size());
+        buffer->remote_access_fd = OpenRemoteAccessCounter();
+        buffers_.push_back(buffer);
+    }
+    return buffer;
+}
+
+void Profiler::Start(const ProfileOptions &opts) {
+    opts_ = opts;
+    start_time_ = std::chrono::steady_clock::now();
+    start_ticks_ = ReadProfileTicks();
+    last_utt_ticks_ = start_ticks_;
+    last_toplevel_ticks_ = TotalToplevelTicks();
+    for (int32 i = 0; i < last_ticks_.size(); i++)
+        last_ticks_[i] = TotalTicks(i);
+    // current thread is counted from now on
+    ThreadBuffer();
+    ReadPageFaults(&start_minor_faults_, &start_major_faults_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_remote_accesses_ = TotalRemoteAccesses();
+    }
+    tracing_.store(opts.profile_trace != "", std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::Record(ProfileThreadBuffer *buffer, int32 stage, uint64 begin, uint64 end) {
+    ProfileSlot &slot = buffer->slots[stage];
+    RelaxedAdd(&slot.ticks, end - begin);
+    RelaxedAdd(&slot.calls, 1);
+    if (buffer->depth == 0)
+        RelaxedAdd(&buffer->toplevel_ticks, end - begin);
+    if (Tracing()) {
+        std::lock_guard<std::mutex> lock(buffer->trace_mutex);
+        if (buffer->trace.size() < kMaxTraceEventsPerThread)
+            buffer->trace.push_back({stage, begin, end});
+    }
+}
+
+void Profiler::Count(int32 stage, uint64 count) {
+    RelaxedAdd(&ThreadBuffer()->slots[stage].count, count);
+}
+
+uint64 Profiler::TotalTicks(int32 stage) {
+    uint64 ticks = 0;
+    for (ProfileThreadBuffer *buffer: buffers_)
+        ticks += buffer->slots[stage].ticks.load(std::memory_order_relaxed);
+    return ticks;
+}
+
+uint64 Profiler::TotalToplevelTicks() {
+    uint64 ticks = 0;
+    for (ProfileThreadBuffer *buffer: buffers_)
+        ticks += buffer->toplevel_ticks.load(std::memory_order_relaxed);
+    return ticks;
+}
+
+int64 Profiler::TotalRemoteAccesses() {
+    int64 total = 0;
+    bool available = false;
+    for (ProfileThreadBuffer *buffer: buffers_) {
+        int64 value = ReadCounter(buffer->remote_access_fd);
+        if (value >= 0)
+            total += value, available = true;
+    }
+    return available ? total: -1;
+}
+
+double Profiler::TicksPerMs() {
+    double elapsed_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start_time_).count();
+    uint64 elapsed_ticks = ReadProfileTicks() - start_ticks_;
+    return elapsed_ms > 0 ? elapsed_ticks / elapsed_ms: 1.0e6;
+}
+
+void Profiler::EndUtterance() {
+    ProfileThreadBuffer *buffer = ThreadBuffer();
+    std::lock_guard<std::mutex> lock(mutex_);
+    EndUtteranceLocked(buffer);
+}
+
+void Profiler::EndUtteranceLocked(ProfileThreadBuffer *buffer) {
+    double ticks_per_ms = TicksPerMs();
+    for (int32 i = 0; i < stage_names_.size(); i++) {
+        uint64 ticks = TotalTicks(i);
+        if (ticks != last_ticks_[i])
+            utt_cost_[i].push_back((ticks - last_ticks_[i]) / ticks_per_ms);
+        last_ticks_[i] = ticks;
+    }
+    // untracked time only makes sense on main thread, which calls EndUtterance()
+    uint64 now = ReadProfileTicks(), toplevel = buffer->toplevel_ticks.load();
+    BaseFloat wall_ms = (now - last_utt_ticks_) / ticks_per_ms,
+              tracked_ms = (toplevel - last_toplevel_ticks_) / ticks_per_ms;
+    utt_wall_.push_back(wall_ms);
+    utt_untracked_.push_back(std::max(wall_ms - tracked_ms, 0.0f));
+    last_utt_ticks_ = now, last_toplevel_ticks_ = toplevel;
+    num_utts_++;
+}
+
+Profiler::~Profiler() {
+#ifdef __linux__
+    for (ProfileThreadBuffer *buffer: buffers_)
+        if (buffer->remote_access_fd >= 0) close(buffer->remote_access_fd);
+#endif
+}
+
+std::string Profiler::Report() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double ticks_per_ms = TicksPerMs();
+    std::ostringstream oss;
+    oss << "Profile of " << num_utts_ << " utterances, "
+        << (ReadProfileTicks() - start_ticks_) / ticks_per_ms << " ms elapsed\n";
+    oss << std::left << std::setw(24) << "stage" << std::right
+        << std::setw(10) << "calls" << std::setw(14) << "total(ms)"
+        << std::setw(12) << "mean(ms)" << std::setw(14) << "p50/utt(ms)"
+        << std::setw(14) << "p99/utt(ms)" << std::setw(12) << "count" << "\n";
+    oss << std::fixed << std::setprecision(3);
+    for (int32 i = 0; i < stage_names_.size(); i++) {
+        uint64 calls = 0, count = 0, ticks = TotalTicks(i);
+        for (ProfileThreadBuffer *buffer: buffers_) {
+            calls += buffer->slots[i].calls.load(std::memory_order_relaxed);
+            count += buffer->slots[i].count.load(std::memory_order_relaxed);
+        }
+        if (!calls && !count) continue;
+        BaseFloat total_ms = ticks / ticks_per_ms;
+        oss << std::left << std::setw(24) << stage_names_[i] << std::right
+            << std::setw(10) << calls << std::setw(14) << total_ms
+            << std::setw(12) << (calls ? total_ms / calls: 0)
+            << std::setw(14) << Percentile(utt_cost_[i], 0.5)
+            << std::setw(14) << Percentile(utt_cost_[i], 0.99)
+            << std::setw(12) << count << "\n";
+    }
+    if (num_utts_) {
+        oss << std::left << std::setw(24) << "(untracked: io/decode)" << std::right
+            << std::setw(10) << num_utts_ << std::setw(14)
+            << std::accumulate(utt_untracked_.begin(), utt_untracked_.end(), 0.0)
+            << std::setw(12) << "-" << std::setw(14) << Percentile(utt_untracked_, 0.5)
+            << std::setw(14) << Percentile(utt_untracked_, 0.99) << std::setw(12) << "-" << "\n";
+    }
+    int64 minor_faults, major_faults, remote_accesses = TotalRemoteAccesses();
+    ReadPageFaults(&minor_faults, &major_faults);
+    oss << "Page faults: " << minor_faults - start_minor_faults_ << " minor, "
+        << major_faults - start_major_faults_ << " major; remote NUMA node accesses: ";
+    if (remote_accesses >= 0)
+        oss << remote_accesses - start_remote_accesses_ << "\n";
+    else
+        oss << "not available\n";
+    return oss.str();
+}
+
+void Profiler::WriteJson(std::ostream &os) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double ticks_per_ms = TicksPerMs();
+    os << "{\n  \"num_utterances\": " << num_utts_ << ",\n";
+    os << "  \"utterance_p50_ms\": " << Percentile(utt_wall_, 0.5)
+       << ", \"utterance_p99_ms\": " << Percentile(utt_wall_, 0.99) << ",\n";
+    os << "  \"untracked_p50_ms\": " << Percentile(utt_untracked_, 0.5)
+       << ", \"untracked_p99_ms\": " << Percentile(utt_untracked_, 0.99) << ",\n";
+    int64 minor_faults, major_faults, remote_accesses = TotalRemoteAccesses();
+    ReadPageFaults(&minor_faults, &major_faults);
+    os << "  \"page_faults_minor\": " << minor_faults - start_minor_faults_
+       << ", \"page_faults_major\": " << major_faults - start_major_faults_
+       << ", \"remote_node_accesses\": "
+       << (remote_accesses >= 0 ? remote_accesses - start_remote_accesses_: -1) << ",\n";
+    os << "  \"stages\": [";
+    bool first = true;
+    for (int32 i = 0; i < stage_names_.size(); i++) {
+        uint64 calls = 0, count = 0, ticks = TotalTicks(i);
+        for (ProfileThreadBuffer *buffer: buffers_) {
+            calls += buffer->slots[i].calls.load(std::memory_order_relaxed);
+            count += buffer->slots[i].count.load(std::memory_order_relaxed);
+        }
+        if (!calls && !count) continue;
+        BaseFloat total_ms = ticks / ticks_per_ms;
+        os << (first ? "\n": ",\n") << "    {\"name\": \"" << stage_names_[i]
+           << "\", \"calls\": " << calls << ", \"count\": " << count
+           << ", \"total_ms\": " << total_ms << ", \"mean_ms\": " << (calls ? total_ms / calls: 0)
+           << ", \"p50_ms\": " << Percentile(utt_cost_[i], 0.5)
+           << ", \"p99_ms\": " << Percentile(utt_cost_[i], 0.99) << "}";
+        first = false;
+    }
+    os << "\n  ]\n}\n";
+}
+
+void Profiler::WriteTrace(std::ostream &os) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double ticks_per_us = TicksPerMs() / 1000;
+    os << "{\"traceEvents\": [";
+    bool first = true;
+    for (ProfileThreadBuffer *buffer: buffers_) {
+        std::lock_guard<std::mutex> lock(buffer->trace_mutex);
+        for (const ProfileTraceEvent &e: buffer->trace) {
+            // ignore events before Start()
+            if (e.begin < start_ticks_) continue;
+            os << (first ? "\n": ",\n") << "{\"name\": \"" << stage_names_[e.stage]
+               << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << buffer->thread_id
+               << ", \"ts\": " << (e.begin - start_ticks_) / ticks_per_us
+               << ", \"dur\": " << (e.end - e.begin) / ticks_per_us << "}";
+            first = false;
+        }
+    }
+    os << "\n]}\n";
+}
+
+void Profiler::Finish() {
+    enabled_.store(false, std::memory_order_relaxed);
+    ProfileThreadBuffer *buffer = ThreadBuffer();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // tools which do not call EndUtterance() are treated as one utterance
+        if (!num_utts_)
+            EndUtteranceLocked(buffer);
+    }
+    if (opts_.profile)
+        KALDI_LOG << Report();
+    if (opts_.profile_json != "") {
+        Output ko(opts_.profile_json, false);
+        WriteJson(ko.Stream());
+    }
+    if (opts_.profile_trace != "") {
+        Output ko(opts_.profile_trace, false);
+        WriteTrace(ko.Stream());
+    }
+}
+
+}
@@ -0,0 +1,249 @@
+// include/setk-profile.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SETK_PROFILE_H
+#define SETK_PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "include/setk-allocator.h"
+
+namespace kaldi {
+
+const int32 kMaxProfileStages = 128;
+const int32 kMaxTraceEventsPerThread = 1 << 20;
+
+// Ticks of time stamp counter, falls back to nanoseconds of steady clock on
+// non-x86 machines. Converted into milliseconds when reporting
+inline uint64 ReadProfileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct ProfileOptions {
+    bool profile;
+    std::string profile_json, profile_trace;
+
+    ProfileOptions(): profile(false), profile_json(""), profile_trace("") {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("profile", &profile, "If true, print time cost of each stage at exit");
+        opts->Register("profile-json", &profile_json, "If not empty, write time cost of each stage in JSON");
+        opts->Register("profile-trace", &profile_trace, "If not empty, write chrome trace events(see chrome://tracing) "
+                        "of each stage for timeline inspection");
+    }
+
+    bool Enabled() const {
+        return profile || profile_json != "" || profile_trace != "";
+    }
+};
+
+// Accumulators of each stage, only written by its owner thread, so relaxed
+// load & store is enough and cheap
+struct ProfileSlot {
+    std::atomic<uint64> ticks, calls, count;
+    ProfileSlot(): ticks(0), calls(0), count(0) {}
+};
+
+struct ProfileTraceEvent {
+    int32 stage;
+    uint64 begin, end;
+};
+
+struct ProfileThreadBuffer {
+    int32 thread_id, depth;
+    // perf event counting remote NUMA node accesses of this thread, -1 if
+    // not available
+    int32 remote_access_fd;
+    // ticks spent in outermost stages
+    std::atomic<uint64> toplevel_ticks;
+    ProfileSlot slots[kMaxProfileStages];
+
+    std::mutex trace_mutex;
+    std::vector<ProfileTraceEvent> trace;
+
+    ProfileThreadBuffer(int32 id): thread_id(id), depth(0), remote_access_fd(-1), toplevel_ticks(0) {}
+};
+
+// Process-wide profiler. Stages are named by static strings and registered
+// once, then each thread accumulates into its own buffer. Statistics of each
+// utterance are collected by EndUtterance(), which tools call after each one.
+class Profiler {
+public:
+    static Profiler &Get() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    static bool Tracing() { return tracing_.load(std::memory_order_relaxed); }
+
+    // Returns id of stage, same name shares same id
+    static int32 RegisterStage(const char *name);
+
+    void Start(const ProfileOptions &opts);
+
+    // Collect cost of each stage since last call as one utterance
+    void EndUtterance();
+
+    // Report in log, JSON file or trace file, depending on options passed to Start()
+    void Finish();
+
+    void Record(ProfileThreadBuffer *buffer, int32 stage, uint64 begin, uint64 end);
+
+    void Count(int32 stage, uint64 count);
+
+    // Report(), WriteJson() and WriteTrace() hold mutex_ themselves
+    std::string Report();
+
+    void WriteJson(std::ostream &os);
+
+    void WriteTrace(std::ostream &os);
+
+    ProfileThreadBuffer *ThreadBuffer();
+
+private:
+    Profiler(): num_utts_(0), start_ticks_(0), last_utt_ticks_(0), last_toplevel_ticks_(0),
+                start_minor_faults_(0), start_major_faults_(0), start_remote_accesses_(0) {}
+
+    // close counters opened by ThreadBuffer(), buffers are kept for threads still alive
+    ~Profiler();
+
+    static std::atomic<bool> enabled_, tracing_;
+
+    ProfileOptions opts_;
+
+    std::mutex mutex_;
+    std::vector<const char*> stage_names_;
+    std::vector<ProfileThreadBuffer*> buffers_;
+
+    // per-utterance cost(in ms) of each stage
+    std::vector<std::vector<BaseFloat> > utt_cost_;
+    // total ticks of each stage at last EndUtterance()
+    std::vector<uint64> last_ticks_;
+    // wall time of each utterance and time not covered by any stage(egs. io & decoding)
+    std::vector<BaseFloat> utt_wall_, utt_untracked_;
+    int32 num_utts_;
+
+    uint64 start_ticks_, last_utt_ticks_, last_toplevel_ticks_;
+    std::chrono::steady_clock::time_point start_time_;
+    // page faults of process & remote accesses of profiled threads at Start()
+    int64 start_minor_faults_, start_major_faults_, start_remote_accesses_;
+
+    double TicksPerMs();
+
+    // mutex_ must be held
+    void EndUtteranceLocked(ProfileThreadBuffer *buffer);
+
+    uint64 TotalTicks(int32 stage);
+
+    uint64 TotalToplevelTicks();
+
+    // -1 if not available, mutex_ must be held
+    int64 TotalRemoteAccesses();
+};
+
+class ScopedProfile {
+public:
+    explicit ScopedProfile(int32 stage): stage_(stage), begin_(0), buffer_(NULL) {
+        if (Profiler::Enabled()) {
+            buffer_ = Profiler::Get().ThreadBuffer();
+            buffer_->depth++;
+            begin_ = ReadProfileTicks();
+        }
+    }
+
+    ~ScopedProfile() {
+        if (buffer_) {
+            uint64 end = ReadProfileTicks();
+            buffer_->depth--;
+            Profiler::Get().Record(buffer_, stage_, begin_, end);
+        }
+    }
+
+private:
+    int32 stage_;
+    uint64 begin_;
+    ProfileThreadBuffer *buffer_;
+};
+
+// Start profiling if enabled by options, and report at the end of scope
+class ProfileSession {
+public:
+    explicit ProfileSession(const ProfileOptions &opts): enabled_(opts.Enabled()) {
+        if (enabled_)
+            Profiler::Get().Start(opts);
+    }
+
+    void EndUtterance() {
+        if (enabled_)
+            Profiler::Get().EndUtterance();
+        // drop scratch blocks left by utterances of different shape
+        ResetScratchPool();
+    }
+
+    ~ProfileSession() {
+        if (enabled_)
+            Profiler::Get().Finish();
+    }
+
+private:
+    bool enabled_;
+};
+
+}
+
+#define SETK_PROFILE_CONCAT_IMPL(a, b) a##b
+#define SETK_PROFILE_CONCAT(a, b) SETK_PROFILE_CONCAT_IMPL(a, b)
+
+#ifndef SETK_DISABLE_PROFILE
+// Time cost of current scope is accumulated into stage "name"
+#define SETK_PROFILE(name) \
+    static const kaldi::int32 SETK_PROFILE_CONCAT(setk_stage_, __LINE__) = \
+        kaldi::Profiler::RegisterStage(name); \
+    kaldi::ScopedProfile SETK_PROFILE_CONCAT(setk_scope_, __LINE__)( \
+        SETK_PROFILE_CONCAT(setk_stage_, __LINE__))
+// Count items(frames, samples...) processed in stage "name"
+#define SETK_PROFILE_COUNT(name, n) \
+    do { \
+        static const kaldi::int32 setk_stage = kaldi::Profiler::RegisterStage(name); \
+        if (kaldi::Profiler::Enabled()) \
+            kaldi::Profiler::Get().Count(setk_stage, n); \
+    } while (0)
+#else
+#define SETK_PROFILE(name)
+#define SETK_PROFILE_COUNT(name, n)
+#endif
+
+#endif
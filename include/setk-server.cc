@@ -0,0 +1,454 @@
+// include/setk-server.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "include/setk-server.h"
+
+namespace kaldi {
+
+static bool WriteAll(int32 fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t ret = write(fd, data, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        data += ret, size -= ret;
+    }
+    return true;
+}
+
+static bool ReadAll(int32 fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t ret = read(fd, data, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        data += ret, size -= ret;
+    }
+    return true;
+}
+
+bool WriteSetkFrame(int32 fd, uint32 type, const std::string &payload) {
+    if (payload.size() >= kSetkMaxFrameLength) {
+        KALDI_WARN << "Refuse to send frame of " << payload.size() << " bytes";
+        return false;
+    }
+    uint32 header[3] = {kSetkFrameMagic, type, static_cast<uint32>(payload.size())};
+    if (!WriteAll(fd, reinterpret_cast<const char*>(header), sizeof(header)))
+        return false;
+    return WriteAll(fd, payload.data(), payload.size());
+}
+
+bool ReadSetkFrame(int32 fd, uint32 *type, std::string *payload, uint32 max_length) {
+    uint32 header[3];
+    if (!ReadAll(fd, reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+    if (header[0] != kSetkFrameMagic) {
+        KALDI_WARN << "Bad magic number in frame header: " << header[0];
+        return false;
+    }
+    if (header[2] >= std::min(max_length, kSetkMaxFrameLength)) {
+        KALDI_WARN << "Frame too large: " << header[2] << " bytes";
+        return false;
+    }
+    *type = header[1];
+    // grow with bytes received, never trust the length in header for allocation
+    payload->clear();
+    const size_t chunk = 1 << 20;
+    for (size_t done = 0; done < header[2]; ) {
+        size_t size = std::min<size_t>(chunk, header[2] - done);
+        payload->resize(done + size);
+        if (!ReadAll(fd, &(*payload)[done], size))
+            return false;
+        done += size;
+    }
+    return true;
+}
+
+static void SetkSocketAddress(const std::string &socket_path, struct sockaddr_un *addr) {
+    if (socket_path.size() >= sizeof(addr->sun_path))
+        KALDI_ERR << "Socket path too long: " << socket_path;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, socket_path.c_str(), sizeof(addr->sun_path) - 1);
+}
+
+int32 ListenSetkSocket(const std::string &socket_path, int32 max_pending) {
+    struct sockaddr_un addr;
+    SetkSocketAddress(socket_path, &addr);
+    int32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        KALDI_ERR << "Create socket failed: " << strerror(errno);
+    unlink(socket_path.c_str());
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+        KALDI_ERR << "Bind " << socket_path << " failed: " << strerror(errno);
+    if (listen(fd, max_pending) < 0)
+        KALDI_ERR << "Listen on " << socket_path << " failed: " << strerror(errno);
+    return fd;
+}
+
+int32 ConnectSetkSocket(const std::string &socket_path) {
+    struct sockaddr_un addr;
+    SetkSocketAddress(socket_path, &addr);
+    int32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        KALDI_ERR << "Create socket failed: " << strerror(errno);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+        KALDI_ERR << "Connect to " << socket_path << " failed: " << strerror(errno);
+    return fd;
+}
+
+void SetkRequestTiming::Write(std::ostream &os) const {
+    BaseFloat stats[4] = {queue_ms, decode_ms, compute_ms, encode_ms};
+    os.write(reinterpret_cast<const char*>(stats), sizeof(stats));
+}
+
+void SetkRequestTiming::Read(std::istream &is) {
+    BaseFloat stats[4];
+    is.read(reinterpret_cast<char*>(stats), sizeof(stats));
+    if (is.fail())
+        KALDI_ERR << "Failed to read request timing from stream";
+    queue_ms = stats[0], decode_ms = stats[1], compute_ms = stats[2], encode_ms = stats[3];
+}
+
+std::string SetkRequestTiming::Report() const {
+    std::ostringstream oss;
+    oss << "queue " << queue_ms << " ms, decode " << decode_ms << " ms, compute "
+        << compute_ms << " ms, encode " << encode_ms << " ms";
+    return oss.str();
+}
+
+
+SetkEngines::SetkEngines(const ShortTimeFTOptions &stft_opts,
+                         const SrpPhatOptions *srp_opts, BaseFloat srp_freq): srp_computor(NULL) {
+    ShortTimeFTOptions opts(stft_opts);
+    stft_computer = new ShortTimeFTComputer(opts);
+    if (srp_opts)
+        srp_computor = new SrpPhatComputor(*srp_opts, srp_freq, opts.PaddingLength() / 2 + 1);
+}
+
+
+SetkServer::SetkServer(const SetkServerOptions &opts,
+                       const ShortTimeFTOptions &stft_opts,
+                       const SrpPhatOptions *srp_opts):
+        opts_(opts), stft_opts_(stft_opts), listen_fd_(-1), stop_(false),
+        num_requests_(0), num_errors_(0), total_compute_ms_(0) {
+    wake_fds_[0] = wake_fds_[1] = -1;
+    KALDI_ASSERT(opts_.num_workers >= 1 && opts_.max_request_bytes > 0);
+    if (opts_.beam_weights != "")
+        ReadKaldiObject(opts_.beam_weights, &beam_weights_);
+    // setup costs(window, fft tables, idtft coefficients) are paid once here
+    for (int32 i = 0; i < opts_.num_workers; i++)
+        engines_.push_back(new SetkEngines(stft_opts_, srp_opts, opts_.srp_samp_frequency));
+}
+
+SetkServer::~SetkServer() {
+    Stop();
+    {
+        // unblock workers stuck on a client which sends partial frames
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (std::set<int32>::iterator it = clients_.begin(); it != clients_.end(); ++it)
+            shutdown(*it, SHUT_RDWR);
+    }
+    for (int32 i = 0; i < workers_.size(); i++)
+        if (workers_[i].joinable()) workers_[i].join();
+    for (int32 i = 0; i < engines_.size(); i++)
+        delete engines_[i];
+    while (!pending_.empty()) {
+        delete pending_.front().second;
+        pending_.pop();
+    }
+    for (std::set<int32>::iterator it = clients_.begin(); it != clients_.end(); ++it)
+        close(*it);
+    for (int32 i = 0; i < 2; i++)
+        if (wake_fds_[i] >= 0) close(wake_fds_[i]);
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        unlink(opts_.socket_path.c_str());
+    }
+}
+
+void SetkServer::Serve() {
+    listen_fd_ = ListenSetkSocket(opts_.socket_path, opts_.max_pending);
+    if (pipe(wake_fds_) < 0)
+        KALDI_ERR << "Create pipe failed: " << strerror(errno);
+    // workers never block on waking up the poller, a full pipe wakes it anyway
+    fcntl(wake_fds_[0], F_SETFL, fcntl(wake_fds_[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fds_[1], F_SETFL, fcntl(wake_fds_[1], F_GETFL) | O_NONBLOCK);
+
+    for (int32 i = 0; i < opts_.num_workers; i++)
+        workers_.push_back(std::thread(&SetkServer::WorkerLoop, this, i));
+    KALDI_LOG << "Serving on " << opts_.socket_path << " with " << opts_.num_workers << " workers";
+
+    // Poll the listening socket and idle connections here, and dispatch one request
+    // at a time to workers, so idle clients never occupy a worker
+    std::vector<struct pollfd> fds;
+    while (true) {
+        fds.resize(2);
+        fds[0].fd = listen_fd_, fds[0].events = POLLIN, fds[0].revents = 0;
+        fds[1].fd = wake_fds_[0], fds[1].events = POLLIN, fds[1].revents = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stop_)
+                break;
+            for (int32 i = 0; i < idle_.size(); i++) {
+                struct pollfd idle_fd = {idle_[i], POLLIN, 0};
+                fds.push_back(idle_fd);
+            }
+        }
+        if (poll(&fds[0], fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            KALDI_WARN << "Poll failed: " << strerror(errno);
+            break;
+        }
+        if (fds[1].revents) {
+            char buf[64];
+            while (read(wake_fds_[0], buf, sizeof(buf)) > 0);
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stop_)
+            break;
+        // readable or hang up, workers handle both
+        for (int32 i = 2; i < fds.size(); i++) {
+            if (!fds[i].revents)
+                continue;
+            idle_.erase(std::find(idle_.begin(), idle_.end(), fds[i].fd));
+            pending_.push(std::make_pair(fds[i].fd, new Timer()));
+            cond_.notify_one();
+        }
+        if (fds[0].revents) {
+            int32 fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+                    continue;
+                // Stop() shutdown the listening socket
+                break;
+            }
+            // a stalled client could not hold a worker forever
+            struct timeval timeout;
+            timeout.tv_sec = opts_.recv_timeout, timeout.tv_usec = 0;
+            if (opts_.recv_timeout > 0 &&
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+                KALDI_WARN << "Set receive timeout failed: " << strerror(errno);
+            // handed to workers once the first request is readable
+            clients_.insert(fd);
+            idle_.push_back(fd);
+        }
+    }
+}
+
+void SetkServer::Stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stop_)
+            return;
+        stop_ = true;
+        cond_.notify_all();
+    }
+    Interrupt();
+}
+
+void SetkServer::Interrupt() {
+    if (listen_fd_ >= 0)
+        shutdown(listen_fd_, SHUT_RDWR);
+}
+
+void SetkServer::WorkerLoop(int32 worker_id) {
+    SetkEngines *engines = engines_[worker_id];
+    while (true) {
+        std::pair<int32, Timer*> conn;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_ && pending_.empty())
+                cond_.wait(lock);
+            if (stop_ && pending_.empty())
+                return;
+            conn = pending_.front();
+            pending_.pop();
+        }
+        KALDI_VLOG(2) << "Worker " << worker_id << " serves connection " << conn.first;
+        bool keep = ServeRequest(conn.first, conn.second, engines);
+        delete conn.second;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (keep && !stop_) {
+            // hand back to the poller, waiting for next request
+            idle_.push_back(conn.first);
+            char c = 0;
+            if (write(wake_fds_[1], &c, 1) < 0 && errno != EAGAIN)
+                KALDI_WARN << "Wake up poller failed: " << strerror(errno);
+        } else {
+            clients_.erase(conn.first);
+            close(conn.first);
+        }
+    }
+}
+
+bool SetkServer::ServeRequest(int32 fd, Timer *ready_timer, SetkEngines *engines) {
+    uint32 type;
+    std::string request;
+    if (!ReadSetkFrame(fd, &type, &request, opts_.max_request_bytes))
+        return false;
+    SetkRequestTiming timing;
+    timing.queue_ms = ready_timer->Elapsed() * 1000;
+
+    std::string payload;
+    bool success = true;
+    try {
+        Process(type, request, engines, &timing, &payload);
+    } catch (const std::exception &e) {
+        payload = e.what();
+        success = false;
+    }
+    std::ostringstream oss;
+    timing.Write(oss);
+    if (success && oss.str().size() + payload.size() >= kSetkMaxFrameLength) {
+        payload = "Response too large: " + std::to_string(payload.size()) + " bytes";
+        success = false;
+    }
+    oss << payload;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        num_requests_++;
+        if (!success) num_errors_++;
+        total_compute_ms_ += timing.compute_ms;
+    }
+    KALDI_VLOG(1) << "Request type " << type << ": " << timing.Report();
+    return WriteSetkFrame(fd, success ? kResponseOk: kResponseError, oss.str());
+}
+
+void SetkServer::Process(uint32 type, const std::string &request,
+                         SetkEngines *engines, SetkRequestTiming *timing,
+                         std::string *response) {
+    Timer timer;
+    WaveData wave;
+    {
+        std::istringstream iss(request);
+        wave.Read(iss);
+    }
+    timing->decode_ms = timer.Elapsed() * 1000;
+    timer.Reset();
+
+    const Matrix<BaseFloat> &samples = wave.Data();
+    std::ostringstream oss;
+    switch (type) {
+        case kRequestSpectrogram: {
+            Matrix<BaseFloat> spectra;
+            engines->stft_computer->Compute(samples, NULL, &spectra, NULL);
+            timing->compute_ms = timer.Elapsed() * 1000;
+            timer.Reset();
+            spectra.Write(oss, true);
+            break;
+        }
+        case kRequestFixedBeamform: {
+            if (beam_weights_.NumRows() == 0)
+                KALDI_ERR << "Fixed beamformer is not configured, see --beam-weights";
+            int32 num_bins = beam_weights_.NumRows(), num_chs = beam_weights_.NumCols();
+            if (samples.NumRows() != num_chs)
+                KALDI_ERR << "Beam weights designed for " << num_chs << " channels, but request has "
+                          << samples.NumRows() << " channels";
+            Matrix<BaseFloat> rstft, enh_rstft, enhan_speech;
+            engines->stft_computer->Compute(samples, &rstft, NULL, NULL);
+            if (rstft.NumCols() != (num_bins - 1) * 2)
+                KALDI_ERR << "Beam weights designed for " << num_bins << " bins, but stft has "
+                          << rstft.NumCols() / 2 + 1 << " bins";
+            CMatrix<BaseFloat> cstft(rstft.NumRows(), num_bins), src_stft, enh_cstft;
+            cstft.CopyFromRealfft(rstft);
+            TrimStft(num_bins, num_chs, cstft, &src_stft);
+            Beamform(src_stft, beam_weights_, &enh_cstft);
+            CastIntoRealfft(enh_cstft, &enh_rstft);
+            BaseFloat range = 0;
+            for (int32 c = 0; c < num_chs; c++)
+                range += samples.RowRange(c, 1).LargestAbsElem();
+            engines->stft_computer->InverseShortTimeFT(enh_rstft, &enhan_speech, range / num_chs - 1);
+            timing->compute_ms = timer.Elapsed() * 1000;
+            timer.Reset();
+            WaveData enhan_wave(wave.SampFreq(), enhan_speech);
+            enhan_wave.Write(oss);
+            break;
+        }
+        case kRequestSrpPhat: {
+            if (!engines->srp_computor)
+                KALDI_ERR << "SRP-PHAT engine is not configured, see --topo-descriptor";
+            if (samples.NumRows() != engines->srp_computor->NumChannels())
+                KALDI_ERR << "SRP-PHAT configured for " << engines->srp_computor->NumChannels()
+                          << " channels, but request has " << samples.NumRows() << " channels";
+            Matrix<BaseFloat> rstft, srp_phat;
+            engines->stft_computer->Compute(samples, &rstft, NULL, NULL);
+            CMatrix<BaseFloat> cstft(rstft.NumRows(), rstft.NumCols() / 2 + 1);
+            cstft.CopyFromRealfft(rstft);
+            engines->srp_computor->Compute(cstft, &srp_phat);
+            timing->compute_ms = timer.Elapsed() * 1000;
+            timer.Reset();
+            srp_phat.Write(oss, true);
+            break;
+        }
+        default:
+            KALDI_ERR << "Unknown request type: " << type;
+    }
+    *response = oss.str();
+    timing->encode_ms = timer.Elapsed() * 1000;
+}
+
+std::string SetkServer::Report() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::ostringstream oss;
+    oss << "Served " << num_requests_ << " requests, " << num_errors_ << " failed, average compute time "
+        << (num_requests_ ? total_compute_ms_ / num_requests_: 0) << " ms";
+    return oss.str();
+}
+
+
+SetkClient::SetkClient(const std::string &socket_path) {
+    fd_ = ConnectSetkSocket(socket_path);
+}
+
+SetkClient::~SetkClient() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool SetkClient::Request(uint32 type, const WaveData &wave,
+                         std::string *response, SetkRequestTiming *timing) {
+    std::ostringstream oss;
+    wave.Write(oss);
+    if (!WriteSetkFrame(fd_, type, oss.str()))
+        KALDI_ERR << "Failed to send request to server";
+    uint32 status;
+    std::string payload;
+    if (!ReadSetkFrame(fd_, &status, &payload))
+        KALDI_ERR << "Failed to receive response from server";
+    std::istringstream iss(payload);
+    timing->Read(iss);
+    response->assign(payload, iss.tellg(), std::string::npos);
+    return status == kResponseOk;
+}
+
+}
@@ -0,0 +1,191 @@
+// include/setk-server.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SETK_SERVER_H
+#define SETK_SERVER_H
+
+#include <queue>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/srp-phat.h"
+
+namespace kaldi {
+
+// Framed protocol used between setk-server and its clients, over a unix domain socket.
+// Each message is: [magic(4) | type(4) | length(4) | payload(length)], little endian.
+// Request payload is a wave file(RIFF bytes, as WaveData::Write() does), response
+// payload is a wave file or a kaldi binary matrix, depending on the request type.
+const uint32 kSetkFrameMagic = 0x4b544553;    // "SETK"
+const uint32 kSetkMaxFrameLength = 1 << 30;
+
+typedef enum {
+    kRequestSpectrogram = 1,    // wave in, (power/log) spectrogram of each channel out
+    kRequestFixedBeamform = 2,  // wave in, enhanced wave out
+    kRequestSrpPhat = 3,        // wave in, angular spectrum out
+    kRequestFetchKey = 10,      // worker id in, next key of setk-coordinator out
+    kRequestSkipKey = 11,       // same as kRequestFetchKey, but last key is skipped(not done)
+    kResponseOk = 100,
+    kResponseError = 101,
+    kResponseNoMoreKeys = 102
+} SetkMessageType;
+
+// Timing of each request, returned ahead of payload in each response
+struct SetkRequestTiming {
+    BaseFloat queue_ms, decode_ms, compute_ms, encode_ms;
+    SetkRequestTiming(): queue_ms(0), decode_ms(0), compute_ms(0), encode_ms(0) {}
+
+    void Write(std::ostream &os) const;
+    void Read(std::istream &is);
+    std::string Report() const;
+};
+
+// write/read a complete frame, return false on EOF, broken socket or oversized payload
+bool WriteSetkFrame(int32 fd, uint32 type, const std::string &payload);
+// payload of a frame no shorter than max_length is refused
+bool ReadSetkFrame(int32 fd, uint32 *type, std::string *payload,
+                   uint32 max_length = kSetkMaxFrameLength);
+
+// bind & listen on(or connect to) a unix domain socket, return the fd
+int32 ListenSetkSocket(const std::string &socket_path, int32 max_pending);
+int32 ConnectSetkSocket(const std::string &socket_path);
+
+struct SetkServerOptions {
+    std::string socket_path;
+    int32 num_workers;
+    int32 max_pending;
+    std::string beam_weights;
+    BaseFloat srp_samp_frequency;
+    int32 max_request_bytes;
+    int32 recv_timeout;
+
+    SetkServerOptions(): socket_path("/tmp/setk.sock"), num_workers(4),
+        max_pending(64), beam_weights(""), srp_samp_frequency(16000),
+        max_request_bytes(1 << 26), recv_timeout(10) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("socket", &socket_path, "Path of unix domain socket to listen on");
+        opts->Register("num-workers", &num_workers, "Number of worker threads, each one holds its own engines");
+        opts->Register("max-pending", &max_pending, "Maximum number of pending connections");
+        opts->Register("beam-weights", &beam_weights, "Complex weights(in kaldi format) for fixed beamformer requests, "
+                                                        "if empty, refuse beamforming requests");
+        opts->Register("srp-samp-frequency", &srp_samp_frequency, "Sample frequency used by srp-phat engine");
+        opts->Register("max-request-bytes", &max_request_bytes, "Requests no smaller than it are refused "
+                       "(connection is closed)");
+        opts->Register("recv-timeout", &recv_timeout, "Seconds to wait for rest of a request before closing "
+                       "the connection, 0 to wait forever");
+    }
+};
+
+// Pre-initialized engines, owned by each worker, cause ShortTimeFTComputer and
+// SrpPhatComputor keep internal caches and are not thread safe
+struct SetkEngines {
+    ShortTimeFTComputer *stft_computer;
+    SrpPhatComputor *srp_computor;
+
+    SetkEngines(const ShortTimeFTOptions &stft_opts,
+                const SrpPhatOptions *srp_opts, BaseFloat srp_freq);
+
+    ~SetkEngines() {
+        delete stft_computer;
+        if (srp_computor) delete srp_computor;
+    }
+};
+
+class SetkServer {
+public:
+    SetkServer(const SetkServerOptions &opts,
+               const ShortTimeFTOptions &stft_opts,
+               const SrpPhatOptions *srp_opts);
+
+    ~SetkServer();
+
+    // Bind socket and block on serving, until Stop() or Interrupt() called
+    void Serve();
+
+    // Stop workers after pending requests are served
+    void Stop();
+
+    // Only shutdown listening socket, async-signal-safe, used in signal handlers
+    void Interrupt();
+
+    std::string Report();
+
+private:
+    SetkServerOptions opts_;
+    ShortTimeFTOptions stft_opts_;
+
+    // shared by all workers, read only
+    CMatrix<BaseFloat> beam_weights_;
+
+    std::vector<SetkEngines*> engines_;
+    std::vector<std::thread> workers_;
+
+    // connections with a request ready to serve, with time it became readable
+    std::queue<std::pair<int32, Timer*> > pending_;
+    // connections waiting for next request, polled in Serve()
+    std::vector<int32> idle_;
+    // all open client connections, shutdown on destruction
+    std::set<int32> clients_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    int32 listen_fd_;
+    // self-pipe, workers wake up poller when handing back idle connections
+    int32 wake_fds_[2];
+    bool stop_;
+
+    int64 num_requests_, num_errors_;
+    double total_compute_ms_;
+
+    void WorkerLoop(int32 worker_id);
+
+    // serve one request on fd, return false if connection should be closed
+    bool ServeRequest(int32 fd, Timer *ready_timer, SetkEngines *engines);
+
+    // process payload of one request, return payload of response
+    void Process(uint32 type, const std::string &request,
+                 SetkEngines *engines, SetkRequestTiming *timing,
+                 std::string *response);
+};
+
+// Client side, used by setk-client
+class SetkClient {
+public:
+    SetkClient(const std::string &socket_path);
+
+    ~SetkClient();
+
+    // send one request and wait for response, returns false if server reports an error
+    bool Request(uint32 type, const WaveData &wave,
+                 std::string *response, SetkRequestTiming *timing);
+
+private:
+    int32 fd_;
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+// include/setk-simd.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cfloat>
+#include <string>
+
+#include "include/setk-simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SETK_SIMD_X86 1
+#endif
+
+// Each kernel is written once as an always-inline body, in plain loops which
+// compiler vectorizes, and instantiated in functions with different target
+// attributes, so one binary carries all variants without global -m flags.
+#define SETK_KERNEL_INLINE inline __attribute__((always_inline))
+
+namespace kaldi {
+
+static SETK_KERNEL_INLINE void ComplexMulImpl(BaseFloat * __restrict a, const BaseFloat * __restrict b,
+                                              int32 n, bool conj) {
+    BaseFloat sign = conj ? -1: 1;
+    for (int32 i = 0; i < n; i++) {
+        BaseFloat ar = a[2 * i], ai = a[2 * i + 1], br = b[2 * i], bi = sign * b[2 * i + 1];
+        a[2 * i] = ar * br - ai * bi;
+        a[2 * i + 1] = ar * bi + ai * br;
+    }
+}
+
+static SETK_KERNEL_INLINE void GccPhatImpl(const BaseFloat * __restrict l, const BaseFloat * __restrict r,
+                                           BaseFloat * __restrict c, int32 n) {
+    for (int32 i = 0; i < n; i++) {
+        BaseFloat lr = l[2 * i], li = l[2 * i + 1], rr = r[2 * i], ri = r[2 * i + 1];
+        // same as DivElements(..., true), which adds FLT_EPSILON on each abs
+        BaseFloat norm = (std::sqrt(lr * lr + li * li) + FLT_EPSILON) *
+                         (std::sqrt(rr * rr + ri * ri) + FLT_EPSILON);
+        c[2 * i] = (lr * rr + li * ri) / norm;
+        c[2 * i + 1] = (li * rr - lr * ri) / norm;
+    }
+}
+
+static SETK_KERNEL_INLINE void WindowFrameImpl(const BaseFloat * __restrict src, const BaseFloat * __restrict window,
+                                               BaseFloat * __restrict dst, int32 n) {
+    for (int32 i = 0; i < n; i++)
+        dst[i] = src[i] * window[i];
+}
+
+static SETK_KERNEL_INLINE void WindowAddImpl(const BaseFloat * __restrict frame, const BaseFloat * __restrict window,
+                                             BaseFloat scale, BaseFloat * __restrict dst, int32 n) {
+    for (int32 i = 0; i < n; i++)
+        dst[i] += scale * frame[i] * window[i];
+}
+
+static SETK_KERNEL_INLINE void PowerSpectrumImpl(const BaseFloat * __restrict realfft,
+                                                 BaseFloat * __restrict power, int32 num_bins) {
+    power[0] = realfft[0] * realfft[0];
+    power[num_bins - 1] = realfft[1] * realfft[1];
+    for (int32 f = 1; f < num_bins - 1; f++)
+        power[f] = realfft[2 * f] * realfft[2 * f] + realfft[2 * f + 1] * realfft[2 * f + 1];
+}
+
+// Branchless version of ApproxAtan2() in stft.h
+static SETK_KERNEL_INLINE BaseFloat Atan2Impl(BaseFloat y, BaseFloat x) {
+    BaseFloat ax = std::abs(x), ay = std::abs(y);
+    BaseFloat mx = std::max(ax, ay), mn = std::min(ax, ay);
+    BaseFloat z = mn / (mx + FLT_MIN), z2 = z * z;
+    BaseFloat a = z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f +
+                  z2 * (-0.0851330f + z2 * 0.0208351f))));
+    a = ay > ax ? static_cast<BaseFloat>(M_PI / 2) - a: a;
+    a = x < 0 ? static_cast<BaseFloat>(M_PI) - a: a;
+    return y < 0 ? -a: a;
+}
+
+static SETK_KERNEL_INLINE void ApproxPhaseImpl(const BaseFloat * __restrict realfft,
+                                               BaseFloat * __restrict angle, int32 num_bins) {
+    angle[0] = realfft[0] < 0 ? M_PI: 0;
+    angle[num_bins - 1] = realfft[1] < 0 ? M_PI: 0;
+    for (int32 f = 1; f < num_bins - 1; f++)
+        angle[f] = Atan2Impl(realfft[2 * f + 1], realfft[2 * f]);
+}
+
+static SETK_KERNEL_INLINE void AxpyImpl(BaseFloat alpha, const BaseFloat * __restrict x,
+                                        BaseFloat * __restrict y, int32 n) {
+    for (int32 i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+// partial sums in 8 lanes, otherwise reduction won't be vectorized without -ffast-math
+static SETK_KERNEL_INLINE void MultiDotImpl(const BaseFloat * __restrict h, const BaseFloat * __restrict x,
+                                            int32 stride, int32 num_channels, int32 n,
+                                            BaseFloat * __restrict y) {
+    for (int32 c = 0; c < num_channels; c++) {
+        const BaseFloat *xc = x + static_cast<int64>(c) * stride;
+        BaseFloat acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        int32 i = 0;
+        for (; i + 8 <= n; i += 8)
+            for (int32 k = 0; k < 8; k++)
+                acc[k] += h[i + k] * xc[i + k];
+        BaseFloat sum = ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+        for (; i < n; i++)
+            sum += h[i] * xc[i];
+        y[c] = sum;
+    }
+}
+
+#define SETK_DEFINE_SIMD_KERNELS(suffix, attr) \
+    static attr void ComplexMul_##suffix(BaseFloat *a, const BaseFloat *b, int32 n, bool conj) { \
+        ComplexMulImpl(a, b, n, conj); } \
+    static attr void GccPhat_##suffix(const BaseFloat *l, const BaseFloat *r, BaseFloat *c, int32 n) { \
+        GccPhatImpl(l, r, c, n); } \
+    static attr void WindowFrame_##suffix(const BaseFloat *src, const BaseFloat *window, \
+                                          BaseFloat *dst, int32 n) { \
+        WindowFrameImpl(src, window, dst, n); } \
+    static attr void WindowAdd_##suffix(const BaseFloat *frame, const BaseFloat *window, \
+                                        BaseFloat scale, BaseFloat *dst, int32 n) { \
+        WindowAddImpl(frame, window, scale, dst, n); } \
+    static attr void PowerSpectrum_##suffix(const BaseFloat *realfft, BaseFloat *power, int32 num_bins) { \
+        PowerSpectrumImpl(realfft, power, num_bins); } \
+    static attr void ApproxPhase_##suffix(const BaseFloat *realfft, BaseFloat *angle, int32 num_bins) { \
+        ApproxPhaseImpl(realfft, angle, num_bins); } \
+    static attr void Axpy_##suffix(BaseFloat alpha, const BaseFloat *x, BaseFloat *y, int32 n) { \
+        AxpyImpl(alpha, x, y, n); } \
+    static attr void MultiDot_##suffix(const BaseFloat *h, const BaseFloat *x, int32 stride, \
+                                       int32 num_channels, int32 n, BaseFloat *y) { \
+        MultiDotImpl(h, x, stride, num_channels, n, y); } \
+    static const SimdKernels kSimdKernels_##suffix = { \
+        #suffix, ComplexMul_##suffix, GccPhat_##suffix, WindowFrame_##suffix, WindowAdd_##suffix, \
+        PowerSpectrum_##suffix, ApproxPhase_##suffix, Axpy_##suffix, MultiDot_##suffix \
+    };
+
+SETK_DEFINE_SIMD_KERNELS(baseline, )
+#ifdef SETK_SIMD_X86
+SETK_DEFINE_SIMD_KERNELS(sse42, __attribute__((target("sse4.2"))))
+SETK_DEFINE_SIMD_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+SETK_DEFINE_SIMD_KERNELS(avx512, __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl,avx2,fma"))))
+#endif
+
+const char *SimdLevelName(SimdLevel level) {
+    static const char *names[kNumSimdLevels] = {"baseline", "sse4.2", "avx2", "avx512"};
+    return names[level];
+}
+
+SimdLevel DetectSimdLevel() {
+#ifdef SETK_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return kSimdAvx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return kSimdAvx2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return kSimdSse42;
+#endif
+    return kSimdBaseline;
+}
+
+static SimdLevel ChooseSimdLevel() {
+    SimdLevel detected = DetectSimdLevel(), selected = detected;
+    const char *env = std::getenv("SETK_SIMD");
+    if (env != NULL && std::string(env) != "") {
+        int32 level = 0;
+        for (; level < kNumSimdLevels; level++)
+            if (std::string(env) == SimdLevelName(static_cast<SimdLevel>(level)))
+                break;
+        if (level == kNumSimdLevels)
+            KALDI_WARN << "Unknown SETK_SIMD=" << env << ", expect baseline|sse4.2|avx2|avx512, ignored";
+        else if (level > detected)
+            KALDI_WARN << "SETK_SIMD=" << env << " is not supported by this CPU, using "
+                       << SimdLevelName(detected);
+        else
+            selected = static_cast<SimdLevel>(level);
+    }
+    KALDI_VLOG(1) << "Using " << SimdLevelName(selected) << " kernels(detected "
+                  << SimdLevelName(detected) << (env ? ", SETK_SIMD=" + std::string(env): "") << ")";
+    return selected;
+}
+
+SimdLevel SelectedSimdLevel() {
+    static const SimdLevel level = ChooseSimdLevel();
+    return level;
+}
+
+const SimdKernels &SimdKernelsOf(SimdLevel level) {
+    KALDI_ASSERT(level <= DetectSimdLevel());
+    switch (level) {
+#ifdef SETK_SIMD_X86
+        case kSimdSse42: return kSimdKernels_sse42;
+        case kSimdAvx2: return kSimdKernels_avx2;
+        case kSimdAvx512: return kSimdKernels_avx512;
+#endif
+        default: return kSimdKernels_baseline;
+    }
+}
+
+const SimdKernels &Simd() {
+    static const SimdKernels &kernels = SimdKernelsOf(SelectedSimdLevel());
+    return kernels;
+}
+
+}
@@ -0,0 +1,79 @@
+// include/setk-simd.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SETK_SIMD_H
+#define SETK_SIMD_H
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+enum SimdLevel {
+    kSimdBaseline = 0,  // whatever the build targets, SSE2 on x86-64
+    kSimdSse42,
+    kSimdAvx2,          // AVX2 + FMA
+    kSimdAvx512,        // AVX-512 F/DQ/BW/VL
+    kNumSimdLevels
+};
+
+// Hot kernels, compiled once for each SimdLevel. Complex arrays are interleaved
+// as (real, imag), length n counts complex numbers. Spectrum in realfft format
+// is [r0, r(N/2), r1, i1, ...], see ShortTimeFTComputer
+struct SimdKernels {
+    const char *name;
+    // a = a .* b, or a .* conj(b)
+    void (*complex_mul)(BaseFloat *a, const BaseFloat *b, int32 n, bool conj);
+    // c = l .* conj(r) ./ (|l| .* |r|)
+    void (*gcc_phat)(const BaseFloat *l, const BaseFloat *r, BaseFloat *c, int32 n);
+    // dst = src .* window
+    void (*window_frame)(const BaseFloat *src, const BaseFloat *window, BaseFloat *dst, int32 n);
+    // dst += scale * frame .* window, for overlapadd
+    void (*window_add)(const BaseFloat *frame, const BaseFloat *window, BaseFloat scale,
+                       BaseFloat *dst, int32 n);
+    // power of each bin from realfft
+    void (*power_spectrum)(const BaseFloat *realfft, BaseFloat *power, int32 num_bins);
+    // phase angle of each bin from realfft, see ApproxAtan2()
+    void (*approx_phase)(const BaseFloat *realfft, BaseFloat *angle, int32 num_bins);
+    // y += alpha * x
+    void (*axpy)(BaseFloat alpha, const BaseFloat *x, BaseFloat *y, int32 n);
+    // y[c] = dot(h, x + c * stride) of length n, for each of num_channels, egs. fir filter
+    void (*multi_dot)(const BaseFloat *h, const BaseFloat *x, int32 stride, int32 num_channels,
+                      int32 n, BaseFloat *y);
+};
+
+// Highest level supported by current CPU(from CPUID)
+SimdLevel DetectSimdLevel();
+
+// Level used by Simd(), which is the detected one, or overrided by environment
+// variable SETK_SIMD=baseline|sse4.2|avx2|avx512(but not higher than detected)
+SimdLevel SelectedSimdLevel();
+
+const char *SimdLevelName(SimdLevel level);
+
+// Kernels of given level, which must be supported, used by tests & benchmarks
+const SimdKernels &SimdKernelsOf(SimdLevel level);
+
+// Kernels selected at startup, selection is reported at verbose level 1
+const SimdKernels &Simd();
+
+}
+
+#endif
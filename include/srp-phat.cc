@@ -20,56 +20,85 @@
 
 
 #include "include/srp-phat.h"
+#include "include/setk-profile.h"
+#include "include/setk-allocator.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
 
 
 namespace kaldi {
 
-// GCC(x, y) = conj(GCC(y, x))
-void SrpPhatComputor::ComputeGccPhat(const CMatrixBase<BaseFloat> &L,
-                                     const CMatrixBase<BaseFloat> &R,
-                                     BaseFloat dist,
-                                     CMatrixBase<BaseFloat> *gcc_phat) {
-    KALDI_ASSERT(dist > 0);
-    BaseFloat max_tdoa = dist / opts_.sound_speed;
-    BaseFloat inc_tdoa = max_tdoa * 2 / (opts_.samp_rate - 1);
-    for (int32 i = 0; i < opts_.samp_rate; i++)
-        if (opts_.samp_tdoa)
-            delay_axis_(i) = (max_tdoa - inc_tdoa * i) * 2 * M_PI;
-        else
-            delay_axis_(i) = std::cos(i * M_PI / opts_.samp_rate) * max_tdoa * 2 * M_PI;
+// GCC(x, y) = conj(GCC(y, x)), so only pairs i < j are used
+void SrpPhatComputor::InitPairs() {
+    std::vector<BaseFloat> &topo = opts_.array_topo; 
+    int32 num_chs = topo.size();
+    Vector<BaseFloat> delay_axis(opts_.samp_rate);
+    Matrix<BaseFloat> idtft_coef(frequency_axis_.Dim(), opts_.samp_rate);
+    pairs_.reserve(num_chs * (num_chs - 1) / 2);
+    for (int32 i = 0; i < num_chs; i++) {
+        for (int32 j = i + 1; j < num_chs; j++) {
+            BaseFloat dist = std::abs(topo[j] - topo[i]);
+            KALDI_ASSERT(dist > 0);
+            BaseFloat max_tdoa = dist / opts_.sound_speed;
+            BaseFloat inc_tdoa = max_tdoa * 2 / (opts_.samp_rate - 1);
+            for (int32 k = 0; k < opts_.samp_rate; k++)
+                if (opts_.samp_tdoa)
+                    delay_axis(k) = (max_tdoa - inc_tdoa * k) * 2 * M_PI;
+                else
+                    delay_axis(k) = std::cos(k * M_PI / opts_.samp_rate) * max_tdoa * 2 * M_PI;
+            idtft_coef.SetZero();
+            idtft_coef.AddVecVec(1, frequency_axis_, delay_axis);
 
-    idtft_coef_.SetZero();
-    idtft_coef_.AddVecVec(1, frequency_axis_, delay_axis_);
-    exp_idtft_coef_j_.Exp(idtft_coef_);
+            pairs_.push_back(MicPair());
+            MicPair &pair = pairs_.back();
+            pair.i = i, pair.j = j;
+            pair.exp_idtft_coef_j.Resize(frequency_axis_.Dim(), opts_.samp_rate);
+            pair.exp_idtft_coef_j.Exp(idtft_coef);
+        }
+    }
+}
 
-    CMatrix<BaseFloat> cor(L);
-    cor.MulElements(R, kConj);
-    cor.DivElements(L, kNoConj, true);
-    cor.DivElements(R, kNoConj, true);
-    // gcc_phat = gcc_phat + cor * coef
-    gcc_phat->AddMatMat(1, 0, cor, kNoTrans, exp_idtft_coef_j_, kNoTrans, 1, 0);
+void SrpPhatComputor::ComputeGccPhat(const CMatrixBase<BaseFloat> &L,
+                                     const CMatrixBase<BaseFloat> &R,
+                                     MicPair *pair) {
+    pair->cor.Resize(L.NumRows(), L.NumCols(), kUndefined);
+    pair->gcc_phat.Resize(L.NumRows(), opts_.samp_rate, kUndefined);
+    SETK_NO_ALLOC("gcc-phat");
+    // cor = L .* conj(R) / (|L| .* |R|), in one pass
+    for (int32 t = 0; t < pair->cor.NumRows(); t++)
+        Simd().gcc_phat(L.RowData(t), R.RowData(t), pair->cor.RowData(t), pair->cor.NumCols());
+    // gcc_phat = cor * coef
+    pair->gcc_phat.AddMatMat(1, 0, pair->cor, kNoTrans, pair->exp_idtft_coef_j, kNoTrans, 0, 0);
 }
 
 
-void SrpPhatComputor::Compute(const CMatrixBase<BaseFloat> &stft, 
+void SrpPhatComputor::Compute(const CMatrixBase<BaseFloat> &in_stft, 
                               Matrix<BaseFloat> *spectra) {
+    SETK_PROFILE("srp-phat");
+    int32 d = opts_.freq_decimation;
+    if (d > 1) {
+        int32 num_used = frequency_axis_.Dim();
+        KALDI_ASSERT((in_stft.NumCols() + d - 1) / d == num_used);
+        decimated_stft_.Resize(in_stft.NumRows(), num_used, kUndefined);
+        for (int32 f = 0; f < num_used; f++)
+            decimated_stft_.ColRange(f, 1).CopyFromMat(in_stft.ColRange(f * d, 1));
+    }
+    const CMatrixBase<BaseFloat> &stft = (d > 1 ? decimated_stft_: in_stft);
     std::vector<BaseFloat> &topo = opts_.array_topo; 
     int32 num_chs = topo.size();
     KALDI_ASSERT(num_chs >= 2);
-    MatrixIndexT num_frames = stft.NumRows() / num_chs, num_bins = stft.NumCols();
-    CMatrix<BaseFloat> coef(num_bins, delay_axis_.Dim());
-    CMatrix<BaseFloat> srp_phat(num_frames, delay_axis_.Dim());
-    spectra->Resize(num_frames, delay_axis_.Dim());
+    MatrixIndexT num_frames = stft.NumRows() / num_chs;
+    CMatrix<BaseFloat> srp_phat(num_frames, opts_.samp_rate);
+    spectra->Resize(num_frames, opts_.samp_rate);
     
-    // GCC(x, y) = conj(GCC(y, x))
-    // GCC_PHAT(x, x) = I
-    for (int32 i = 0; i < num_chs; i++) {
-        for (int32 j = i + 1; j < num_chs; j++) {
-            ComputeGccPhat(stft.RowRange(i * num_frames, num_frames),
-                           stft.RowRange(j * num_frames, num_frames),
-                           std::abs(topo[j] - topo[i]), &srp_phat);
-        }
-    }
+    // GCC_PHAT(x, x) = I, pairs in parallel and summed up after
+    ParallelFor(0, pairs_.size(), [&](int32 pbeg, int32 pend) {
+        for (int32 p = pbeg; p < pend; p++)
+            ComputeGccPhat(stft.RowRange(pairs_[p].i * num_frames, num_frames),
+                           stft.RowRange(pairs_[p].j * num_frames, num_frames), &pairs_[p]);
+    });
+    for (size_t p = 0; p < pairs_.size(); p++)
+        srp_phat.AddMat(1, 0, pairs_[p].gcc_phat);
     if (opts_.smooth_context)
         Smooth(&srp_phat);
     srp_phat.Part(spectra, kReal);
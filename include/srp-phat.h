@@ -38,14 +38,14 @@ namespace kaldi {
 struct SrpPhatOptions {
 
     BaseFloat sound_speed;
-    int32 samp_rate, smooth_context;
+    int32 samp_rate, smooth_context, freq_decimation;
     // For linear microphone arrays
     std::string topo_descriptor;
     std::vector<BaseFloat> array_topo;
     bool samp_doa = false, samp_tdoa = true;
 
     SrpPhatOptions(): sound_speed(340.4), 
-        samp_rate(180), smooth_context(0),
+        samp_rate(180), smooth_context(0), freq_decimation(1),
         topo_descriptor("") {} 
 
     void Register(OptionsItf *opts) {
@@ -55,6 +55,8 @@ struct SrpPhatOptions {
         opts->Register("samp-doa", &samp_doa, "Sample doa instead of tdoa on y-axis");
         opts->Register("samp-tdoa", &samp_tdoa, "Sample tdoa instead of doa on y-axis, by default using it");
         opts->Register("smooth-context", &smooth_context, "Context of frames used for spectra smoothing");
+        opts->Register("freq-decimation", &freq_decimation, "If larger than 1, only use every "
+                    "freq-decimation frequency bins in GCC-PHAT, an approximation to speed up");
         opts->Register("topo-descriptor", &topo_descriptor, 
                     "Description of microarray's topology, now only support linear array."
                     " egs: --topo-descriptor=0,0.3,0.6,0.9 described a ULA with element spacing equals 0.3");
@@ -67,6 +69,7 @@ struct SrpPhatOptions {
         KALDI_ASSERT(SplitStringToFloats(topo_descriptor, ",", false, &array_topo));
         KALDI_ASSERT(array_topo.size() >= 2);
         KALDI_ASSERT(samp_rate);
+        KALDI_ASSERT(freq_decimation >= 1);
         std::ostringstream oss;
         std::copy(array_topo.begin(), array_topo.end(), std::ostream_iterator<BaseFloat>(oss, " "));
         KALDI_VLOG(1) << "Parse topo_descriptor(" << topo_descriptor << ") to " << oss.str();
@@ -80,12 +83,12 @@ public:
                     BaseFloat freq, int32 num_bins): 
         samp_frequency_(freq), opts_(opts) {
             opts_.ComputeDerived();
-            frequency_axis_.Resize(num_bins);
-            delay_axis_.Resize(opts_.samp_rate);
-            idtft_coef_.Resize(num_bins, opts_.samp_rate);
-            exp_idtft_coef_j_.Resize(num_bins, opts_.samp_rate);
-            for (int32 f = 0; f < num_bins; f++) 
-                frequency_axis_(f) = f * samp_frequency_ / ((num_bins - 1) * 2);
+            // bins used: 0, d, 2d...
+            int32 d = opts_.freq_decimation, num_used = (num_bins + d - 1) / d;
+            frequency_axis_.Resize(num_used);
+            for (int32 f = 0; f < num_used; f++) 
+                frequency_axis_(f) = f * d * samp_frequency_ / ((num_bins - 1) * 2);
+            InitPairs();
         }
 
     void Compute(const CMatrixBase<BaseFloat> &stft, 
@@ -98,10 +101,19 @@ private:
     // sample frequency of wave
     BaseFloat samp_frequency_;
 
-    Vector<BaseFloat> frequency_axis_, delay_axis_;
-    // note that exp_idtft_coef_j_ = exp(idtft_coef_)
-    Matrix<BaseFloat> idtft_coef_;
-    CMatrix<BaseFloat> exp_idtft_coef_j_;
+    Vector<BaseFloat> frequency_axis_;
+
+    // Microphone pairs, processed in parallel, so each one keeps its own buffers
+    struct MicPair {
+        int32 i, j;
+        // exp(j * frequency_axis' * delay_axis), only depends on distance
+        CMatrix<BaseFloat> exp_idtft_coef_j;
+        // cross correlation & GCC-PHAT, reused between calls
+        CMatrix<BaseFloat> cor, gcc_phat;
+    };
+    std::vector<MicPair> pairs_;
+    // decimated stft, if freq_decimation > 1
+    CMatrix<BaseFloat> decimated_stft_;
     
     // This function implements GCC-PHAT algorithm. For MATLAB:
     // >> R = L .* conj(R) ./ (abs(L) .* abs(R));
@@ -109,8 +121,9 @@ private:
     // >> augular = R * (exp(frequency' * tau * 2j * pi));
     void ComputeGccPhat(const CMatrixBase<BaseFloat> &L,
                         const CMatrixBase<BaseFloat> &R,
-                        BaseFloat dist,
-                        CMatrixBase<BaseFloat> *spectra);
+                        MicPair *pair);
+
+    void InitPairs();
 
     void Smooth(CMatrix<BaseFloat> *spectra);
 };
@@ -0,0 +1,138 @@
+// include/stft-feature.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/stft-feature.h"
+#include "include/setk-profile.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
+
+namespace kaldi {
+
+StftFeatureComputer::StftFeatureComputer(const StftFeatureOptions &opts,
+                                         ShortTimeFTComputer *stft_computer):
+        opts_(opts), stft_computer_(stft_computer), fbank_(opts.fbank_opts),
+        mel_banks_(NULL), warned_(false) {
+    if (!opts_.OutputWave() && opts_.output_feature != "fbank" && opts_.output_feature != "log-power")
+        KALDI_ERR << "Unknown type of output features: " << opts_.output_feature;
+    const FrameExtractionOptions &frame_opts = opts_.fbank_opts.frame_opts;
+    // mel banks are only used if framing agrees, then padding is same as stft's
+    if (opts_.output_feature == "fbank" &&
+        frame_opts.PaddedWindowSize() == stft_computer_->Options().PaddingLength())
+        mel_banks_ = new MelBanks(opts_.fbank_opts.mel_opts, frame_opts, 1.0);
+}
+
+int32 StftFeatureComputer::Dim() const {
+    if (opts_.output_feature == "log-power")
+        return stft_computer_->Options().PaddingLength() / 2 + 1;
+    return fbank_.Dim();
+}
+
+bool StftFeatureComputer::MatchFraming(BaseFloat samp_freq, std::string *reason) const {
+    const FrameExtractionOptions &frame_opts = opts_.fbank_opts.frame_opts;
+    std::ostringstream oss;
+    if (frame_opts.samp_freq != samp_freq)
+        oss << "sample frequency " << frame_opts.samp_freq << " vs " << samp_freq;
+    else if (frame_opts.WindowSize() != stft_computer_->FrameLength() ||
+             frame_opts.WindowShift() != stft_computer_->FrameShift())
+        oss << "frame length/shift " << frame_opts.WindowSize() << "/" << frame_opts.WindowShift()
+            << " vs " << stft_computer_->FrameLength() << "/" << stft_computer_->FrameShift();
+    else if (frame_opts.PaddedWindowSize() != stft_computer_->Options().PaddingLength())
+        oss << "fft size " << frame_opts.PaddedWindowSize() << " vs "
+            << stft_computer_->Options().PaddingLength();
+    else if (frame_opts.window_type != stft_computer_->Options().window)
+        oss << "window " << frame_opts.window_type << " vs " << stft_computer_->Options().window;
+    else if (!frame_opts.snip_edges)
+        oss << "snip-edges=false";
+    else if (frame_opts.dither != 0 || frame_opts.preemph_coeff != 0 || frame_opts.remove_dc_offset)
+        oss << "dither, preemphasis or dc removal";
+    else if (opts_.fbank_opts.use_energy)
+        oss << "use-energy=true";
+    if (reason)
+        *reason = oss.str();
+    return oss.str().empty();
+}
+
+void StftFeatureComputer::ComputeFromStft(const MatrixBase<BaseFloat> &rstft,
+                                          Matrix<BaseFloat> *feats) {
+    int32 num_frames = rstft.NumRows(), num_bins = rstft.NumCols() / 2 + 1;
+    bool log_power = (opts_.output_feature == "log-power");
+    feats->Resize(num_frames, log_power ? num_bins: mel_banks_->NumBins(), kUndefined);
+    // stft of normalized samples is in range [-1, 1], back to int16 range
+    BaseFloat scale = 1.0;
+    if (stft_computer_->Options().normalize_input) {
+        scale = static_cast<BaseFloat>(std::numeric_limits<int16>::max());
+        scale = scale * scale;
+    }
+    BaseFloat floor = std::numeric_limits<float>::epsilon();
+    const FbankOptions &fbank_opts = opts_.fbank_opts;
+    ParallelFor(0, num_frames, [&](int32 tbeg, int32 tend) {
+        Vector<BaseFloat> power(num_bins);
+        for (int32 t = tbeg; t < tend; t++) {
+            Simd().power_spectrum(rstft.RowData(t), power.Data(), num_bins);
+            power.Scale(scale);
+            SubVector<BaseFloat> feat(*feats, t);
+            if (log_power) {
+                feat.CopyFromVec(power);
+                feat.ApplyFloor(floor);
+                feat.ApplyLog();
+                continue;
+            }
+            // same as FbankComputer::Compute()
+            if (!fbank_opts.use_power)
+                power.ApplyPow(0.5);
+            mel_banks_->Compute(power, &feat);
+            if (fbank_opts.use_log_fbank) {
+                feat.ApplyFloor(floor);
+                feat.ApplyLog();
+            }
+        }
+    }, 16);
+}
+
+void StftFeatureComputer::Compute(MatrixBase<BaseFloat> *rstft, BaseFloat samp_freq,
+                                  Matrix<BaseFloat> *feats) {
+    SETK_PROFILE("stft-feature");
+    KALDI_ASSERT(rstft->NumCols() == stft_computer_->Options().PaddingLength());
+    std::string reason;
+    if (opts_.output_feature == "log-power" || MatchFraming(samp_freq, &reason)) {
+        ComputeFromStft(*rstft, feats);
+        return;
+    }
+    if (!warned_) {
+        KALDI_WARN << "Framing of fbank differs from stft(" << reason << "), "
+                   << "compute fbank on resynthesized waveform, see StftFeatureComputer "
+                   << "for options to compute it on stft directly";
+        warned_ = true;
+    }
+    // not normalized, keep scale of stft as ComputeFromStft() does: undo gain of
+    // overlap-add(sum of window x synthesis window per shift), synthesis scale and
+    // input normalization
+    Matrix<BaseFloat> wave;
+    stft_computer_->InverseShortTimeFT(*rstft, &wave, -1);
+    BaseFloat scale = stft_computer_->SynthesisScale() * stft_computer_->FrameShift() /
+                      VecVec(stft_computer_->Window(), stft_computer_->SynthesisWindow());
+    if (stft_computer_->Options().normalize_input)
+        scale *= static_cast<BaseFloat>(std::numeric_limits<int16>::max());
+    wave.Scale(scale);
+    fbank_.ComputeFeatures(wave.Row(0), samp_freq, 1.0, feats);
+}
+
+}
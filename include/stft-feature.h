@@ -0,0 +1,90 @@
+// include/stft-feature.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef STFT_FEATURE_H
+#define STFT_FEATURE_H
+
+#include "feat/feature-fbank.h"
+
+#include "include/stft.h"
+
+namespace kaldi {
+
+struct StftFeatureOptions {
+    std::string output_feature;
+    FbankOptions fbank_opts;
+
+    StftFeatureOptions(): output_feature("wave") {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("output-feature", &output_feature, "Type(\"wave\"|\"fbank\"|\"log-power\") of outputs. "
+                       "If not \"wave\", features are computed on enhanced stft and written as matrices");
+        // --frame-length etc. are taken by stft
+        ParseOptions fbank_po("fbank", opts);
+        fbank_opts.Register(&fbank_po);
+    }
+
+    bool OutputWave() const { return output_feature == "wave"; }
+};
+
+// Computes features on enhanced stft, without iSTFT & STFT again:
+//  log-power:  log power spectrum on stft frames
+//  fbank:      Kaldi's fbank on stft frames, if its framing agrees with stft,
+//              see MatchFraming(), otherwise on resynthesized waveform
+// Kaldi's default fbank options never agree, fbank on stft frames requires:
+//  --fbank.dither=0 --fbank.preemphasis-coefficient=0 --fbank.remove-dc-offset=false
+//  --fbank.window-type, --fbank.frame-length/shift & --fbank.sample-frequency same as stft,
+//  --fbank.round-to-power-of-two same as stft's padding, and --fbank.use-energy=false.
+// Features of both ways keep the scale of enhanced stft(int16 range of input, not
+// normalized like resynthesized waveform), same as Kaldi's on original waveform.
+class StftFeatureComputer {
+public:
+    StftFeatureComputer(const StftFeatureOptions &opts, ShortTimeFTComputer *stft_computer);
+
+    ~StftFeatureComputer() { delete mel_banks_; }
+
+    // Fbank frames are same as stft's: same samples, window & padding, and nothing
+    // is done before windowing(dither, dc removal, pre-emphasis) or needs samples
+    // (energy). If not, reason is given.
+    bool MatchFraming(BaseFloat samp_freq, std::string *reason = NULL) const;
+
+    // rstft:   (num_frames, padding), enhanced stft in realfft format,
+    //          destroyed if resynthesized
+    void Compute(MatrixBase<BaseFloat> *rstft, BaseFloat samp_freq, Matrix<BaseFloat> *feats);
+
+    int32 Dim() const;
+
+private:
+    void ComputeFromStft(const MatrixBase<BaseFloat> &rstft, Matrix<BaseFloat> *feats);
+
+    StftFeatureOptions opts_;
+    ShortTimeFTComputer *stft_computer_;
+
+    // for fbank computed on resynthesized waveform
+    Fbank fbank_;
+    // for fbank computed on stft frames, at --fbank.sample-frequency
+    MelBanks *mel_banks_;
+    bool warned_;
+};
+
+}
+
+#endif
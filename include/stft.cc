@@ -20,6 +20,10 @@
 
 
 #include "include/stft.h"
+#include "include/setk-profile.h"
+#include "include/setk-allocator.h"
+#include "include/setk-simd.h"
+#include "include/thread-pool.h"
 
 namespace kaldi {
 
@@ -27,55 +31,119 @@ namespace kaldi {
 // wave:    (num_channels, num_samples)
 // stft:    (num_channels x num_frames, num_bins)
 void ShortTimeFTComputer::ShortTimeFT(const MatrixBase<BaseFloat> &wave, Matrix<BaseFloat> *stft) {
+    // zeroed by the task which processes the rows, so pages are first touched
+    // on its NUMA node
+    stft->Resize(NumFrames(wave.NumCols()) * wave.NumRows(), opts_.PaddingLength(), kUndefined);
+    ShortTimeFT(wave, static_cast<MatrixBase<BaseFloat>*>(stft));
+}
+
+void ShortTimeFTComputer::ShortTimeFT(const MatrixBase<BaseFloat> &wave, MatrixBase<BaseFloat> *stft) {
+    SETK_PROFILE("stft");
     KALDI_ASSERT(window_.Dim() == frame_length_);
 
     int32 num_samples = wave.NumCols(), num_channels = wave.NumRows();
-    int32 num_frames  = NumFrames(num_samples);
+    int32 num_frames  = NumFrames(num_samples), padding_length = opts_.PaddingLength();
+    SETK_PROFILE_COUNT("stft", num_frames * num_channels);
+    KALDI_ASSERT(stft->NumRows() == num_frames * num_channels && stft->NumCols() == padding_length);
     
-    stft->Resize(num_frames * num_channels, opts_.PaddingLength(), kSetZero);
-    
-    // new copy of wave, cause my modify origin matrix
-    Matrix<BaseFloat> copy_mat(wave);
+    // channels in parallel, srfft_ keeps internal buffer, so each task uses its own
+    // (per thread, reused by later calls). Each channel is copied(cause may modify
+    // origin samples) into workspace of the thread runs the task, which avoids
+    // allocation for each chunk in streaming mode. Never hold workspace across
+    // ParallelFor(), the waiting thread may run tasks stolen from other callers,
+    // which reuse the same slot.
+    ParallelFor(0, num_channels, [&](int32 cbeg, int32 cend) {
+        static thread_local std::vector<BaseFloat> fft_buffer;
+        for (int32 c = cbeg; c < cend; c++) {
+            BaseFloat *copy_data = static_cast<BaseFloat*>(ThreadWorkspace(kStftScratch,
+                                        sizeof(BaseFloat) * num_samples));
+            SubVector<BaseFloat> samples(copy_data, num_samples);
+            samples.CopyFromVec(wave.Row(c));
+            SubMatrix<BaseFloat> spectra(*stft, c * num_frames, num_frames, 0, padding_length);
+            TransformChannel(&samples, &spectra, &fft_buffer);
+        }
+    });
+}
 
-    if (opts_.normalize_input)
-        copy_mat.Scale(1.0 / int16_max);
+// waves:   num_utts x (num_channels, num_samples of each utterance)
+// stft:    (num_channels x num_frames, num_bins), num_frames is total frames of utterances
+void ShortTimeFTComputer::ShortTimeFT(const std::vector<const MatrixBase<BaseFloat>*> &waves,
+                                      Matrix<BaseFloat> *stft, std::vector<int32> *frame_offsets) {
+    SETK_PROFILE("stft");
+    KALDI_ASSERT(window_.Dim() == frame_length_);
+    KALDI_ASSERT(!waves.empty());
 
-    int32 ibeg, iend;
-    for (int32 c = 0; c < num_channels; c++) {
-        // channel c
-        SubVector<BaseFloat> samples(copy_mat, c);
+    int32 num_utts = waves.size(), num_channels = waves[0]->NumRows();
+    frame_offsets->resize(num_utts + 1);
+    (*frame_offsets)[0] = 0;
+    for (int32 u = 0; u < num_utts; u++) {
+        KALDI_ASSERT(waves[u]->NumRows() == num_channels);
+        int32 num_frames = NumFrames(waves[u]->NumCols());
+        KALDI_ASSERT(num_frames > 0);
+        (*frame_offsets)[u + 1] = (*frame_offsets)[u] + num_frames;
+    }
+    int32 num_frames = frame_offsets->back(), padding_length = opts_.PaddingLength();
+    SETK_PROFILE_COUNT("stft", num_frames * num_channels);
+    // one allocation for the whole batch
+    stft->Resize(num_frames * num_channels, padding_length, kUndefined);
 
-        if (opts_.enable_scale) {
-            BaseFloat samp_norm = samples.Norm(float_inf);
-            samples.Scale(int16_max / samp_norm);
+    // each (utterance, channel) pair is a task, copied into workspace of the thread runs it
+    ParallelFor(0, num_utts * num_channels, [&](int32 beg, int32 end) {
+        std::vector<BaseFloat> fft_buffer;
+        for (int32 i = beg; i < end; i++) {
+            int32 u = i / num_channels, c = i % num_channels, num_samples = waves[u]->NumCols(),
+                  offset = (*frame_offsets)[u], utt_frames = (*frame_offsets)[u + 1] - offset;
+            BaseFloat *copy_data = static_cast<BaseFloat*>(ThreadWorkspace(kStftScratch,
+                                        sizeof(BaseFloat) * num_samples));
+            SubVector<BaseFloat> samples(copy_data, num_samples);
+            samples.CopyFromVec(waves[u]->Row(c));
+            SubMatrix<BaseFloat> spectra(*stft, c * num_frames + offset, utt_frames, 0, padding_length);
+            TransformChannel(&samples, &spectra, &fft_buffer);
         }
+    });
+}
 
-        for (int32 i = 0; i < num_frames; i++) {
-            SubVector<BaseFloat> spectra(*stft, c * num_frames + i);
-            ibeg = i * frame_shift_;
-            iend = ibeg + frame_length_ <= num_samples ? ibeg + frame_length_: num_samples;  
-            spectra.Range(0, iend - ibeg).CopyFromVec(samples.Range(ibeg, iend - ibeg)); 
-            spectra.Range(0, frame_length_).MulElements(window_);
-            srfft_->Compute(spectra.Data(), true);
-        } 
+void ShortTimeFTComputer::TransformChannel(VectorBase<BaseFloat> *samples, MatrixBase<BaseFloat> *stft,
+                                           std::vector<BaseFloat> *fft_buffer) {
+    int32 num_samples = samples->Dim(), num_frames = stft->NumRows(),
+          padding_length = stft->NumCols(), ibeg, iend;
+    if (opts_.normalize_input)
+        samples->Scale(1.0 / int16_max);
+
+    if (opts_.enable_scale) {
+        BaseFloat samp_norm = samples->Norm(float_inf);
+        samples->Scale(int16_max / samp_norm);
     }
+
+    for (int32 i = 0; i < num_frames; i++) {
+        SubVector<BaseFloat> spectra(*stft, i);
+        ibeg = i * frame_shift_;
+        iend = ibeg + frame_length_ <= num_samples ? ibeg + frame_length_: num_samples;  
+        if (iend - ibeg == frame_length_) {
+            // copy & window in one pass
+            Simd().window_frame(samples->Data() + ibeg, window_.Data(), spectra.Data(),
+                                frame_length_);
+            if (padding_length > frame_length_)
+                spectra.Range(frame_length_, padding_length - frame_length_).SetZero();
+        } else {
+            spectra.SetZero();
+            spectra.Range(0, iend - ibeg).CopyFromVec(samples->Range(ibeg, iend - ibeg)); 
+            spectra.Range(0, frame_length_).MulElements(window_);
+        }
+        srfft_->Compute(spectra.Data(), true, fft_buffer);
+    } 
 }
     
 void ShortTimeFTComputer::ComputeSpectrogram(MatrixBase<BaseFloat> &stft, 
                                              Matrix<BaseFloat> *spectra) {
+    SETK_PROFILE("spectrogram");
     int32 window_size = stft.NumCols(), num_frames = stft.NumRows();
     // index range(0, num_bins - 1)
     int32 num_bins = (window_size >> 1) + 1;
 
     spectra->Resize(num_frames, num_bins);
-    for (int32 t = 0; t < num_frames; t++) {
-        (*spectra)(t, 0) = stft(t, 0) * stft(t, 0);
-        (*spectra)(t, num_bins - 1) = stft(t, 1) * stft(t, 1);
-        for (int32 f = 1; f < num_bins - 1; f++) {
-            BaseFloat r = stft(t, f * 2), i = stft(t, f * 2 + 1);
-            (*spectra)(t, f) = r * r + i * i;
-        }
-    }
+    for (int32 t = 0; t < num_frames; t++)
+        Simd().power_spectrum(stft.RowData(t), spectra->RowData(t), num_bins);
     if (!opts_.apply_pow)
         spectra->ApplyPow(0.5);
     if (opts_.apply_log) {
@@ -87,10 +155,17 @@ void ShortTimeFTComputer::ComputeSpectrogram(MatrixBase<BaseFloat> &stft,
 
 
 void ShortTimeFTComputer::ComputePhaseAngle(MatrixBase<BaseFloat> &stft, Matrix<BaseFloat> *angle) {
+    SETK_PROFILE("phase-angle");
     int32 window_size = stft.NumCols(), num_frames = stft.NumRows();
     // index range(0, num_bins - 1)
     int32 num_bins = (window_size >> 1) + 1;
     angle->Resize(num_frames, num_bins);
+    if (opts_.approx_trig) {
+        // vectorized ApproxAtan2()
+        for (int32 t = 0; t < num_frames; t++)
+            Simd().approx_phase(stft.RowData(t), angle->RowData(t), num_bins);
+        return;
+    }
     // processing angle(i, j)
     for (int32 t = 0; t < num_frames; t++) {
         (*angle)(t, 0) = atan2(0, stft(t, 0));
@@ -106,23 +181,47 @@ void ShortTimeFTComputer::Compute(const MatrixBase<BaseFloat> &wave, Matrix<Base
                                   Matrix<BaseFloat> *spectra, Matrix<BaseFloat> *angle) {
     KALDI_ASSERT(window_.Dim() == frame_length_);
     
+    // write into stft directly, which keeps its buffer if shape is not changed
     Matrix<BaseFloat> stft_cache;
-    ShortTimeFT(wave, &stft_cache);
+    Matrix<BaseFloat> *stft_out = stft ? stft: &stft_cache;
+    ShortTimeFT(wave, stft_out);
     
     if (spectra) {
-        ComputeSpectrogram(stft_cache, spectra); 
+        ComputeSpectrogram(*stft_out, spectra); 
     }
     if (angle) {
-        ComputePhaseAngle(stft_cache, angle);
-    }
-    // copy back to stft
-    if (stft) {
-        stft->Swap(&stft_cache);
+        ComputePhaseAngle(*stft_out, angle);
     }
 } 
 
+void ShortTimeFTComputer::Compute(const std::vector<const MatrixBase<BaseFloat>*> &waves,
+                                  Matrix<BaseFloat> *stft, Matrix<BaseFloat> *spectra,
+                                  Matrix<BaseFloat> *angle, std::vector<int32> *frame_offsets) {
+    Matrix<BaseFloat> stft_cache;
+    Matrix<BaseFloat> *stft_out = stft ? stft: &stft_cache;
+    ShortTimeFT(waves, stft_out, frame_offsets);
+    // both are frame-wise, so batch boundaries don't matter
+    if (spectra)
+        ComputeSpectrogram(*stft_out, spectra);
+    if (angle)
+        ComputePhaseAngle(*stft_out, angle);
+}
+
+void CopyUtteranceFromBatch(const MatrixBase<BaseFloat> &batch,
+                            const std::vector<int32> &frame_offsets,
+                            int32 num_channels, int32 u, Matrix<BaseFloat> *out) {
+    int32 num_frames = frame_offsets.back(), offset = frame_offsets[u],
+          utt_frames = frame_offsets[u + 1] - offset;
+    KALDI_ASSERT(batch.NumRows() == num_frames * num_channels);
+    out->Resize(utt_frames * num_channels, batch.NumCols(), kUndefined);
+    for (int32 c = 0; c < num_channels; c++)
+        out->RowRange(c * utt_frames, utt_frames).CopyFromMat(
+            batch.RowRange(c * num_frames + offset, utt_frames));
+}
+
 void ShortTimeFTComputer::Polar(MatrixBase<BaseFloat> &spectra, MatrixBase<BaseFloat> &angle, 
                                 Matrix<BaseFloat> *stft) {
+    SETK_PROFILE("polar");
     KALDI_ASSERT(spectra.NumCols() == angle.NumCols() && spectra.NumRows() == angle.NumRows());
     int32 num_frames = spectra.NumRows(), num_bins = spectra.NumCols();
     int32 window_size = (num_bins - 1) * 2;
@@ -147,42 +246,60 @@ void ShortTimeFTComputer::Polar(MatrixBase<BaseFloat> &spectra, MatrixBase<BaseF
 
 void ShortTimeFTComputer::InverseShortTimeFT(MatrixBase<BaseFloat> &stft, Matrix<BaseFloat> *wave, 
                                              BaseFloat range) {
+    SETK_PROFILE("istft");
     int32 num_frames = stft.NumRows();
     // should be longer than original
     int32 num_samples = NumSamples(num_frames); 
     wave->Resize(1, num_samples);
     
     SubVector<BaseFloat> samples(*wave, 0);
-    Vector<BaseFloat> seg(frame_length_);
 
     for (int32 i = 0; i < num_frames; i++) {
         SubVector<BaseFloat> spectra(stft, i);
-        // iRealFFT
-        srfft_->Compute(spectra.Data(), false);
-        spectra.Scale(1.0 / frame_length_);
-
-        seg.CopyFromVec(spectra.Range(0, frame_length_));
-        // NOTE: synthetic window should be orthogonalized with analysis window
-        //       but I haven't implement orthogonalization algorithm, I use 
-        //       'range' to control synthetic energy
-        seg.MulElements(window_);
-        samples.Range(i * frame_shift_, frame_length_).AddVec(1, seg);
+        SynthesisAdd(&spectra, samples.Data() + i * FrameShift());
     }
 
-    BaseFloat samp_norm = samples.Norm(float_inf);
+    NormalizeRange(&samples, range);
+}
+
+void ShortTimeFTComputer::NormalizeRange(VectorBase<BaseFloat> *samples, BaseFloat range) {
+    BaseFloat samp_norm = samples->Norm(float_inf);
     // by default, normalize to int16 to avoid cutoff when writing wave to disk
     if (range == 0)
         range = int16_max;
     // range < 0, do not normalize it.
     if (range >= 0) {
-        samples.Scale(range / samp_norm);
+        samples->Scale(range / samp_norm);
         KALDI_VLOG(3) << "Rescale samples(" << range << "/" << samp_norm << ")";
     }
 }
 
+void ShortTimeFTComputer::SynthesisFrame(VectorBase<BaseFloat> *frame) {
+    KALDI_ASSERT(frame->Dim() == opts_.PaddingLength());
+    // iRealFFT
+    srfft_->Compute(frame->Data(), false);
+    // scaled by 1 / frame_length(not padding length, size of iRealFFT), kept for
+    // outputs of offline tools, see SynthesisScale()
+    frame->Scale(1.0 / frame_length_);
+    // NOTE: synthetic window is same as analysis one except asymmetric window,
+    //       'range' is used to control synthetic energy
+    frame->Range(0, frame_length_).MulElements(synthesis_window_);
+}
+
+void ShortTimeFTComputer::SynthesisAdd(VectorBase<BaseFloat> *frame, BaseFloat *samples) {
+    KALDI_ASSERT(frame->Dim() == opts_.PaddingLength());
+    srfft_->Compute(frame->Data(), false);
+    // scale, window & add in one pass
+    Simd().window_add(frame->Data(), synthesis_window_.Data(), 1.0 / frame_length_, samples, frame_length_);
+}
+
 void ShortTimeFTComputer::CacheWindow(const ShortTimeFTOptions &opts) {
     int32 frame_length = opts.frame_length;
     window_.Resize(frame_length);
+    if (opts.window == "asymmetric") {
+        CacheAsymmetricWindow(opts);
+        return;
+    }
     double a = M_2PI / (frame_length - 1);
     for (int32 i = 0; i < frame_length; i++) {
         double d = static_cast<double>(i);
@@ -199,7 +316,154 @@ void ShortTimeFTComputer::CacheWindow(const ShortTimeFTOptions &opts) {
             KALDI_ERR << "Unknown window type " << opts.window;
         }
     }
+    synthesis_window_ = window_;
+    synthesis_offset_ = 0;
+}
+
+// Mauler & Martin(2007), with N = frame_length, M = frame_shift:
+//  analysis:   sqrt(hann) rising in [0, N - M), sqrt(hann) falling in [N - M, N)
+//  synthesis:  zero in [0, N - 2M), then hann(2M) / analysis, so that product of
+//              them is a periodic hann of 2M samples at the end of frame, which
+//              sums to one with shift M
+void ShortTimeFTComputer::CacheAsymmetricWindow(const ShortTimeFTOptions &opts) {
+    int32 N = opts.frame_length, M = opts.frame_shift;
+    if (M != opts.frame_shift || N < 2 * M)
+        KALDI_ERR << "Asymmetric window requires integer frame shift and frame length >= 2 x "
+                  << "frame shift, got " << opts.frame_shift << " vs " << opts.frame_length;
+    synthesis_window_.Resize(N);
+    synthesis_offset_ = N - 2 * M;
+    for (int32 n = 0; n < N; n++) {
+        if (n < N - M)
+            window_(n) = std::sqrt(0.5 - 0.5 * cos(M_PI * n / (N - M)));
+        else
+            window_(n) = std::sqrt(0.5 - 0.5 * cos(M_PI * (n - N + 2 * M) / M));
+        if (n < synthesis_offset_)
+            continue;
+        double hann = 0.5 - 0.5 * cos(M_PI * (n - synthesis_offset_) / M);
+        synthesis_window_(n) = window_(n) > 0 ? hann / window_(n): 0;
+    }
 }
 
+
+OnlineShortTimeFTComputer::OnlineShortTimeFTComputer(const ShortTimeFTOptions &opts, 
+                                                     int32 num_channels): 
+        computer_(opts), num_channels_(num_channels), num_samples_(0), num_ready_(0) {
+    KALDI_ASSERT(num_channels_ >= 1);
+    if (opts.enable_scale)
+        KALDI_ERR << "Option --enable-scale is not supported in streaming mode";
+    int32 frame_length = computer_.FrameLength(), frame_shift = computer_.FrameShift();
+    KALDI_ASSERT(frame_shift <= frame_length);
+    synthesis_.Resize(frame_length);
+    frame_.Resize(computer_.Options().PaddingLength());
+    // gain of overlapadd: \sum_k a(n + k * shift) s(n + k * shift), averaged over n
+    // (exactly one for asymmetric window)
+    BaseFloat gain = VecVec(computer_.Window(), computer_.SynthesisWindow()) / frame_shift;
+    synthesis_scale_ = computer_.SynthesisScale() / gain;
+    if (opts.normalize_input)
+        synthesis_scale_ *= static_cast<BaseFloat>(std::numeric_limits<int16>::max());
 }
 
+void OnlineShortTimeFTComputer::AcceptWaveform(const MatrixBase<BaseFloat> &chunk) {
+    SETK_PROFILE("online-stft");
+    KALDI_ASSERT(chunk.NumRows() == num_channels_);
+    int32 num_samples = num_samples_ + chunk.NumCols();
+    int32 frame_length = computer_.FrameLength(), frame_shift = computer_.FrameShift(),
+          padding_length = computer_.Options().PaddingLength();
+
+    if (samples_.NumCols() < num_samples) {
+        Matrix<BaseFloat> samples(num_channels_, num_samples, kUndefined);
+        if (num_samples_)
+            samples.ColRange(0, num_samples_).CopyFromMat(samples_.ColRange(0, num_samples_));
+        samples_.Swap(&samples);
+    }
+    if (chunk.NumCols())
+        samples_.ColRange(num_samples_, chunk.NumCols()).CopyFromMat(chunk);
+    num_samples_ = num_samples;
+    if (num_samples < frame_length)
+        return;
+
+    int32 num_frames = (num_samples - frame_length) / frame_shift + 1;
+    if (stft_.NumRows() < num_frames * num_channels_)
+        stft_.Resize(num_frames * num_channels_, padding_length, kUndefined);
+    SubMatrix<BaseFloat> stft(stft_, 0, num_frames * num_channels_, 0, padding_length);
+    computer_.ShortTimeFT(samples_.ColRange(0, (num_frames - 1) * frame_shift + frame_length), &stft);
+
+    // append new frames, keep channel-major order
+    int32 capacity = frames_ready_.NumRows() / num_channels_;
+    if (num_ready_ + num_frames > capacity) {
+        int32 new_capacity = std::max(num_ready_ + num_frames, capacity * 2);
+        Matrix<BaseFloat> frames(new_capacity * num_channels_, padding_length, kUndefined);
+        for (int32 c = 0; c < num_channels_ && num_ready_; c++)
+            frames.RowRange(c * new_capacity, num_ready_).CopyFromMat(
+                frames_ready_.RowRange(c * capacity, num_ready_));
+        frames_ready_.Swap(&frames);
+        capacity = new_capacity;
+    }
+    for (int32 c = 0; c < num_channels_; c++)
+        frames_ready_.RowRange(c * capacity + num_ready_, num_frames).CopyFromMat(
+            stft.RowRange(c * num_frames, num_frames));
+    num_ready_ += num_frames;
+
+    // move samples not consumed to the front
+    int32 consumed = num_frames * frame_shift;
+    num_samples_ = num_samples - consumed;
+    for (int32 c = 0; c < num_channels_ && num_samples_; c++)
+        memmove(samples_.RowData(c), samples_.RowData(c) + consumed, sizeof(BaseFloat) * num_samples_);
+}
+
+int32 OnlineShortTimeFTComputer::PopFrames(Matrix<BaseFloat> *stft, int32 max_frames) {
+    int32 num_frames = (max_frames < 0 || max_frames >= num_ready_) ? num_ready_: max_frames;
+    if (!num_frames) {
+        stft->Resize(0, 0);
+        return 0;
+    }
+    // split each channel into popped & rest
+    int32 num_rest = num_ready_ - num_frames, capacity = frames_ready_.NumRows() / num_channels_;
+    stft->Resize(num_frames * num_channels_, frames_ready_.NumCols(), kUndefined);
+    for (int32 c = 0; c < num_channels_; c++) {
+        stft->RowRange(c * num_frames, num_frames).CopyFromMat(
+            frames_ready_.RowRange(c * capacity, num_frames));
+        // row by row, source is always ahead of destination
+        for (int32 t = 0; t < num_rest; t++)
+            frames_ready_.Row(c * capacity + t).CopyFromVec(
+                frames_ready_.Row(c * capacity + num_frames + t));
+    }
+    num_ready_ = num_rest;
+    return num_frames;
+}
+
+void OnlineShortTimeFTComputer::OverlapAdd(const MatrixBase<BaseFloat> &stft, 
+                                           Matrix<BaseFloat> *samples) {
+    SETK_PROFILE("online-istft");
+    int32 num_frames = stft.NumRows();
+    int32 frame_length = computer_.FrameLength(), frame_shift = computer_.FrameShift(),
+          offset = computer_.SynthesisOffset();
+    KALDI_ASSERT(stft.NumCols() == computer_.Options().PaddingLength());
+
+    samples->Resize(1, num_frames * frame_shift, kUndefined);
+    for (int32 t = 0; t < num_frames; t++) {
+        frame_.CopyFromVec(stft.Row(t));
+        computer_.SynthesisAdd(&frame_, synthesis_.Data());
+        // frame_shift samples after synthesis offset are finished, samples before
+        // it are never reached by synthesis window, so they are skipped
+        samples->Row(0).Range(t * frame_shift, frame_shift).CopyFromVec(
+            synthesis_.Range(offset, frame_shift));
+        // shift left
+        for (int32 n = 0; n < frame_length - frame_shift; n++)
+            synthesis_(n) = synthesis_(n + frame_shift);
+        synthesis_.Range(frame_length - frame_shift, frame_shift).SetZero();
+    }
+    samples->Scale(synthesis_scale_);
+}
+
+void OnlineShortTimeFTComputer::Flush(Matrix<BaseFloat> *samples) {
+    int32 offset = computer_.SynthesisOffset(),
+          num_rest = computer_.FrameLength() - computer_.FrameShift() - offset;
+    samples->Resize(1, num_rest, kUndefined);
+    if (num_rest)
+        samples->Row(0).CopyFromVec(synthesis_.Range(offset, num_rest));
+    samples->Scale(synthesis_scale_);
+    synthesis_.SetZero();
+}
+
+}
@@ -38,29 +38,47 @@ struct ShortTimeFTOptions {
     bool volumn;
     bool apply_pow;
     bool apply_log;
+    bool approx_trig;
 
     ShortTimeFTOptions(): frame_shift(256), frame_length(1024), 
         window("hamming"), normalize_input(false), enable_scale(false),
-        apply_log(false), apply_pow(false) {}
+        apply_log(false), apply_pow(false), approx_trig(false) {}
 
-    int32 PaddingLength() {
+    int32 PaddingLength() const {
         return RoundUpToNearestPowerOfTwo(frame_length);
     }
 
     void Register(OptionsItf *opts) {
         opts->Register("frame-shift", &frame_shift, "Frame shift in number of samples");
         opts->Register("frame-length", &frame_length, "Frame length in number of samples");
-        opts->Register("window", &window, "Type of window(\"hamming\"|\"hanning\"|\"blackman\"|\"rectangular\")");
+        opts->Register("window", &window, "Type of window(\"hamming\"|\"hanning\"|\"blackman\"|\"rectangular\""
+                                          "|\"asymmetric\"), asymmetric one is a low latency analysis & "
+                                          "synthesis pair, which needs frame-length >= 2 x frame-shift");
         opts->Register("normalize-input", &normalize_input, "Scale samples into range [-1, 1], like MATLAB or librosa");
         opts->Register("enable-scale", &enable_scale, "Let infinite norm of sample vector to be one");
         opts->Register("apply-pow", &apply_pow, "Using power spectrum instead of magnitude spectrum. "
                                                 "This options only works when computing (Power/Magnitude) spectrum"
                                                 " and corresponding wave reconstruction(egs: wav-estimate).");
         opts->Register("apply-log", &apply_log, "Apply log on computed spectrum if needed.");
+        opts->Register("approx-trig", &approx_trig, "Using polynomial approximation of atan2 when "
+                                                    "computing phase angle(absolute error < 1e-5 rad)");
     }
 };
 
 
+// Polynomial approximation of atan2, absolute error is less than 1e-5 rad
+inline BaseFloat ApproxAtan2(BaseFloat y, BaseFloat x) {
+    BaseFloat ax = std::abs(x), ay = std::abs(y);
+    if (ax == 0 && ay == 0) return 0;
+    // z in [0, 1]
+    BaseFloat z = ax >= ay ? ay / ax: ax / ay, z2 = z * z;
+    BaseFloat a = z * (0.9998660 + z2 * (-0.3302995 + z2 * (0.1801410 + 
+                  z2 * (-0.0851330 + z2 * 0.0208351))));
+    if (ay > ax) a = M_PI / 2 - a;
+    if (x < 0) a = M_PI - a;
+    return y < 0 ? -a: a;
+}
+
 class ShortTimeFTComputer {
 public:
     ShortTimeFTComputer(const ShortTimeFTOptions &opts): 
@@ -85,10 +103,26 @@ public:
     //  0.72716829-0.08915424j  0.87527244-1.57259355j -2.86146448+0.j        ]
     void ShortTimeFT(const MatrixBase<BaseFloat> &wave, Matrix<BaseFloat> *stft);
 
+    // Same as above, but stft is not resized, egs. part of a larger buffer
+    // stft:    (num_channels x num_frames, padding)
+    void ShortTimeFT(const MatrixBase<BaseFloat> &wave, MatrixBase<BaseFloat> *stft);
+
+    // Batched version for many short utterances(with same number of channels), which
+    // shares the setup and runs all (utterance, channel) pairs as tasks of one pass
+    // waves:   num_utts x (num_channels, num_samples)
+    // stft:    (num_channels x num_frames, num_bins), num_frames = frame_offsets->back(),
+    //          channel c of utterance u is in rows c * num_frames + [offsets[u], offsets[u + 1])
+    void ShortTimeFT(const std::vector<const MatrixBase<BaseFloat>*> &waves,
+                     Matrix<BaseFloat> *stft, std::vector<int32> *frame_offsets);
+
     // using overlapadd to reconstruct waveform from realfft's complex results
     void InverseShortTimeFT(MatrixBase<BaseFloat> &stft, Matrix<BaseFloat> *wave, 
                             BaseFloat range = 0);
 
+    // scale samples synthesized by SynthesisAdd() as InverseShortTimeFT() does:
+    // infinite norm to range(int16 max if range is 0), or keep them if range < 0
+    void NormalizeRange(VectorBase<BaseFloat> *samples, BaseFloat range = 0);
+
     // compute spectrogram from stft results, abs(i^2 + r^2) or i^2 + r^2...)
     void ComputeSpectrogram(MatrixBase<BaseFloat> &stft, Matrix<BaseFloat> *spectra);
 
@@ -103,14 +137,67 @@ public:
     void Compute(const MatrixBase<BaseFloat> &wave, Matrix<BaseFloat> *stft, 
                  Matrix<BaseFloat> *spectra, Matrix<BaseFloat> *angle); 
 
+    // batched version of Compute(), outputs are in layout of batched ShortTimeFT()
+    void Compute(const std::vector<const MatrixBase<BaseFloat>*> &waves,
+                 Matrix<BaseFloat> *stft, Matrix<BaseFloat> *spectra,
+                 Matrix<BaseFloat> *angle, std::vector<int32> *frame_offsets);
+
+    // iRealFFT and apply synthetic window on one frame(in realfft format), in place.
+    // After calling, first frame_length samples of frame are ready for overlapadd
+    void SynthesisFrame(VectorBase<BaseFloat> *frame);
+
+    // Same as SynthesisFrame(), but adds windowed frame_length samples on samples
+    // directly instead of writing back, frame is destroyed after calling
+    void SynthesisAdd(VectorBase<BaseFloat> *frame, BaseFloat *samples);
+
+    // Frames are synthesized with scale 1 / frame_length as offline tools always
+    // did, while iRealFFT has padding points. Multiply synthesized samples by it
+    // to keep scale of input(only differs if frame length is not power of 2).
+    BaseFloat SynthesisScale() const {
+        return static_cast<BaseFloat>(frame_length_) / opts_.PaddingLength();
+    }
+
+    int32 FrameShift() const { return static_cast<int32>(frame_shift_); }
+
+    int32 FrameLength() const { return static_cast<int32>(frame_length_); }
+
+    // analysis window
+    const Vector<BaseFloat> &Window() const { return window_; }
+
+    // same as analysis window except asymmetric one
+    const Vector<BaseFloat> &SynthesisWindow() const { return synthesis_window_; }
+
+    // number of leading zeros of synthesis window, frame_length - 2 x frame_shift
+    // for asymmetric window, otherwise 0
+    int32 SynthesisOffset() const { return synthesis_offset_; }
+
+    const ShortTimeFTOptions &Options() const { return opts_; }
+
+    // keep same as Kaldi's
+    int32 NumFrames(int32 num_samples) const {
+        return static_cast<int32>((num_samples - opts_.frame_length) / opts_.frame_shift) + 1;
+    }
+
+    int32 NumSamples(int32 num_frames) const {
+        return static_cast<int32>((num_frames - 1) * opts_.frame_shift + opts_.frame_length);
+    }
+
 
 private:
     void CacheWindow(const ShortTimeFTOptions &opts);
 
+    void CacheAsymmetricWindow(const ShortTimeFTOptions &opts);
+
+    // frame, window & fft samples of one channel(scaled in place if needed)
+    // stft:    (num_frames, num_bins), frames of this channel
+    void TransformChannel(VectorBase<BaseFloat> *samples, MatrixBase<BaseFloat> *stft,
+                          std::vector<BaseFloat> *fft_buffer);
+
     ShortTimeFTOptions opts_;
     SplitRadixRealFft<BaseFloat> *srfft_;
 
-    Vector<BaseFloat> window_;
+    Vector<BaseFloat> window_, synthesis_window_;
+    int32 synthesis_offset_;
 
     BaseFloat frame_shift_;
     BaseFloat frame_length_;
@@ -118,14 +205,77 @@ private:
     BaseFloat int16_max = static_cast<BaseFloat>(std::numeric_limits<int16>::max());
     BaseFloat float_inf = static_cast<BaseFloat>(std::numeric_limits<BaseFloat>::infinity());
 
-    // keep same as Kaldi's
-    int32 NumFrames(int32 num_samples) {
-        return static_cast<int32>((num_samples - opts_.frame_length) / opts_.frame_shift) + 1;
-    }
+};
 
-    int32 NumSamples(int32 num_frames) {
-        return static_cast<int32>((num_frames - 1) * opts_.frame_shift + opts_.frame_length);
+// Rows of utterance u from outputs of batched ShortTimeFTComputer::Compute(),
+// in the same layout as unbatched ones
+// batch:   (num_channels x num_frames, dim)
+// out:     (num_channels x num_frames of utterance u, dim)
+void CopyUtteranceFromBatch(const MatrixBase<BaseFloat> &batch,
+                            const std::vector<int32> &frame_offsets,
+                            int32 num_channels, int32 u, Matrix<BaseFloat> *out);
+
+// Streaming version of ShortTimeFTComputer, which accepts waveform chunk by chunk
+// and keeps samples of incomplete frame & overlapadd buffer between calls.
+// Note that --enable-scale is not supported here, cause it needs the whole utterance.
+class OnlineShortTimeFTComputer {
+public:
+    OnlineShortTimeFTComputer(const ShortTimeFTOptions &opts, int32 num_channels);
+
+    // chunk:   (num_channels, num_samples)
+    void AcceptWaveform(const MatrixBase<BaseFloat> &chunk);
+
+    int32 NumFramesReady() const { return num_ready_; }
+
+    // Pop ready frames(at most max_frames if it's not negative), in same format
+    // as ShortTimeFTComputer::ShortTimeFT(), egs:
+    // stft:    (num_channels x num_frames, num_bins), realfft format
+    // returns number of frames popped
+    int32 PopFrames(Matrix<BaseFloat> *stft, int32 max_frames = -1);
+
+    // Overlapadd stft frames(single channel, realfft format) into synthesis buffer,
+    // and output samples finished: (1, num_frames x frame_shift).
+    // Output keeps same scale as input waveform, and starts from sample
+    // Computer().SynthesisOffset() of input(earlier ones are never synthesized).
+    void OverlapAdd(const MatrixBase<BaseFloat> &stft, Matrix<BaseFloat> *samples);
+
+    // Flush the rest (frame_length - frame_shift - synthesis offset) samples in
+    // synthesis buffer
+    void Flush(Matrix<BaseFloat> *samples);
+
+    // Algorithmic latency in samples: an input sample comes out at most this
+    // number of samples later, frame_length for symmetric windows and
+    // 2 x frame_shift for asymmetric one
+    int32 Latency() const {
+        return computer_.FrameLength() - computer_.SynthesisOffset();
     }
+
+    int32 NumChannels() const { return num_channels_; }
+
+    int32 NumBins() const { return computer_.Options().PaddingLength() / 2 + 1; }
+
+    const ShortTimeFTComputer &Computer() const { return computer_; }
+
+private:
+    ShortTimeFTComputer computer_;
+    int32 num_channels_;
+
+    // Buffers below only grow, so nothing is allocated in steady state.
+    // samples not consumed by analysis frames yet, in first num_samples_ columns
+    Matrix<BaseFloat> samples_;
+    int32 num_samples_;
+    // scratch of stft of each chunk
+    Matrix<BaseFloat> stft_;
+    // analysis frames not popped yet, frames of channel c are in rows
+    // c x capacity + [0, num_ready_), capacity = NumRows() / num_channels
+    Matrix<BaseFloat> frames_ready_;
+    int32 num_ready_;
+    // overlapadd buffer, length frame_length
+    Vector<BaseFloat> synthesis_;
+    // scratch of one synthesis frame
+    Vector<BaseFloat> frame_;
+    // 1 / (gain of overlapadd analysis & synthetic window)
+    BaseFloat synthesis_scale_;
 };
 
 }
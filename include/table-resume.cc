@@ -0,0 +1,120 @@
+// include/table-resume.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <fstream>
+
+#include "include/table-resume.h"
+
+namespace kaldi {
+
+static bool FileExists(const std::string &filename) {
+    std::ifstream is(filename);
+    return is.good();
+}
+
+std::string ResumeJournal::Open(const std::string &wspecifier, const ResumeOptions &opts,
+                                const Validator &validator) {
+    resumed_ = false;
+    done_.clear();
+    done_script_.clear();
+    merged_scripts_.clear();
+    if (!opts.resume)
+        return wspecifier;
+
+    std::string archive, script;
+    if (ClassifyWspecifier(wspecifier, &archive, &script, NULL) != kBothWspecifier)
+        KALDI_ERR << "--resume requires both archive and scp in wspecifier, but got " << wspecifier;
+    if (ClassifyWxfilename(archive) != kFileOutput || ClassifyWxfilename(script) != kFileOutput)
+        KALDI_ERR << "--resume requires archive and scp to be regular files, but got " << wspecifier;
+
+    // scp of last finished run, then part scp of unfinished runs
+    int32 num_parts = 0;
+    std::vector<std::string> candidates;
+    if (FileExists(script))
+        candidates.push_back(script);
+    for (int32 n = 1; ; n++) {
+        std::string part = std::to_string(n);
+        bool has_script = FileExists(script + "." + part);
+        if (!has_script && !FileExists(archive + "." + part))
+            break;
+        if (has_script)
+            candidates.push_back(script + "." + part);
+        num_parts = n;
+    }
+    int32 num_invalid = 0;
+    for (const std::string &candidate: candidates) {
+        std::vector<std::pair<std::string, std::string> > entries;
+        if (!ReadScriptFile(candidate, true, &entries)) {
+            KALDI_WARN << "Failed to read " << candidate << ", ignore it";
+            continue;
+        }
+        for (const auto &entry: entries) {
+            if (done_.count(entry.first))
+                continue;
+            if (!validator(entry.second)) {
+                num_invalid++;
+                continue;
+            }
+            done_.insert(entry.first);
+            done_script_.push_back(entry);
+        }
+        if (candidate != script)
+            merged_scripts_.push_back(candidate);
+    }
+
+    std::string part = std::to_string(num_parts + 1);
+    part_archive_ = archive + "." + part;
+    part_script_ = script + "." + part;
+    script_ = script;
+    resumed_ = true;
+    KALDI_LOG << "Resume " << wspecifier << ": " << done_script_.size() << " completed, "
+              << num_invalid << " invalid entries dropped, write the rest to "
+              << archive << "." << part;
+    // options are in front of ':', archive is always ahead of scp
+    return wspecifier.substr(0, wspecifier.find(':') + 1) + archive + "." + part + "," + part_script_;
+}
+
+bool ResumeJournal::Close() {
+    if (!resumed_)
+        return true;
+    resumed_ = false;
+    std::vector<std::pair<std::string, std::string> > entries;
+    if (!ReadScriptFile(part_script_, true, &entries))
+        return false;
+    entries.insert(entries.begin(), done_script_.begin(), done_script_.end());
+    // write & rename, so scp is always consistent
+    std::string tmp_script = script_ + ".tmp";
+    if (!WriteScriptFile(tmp_script, entries) || std::rename(tmp_script.c_str(), script_.c_str()) != 0) {
+        KALDI_WARN << "Failed to update " << script_ << ", rerun with --resume to merge it";
+        return false;
+    }
+    merged_scripts_.push_back(part_script_);
+    for (const std::string &merged: merged_scripts_)
+        std::remove(merged.c_str());
+    // nothing is written in this run, never leave an empty archive
+    if (entries.size() == done_script_.size())
+        std::remove(part_archive_.c_str());
+    KALDI_LOG << "Merged " << entries.size() << " entries into " << script_;
+    return true;
+}
+
+}
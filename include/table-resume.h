@@ -0,0 +1,144 @@
+// include/table-resume.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef TABLE_RESUME_H
+#define TABLE_RESUME_H
+
+#include <functional>
+#include <unordered_set>
+
+#include "util/common-utils.h"
+#include "feat/wave-reader.h"
+
+namespace kaldi {
+
+struct ResumeOptions {
+    bool resume;
+
+    ResumeOptions(): resume(false) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("resume", &resume, "If true, skip utterances already completed in output table "
+                       "(wspecifier must contain scp, egs. ark,scp:enh.ark,enh.scp), write the rest into "
+                       "a new archive and merge scp at the end, egs. to restart a preempted job");
+    }
+};
+
+// Book-keeping of resumable output tables, independent of object type.
+// For wspecifier ark,scp:foo.ark,foo.scp, entries of foo.scp and of part
+// scp(foo.scp.N, left by runs which did not finish) are validated and kept as
+// completed keys. Objects of this run go to foo.ark.N/foo.scp.N with a new N,
+// and foo.scp is rewritten with both old & new entries on Close(), which removes
+// foo.ark.N if nothing is written in this run. Old archives
+// are never truncated, so a crash during resuming loses nothing either.
+class ResumeJournal {
+public:
+    typedef std::function<bool(const std::string&)> Validator;
+
+    ResumeJournal(): resumed_(false) {}
+
+    // Returns wspecifier used for writing in this run, egs. wspecifier itself
+    // if not resume. Validator returns true if object in rxfilename is readable.
+    std::string Open(const std::string &wspecifier, const ResumeOptions &opts,
+                     const Validator &validator);
+
+    // If key is completed in previous runs
+    bool IsDone(const std::string &key) const { return done_.count(key) != 0; }
+
+    int32 NumDone() const { return done_script_.size(); }
+
+    // Merge scp, called after writer of this run is closed
+    bool Close();
+
+private:
+    bool resumed_;
+    std::string script_, part_archive_, part_script_;
+    std::vector<std::string> merged_scripts_;
+    std::unordered_set<std::string> done_;
+    std::vector<std::pair<std::string, std::string> > done_script_;
+};
+
+// Drop-in replacement of TableWriter with --resume support, egs.
+//   ResumableWaveWriter wav_writer;
+//   wav_writer.Open(wspecifier, resume_opts);
+//   for (...) { if (wav_writer.IsDone(key)) continue; ...; wav_writer.Write(key, wave); }
+template<class Holder>
+class ResumableTableWriter {
+public:
+    typedef typename Holder::T T;
+
+    ResumableTableWriter() {}
+
+    ResumableTableWriter(const std::string &wspecifier, const ResumeOptions &opts) {
+        if (!Open(wspecifier, opts))
+            KALDI_ERR << "Failed to open table for writing: " << wspecifier;
+    }
+
+    bool Open(const std::string &wspecifier, const ResumeOptions &opts) {
+        return writer_.Open(journal_.Open(wspecifier, opts, &ResumableTableWriter::Validate));
+    }
+
+    bool IsDone(const std::string &key) const { return journal_.IsDone(key); }
+
+    int32 NumDone() const { return journal_.NumDone(); }
+
+    void Write(const std::string &key, const T &value) const { writer_.Write(key, value); }
+
+    bool IsOpen() const { return writer_.IsOpen(); }
+
+    bool Close() {
+        if (!writer_.IsOpen())
+            return true;
+        bool ans = writer_.Close();
+        return journal_.Close() && ans;
+    }
+
+    ~ResumableTableWriter() {
+        if (!Close())
+            KALDI_WARN << "Failed to close resumable table";
+    }
+
+private:
+    TableWriter<Holder> writer_;
+    ResumeJournal journal_;
+
+    // Read the whole object, as the tail of an archive may be truncated
+    static bool Validate(const std::string &rxfilename) {
+        try {
+            Input ki;
+            bool ans = Holder::IsReadInBinary() ? ki.Open(rxfilename): ki.OpenTextMode(rxfilename);
+            if (!ans)
+                return false;
+            Holder holder;
+            return holder.Read(ki.Stream());
+        } catch (const std::exception &e) {
+            return false;
+        }
+    }
+};
+
+typedef ResumableTableWriter<WaveHolder> ResumableWaveWriter;
+typedef ResumableTableWriter<KaldiObjectHolder<Matrix<BaseFloat> > > ResumableMatrixWriter;
+
+}
+
+#endif
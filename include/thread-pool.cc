@@ -0,0 +1,225 @@
+// include/thread-pool.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+#include "include/thread-pool.h"
+
+#ifdef HAVE_OPENBLAS
+extern "C" void openblas_set_num_threads(int num_threads);
+#endif
+
+namespace kaldi {
+
+// index of worker in its pool, -1 for other threads
+static thread_local int32 worker_index = -1;
+
+void ThreadPool::Configure(const ThreadPoolOptions &opts) {
+    Stop();
+    int32 num_threads = opts.num_threads;
+    if (num_threads <= 0)
+        num_threads = std::max(static_cast<int32>(std::thread::hardware_concurrency()), 1);
+
+#ifdef HAVE_OPENBLAS
+    // tasks call BLAS concurrently, avoid oversubscription from its own threads
+    if (num_threads > 1)
+        openblas_set_num_threads(1);
+#endif
+    stop_ = false;
+    for (int32 i = 0; i < num_threads; i++)
+        queues_.push_back(new TaskQueue());
+    for (int32 i = 0; i < num_threads - 1; i++) {
+        workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+#ifdef __linux__
+        if (opts.pin_threads) {
+            // leave core 0 for the main thread
+            int32 num_cores = std::max(static_cast<int32>(std::thread::hardware_concurrency()), 1);
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET((i + 1) % num_cores, &cpu_set);
+            if (pthread_setaffinity_np(workers_.back().native_handle(), sizeof(cpu_set), &cpu_set))
+                KALDI_WARN << "Failed to pin worker " << i << " to core " << (i + 1) % num_cores;
+        }
+#endif
+    }
+    KALDI_VLOG(1) << "Thread pool started with " << num_threads << " threads"
+                  << (opts.pin_threads ? "(pinned)": "");
+}
+
+void ThreadPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i].join();
+    workers_.clear();
+    for (size_t i = 0; i < queues_.size(); i++) {
+        KALDI_ASSERT(queues_[i]->tasks.empty());
+        delete queues_[i];
+    }
+    queues_.clear();
+}
+
+void ThreadPool::Submit(const Task &task) {
+    // workers push into their own queue, others into the shared one
+    int32 index = worker_index >= 0 ? worker_index: static_cast<int32>(queues_.size()) - 1;
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(task);
+    }
+    num_pending_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex_);
+    }
+    wakeup_.notify_one();
+}
+
+bool ThreadPool::PopTask(int32 index, Task *task) {
+    if (num_pending_.load() == 0)
+        return false;
+    int32 num_queues = static_cast<int32>(queues_.size());
+    // own queue first(LIFO, still hot in cache)
+    if (index >= 0) {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        if (!queues_[index]->tasks.empty()) {
+            *task = queues_[index]->tasks.back();
+            queues_[index]->tasks.pop_back();
+            num_pending_.fetch_sub(1);
+            return true;
+        }
+    }
+    // then shared queue and others(FIFO, steal the biggest pieces)
+    for (int32 i = 0; i < num_queues; i++) {
+        int32 victim = (index + i + num_queues) % num_queues;
+        if (victim == index) continue;
+        std::lock_guard<std::mutex> lock(queues_[victim]->mutex);
+        if (!queues_[victim]->tasks.empty()) {
+            *task = queues_[victim]->tasks.front();
+            queues_[victim]->tasks.pop_front();
+            num_pending_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+    Task task;
+    if (queues_.empty() || !PopTask(worker_index, &task))
+        return false;
+    {
+        // done even if Execute() throws, group may be destroyed after this
+        TaskGroup::PendingGuard done(task.group);
+        task.group->Execute(task.func);
+    }
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int32 index) {
+    worker_index = index;
+    while (true) {
+        if (RunPendingTask())
+            continue;
+        std::unique_lock<std::mutex> lock(wakeup_mutex_);
+        wakeup_.wait(lock, [this] { return stop_ || num_pending_.load() > 0; });
+        if (stop_ && num_pending_.load() == 0)
+            break;
+    }
+    worker_index = -1;
+}
+
+
+TaskGroup::~TaskGroup() {
+    // tasks refer to this group, must be finished before destruction
+    while (pending_.load() > 0)
+        if (!ThreadPool::Get().RunPendingTask())
+            std::this_thread::yield();
+}
+
+void TaskGroup::Run(const std::function<void()> &func) {
+    ThreadPool &pool = ThreadPool::Get();
+    if (pool.NumThreads() == 1) {
+        Execute(func);
+        return;
+    }
+    pending_.fetch_add(1);
+    // undone if the task could not be queued
+    PendingGuard guard(this);
+    ThreadPool::Task task = {func, this};
+    pool.Submit(task);
+    guard.Dismiss();
+}
+
+void TaskGroup::Execute(const std::function<void()> &func) {
+    try {
+        func();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_)
+            error_ = std::current_exception();
+    }
+}
+
+void TaskGroup::Wait() {
+    ThreadPool &pool = ThreadPool::Get();
+    // help others instead of blocking
+    while (pending_.load() > 0)
+        if (!pool.RunPendingTask())
+            std::this_thread::yield();
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = NULL;
+        std::rethrow_exception(error);
+    }
+}
+
+
+void ParallelForTasks(int32 begin, int32 end, const std::function<void(int32, int32)> &body,
+                      int32 grain) {
+    int32 num_items = end - begin, num_threads = ThreadPool::Get().NumThreads();
+    grain = std::max(grain, 1);
+    // a few pieces per thread for load balance
+    int32 num_chunks = std::min((num_items + grain - 1) / grain, num_threads * 4);
+    int32 chunk_size = (num_items + num_chunks - 1) / num_chunks;
+    TaskGroup group;
+    for (int32 b = begin + chunk_size; b < end; b += chunk_size) {
+        int32 e = std::min(b + chunk_size, end);
+        group.Run([&body, b, e] { body(b, e); });
+    }
+    // first piece on current thread
+    try {
+        body(begin, std::min(begin + chunk_size, end));
+    } catch (...) {
+        // keep the first exception
+        try { group.Wait(); } catch (...) {}
+        throw;
+    }
+    group.Wait();
+}
+
+}
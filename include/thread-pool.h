@@ -0,0 +1,166 @@
+// include/thread-pool.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+struct ThreadPoolOptions {
+    int32 num_threads;
+    bool pin_threads;
+
+    ThreadPoolOptions(): num_threads(1), pin_threads(false) {}
+
+    void Register(OptionsItf *opts) {
+        opts->Register("num-threads", &num_threads, "Number of threads shared by all components(STFT, "
+                       "beamforming, SRP-PHAT, RIR...), 0 means number of cores. If > 1, BLAS runs single-threaded");
+        opts->Register("pin-threads", &pin_threads, "If true, pin each worker thread to one core");
+    }
+};
+
+class TaskGroup;
+
+// Process-wide work-stealing pool. Each worker owns a deque: it pushes and pops
+// its own tasks at the back, and steals from the front of others. Tasks from
+// non-worker threads go into a shared queue. Waiting threads execute pending
+// tasks instead of blocking, so parallel regions can be nested freely.
+// With one thread(the default) everything runs inline on the calling thread.
+class ThreadPool {
+public:
+    static ThreadPool &Get() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // (Re)start workers, must not be called while tasks are running
+    void Configure(const ThreadPoolOptions &opts);
+
+    // Including the calling thread
+    int32 NumThreads() const { return static_cast<int32>(workers_.size()) + 1; }
+
+    // Run one pending task if there is, returns false if nothing to do
+    bool RunPendingTask();
+
+    ~ThreadPool() { Stop(); }
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> func;
+        TaskGroup *group;
+    };
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    ThreadPool(): num_pending_(0), stop_(false) {}
+
+    void Submit(const Task &task);
+
+    bool PopTask(int32 index, Task *task);
+
+    void WorkerLoop(int32 index);
+
+    void Stop();
+
+    // queues_[i] is owned by worker i, last one is shared by other threads
+    std::vector<TaskQueue*> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex wakeup_mutex_;
+    std::condition_variable wakeup_;
+    std::atomic<int32> num_pending_;
+    bool stop_;
+};
+
+// Tasks which can be waited together, exception thrown by any task is
+// rethrown by Wait(). Destruction also waits for them(egs. the caller leaves
+// by exception before Wait()), as they may refer to its stack.
+class TaskGroup {
+public:
+    TaskGroup(): pending_(0) {}
+
+    ~TaskGroup();
+
+    void Run(const std::function<void()> &func);
+
+    void Wait();
+
+private:
+    friend class ThreadPool;
+
+    // Counts one task down when leaving scope, so a task which throws(or fails
+    // to be submitted) is never left pending and Wait() never hangs
+    class PendingGuard {
+    public:
+        explicit PendingGuard(TaskGroup *group): group_(group) {}
+        ~PendingGuard() { if (group_) group_->pending_.fetch_sub(1); }
+        void Dismiss() { group_ = NULL; }
+    private:
+        TaskGroup *group_;
+    };
+
+    void Execute(const std::function<void()> &func);
+
+    std::atomic<int32> pending_;
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+// ParallelFor() with more than one piece
+void ParallelForTasks(int32 begin, int32 end, const std::function<void(int32, int32)> &body,
+                      int32 grain);
+
+// Calls body(b, e) on disjoint sub-ranges of [begin, end), each one has at
+// least grain items(except the last one). Body can allocate buffers per call
+// and reuse them across the sub-range. If it runs inline(one thread or one
+// piece), body is called directly, never wrapped into std::function(which
+// allocates for large closures), so streaming loops stay allocation free.
+template<class Body>
+inline void ParallelFor(int32 begin, int32 end, const Body &body, int32 grain = 1) {
+    if (end <= begin)
+        return;
+    if (ThreadPool::Get().NumThreads() == 1 || end - begin <= std::max(grain, 1)) {
+        body(begin, end);
+        return;
+    }
+    ParallelForTasks(begin, end, body, grain);
+}
+
+}
+
+#endif
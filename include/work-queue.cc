@@ -0,0 +1,301 @@
+// include/work-queue.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "include/work-queue.h"
+#include "include/setk-server.h"
+
+namespace kaldi {
+
+WorkQueueClient::WorkQueueClient(const std::string &socket_path) {
+    fd_ = ConnectSetkSocket(socket_path);
+    const char *worker_id = std::getenv("SETK_WORKER_ID");
+    worker_id_ = worker_id ? worker_id: "0";
+}
+
+WorkQueueClient::~WorkQueueClient() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool WorkQueueClient::Fetch(std::string *key, bool skip_last) {
+    if (!WriteSetkFrame(fd_, skip_last ? kRequestSkipKey: kRequestFetchKey, worker_id_))
+        KALDI_ERR << "Failed to send request to work queue";
+    uint32 status;
+    if (!ReadSetkFrame(fd_, &status, key))
+        KALDI_ERR << "Failed to receive key from work queue";
+    if (status == kResponseError)
+        KALDI_ERR << "Work queue refused worker " << worker_id_ << ": " << *key;
+    return status == kResponseOk;
+}
+
+
+WorkQueueCoordinator::WorkQueueCoordinator(const std::string &socket_path,
+                                           const std::vector<std::string> &keys,
+                                           int32 max_retries):
+        socket_path_(socket_path), keys_(keys), owners_(keys.size(), 0),
+        retries_(keys.size(), 0), skipped_(keys.size(), false), max_retries_(max_retries) {
+    KALDI_ASSERT(max_retries >= 0);
+    for (int32 k = 0; k < keys_.size(); k++)
+        queue_.push_back(k);
+    listen_fd_ = ListenSetkSocket(socket_path_, 128);
+}
+
+WorkQueueCoordinator::~WorkQueueCoordinator() {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+}
+
+bool WorkQueueCoordinator::ServeRequest(int32 fd, int32 *worker, int32 *holding) {
+    uint32 type;
+    std::string payload;
+    if (!ReadSetkFrame(fd, &type, &payload))
+        return false;
+    if (type != kRequestFetchKey && type != kRequestSkipKey) {
+        WriteSetkFrame(fd, kResponseError, "unknown request type");
+        return false;
+    }
+    if (*worker == 0) {
+        int32 id;
+        if (!ConvertStringToInteger(payload, &id) || id <= 0) {
+            WriteSetkFrame(fd, kResponseError, "invalid worker id " + payload
+                           + ", workers should be spawned by setk-coordinator");
+            return false;
+        }
+        *worker = id;
+    }
+    // fetching next one acknowledges the last one
+    if (*holding >= 0) {
+        if (type == kRequestSkipKey)
+            skipped_[*holding] = true;
+        else
+            owners_[*holding] = *worker;
+    }
+    *holding = -1;
+    if (queue_.empty())
+        return WriteSetkFrame(fd, kResponseNoMoreKeys, "");
+    *holding = queue_.front();
+    queue_.pop_front();
+    return WriteSetkFrame(fd, kResponseOk, keys_[*holding]);
+}
+
+int32 WorkQueueCoordinator::Run(const std::vector<std::string> &commands) {
+    std::vector<pid_t> pids;
+    succeeded_.assign(commands.size(), false);
+    for (int32 j = 0; j < commands.size(); j++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            KALDI_ERR << "Fork worker failed: " << strerror(errno);
+        if (pid == 0) {
+            close(listen_fd_);
+            setenv("SETK_WORK_QUEUE", socket_path_.c_str(), 1);
+            setenv("SETK_WORKER_ID", std::to_string(j + 1).c_str(), 1);
+            execl("/bin/sh", "sh", "-c", commands[j].c_str(), static_cast<char*>(NULL));
+            _exit(127);
+        }
+        pids.push_back(pid);
+        KALDI_VLOG(1) << "Spawn worker " << j + 1 << ": " << commands[j];
+    }
+
+    // connections: fd, worker id(0 if unknown yet) & index of key held(-1 if none)
+    std::vector<struct pollfd> fds(1);
+    std::vector<std::pair<int32, int32> > states(1);
+    fds[0].fd = listen_fd_, fds[0].events = POLLIN;
+    int32 num_running = pids.size(), num_failed = 0;
+    while (num_running > 0) {
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR)
+            KALDI_ERR << "Poll on work queue failed: " << strerror(errno);
+        for (int32 i = fds.size() - 1; i >= 1; i--) {
+            if (!fds[i].revents)
+                continue;
+            if (!(fds[i].revents & POLLIN) ||
+                    !ServeRequest(fds[i].fd, &states[i].first, &states[i].second)) {
+                int32 k = states[i].second;
+                if (k >= 0 && ++retries_[k] > max_retries_) {
+                    KALDI_WARN << "Worker " << states[i].first << " disconnected, give up "
+                               << keys_[k] << " after " << max_retries_ << " retries";
+                    poison_keys_.push_back(keys_[k]);
+                } else if (k >= 0) {
+                    KALDI_WARN << "Worker " << states[i].first << " disconnected, requeue "
+                               << keys_[k];
+                    queue_.push_front(k);
+                }
+                close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+                states.erase(states.begin() + i);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int32 fd = accept(listen_fd_, NULL, NULL);
+            if (fd >= 0) {
+                struct pollfd conn;
+                conn.fd = fd, conn.events = POLLIN, conn.revents = 0;
+                fds.push_back(conn);
+                states.push_back(std::make_pair(0, -1));
+            }
+        }
+        int32 status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            num_running--;
+            int32 worker = std::find(pids.begin(), pids.end(), pid) - pids.begin() + 1;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                KALDI_WARN << "Worker " << worker << " exited with status " << status;
+                num_failed++;
+            } else {
+                KALDI_VLOG(1) << "Worker " << worker << " done";
+                succeeded_[worker - 1] = true;
+            }
+        }
+    }
+    for (int32 i = 1; i < fds.size(); i++)
+        close(fds[i].fd);
+    return num_failed;
+}
+
+
+// Parse "path:offset" written by TableWriter
+static bool SplitOffset(const std::string &rxfilename, std::string *path, int64 *offset) {
+    size_t pos = rxfilename.find_last_of(':');
+    if (pos == std::string::npos)
+        return false;
+    *path = rxfilename.substr(0, pos);
+    return ConvertStringToInteger(rxfilename.substr(pos + 1), offset);
+}
+
+// Check "<key> " is written just before offset(where object begins) in archive
+static bool HasKeyAt(std::ifstream *is, int64 file_size, const std::string &key, int64 offset) {
+    int64 begin = offset - static_cast<int64>(key.size()) - 1;
+    if (begin < 0 || offset > file_size)
+        return false;
+    std::string header(key.size() + 1, ' ');
+    is->clear();
+    is->seekg(begin);
+    is->read(&header[0], header.size());
+    return *is && header.compare(0, key.size(), key) == 0 && header.back() == ' ';
+}
+
+int32 MergeWorkerTables(const std::vector<std::string> &keys,
+                        const std::vector<int32> &owners,
+                        const std::vector<std::string> &worker_scripts,
+                        const std::vector<bool> &worker_succeeded,
+                        const std::string &archive, const std::string &script,
+                        bool merge_archive) {
+    KALDI_ASSERT(keys.size() == owners.size());
+    KALDI_ASSERT(worker_scripts.size() == worker_succeeded.size());
+    std::unordered_map<std::string, int32> key_index;
+    for (int32 k = 0; k < keys.size(); k++)
+        key_index[keys[k]] = k;
+    // key => (rxfilename, end of object), of its owner
+    std::unordered_map<std::string, std::pair<std::string, int64> > entries;
+    for (int32 j = 0; j < worker_scripts.size(); j++) {
+        std::vector<std::pair<std::string, std::string> > script_entries;
+        if (!ReadScriptFile(worker_scripts[j], true, &script_entries)) {
+            KALDI_WARN << "Failed to read output of worker " << j + 1 << ": " << worker_scripts[j];
+            continue;
+        }
+        // objects are contiguous in archive: end of one is where key of next begins
+        std::map<std::string, std::map<int64, int32> > archives;
+        for (int32 e = 0; e < script_entries.size(); e++) {
+            std::string path;
+            int64 offset;
+            if (!SplitOffset(script_entries[e].second, &path, &offset))
+                KALDI_ERR << "Unexpected entry in " << worker_scripts[j] << ": " << script_entries[e].second;
+            archives[path][offset] = e;
+        }
+        for (auto &archive_entries: archives) {
+            std::ifstream is(archive_entries.first, std::ios::binary | std::ios::ate);
+            int64 file_size = is.tellg();
+            bool valid = HasKeyAt(&is, file_size, script_entries[archive_entries.second.begin()->second].first,
+                                  archive_entries.second.begin()->first);
+            for (auto iter = archive_entries.second.begin(); valid && iter != archive_entries.second.end(); iter++) {
+                const std::string &key = script_entries[iter->second].first;
+                auto next = std::next(iter);
+                int64 end = file_size;
+                if (next != archive_entries.second.end()) {
+                    const std::string &next_key = script_entries[next->second].first;
+                    end = next->first - next_key.size() - 1;
+                    valid = end >= iter->first && HasKeyAt(&is, file_size, next_key, next->first);
+                } else {
+                    // last object of a crashed worker may be truncated
+                    valid = worker_succeeded[j];
+                }
+                if (!valid) {
+                    KALDI_WARN << "Archive " << archive_entries.first << " of worker " << j + 1
+                               << " is incomplete from " << key << ", ignore the rest of it";
+                    break;
+                }
+                auto index = key_index.find(key);
+                if (index != key_index.end() && owners[index->second] == j + 1)
+                    entries[key] = std::make_pair(script_entries[iter->second].second, end);
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string> > merged;
+    std::ofstream os;
+    if (merge_archive) {
+        os.open(archive, std::ios::binary);
+        if (!os.is_open())
+            KALDI_ERR << "Failed to open " << archive << " for writing";
+    }
+    std::vector<char> buffer;
+    for (const std::string &key: keys) {
+        auto iter = entries.find(key);
+        if (iter == entries.end())
+            continue;
+        if (!merge_archive) {
+            merged.push_back(std::make_pair(key, iter->second.first));
+            continue;
+        }
+        std::string path;
+        int64 offset, end = iter->second.second;
+        SplitOffset(iter->second.first, &path, &offset);
+        buffer.resize(end - offset);
+        std::ifstream is(path, std::ios::binary);
+        is.seekg(offset);
+        is.read(buffer.data(), buffer.size());
+        if (!is)
+            KALDI_ERR << "Failed to read " << key << " from " << iter->second.first;
+        os << key << ' ';
+        merged.push_back(std::make_pair(key, archive + ":" + std::to_string(static_cast<int64>(os.tellp()))));
+        os.write(buffer.data(), buffer.size());
+    }
+    if (merge_archive) {
+        os.close();
+        if (os.fail())
+            KALDI_ERR << "Failed to write " << archive;
+    }
+    if (!WriteScriptFile(script, merged))
+        KALDI_ERR << "Failed to write " << script;
+    return merged.size();
+}
+
+}
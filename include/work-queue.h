@@ -0,0 +1,197 @@
+// include/work-queue.h
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <deque>
+#include <cstdlib>
+
+#include "util/common-utils.h"
+#include "feat/wave-reader.h"
+
+namespace kaldi {
+
+// Utterances are handed out by setk-coordinator one by one, so workers(any tool
+// using DistributedTableReader) finish at the same time, instead of waiting for
+// the shard with longest utterances.
+struct WorkQueueOptions {
+    std::string work_queue;
+
+    // workers spawned by setk-coordinator join the queue by default
+    WorkQueueOptions() {
+        const char *socket_path = std::getenv("SETK_WORK_QUEUE");
+        work_queue = socket_path ? socket_path: "";
+    }
+
+    void Register(OptionsItf *opts) {
+        opts->Register("work-queue", &work_queue, "Unix domain socket of setk-coordinator, if not empty, "
+                       "utterances of input table are fetched from it instead of read sequentially "
+                       "(default is $SETK_WORK_QUEUE, set by setk-coordinator)");
+    }
+};
+
+// Fetch client of setk-coordinator. Fetching next key acknowledges that the
+// previous one is completed, so keys held by a crashed worker are handed out again.
+// Worker id is $SETK_WORKER_ID(JOB index of setk-coordinator).
+class WorkQueueClient {
+public:
+    explicit WorkQueueClient(const std::string &socket_path);
+
+    ~WorkQueueClient();
+
+    // Returns false if no keys left. If skip_last, the previous key is
+    // reported as skipped(egs. missing in input table) instead of done.
+    bool Fetch(std::string *key, bool skip_last = false);
+
+private:
+    int32 fd_;
+    std::string worker_id_;
+};
+
+// Drop-in replacement of SequentialTableReader. If work queue is configured, keys
+// come from setk-coordinator and objects are read by random access(so prefer
+// scp for rspecifier), otherwise it reads the table sequentially as usual.
+// Output of current key must be written before Next(), which acknowledges it,
+// so tools deferring writes(egs. batching) should not batch under work queue.
+template<class Holder>
+class DistributedTableReader {
+public:
+    typedef typename Holder::T T;
+
+    DistributedTableReader(const std::string &rspecifier, const WorkQueueOptions &opts):
+            client_(NULL), done_(false) {
+        if (opts.work_queue.empty()) {
+            if (!sequential_reader_.Open(rspecifier))
+                KALDI_ERR << "Failed to open table for reading: " << rspecifier;
+        } else {
+            if (!random_reader_.Open(rspecifier))
+                KALDI_ERR << "Failed to open table for reading: " << rspecifier;
+            client_ = new WorkQueueClient(opts.work_queue);
+            FetchNext();
+        }
+    }
+
+    ~DistributedTableReader() { delete client_; }
+
+    bool Done() { return client_ ? done_: sequential_reader_.Done(); }
+
+    std::string Key() { return client_ ? key_: sequential_reader_.Key(); }
+
+    const T &Value() { return client_ ? random_reader_.Value(key_): sequential_reader_.Value(); }
+
+    void Next() {
+        if (client_)
+            FetchNext();
+        else
+            sequential_reader_.Next();
+    }
+
+private:
+    SequentialTableReader<Holder> sequential_reader_;
+    RandomAccessTableReader<Holder> random_reader_;
+    WorkQueueClient *client_;
+    std::string key_;
+    bool done_;
+
+    // keys missing in this table are skipped(and reported to coordinator)
+    void FetchNext() {
+        bool skip_last = false;
+        while (client_->Fetch(&key_, skip_last)) {
+            if (random_reader_.HasKey(key_))
+                return;
+            KALDI_WARN << "Key " << key_ << " from work queue is missing in input table";
+            skip_last = true;
+        }
+        done_ = true;
+    }
+};
+
+typedef DistributedTableReader<WaveHolder> DistributedWaveReader;
+typedef DistributedTableReader<KaldiObjectHolder<Matrix<BaseFloat> > > DistributedMatrixReader;
+typedef DistributedTableReader<KaldiObjectHolder<Vector<BaseFloat> > > DistributedVectorReader;
+
+
+// Server side of work queue, used by setk-coordinator. Keys are handed out in
+// the given order(egs. longest first), and requeued at front if the worker holding
+// it disconnects without acknowledgement, at most max_retries times. Keys which
+// still crash workers after that are given up as poison keys.
+class WorkQueueCoordinator {
+public:
+    WorkQueueCoordinator(const std::string &socket_path,
+                         const std::vector<std::string> &keys,
+                         int32 max_retries = 3);
+
+    ~WorkQueueCoordinator();
+
+    // Spawn one worker for each command(by /bin/sh, with $SETK_WORK_QUEUE and
+    // $SETK_WORKER_ID = index + 1), serve them until all exit. Returns number
+    // of workers which exit with non-zero status.
+    int32 Run(const std::vector<std::string> &commands);
+
+    // Index(from 1) of worker completed each key, 0 if not completed
+    const std::vector<int32> &Owners() const { return owners_; }
+
+    // Whether each key is skipped by workers(missing in their input), not
+    // counted in Owners()
+    const std::vector<bool> &Skipped() const { return skipped_; }
+
+    // Keys given up after max_retries disconnections of their workers
+    const std::vector<std::string> &PoisonKeys() const { return poison_keys_; }
+
+    // Whether each worker exits with zero status, valid after Run()
+    const std::vector<bool> &Succeeded() const { return succeeded_; }
+
+private:
+    std::string socket_path_;
+    std::vector<std::string> keys_;
+    std::vector<int32> owners_, retries_;
+    std::vector<bool> skipped_, succeeded_;
+    std::vector<std::string> poison_keys_;
+    std::deque<int32> queue_;
+    int32 max_retries_;
+    int32 listen_fd_;
+
+    // returns false if connection should be closed
+    bool ServeRequest(int32 fd, int32 *worker, int32 *holding);
+};
+
+// Merge outputs(ark,scp) of setk-coordinator's workers into one table.
+// For each key, the entry in scp of its owner is used(entries from crashed
+// workers are ignored). If merge_archive, objects are copied into archive in
+// key order(byte by byte, so works for any type), otherwise only scp is written,
+// pointing to archives of workers.
+// Objects are checked before merged: one is complete if key of next object
+// follows it in archive, or it's the last one and worker_succeeded. Archives of
+// crashed workers may be truncated, so only objects before the first incomplete
+// one are used.
+// Returns number of keys written.
+int32 MergeWorkerTables(const std::vector<std::string> &keys,
+                        const std::vector<int32> &owners,
+                        const std::vector<std::string> &worker_scripts,
+                        const std::vector<bool> &worker_succeeded,
+                        const std::string &archive, const std::string &script,
+                        bool merge_archive);
+
+}
+
+#endif
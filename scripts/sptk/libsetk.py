@@ -0,0 +1,429 @@
+#!/usr/bin/env python
+# coding=utf-8
+# wujian@2018
+"""
+NumPy bindings of libsetk(see include/setk-c-api.h), egs:
+
+    import libsetk
+    stft = libsetk.STFT(frame_length=400, frame_shift=160, num_channels=4)
+    spectrum = stft.forward(samples)                # N x T x F
+    mvdr = libsetk.Beamformer("mvdr", stft.num_bins, 4)
+    mvdr.estimate(spectrum, mask)                   # mask: T x F
+    samples_enh = stft.inverse(mvdr.apply(spectrum))
+
+Arrays are passed to native engines in place: float32 for real ones and
+complex64 for complex ones, whose memory layout is same as CMatrix(interleaved
+real & imag). Inputs in other dtype or not in C order are converted once,
+outputs are allocated by NumPy and filled by native code directly.
+ctypes releases the GIL during each call, so engines could run in parallel
+with other Python threads. Use set_num_threads() for their own parallelism.
+
+libsetk.so is searched in $SETK_LIB, then ../../lib relative to this file.
+Depends on NumPy only(pip install numpy), which is not shipped with setk.
+"""
+
+import os
+import ctypes as C
+
+import numpy as np
+
+__all__ = [
+    "set_num_threads", "STFT", "Beamformer", "SrpPhat", "RirConfig",
+    "generate_rir"
+]
+
+_float_p = C.POINTER(C.c_float)
+
+
+def _load_library():
+    candidates = []
+    if "SETK_LIB" in os.environ:
+        candidates.append(os.environ["SETK_LIB"])
+    lib_dir = os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), "..", "..", "lib")
+    candidates += [
+        os.path.join(lib_dir, name) for name in ["libsetk.so", "libsetk.dylib"]
+    ]
+    for path in candidates:
+        if os.path.exists(path):
+            return C.CDLL(path)
+    raise RuntimeError("Could not find libsetk in {}, build it first or "
+                       "export SETK_LIB=/path/to/libsetk.so".format(
+                           ", ".join(candidates)))
+
+
+class RirConfig(C.Structure):
+    """
+    Same as setk_rir_config_t
+    """
+    _fields_ = [("sound_velocity", C.c_float), ("samp_frequency", C.c_float),
+                ("source", C.c_float * 3), ("room", C.c_float * 3),
+                ("receivers", _float_p), ("num_receivers", C.c_int),
+                ("beta", C.c_float * 6), ("num_beta", C.c_int),
+                ("num_samples", C.c_int), ("order", C.c_int),
+                ("hp_filter", C.c_int), ("microphone_type", C.c_char_p),
+                ("orientation", C.c_float * 2)]
+
+
+_lib = _load_library()
+
+
+def _declare(name, restype, argtypes):
+    func = getattr(_lib, name)
+    func.restype = restype
+    func.argtypes = argtypes
+
+
+_vp = C.c_void_p
+_int = C.c_int
+
+_declare("setk_last_error", C.c_char_p, [])
+_declare("setk_set_num_threads", _int, [_int])
+_declare("setk_stft_create", _vp, [_int, _int, C.c_char_p, _int])
+_declare("setk_stft_destroy", None, [_vp])
+_declare("setk_stft_num_bins", _int, [_vp])
+_declare("setk_stft_frame_shift", _int, [_vp])
+_declare("setk_stft_latency", _int, [_vp])
+_declare("setk_stft_push", _int, [_vp, _float_p, _int])
+_declare("setk_stft_pull", _int, [_vp, _float_p])
+_declare("setk_stft_synthesize", _int, [_vp, _float_p, _float_p])
+_declare("setk_stft_flush", _int, [_vp, _float_p])
+_declare("setk_stft_num_frames", _int, [_vp, _int])
+_declare("setk_stft_forward", _int, [_vp, _float_p, _int, _float_p])
+_declare("setk_stft_inverse", _int, [_vp, _float_p, _int, _float_p])
+_declare("setk_beamformer_create", _vp,
+         [C.c_char_p, _int, _int, C.c_float, _int])
+_declare("setk_beamformer_destroy", None, [_vp])
+_declare("setk_beamformer_set_weights", _int, [_vp, _float_p])
+_declare("setk_beamformer_get_weights", _int, [_vp, _float_p])
+_declare("setk_beamformer_push", _int, [_vp, _float_p, _float_p])
+_declare("setk_beamformer_pull", _int, [_vp, _float_p])
+_declare("setk_beamformer_estimate", _int, [_vp, _float_p, _float_p, _int])
+_declare("setk_beamformer_apply", _int, [_vp, _float_p, _int, _float_p])
+_declare("setk_srp_create", _vp,
+         [_float_p, _int, C.c_float, _int, _int, _int])
+_declare("setk_srp_destroy", None, [_vp])
+_declare("setk_srp_resolution", _int, [_vp])
+_declare("setk_srp_push", _int, [_vp, _float_p])
+_declare("setk_srp_pull", _int, [_vp, _float_p])
+_declare("setk_srp_compute", _int, [_vp, _float_p, _int, _float_p])
+_declare("setk_rir_config_init", None, [C.POINTER(RirConfig)])
+_declare("setk_rir_num_samples", _int, [C.POINTER(RirConfig)])
+_declare("setk_rir_generate", _int, [C.POINTER(RirConfig), _float_p])
+
+
+def _check(ret):
+    if ret < 0:
+        raise RuntimeError(_lib.setk_last_error().decode())
+    return ret
+
+
+def _check_handle(handle):
+    if not handle:
+        raise RuntimeError(_lib.setk_last_error().decode())
+    return handle
+
+
+def _as_input(array, dtype, shape=None):
+    """
+    View of array in given dtype & C order, copy only if needed
+    """
+    array = np.ascontiguousarray(array, dtype=dtype)
+    if shape is not None and array.shape != shape:
+        raise ValueError("Expect array in shape {}, got {}".format(
+            shape, array.shape))
+    return array
+
+
+def _ptr(array):
+    # complex64 is viewed as interleaved float32
+    return array.ctypes.data_as(_float_p)
+
+
+def set_num_threads(num_threads):
+    """
+    Size of thread pool shared by all engines, 0 means number of cores
+    """
+    _check(_lib.setk_set_num_threads(num_threads))
+
+
+class _Handle(object):
+    _destroy = None
+
+    def __init__(self, handle):
+        self._handle = _check_handle(handle)
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            self._destroy(self._handle)
+            self._handle = None
+
+
+class STFT(_Handle):
+    """
+    STFT & overlapadd, same as ShortTimeFTComputer. Frames are not centered,
+    egs. librosa.stft(center=False)
+    """
+    _destroy = _lib.setk_stft_destroy
+
+    def __init__(self,
+                 frame_length=1024,
+                 frame_shift=256,
+                 window="hamming",
+                 num_channels=1):
+        super(STFT, self).__init__(
+            _lib.setk_stft_create(frame_length, frame_shift, window.encode(),
+                                  num_channels))
+        self.num_channels = num_channels
+        self.frame_length = frame_length
+        self.frame_shift = _lib.setk_stft_frame_shift(self._handle)
+        self.latency = _lib.setk_stft_latency(self._handle)
+        self.num_bins = _lib.setk_stft_num_bins(self._handle)
+
+    def forward(self, samples):
+        """
+        Arguments: (for N: num_channels, S: num_samples)
+            samples: shape as N x S(or S if N == 1)
+        Return:
+            spectrum: shape as N x T x F(or T x F if N == 1), complex64
+        """
+        samples = _as_input(samples, np.float32)
+        if samples.ndim != 2:
+            samples = samples.reshape(self.num_channels, -1)
+        if samples.shape[0] != self.num_channels:
+            raise ValueError("Expect {} channels, got {}".format(
+                self.num_channels, samples.shape[0]))
+        num_samples = samples.shape[1]
+        num_frames = _check(
+            _lib.setk_stft_num_frames(self._handle, num_samples))
+        spectrum = np.empty(
+            [self.num_channels, num_frames, self.num_bins], dtype=np.complex64)
+        _check(
+            _lib.setk_stft_forward(self._handle, _ptr(samples), num_samples,
+                                   _ptr(spectrum)))
+        return spectrum[0] if self.num_channels == 1 else spectrum
+
+    def inverse(self, spectrum):
+        """
+        Arguments: (for T: num_frames, F: num_bins)
+            spectrum: shape as T x F, single channel
+        Return:
+            samples: shape as (T - 1) x frame_shift + frame_length, not normalized
+        """
+        spectrum = _as_input(spectrum, np.complex64)
+        if spectrum.ndim != 2 or spectrum.shape[1] != self.num_bins:
+            raise ValueError("Expect spectrum in shape T x {}, got {}".format(
+                self.num_bins, spectrum.shape))
+        num_frames = spectrum.shape[0]
+        samples = np.empty(
+            (num_frames - 1) * self.frame_shift + self.frame_length,
+            dtype=np.float32)
+        _check(
+            _lib.setk_stft_inverse(self._handle, _ptr(spectrum), num_frames,
+                                   _ptr(samples)))
+        return samples
+
+    def push(self, chunk):
+        """
+        Streaming analysis, chunk: N x S, returns frames ready: N x T x F
+        """
+        chunk = _as_input(chunk, np.float32)
+        if chunk.ndim != 2:
+            chunk = chunk.reshape(self.num_channels, -1)
+        _check(_lib.setk_stft_push(self._handle, _ptr(chunk), chunk.shape[1]))
+        frames = []
+        frame = np.empty([self.num_channels, self.num_bins], dtype=np.complex64)
+        while _check(_lib.setk_stft_pull(self._handle, _ptr(frame))) == 1:
+            frames.append(frame.copy())
+        if not frames:
+            return np.empty([self.num_channels, 0, self.num_bins],
+                            dtype=np.complex64)
+        return np.stack(frames, axis=1)
+
+    def synthesize(self, frame):
+        """
+        Streaming overlapadd of one frame(F), returns frame_shift samples finished
+        """
+        frame = _as_input(frame, np.complex64, (self.num_bins, ))
+        samples = np.empty(self.frame_shift, dtype=np.float32)
+        _check(
+            _lib.setk_stft_synthesize(self._handle, _ptr(frame),
+                                      _ptr(samples)))
+        return samples
+
+    def flush(self):
+        samples = np.empty(self.latency - self.frame_shift, dtype=np.float32)
+        _check(_lib.setk_stft_flush(self._handle, _ptr(samples)))
+        return samples
+
+
+class Beamformer(_Handle):
+    """
+    "fixed"|"mvdr"|"gevd" beamformer. Offline ones estimate weights on the whole
+    utterance(estimate() then apply()), online ones update psd recursively
+    using forget_factor(process())
+    """
+    _destroy = _lib.setk_beamformer_destroy
+
+    def __init__(self,
+                 beamformer,
+                 num_bins,
+                 num_channels,
+                 forget_factor=0.98,
+                 update_periods=20):
+        super(Beamformer, self).__init__(
+            _lib.setk_beamformer_create(beamformer.encode(), num_bins,
+                                        num_channels, forget_factor,
+                                        update_periods))
+        self.num_bins = num_bins
+        self.num_channels = num_channels
+
+    @property
+    def weights(self):
+        """
+        F x N, complex64
+        """
+        weights = np.empty(
+            [self.num_bins, self.num_channels], dtype=np.complex64)
+        _check(_lib.setk_beamformer_get_weights(self._handle, _ptr(weights)))
+        return weights
+
+    @weights.setter
+    def weights(self, weights):
+        weights = _as_input(weights, np.complex64,
+                            (self.num_bins, self.num_channels))
+        _check(_lib.setk_beamformer_set_weights(self._handle, _ptr(weights)))
+
+    def _check_spectrum(self, spectrum):
+        spectrum = _as_input(spectrum, np.complex64)
+        if spectrum.ndim != 3 or spectrum.shape[0] != self.num_channels \
+                or spectrum.shape[2] != self.num_bins:
+            raise ValueError(
+                "Expect spectrum in shape {} x T x {}, got {}".format(
+                    self.num_channels, self.num_bins, spectrum.shape))
+        return spectrum
+
+    def estimate(self, spectrum, target_mask):
+        """
+        Arguments: (for N: num_channels, F: num_bins, T: num_frames)
+            spectrum: shape as N x T x F
+            target_mask: shape as T x F, noise mask is 1 - target_mask
+        """
+        spectrum = self._check_spectrum(spectrum)
+        num_frames = spectrum.shape[1]
+        target_mask = _as_input(target_mask, np.float32,
+                                (num_frames, self.num_bins))
+        _check(
+            _lib.setk_beamformer_estimate(self._handle, _ptr(spectrum),
+                                          _ptr(target_mask), num_frames))
+
+    def apply(self, spectrum):
+        """
+        Arguments:
+            spectrum: shape as N x T x F
+        Return:
+            enhanced: shape as T x F, using current weights
+        """
+        spectrum = self._check_spectrum(spectrum)
+        num_frames = spectrum.shape[1]
+        enhanced = np.empty([num_frames, self.num_bins], dtype=np.complex64)
+        _check(
+            _lib.setk_beamformer_apply(self._handle, _ptr(spectrum),
+                                       num_frames, _ptr(enhanced)))
+        return enhanced
+
+    def process(self, frame, mask=None):
+        """
+        Streaming beamforming of one frame
+        Arguments:
+            frame: shape as N x F
+            mask: shape as F, could be None for fixed beamformer
+        Return:
+            enhanced: shape as F
+        """
+        frame = _as_input(frame, np.complex64,
+                          (self.num_channels, self.num_bins))
+        if mask is not None:
+            mask = _as_input(mask, np.float32, (self.num_bins, ))
+        _check(
+            _lib.setk_beamformer_push(self._handle, _ptr(frame),
+                                      None if mask is None else _ptr(mask)))
+        enhanced = np.empty(self.num_bins, dtype=np.complex64)
+        _check(_lib.setk_beamformer_pull(self._handle, _ptr(enhanced)))
+        return enhanced
+
+
+class SrpPhat(_Handle):
+    """
+    SRP-PHAT angular spectrum of linear array
+    """
+    _destroy = _lib.setk_srp_destroy
+
+    def __init__(self,
+                 topo,
+                 samp_frequency,
+                 num_bins,
+                 resolution=180,
+                 samp_doa=False):
+        topo = _as_input(topo, np.float32)
+        super(SrpPhat, self).__init__(
+            _lib.setk_srp_create(
+                _ptr(topo), topo.size, samp_frequency, num_bins, resolution,
+                int(samp_doa)))
+        self.num_mics = topo.size
+        self.num_bins = num_bins
+        self.resolution = _lib.setk_srp_resolution(self._handle)
+
+    def compute(self, spectrum):
+        """
+        Arguments: (for N: num_mics, F: num_bins, T: num_frames)
+            spectrum: shape as N x T x F
+        Return:
+            spectra: shape as T x resolution
+        """
+        spectrum = _as_input(spectrum, np.complex64)
+        if spectrum.ndim != 3 or spectrum.shape[0] != self.num_mics \
+                or spectrum.shape[2] != self.num_bins:
+            raise ValueError(
+                "Expect spectrum in shape {} x T x {}, got {}".format(
+                    self.num_mics, self.num_bins, spectrum.shape))
+        num_frames = spectrum.shape[1]
+        spectra = np.empty([num_frames, self.resolution], dtype=np.float32)
+        _check(
+            _lib.setk_srp_compute(self._handle, _ptr(spectrum), num_frames,
+                                  _ptr(spectra)))
+        return spectra
+
+
+def generate_rir(receivers, source, room, beta, **kwargs):
+    """
+    Arguments:
+        receivers: shape as M x 3, in meters
+        source, room: 3 floats
+        beta: T60, or 6 reflection coefficients
+        kwargs: other fields of RirConfig, egs. samp_frequency
+    Return:
+        rir: shape as M x num_samples
+    """
+    conf = RirConfig()
+    _lib.setk_rir_config_init(C.byref(conf))
+    receivers = _as_input(receivers, np.float32)
+    receivers = receivers.reshape(-1, 3)
+    beta = np.atleast_1d(beta)
+    conf.receivers = _ptr(receivers)
+    conf.num_receivers = receivers.shape[0]
+    conf.source[:] = list(source)
+    conf.room[:] = list(room)
+    conf.beta[:beta.size] = list(beta)
+    conf.num_beta = beta.size
+    for key, value in kwargs.items():
+        if key == "microphone_type":
+            value = value.encode()
+        if key == "orientation":
+            conf.orientation[:] = list(value)
+        else:
+            setattr(conf, key, value)
+    num_samples = _check(_lib.setk_rir_num_samples(C.byref(conf)))
+    rir = np.empty([receivers.shape[0], num_samples], dtype=np.float32)
+    _check(_lib.setk_rir_generate(C.byref(conf), _ptr(rir)))
+    return rir
@@ -0,0 +1,188 @@
+// apply-echo-canceller.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/echo-canceller.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
+
+using namespace kaldi;
+
+// mic:     (num_channels, num_samples)
+// ref:     (num_samples), shorter one is padded with zeros
+void DoEchoCancellation(const EchoCancellerOptions &opts,
+                        const MatrixBase<BaseFloat> &mic,
+                        const VectorBase<BaseFloat> &ref,
+                        Matrix<BaseFloat> *out) {
+    if (mic.NumCols() != ref.Dim())
+        KALDI_WARN << "Length of microphone & reference differs: "
+                   << mic.NumCols() << " vs " << ref.Dim() << ", pad reference with zeros";
+    Vector<BaseFloat> aligned_ref(mic.NumCols());
+    int32 num_samples = std::min(mic.NumCols(), ref.Dim());
+    aligned_ref.Range(0, num_samples).CopyFromVec(ref.Range(0, num_samples));
+    CancelEcho(opts, mic, aligned_ref, out);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Cancel acoustic echo of (multi-channel) microphone signals with far-end reference, using\n"
+            "partitioned-block frequency-domain adaptive filter, egs. before beamforming\n"
+            "\n"
+            "Usage:  apply-echo-canceller [options...] <mic-wav-rspecifier> <ref-wav-rspecifier> <wav-wspecifier>\n"
+            "   or:  apply-echo-canceller [options...] <mic-wav-rxfilename> <ref-wav-rxfilename> <wav-wxfilename>\n"
+            "   or:  apply-echo-canceller [options...] --ref-channel=<n> <mic-wav-rspecifier> <wav-wspecifier>\n"
+            "   or:  apply-echo-canceller [options...] --ref-channel=<n> <mic-wav-rxfilename> <wav-wxfilename>\n"
+            "Far-end reference is the first channel of reference wave, or channel <n> of microphone wave\n"
+            "(which is removed from output) if --ref-channel is given.\n";
+
+        ParseOptions po(usage);
+        int32 ref_channel = -1;
+        po.Register("ref-channel", &ref_channel, "If not negative, far-end reference is this channel "
+                    "of microphone wave, instead of a separate reference wave");
+
+        EchoCancellerOptions aec_options;
+        aec_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        int32 num_args = ref_channel >= 0 ? 2: 3;
+        if (po.NumArgs() != num_args) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
+        std::string mic_in = po.GetArg(1), ref_in = ref_channel >= 0 ? "": po.GetArg(2),
+                    enh_out = po.GetArg(num_args);
+
+        bool mic_is_rspecifier = (ClassifyRspecifier(mic_in, NULL, NULL) != kNoRspecifier),
+             enh_is_wspecifier = (ClassifyWspecifier(enh_out, NULL, NULL, NULL) != kNoWspecifier);
+        if (mic_is_rspecifier != enh_is_wspecifier)
+            KALDI_ERR << "Cannot mix archives with regular files";
+        if (ref_channel < 0 && mic_is_rspecifier != (ClassifyRspecifier(ref_in, NULL, NULL) != kNoRspecifier))
+            KALDI_ERR << "Configure with microphone and reference must keep same";
+
+        WaveResampler mic_resampler(resample_options), ref_resampler(resample_options);
+
+        // returns false if failed
+        auto cancel_echo = [&](const std::string &key, const WaveData &mic_data,
+                               const WaveData *ref_data, WaveData *enh_data) -> bool {
+            const Matrix<BaseFloat> &mic = mic_resampler.Resample(mic_data);
+            BaseFloat samp_freq = mic_resampler.SampFreq(mic_data);
+            Matrix<BaseFloat> enh;
+            if (ref_channel >= 0) {
+                int32 num_channels = mic.NumRows();
+                if (ref_channel >= num_channels || num_channels == 1) {
+                    KALDI_WARN << key << ": reference channel " << ref_channel << " is not valid for "
+                               << num_channels << " channels";
+                    return false;
+                }
+                Matrix<BaseFloat> near(num_channels - 1, mic.NumCols(), kUndefined);
+                for (int32 c = 0, n = 0; c < num_channels; c++)
+                    if (c != ref_channel) near.Row(n++).CopyFromVec(mic.Row(c));
+                DoEchoCancellation(aec_options, near, mic.Row(ref_channel), &enh);
+            } else {
+                if (ref_resampler.SampFreq(*ref_data) != samp_freq) {
+                    KALDI_WARN << key << ": sample frequency of microphone & reference differs"
+                               << "(or use --target-samp-freq)";
+                    return false;
+                }
+                const Matrix<BaseFloat> &ref = ref_resampler.Resample(*ref_data);
+                DoEchoCancellation(aec_options, mic, ref.Row(0), &enh);
+            }
+            *enh_data = WaveData(samp_freq, enh);
+            return true;
+        };
+
+        if (mic_is_rspecifier) {
+            DistributedWaveReader mic_reader(mic_in, work_queue_options);
+            RandomAccessTableReader<WaveHolder> ref_reader;
+            if (ref_channel < 0)
+                ref_reader.Open(ref_in);
+            ResumableWaveWriter wav_writer(enh_out, resume_options);
+
+            int32 num_utts = 0, num_done = 0;
+            for (; !mic_reader.Done(); mic_reader.Next()) {
+                std::string utt_key = mic_reader.Key();
+                if (wav_writer.IsDone(utt_key))
+                    continue;
+                num_utts++;
+                if (ref_channel < 0 && !ref_reader.HasKey(utt_key)) {
+                    KALDI_WARN << utt_key << ", missing far-end reference";
+                    continue;
+                }
+                WaveData enh_data;
+                if (!cancel_echo(utt_key, mic_reader.Value(),
+                                 ref_channel < 0 ? &ref_reader.Value(utt_key): NULL, &enh_data))
+                    continue;
+                { SETK_PROFILE("write"); wav_writer.Write(utt_key, enh_data); }
+                num_done++;
+                profile_session.EndUtterance();
+                if (num_done % 100 == 0)
+                    KALDI_LOG << "Processed " << num_utts << " utterances";
+                KALDI_VLOG(2) << "Cancel echo for utterance " << utt_key;
+            }
+            KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts;
+            return num_done + wav_writer.NumDone() == 0 ? 1: 0;
+        } else {
+            bool binary;
+            WaveData mic_data, ref_data, enh_data;
+            {
+                Input ki(mic_in, &binary);
+                mic_data.Read(ki.Stream());
+            }
+            if (ref_channel < 0) {
+                Input ki(ref_in, &binary);
+                ref_data.Read(ki.Stream());
+            }
+            if (!cancel_echo(mic_in, mic_data, ref_channel < 0 ? &ref_data: NULL, &enh_data))
+                return 1;
+            Output ko(enh_out, true, false);
+            enh_data.Write(ko.Stream());
+            KALDI_LOG << "Done processed " << mic_in;
+        }
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
@@ -20,8 +20,17 @@
 // limitations under the License.
 
 
+#include <memory>
+
 #include "include/stft.h"
 #include "include/beamformer.h"
+#include "include/beam-weight-table.h"
+#include "include/stft-feature.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
@@ -29,6 +38,7 @@ BaseFloat DoBeamforming(ShortTimeFTComputer &stft_computer,
                   const Matrix<BaseFloat> &data,
                   const CMatrix<BaseFloat> &weight,
                   int32 num_bins, int32 num_chs,
+                  const PostFilterOptions &post_filter_opts,
                   Matrix<BaseFloat> *enh_rstft) {
     Matrix<BaseFloat> rstft;
     stft_computer.Compute(data, &rstft, NULL, NULL);
@@ -45,6 +55,7 @@ BaseFloat DoBeamforming(ShortTimeFTComputer &stft_computer,
 
     TrimStft(num_bins, num_chs, cstft, &src_stft); 
     Beamform(src_stft, weight, &enh_cstft);
+    ApplyPostFilter(post_filter_opts, NULL, &enh_cstft);
     CastIntoRealfft(enh_cstft, enh_rstft);
     return range;
 }
@@ -56,21 +67,52 @@ int main(int argc, char *argv[]) {
                 "you need to pre-design/compute beam weights according to array's topology and other prior infomation, such as DoA\n"
                 "It's designed for DS(delay and sum) or superdirective beamformer\n"
                 "\n"
-                "Usage: apply-fixed-beamformer [options...] <wav-rspecifier> <complex-mat-rxfilename> <wav-wspecifier>\n"
-                "or   : apply-fixed-beamformer [options...] <wav-rxfilename> <complex-mat-rxfilename> <wav-wxfilename>\n"
+                "Weights could be one matrix for all utterances, or a table keyed by utterance(or by weight id\n"
+                "given in --utt2weight, egs. speaker position or session), cached in memory(prefer scp)\n"
+                "\n"
+                "Usage: apply-fixed-beamformer [options...] <wav-rspecifier> <complex-mat-rxfilename> <wspecifier>\n"
+                "or   : apply-fixed-beamformer [options...] <wav-rspecifier> <complex-mat-rspecifier> <wspecifier>\n"
+                "or   : apply-fixed-beamformer [options...] <wav-rxfilename> <complex-mat-rxfilename> <wxfilename>\n"
                 "e.g:\n"
-                "   apply-fixed-beamformer 4ch.wav weight.cmat enhan.wav\n";
+                "   apply-fixed-beamformer 4ch.wav weight.cmat enhan.wav\n"
+                "   apply-fixed-beamformer --utt2weight=ark:utt2pos scp:wav.scp scp:weight.scp ark:enhan.ark\n";
 
         ParseOptions po(usage);
         ShortTimeFTOptions stft_options;
 
         bool track_volumn = true, normalize_output = false;
+        std::string utt2weight_rspecifier;
+        int32 weight_cache_size = 32;
 
         po.Register("track-volumn", &track_volumn, "If true, set target's volumn as average of input channels'");
         po.Register("normalize-output", &normalize_output, 
                     "If true, normalize enhanced samples when write files");
+        po.Register("utt2weight", &utt2weight_rspecifier, "Rspecifier of map from utterance to weight id, "
+                    "egs. utt2spk-style file. If empty, weights are keyed by utterance");
+        po.Register("weight-cache-size", &weight_cache_size, "Number of beam weights kept in memory "
+                    "(least recently used ones are dropped), if weights are given in rspecifier");
         
         stft_options.Register(&po);
+        PostFilterOptions post_filter_options;
+        post_filter_options.Register(&po);
+
+        StftFeatureOptions feature_options;
+        feature_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
@@ -78,10 +120,16 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         if (track_volumn && normalize_output)
             KALDI_ERR << "Options --track-volumn conflict with --normalize-output, " 
                       << "setting one of them true, or both false";
 
+        if (post_filter_options.post_filter == "mask")
+            KALDI_ERR << "Fixed beamformer has no target mask, use --post-filter=wiener instead";
+
         std::string chs_in = po.GetArg(1), enhan_out = po.GetArg(3);
 
         bool in_is_rspecifier = (ClassifyRspecifier(chs_in, NULL, NULL) != kNoRspecifier),
@@ -90,29 +138,71 @@ int main(int argc, char *argv[]) {
         if (in_is_rspecifier != out_is_wspecifier)
             KALDI_ERR << "Cannot mix archives with regular files";
 
+        std::string weight_in = po.GetArg(2);
+        bool weight_is_rspecifier = (ClassifyRspecifier(weight_in, NULL, NULL) != kNoRspecifier);
+        if (weight_is_rspecifier && !in_is_rspecifier)
+            KALDI_ERR << "Weights in rspecifier are only supported with wave rspecifier";
+        if (!utt2weight_rspecifier.empty() && !weight_is_rspecifier)
+            KALDI_ERR << "--utt2weight requires weights in rspecifier";
+
         CMatrix<BaseFloat> beam_weight;
-        ReadKaldiObject(po.GetArg(2), &beam_weight);
-        int32 num_bins = beam_weight.NumRows(), num_chs = beam_weight.NumCols();
+        if (!weight_is_rspecifier)
+            ReadKaldiObject(weight_in, &beam_weight);
         ShortTimeFTComputer stft_computer(stft_options);
-
+        StftFeatureComputer feature_computer(feature_options, &stft_computer);
+        WaveResampler resampler(resample_options);
 
         if (in_is_rspecifier) {
-            SequentialTableReader<WaveHolder> wave_reader(chs_in);
-            TableWriter<WaveHolder> wav_writer(enhan_out);
-
-            int num_utts = 0;
+            DistributedWaveReader wave_reader(chs_in, work_queue_options);
+            // enhanced waves, or features computed on enhanced stft
+            ResumableWaveWriter wav_writer;
+            ResumableMatrixWriter feats_writer;
+            if (feature_options.OutputWave())
+                wav_writer.Open(enhan_out, resume_options);
+            else
+                feats_writer.Open(enhan_out, resume_options);
+
+            std::unique_ptr<BeamWeightTable> weight_table;
+            RandomAccessTokenReader utt2weight_reader;
+            if (weight_is_rspecifier)
+                weight_table.reset(new BeamWeightTable(weight_in, weight_cache_size));
+            if (!utt2weight_rspecifier.empty())
+                utt2weight_reader.Open(utt2weight_rspecifier);
+
+            int num_utts = 0, num_err = 0;
             for (; !wave_reader.Done(); wave_reader.Next()) {
                 std::string utt_key = wave_reader.Key();
+                if (wav_writer.IsDone(utt_key) || feats_writer.IsDone(utt_key))
+                    continue;
+                const CMatrix<BaseFloat> *weight = &beam_weight;
+                if (weight_table) {
+                    std::string weight_id = utt_key;
+                    if (!utt2weight_rspecifier.empty()) {
+                        if (!utt2weight_reader.HasKey(utt_key)) {
+                            KALDI_WARN << utt_key << ", missing weight id in utt2weight";
+                            num_err++;
+                            continue;
+                        }
+                        weight_id = utt2weight_reader.Value(utt_key);
+                    }
+                    weight = weight_table->Value(weight_id);
+                    if (!weight) {
+                        KALDI_WARN << utt_key << ", missing beam weights " << weight_id;
+                        num_err++;
+                        continue;
+                    }
+                }
+                int32 num_bins = weight->NumRows(), num_chs = weight->NumCols();
                 const WaveData &wave_data = wave_reader.Value();
-                BaseFloat target_freq = wave_data.SampFreq();
+                BaseFloat target_freq = resampler.SampFreq(wave_data);
 
                 if (wave_data.Data().NumRows() != num_chs) 
                     KALDI_ERR << "Input weight designed for " << num_chs << " channels, but utterance "
                               << utt_key << " has " << wave_data.Data().NumRows() << " channels";                
 
                 Matrix<BaseFloat> enh_rstft, enhan_speech;
-                BaseFloat range = DoBeamforming(stft_computer, wave_data.Data(), beam_weight, 
-                                                num_bins, num_chs, &enh_rstft);
+                BaseFloat range = DoBeamforming(stft_computer, resampler.Resample(wave_data), *weight, 
+                                                num_bins, num_chs, post_filter_options, &enh_rstft);
 
                 if (track_volumn) {
                     range = range / num_chs - 1;
@@ -121,19 +211,28 @@ int main(int argc, char *argv[]) {
                 } else {
                     range = -1; // keep what it is
                 }
-                stft_computer.InverseShortTimeFT(enh_rstft, &enhan_speech, range);
-
-                WaveData enhan_wavedata(target_freq, enhan_speech);
-                wav_writer.Write(utt_key, enhan_wavedata);
+                if (feature_options.OutputWave()) {
+                    stft_computer.InverseShortTimeFT(enh_rstft, &enhan_speech, range);
+                    WaveData enhan_wavedata(target_freq, enhan_speech);
+                    { SETK_PROFILE("write"); wav_writer.Write(utt_key, enhan_wavedata); }
+                } else {
+                    Matrix<BaseFloat> feats;
+                    feature_computer.Compute(&enh_rstft, target_freq, &feats);
+                    SETK_PROFILE("write");
+                    feats_writer.Write(utt_key, feats);
+                }
 
                 num_utts += 1;
+                profile_session.EndUtterance();
                 if (num_utts % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
                 KALDI_VLOG(2) << "Processed features for key " << utt_key;
 
             }
-            KALDI_LOG << "Done " << num_utts << " utterances";
-            return num_utts == 0 ? 1: 0;
+            if (weight_table)
+                KALDI_LOG << "Loaded beam weights " << weight_table->NumLoads() << " times";
+            KALDI_LOG << "Done " << num_utts << " utterances, failed for " << num_err;
+            return num_utts + wav_writer.NumDone() + feats_writer.NumDone() == 0 ? 1: 0;
 
         } else {
             bool binary;
@@ -141,10 +240,12 @@ int main(int argc, char *argv[]) {
             WaveData wave_data;
             wave_data.Read(wave_in.Stream());
             
+            int32 num_bins = beam_weight.NumRows(), num_chs = beam_weight.NumCols();
             KALDI_ASSERT(num_chs == wave_data.Data().NumRows());
+            BaseFloat target_freq = resampler.SampFreq(wave_data);
             Matrix<BaseFloat> enh_rstft, enhan_speech;
-            BaseFloat range = DoBeamforming(stft_computer, wave_data.Data(), beam_weight, 
-                                            num_bins, num_chs, &enh_rstft);
+            BaseFloat range = DoBeamforming(stft_computer, resampler.Resample(wave_data), beam_weight, 
+                                            num_bins, num_chs, post_filter_options, &enh_rstft);
             if (track_volumn) {
                 range = range / num_chs - 1;
             } else if (normalize_output) {
@@ -152,11 +253,16 @@ int main(int argc, char *argv[]) {
             } else {
                 range = -1;
             }
-            stft_computer.InverseShortTimeFT(enh_rstft, &enhan_speech, range);
-
-            WaveData enhan_wavedata(wave_data.SampFreq(), enhan_speech);
-            Output ko(enhan_out, binary, false);
-            enhan_wavedata.Write(ko.Stream());
+            if (feature_options.OutputWave()) {
+                stft_computer.InverseShortTimeFT(enh_rstft, &enhan_speech, range);
+                WaveData enhan_wavedata(target_freq, enhan_speech);
+                Output ko(enhan_out, binary, false);
+                enhan_wavedata.Write(ko.Stream());
+            } else {
+                Matrix<BaseFloat> feats;
+                feature_computer.Compute(&enh_rstft, target_freq, &feats);
+                WriteKaldiObject(feats, enhan_out, true);
+            }
 
             KALDI_LOG << "Done " << chs_in;
         }
@@ -0,0 +1,333 @@
+// src/apply-nnet3-beamformer.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nnet3/nnet-am-decodable-simple.h"
+#include "nnet3/nnet-utils.h"
+#if HAVE_CUDA == 1
+#include "cudamatrix/cu-device.h"
+#endif
+
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/stft-feature.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
+
+using namespace kaldi;
+using namespace kaldi::nnet3;
+
+void ParseInputRspecifier(std::string &input_rspecifier,
+                          std::vector<std::string> *rspecifiers) {
+    size_t found = input_rspecifier.find_first_of(":", 0);
+    if (found == std::string::npos)
+        KALDI_ERR << "Wrong input-rspecifier format: " << input_rspecifier;
+    const std::string &decorator = input_rspecifier.substr(0, found);
+
+    std::vector<std::string> tmp;
+    SplitStringToVector(input_rspecifier.substr(found + 1), ",", false, &tmp);
+    for (std::string &s: tmp)
+        rspecifiers->push_back(decorator + ":" + s);
+}
+
+int main(int argc, char *argv[]) {
+    try{
+        const char *usage =
+            "Do mask based beamformer(MVDR or GEVD), with masks computed by nnet3 model in process.\n"
+            "Masks are computed chunk by chunk and accumulated into psd of target & noise while\n"
+            "the next chunk is being computed, so no mask archives are needed.\n"
+            "\n"
+            "Usage: apply-nnet3-beamformer [options...] <nnet3-in> <feats-rspecifier> <input-rspecifier> <target-wspecifier>\n"
+            "\n"
+            "e.g.:\n"
+            " apply-nnet3-beamformer --config=mask.conf final.raw scp:feats.scp scp:CH1.scp,CH2.scp,CH3.scp scp:dst.scp\n";
+
+        ParseOptions po(usage);
+        ShortTimeFTOptions stft_options;
+
+        bool track_volumn = true, normalize_input = true, apply_exp = false;
+        std::string window = "hamming", beamformer = "mvdr", use_gpu = "no";
+        BaseFloat frame_shift = 256, frame_length = 1024;
+        int32 weights_decimation = 1;
+        BaseFloat psd_mask_floor = 0;
+
+        po.Register("frame-shift", &frame_shift, "Frame shift in number of samples");
+        po.Register("frame-length", &frame_length, "Frame length in number of samples");
+        po.Register("window", &window, "Type of window(\"hamming\"|\"hanning\"|\"blackman\"|\"rectangular\")");
+        po.Register("track-volumn", &track_volumn,
+                    "If true, using average volumn of input channels as target's");
+        po.Register("normalize-input", &normalize_input,
+                    "Scale samples into float in range [-1, 1], like MATLAB or librosa");
+        po.Register("beamformer", &beamformer, "Type(\"mvdr\"|\"gevd\") of beamformer");
+        po.Register("apply-exp", &apply_exp, "If true, apply exp on outputs of nnet3 model to get masks");
+        po.Register("use-gpu", &use_gpu, "yes|no|optional|wait, only has effect if compiled with CUDA");
+        po.Register("weights-decimation", &weights_decimation, "If larger than 1, compute beam weights "
+                    "on every weights-decimation bins and copy to the others(approximation)");
+        po.Register("psd-mask-floor", &psd_mask_floor, "If positive, skip frames whose mask is not "
+                    "larger than it when estimating psd(approximation)");
+
+        // same as local/run_beamformer.sh
+        NnetSimpleComputationOptions compute_options;
+        compute_options.acoustic_scale = 1.0;
+        compute_options.frames_per_chunk = 140;
+        compute_options.extra_left_context = 40;
+        compute_options.extra_right_context = 40;
+        compute_options.Register(&po);
+
+        PostFilterOptions post_filter_options;
+        post_filter_options.Register(&po);
+
+        StftFeatureOptions feature_options;
+        feature_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 4) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
+#if HAVE_CUDA == 1
+        CuDevice::Instantiate().SelectGpuId(use_gpu);
+#else
+        if (use_gpu != "no")
+            KALDI_WARN << "Not compiled with CUDA(HAVE_CUDA is not defined by kaldi.mk), "
+                       << "ignore --use-gpu=" << use_gpu;
+#endif
+
+        if (beamformer != "mvdr" && beamformer != "gevd")
+            KALDI_ERR << "Unknown type of beamformer: " << beamformer;
+        // masks are needed on every frame of stft
+        if (compute_options.frame_subsampling_factor != 1)
+            KALDI_ERR << "--frame-subsampling-factor is not supported for mask estimation";
+
+        std::string nnet_rxfilename = po.GetArg(1), feats_rspecifier = po.GetArg(2),
+                    input_rspecifier = po.GetArg(3), enhan_wspecifier = po.GetArg(4);
+
+        Nnet nnet;
+        ReadKaldiObject(nnet_rxfilename, &nnet);
+        SetBatchnormTestMode(true, &nnet);
+        SetDropoutTestMode(true, &nnet);
+        CollapseModel(CollapseModelConfig(), &nnet);
+
+        CachingOptimizingCompiler compiler(nnet, compute_options.optimize_config);
+        // no priors for masks
+        Vector<BaseFloat> priors;
+
+        std::vector<std::string> rspecifiers;
+        ParseInputRspecifier(input_rspecifier, &rspecifiers);
+
+        int32 num_channels = rspecifiers.size();
+
+        std::vector<RandomAccessTableReader<WaveHolder> > wav_reader(num_channels);
+        for (int32 c = 0; c < num_channels; c++) {
+            std::string &cur_ch = rspecifiers[c];
+            if (ClassifyRspecifier(cur_ch, NULL, NULL) == kNoRspecifier)
+                KALDI_ERR << cur_ch << " is not a rspecifier";
+            KALDI_ASSERT(wav_reader[c].Open(cur_ch));
+        }
+
+        stft_options.window = window;
+        stft_options.normalize_input = normalize_input;
+        stft_options.frame_shift = frame_shift;
+        stft_options.frame_length = frame_length;
+
+        ShortTimeFTComputer stft_computer(stft_options);
+
+        DistributedMatrixReader feats_reader(feats_rspecifier, work_queue_options);
+        // enhanced waves, or features computed on enhanced stft
+        ResumableWaveWriter wav_writer;
+        ResumableMatrixWriter feats_writer;
+        if (feature_options.OutputWave())
+            wav_writer.Open(enhan_wspecifier, resume_options);
+        else
+            feats_writer.Open(enhan_wspecifier, resume_options);
+        StftFeatureComputer feature_computer(feature_options, &stft_computer);
+
+        int32 num_done = 0, num_miss = 0, num_utts = 0;
+        int32 chunk_width = compute_options.frames_per_chunk;
+
+        std::vector<Matrix<BaseFloat> > mstft(num_channels);
+        std::vector<BaseFloat> mfreq(num_channels);
+        WaveResampler resampler(resample_options);
+
+        for (; !feats_reader.Done(); feats_reader.Next()) {
+            std::string utt_key = feats_reader.Key();
+            if (wav_writer.IsDone(utt_key) || feats_writer.IsDone(utt_key))
+                continue;
+            const Matrix<BaseFloat> &feats = feats_reader.Value();
+
+            BaseFloat range = 0.0;
+            num_utts++;
+
+            int32 cur_ch = 0;
+            for (int32 c = 0; c < num_channels; c++) {
+                if (wav_reader[c].HasKey(utt_key)) {
+                    const WaveData &wave_data = wav_reader[c].Value(utt_key);
+                    const Matrix<BaseFloat> &wave_samp = resampler.Resample(wave_data);
+                    if (track_volumn)
+                        range += wave_samp.LargestAbsElem();
+                    mfreq[cur_ch] = resampler.SampFreq(wave_data);
+                    stft_computer.Compute(wave_samp, &mstft[cur_ch], NULL, NULL);
+                    cur_ch++;
+                }
+            }
+            KALDI_VLOG(2) << "Processing " << cur_ch << " channels for " << utt_key;
+            if (cur_ch <= 1) {
+                num_miss++;
+                continue;
+            }
+
+            int32 num_frames = mstft[0].NumRows(), num_bins = mstft[0].NumCols() / 2 + 1;
+            BaseFloat target_freq = mfreq[0];
+
+            bool problem = false;
+            for (int32 c = 1; c < cur_ch; c++) {
+                if (mstft[c].NumCols() != (num_bins - 1) * 2 || mstft[c].NumRows() != num_frames) {
+                    KALDI_WARN << "There is obvious length difference between"
+                        << "multiple channels, please check, skip for " << utt_key;
+                    problem = true;
+                    break;
+                }
+                if (target_freq != mfreq[c]) {
+                    KALDI_WARN << "Sample frequency may be difference between"
+                        << "multiple channels, please check(or use --target-samp-freq), skip for " << utt_key;
+                    problem = true;
+                    break;
+                }
+            }
+            if (problem) {
+                num_miss++;
+                continue;
+            }
+
+            DecodableNnetSimple nnet_computer(compute_options, nnet, priors, feats, &compiler);
+            if (nnet_computer.NumFrames() != num_frames || nnet_computer.OutputDim() != num_bins) {
+                KALDI_WARN << "Utterance " << utt_key << ": The shape of nnet3 output is different from stft"
+                           << " (" << nnet_computer.NumFrames() << " x " << nnet_computer.OutputDim() << ") vs"
+                           << " (" << num_frames << " x " << num_bins << ")";
+                num_miss++;
+                continue;
+            }
+
+            CMatrix<BaseFloat> stft_reshape(num_frames, num_bins * cur_ch), src_stft;
+            for (int32 c = 0; c < cur_ch; c++)
+                stft_reshape.ColRange(c * num_bins, num_bins).CopyFromRealfft(mstft[c]);
+            TrimStft(num_bins, cur_ch, stft_reshape, &src_stft);
+
+            // nnet3 computes chunk i while psd is accumulated on chunk i - 1(by
+            // the thread pool), in two mask buffers by turns. With --num-threads=1
+            // accumulation runs inline, after forward of each chunk
+            PsdAccumulator accumulator(num_bins, cur_ch, psd_mask_floor);
+            Matrix<BaseFloat> mask_chunks[2], target_mask;
+            // whole mask is kept only for mask post-filter
+            if (post_filter_options.post_filter == "mask")
+                target_mask.Resize(num_frames, num_bins, kUndefined);
+            TaskGroup accumulate;
+            for (int32 i = 0, t = 0; t < num_frames; i++, t += chunk_width) {
+                int32 duration = std::min(chunk_width, num_frames - t);
+                Matrix<BaseFloat> &mask = mask_chunks[i % 2];
+                {
+                    SETK_PROFILE("nnet3-forward");
+                    mask.Resize(duration, num_bins, kUndefined);
+                    for (int32 n = 0; n < duration; n++) {
+                        SubVector<BaseFloat> row(mask, n);
+                        nnet_computer.GetOutputForFrame(t + n, &row);
+                    }
+                    if (apply_exp)
+                        mask.ApplyExp();
+                    if (target_mask.NumRows())
+                        target_mask.RowRange(t, duration).CopyFromMat(mask);
+                }
+                // chunk i - 1 is finished before chunk i + 1 reuses its buffer,
+                // Wait() also rethrows errors of accumulation
+                accumulate.Wait();
+                accumulate.Run([&accumulator, &src_stft, &mask, t] {
+                    accumulator.Accumulate(src_stft, t, mask);
+                });
+            }
+            accumulate.Wait();
+
+            CMatrix<BaseFloat> noise_psd, target_psd, steer_vector, beam_weights, enh_stft;
+            accumulator.GetPsd(&target_psd, &noise_psd);
+            if (beamformer == "mvdr") {
+                EstimateSteerVector(target_psd, &steer_vector, weights_decimation);
+                ComputeMvdrBeamWeights(noise_psd, steer_vector, &beam_weights, weights_decimation);
+            } else {
+                ComputeGevdBeamWeights(target_psd, noise_psd, &beam_weights, weights_decimation);
+            }
+            Beamform(src_stft, beam_weights, &enh_stft);
+
+            Matrix<BaseFloat> rstft, enhan_speech;
+            ApplyPostFilter(post_filter_options, post_filter_options.post_filter == "mask" ? &target_mask: NULL, &enh_stft);
+            CastIntoRealfft(enh_stft, &rstft);
+            if (feature_options.OutputWave()) {
+                stft_computer.InverseShortTimeFT(rstft, &enhan_speech, range / cur_ch - 1);
+                WaveData target_data(target_freq, enhan_speech);
+                { SETK_PROFILE("write"); wav_writer.Write(utt_key, target_data); }
+            } else {
+                Matrix<BaseFloat> enhan_feats;
+                feature_computer.Compute(&rstft, target_freq, &enhan_feats);
+                SETK_PROFILE("write");
+                feats_writer.Write(utt_key, enhan_feats);
+            }
+            num_done++;
+            profile_session.EndUtterance();
+
+            if (num_done % 100 == 0)
+                KALDI_LOG << "Processed " << num_utts << " utterances.";
+            KALDI_VLOG(2) << "Do " << beamformer << " beamforming for utterance-id " << utt_key << " done.";
+        }
+
+#if HAVE_CUDA == 1
+        CuDevice::Instantiate().PrintProfile();
+#endif
+        KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts
+                  << ", " << num_miss << " missing cause of some problems.";
+
+        return num_done + wav_writer.NumDone() + feats_writer.NumDone() == 0 ? 1: 0;
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
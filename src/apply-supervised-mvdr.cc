@@ -21,6 +21,13 @@
 
 #include "include/stft.h"
 #include "include/beamformer.h"
+#include "include/stft-feature.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/memory-tracker.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
@@ -42,7 +49,7 @@ int main(int argc, char *argv[]) {
         const char *usage = 
             "Do minimum variance distortionless response (MVDR) beamformer, depending on TF mask\n"
             "\n"
-            "Usage: apply-supervised-mvdr [options...] <mask-rspecifier> <input-rspecifier> <target-wav-wspecifier>\n"
+            "Usage: apply-supervised-mvdr [options...] <mask-rspecifier> <input-rspecifier> <target-wspecifier>\n"
             "\n"
             "e.g.:\n"
             " apply-supervised-mvdr --config=mask.conf scp:mask.scp scp:CH1.scp,CH2.scp,CH3.scp scp:dst.scp\n";
@@ -54,6 +61,8 @@ int main(int argc, char *argv[]) {
         std::string window = "hamming";
         BaseFloat frame_shift = 256, frame_length = 1024;
         int32 update_periods = 0, minimum_update_periods = 20;
+        int32 weights_decimation = 1, num_stacked_frames = 1, batch_size = 1;
+        BaseFloat psd_mask_floor = 0;
 
         po.Register("frame-shift", &frame_shift, "Frame shift in number of samples");
         po.Register("frame-length", &frame_length, "Frame length in number of samples");
@@ -65,6 +74,37 @@ int main(int argc, char *argv[]) {
         po.Register("update-periods", &update_periods, 
                     "Number of frames to use for estimating psd of noise or target, "
                     "if zero, do beamforming offline");
+        po.Register("weights-decimation", &weights_decimation, "If larger than 1, compute beam weights "
+                    "on every weights-decimation bins and copy to the others(approximation)");
+        po.Register("psd-mask-floor", &psd_mask_floor, "If positive, skip frames whose mask is not "
+                    "larger than it when estimating psd(approximation)");
+        po.Register("num-stacked-frames", &num_stacked_frames, "If larger than 1, single channel input "
+                    "is enhanced by multi-frame mvdr, which stacks this number of frames as virtual array");
+        po.Register("batch-size", &batch_size, "Number of utterances beamformed in one batch, which "
+                    "amortizes per-utterance overhead for short utterances(offline mvdr only)");
+
+        PostFilterOptions post_filter_options;
+        post_filter_options.Register(&po);
+
+        StftFeatureOptions feature_options;
+        feature_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+        MemoryOptions memory_options;
+        memory_options.Register(&po);
 
         po.Read(argc, argv);
 
@@ -75,10 +115,25 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         KALDI_ASSERT(update_periods >= 0);
         if (update_periods < minimum_update_periods && update_periods > 0) {
             KALDI_WARN << "Value of update_periods may be too small, ignore it";
         }
+        KALDI_ASSERT(batch_size >= 1);
+        if (batch_size > 1 && (update_periods || weights_decimation > 1 || num_stacked_frames > 1)) {
+            KALDI_WARN << "Batching only works for offline mvdr without chunking, decimation "
+                       << "or stacked frames, ignore --batch-size";
+            batch_size = 1;
+        }
+        // fetching next key acknowledges the previous one, which is not written yet
+        if (batch_size > 1 && !work_queue_options.work_queue.empty()) {
+            KALDI_WARN << "Batching defers writing of utterances, which could be lost "
+                       << "under work queue, ignore --batch-size";
+            batch_size = 1;
+        }
 
         std::string mask_rspecifier = po.GetArg(1), input_rspecifier = po.GetArg(2),
                     enhan_wspecifier = po.GetArg(3);
@@ -105,40 +160,198 @@ int main(int argc, char *argv[]) {
 
         ShortTimeFTComputer stft_computer(stft_options);
 
-        SequentialBaseFloatMatrixReader mask_reader(mask_rspecifier);
-        TableWriter<WaveHolder> wav_writer(enhan_wspecifier);
+        DistributedMatrixReader mask_reader(mask_rspecifier, work_queue_options);
+        // enhanced waves, or features computed on enhanced stft
+        ResumableWaveWriter wav_writer;
+        ResumableMatrixWriter feats_writer;
+        if (feature_options.OutputWave())
+            wav_writer.Open(enhan_wspecifier, resume_options);
+        else
+            feats_writer.Open(enhan_wspecifier, resume_options);
+        StftFeatureComputer feature_computer(feature_options, &stft_computer);
 
         int32 num_done = 0, num_miss = 0, num_utts = 0;
 
+        // mstft: cache for realfft of each channel, reused between utterances
+        std::vector<Matrix<BaseFloat> > mstft(num_channels);
+        std::vector<BaseFloat> mfreq(num_channels);
+        WaveResampler resampler(resample_options);
+        MemoryTracker memory_tracker;
+
+        // short utterances batched with same number of channels & sample frequency,
+        // waves & masks keep their buffers between batches. Samples are read into
+        // rows [0, batch_channels[u]) of batch_waves[u] directly
+        std::vector<std::string> batch_keys;
+        std::vector<Matrix<BaseFloat> > batch_waves(batch_size), batch_masks(batch_size);
+        std::vector<BaseFloat> batch_ranges(batch_size);
+        std::vector<int32> batch_channels(batch_size);
+        BaseFloat batch_freq = 0;
+        // estimated bytes of the batch, checked against --memory-cap-mb
+        int64 batch_bytes = 0, cap_bytes = memory_options.CapBytes();
+        // concatenates frames of the batch, then runs stft, psd estimation and
+        // beamforming once on the whole batch, results are split by utterance
+        auto process_batch = [&]() {
+            int32 num_batched = batch_keys.size();
+            if (!num_batched)
+                return;
+            int32 cur_ch = batch_channels[0];
+            std::vector<SubMatrix<BaseFloat> > views;
+            std::vector<const MatrixBase<BaseFloat>*> waves(num_batched);
+            views.reserve(num_batched);
+            for (int32 u = 0; u < num_batched; u++) {
+                views.push_back(batch_waves[u].RowRange(0, cur_ch));
+                waves[u] = &views[u];
+            }
+            Matrix<BaseFloat> rstft;
+            std::vector<int32> frame_offsets;
+            stft_computer.ShortTimeFT(waves, &rstft, &frame_offsets);
+            memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(rstft));
+
+            int32 num_frames = frame_offsets.back(), num_bins = rstft.NumCols() / 2 + 1;
+            CMatrix<BaseFloat> cstft(num_frames * cur_ch, num_bins), src_stft, noise_psd, target_psd,
+                               steer_vector, beam_weights, enh_stft;
+            cstft.CopyFromRealfft(rstft);
+            TrimStft(num_bins, cur_ch, cstft, &src_stft);
+            memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(cstft) + MemoryTracker::Bytes(src_stft));
+            Matrix<BaseFloat> masks(num_frames, num_bins, kUndefined);
+            for (int32 u = 0; u < num_batched; u++)
+                masks.RowRange(frame_offsets[u], frame_offsets[u + 1] - frame_offsets[u])
+                    .CopyFromMat(batch_masks[u]);
+            memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(masks));
+
+            KALDI_VLOG(1) << "Do mvdr beamforming on a batch of " << num_batched << " utterances";
+            EstimatePsd(src_stft, masks, frame_offsets, &target_psd, &noise_psd, psd_mask_floor);
+            memory_tracker.Add(kMemoryPsd, MemoryTracker::Bytes(target_psd) + MemoryTracker::Bytes(noise_psd));
+            EstimateSteerVector(target_psd, &steer_vector);
+            ComputeMvdrBeamWeights(noise_psd, steer_vector, &beam_weights);
+            memory_tracker.Add(kMemoryWeights, MemoryTracker::Bytes(steer_vector) + MemoryTracker::Bytes(beam_weights));
+            Beamform(src_stft, beam_weights, frame_offsets, &enh_stft);
+            memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enh_stft));
+
+            Matrix<BaseFloat> utt_rstft, enhan_speech, feats;
+            for (int32 u = 0; u < num_batched; u++) {
+                SubCMatrix<BaseFloat> utt_stft(enh_stft.RowRange(frame_offsets[u],
+                                                                 frame_offsets[u + 1] - frame_offsets[u]));
+                ApplyPostFilter(post_filter_options, &batch_masks[u], &utt_stft);
+                CastIntoRealfft(utt_stft, &utt_rstft);
+                BaseFloat range = batch_ranges[u] / cur_ch - 1;
+                if (feature_options.OutputWave()) {
+                    stft_computer.InverseShortTimeFT(utt_rstft, &enhan_speech, range);
+                    WaveData target_data(batch_freq, enhan_speech);
+                    SETK_PROFILE("write");
+                    wav_writer.Write(batch_keys[u], target_data);
+                } else {
+                    feature_computer.Compute(&utt_rstft, batch_freq, &feats);
+                    SETK_PROFILE("write");
+                    feats_writer.Write(batch_keys[u], feats);
+                }
+                num_done++;
+                profile_session.EndUtterance();
+                if (num_done % 100 == 0)
+                    KALDI_LOG << "Processed " << num_utts << " utterances.";
+                KALDI_VLOG(2) << "Do mvdr beamforming for utterance-id " << batch_keys[u] << " done.";
+            }
+            // peak memory of the batch is reported under its first utterance
+            memory_tracker.EndUtterance(batch_keys[0]);
+            batch_keys.clear();
+            batch_bytes = 0;
+        };
+
         for (; !mask_reader.Done(); mask_reader.Next()) {
             std::string utt_key = mask_reader.Key();
+            if (wav_writer.IsDone(utt_key) || feats_writer.IsDone(utt_key))
+                continue;
             const Matrix<BaseFloat> &target_mask = mask_reader.Value();
 
-            // init num_channels
-            // mstft: cache for realfft of each channel
-            std::vector<Matrix<BaseFloat> > mstft(num_channels);
-            std::vector<BaseFloat> mfreq(num_channels);
             BaseFloat range = 0.0;
             num_utts++;
 
             int32 cur_ch = 0;
+            int64 wave_bytes = 0;
+            bool length_differs = false;
             for (int32 c = 0; c < num_channels; c++) {
                 if (wav_reader[c].HasKey(utt_key)) {
                     const WaveData &wave_data = wav_reader[c].Value(utt_key);
-                    const Matrix<BaseFloat> &wave_samp = wave_data.Data(); 
+                    const Matrix<BaseFloat> &wave_samp = resampler.Resample(wave_data);
                     if (track_volumn)
                         range += wave_samp.LargestAbsElem();
-                    mfreq[cur_ch] = wave_data.SampFreq();
-                    stft_computer.Compute(wave_samp, &mstft[cur_ch], NULL, NULL);
+                    mfreq[cur_ch] = resampler.SampFreq(wave_data);
+                    wave_bytes += MemoryTracker::Bytes(wave_samp);
+                    if (batch_size > 1) {
+                        // stft of batched utterances is computed in process_batch(), samples
+                        // go into the free slot of batch directly
+                        Matrix<BaseFloat> &batch_wave = batch_waves[batch_keys.size()];
+                        if (cur_ch == 0)
+                            batch_wave.Resize(num_channels, wave_samp.NumCols(), kUndefined);
+                        if (wave_samp.NumCols() == batch_wave.NumCols())
+                            batch_wave.Row(cur_ch).CopyFromVec(wave_samp.Row(0));
+                        else
+                            length_differs = true;
+                    } else {
+                        stft_computer.Compute(wave_samp, &mstft[cur_ch], NULL, NULL);
+                    }
                     cur_ch++;
                 }
             }
             KALDI_VLOG(2) << "Processing " << cur_ch << " channels for " << utt_key;
-            // do not process if num_channels <= 1
-            if (cur_ch <= 1) {
+            // do not process if num_channels <= 1, unless multi-frame mvdr is enabled
+            if (cur_ch == 0 || (cur_ch == 1 && num_stacked_frames <= 1)) {
                 num_miss++;
                 continue;
             }
+
+            if (batch_size > 1) {
+                // utterances needing more memory than cap on their own are processed
+                // unbatched, which switches to chunked mode
+                bool unbatched = false;
+                int32 n = batch_keys.size(), num_samples = batch_waves[n].NumCols();
+                bool problem = length_differs;
+                for (int32 c = 1; c < cur_ch; c++)
+                    problem = problem || mfreq[c] != mfreq[0];
+                if (problem)
+                    KALDI_WARN << "Length or sample frequency differs between multiple channels, skip for " << utt_key;
+                if (!problem && (num_samples < frame_length || target_mask.NumRows() != stft_computer.NumFrames(num_samples)
+                                 || target_mask.NumCols() != stft_options.PaddingLength() / 2 + 1)) {
+                    KALDI_WARN << "Utterance " << utt_key << ": The shape of target mask is different from stft";
+                    problem = true;
+                }
+                if (problem) {
+                    num_miss++;
+                    continue;
+                }
+                // stft(realfft, complex & trimmed copies), masks, enhanced stft & psd
+                int64 utt_bytes = 0;
+                if (cap_bytes > 0) {
+                    int64 num_frames = target_mask.NumRows(), num_bins = target_mask.NumCols(),
+                          frame_bytes = num_bins * cur_ch * 2 * sizeof(BaseFloat);
+                    utt_bytes = wave_bytes + num_frames * (3 * frame_bytes + 4 * num_bins * sizeof(BaseFloat))
+                                + 4 * frame_bytes * cur_ch;
+                    unbatched = utt_bytes > cap_bytes;
+                }
+                if (n && (batch_channels[0] != cur_ch || batch_freq != mfreq[0] || unbatched ||
+                          (cap_bytes > 0 && batch_bytes + utt_bytes > cap_bytes))) {
+                    process_batch();
+                    // samples of this utterance are in slot n, move them to the new batch
+                    batch_waves[0].Swap(&batch_waves[n]);
+                    n = 0;
+                }
+                if (!unbatched) {
+                    memory_tracker.Add(kMemoryWave, wave_bytes);
+                    batch_masks[n] = target_mask;
+                    batch_ranges[n] = range;
+                    batch_channels[n] = cur_ch;
+                    batch_freq = mfreq[0];
+                    batch_bytes += utt_bytes;
+                    batch_keys.push_back(utt_key);
+                    if (n + 1 == batch_size)
+                        process_batch();
+                    continue;
+                }
+                for (int32 c = 0; c < cur_ch; c++) {
+                    SubMatrix<BaseFloat> wave(batch_waves[n], c, 1, 0, num_samples);
+                    stft_computer.Compute(wave, &mstft[c], NULL, NULL);
+                }
+            }
             
             // check dimentions
             // mstft[..].NumCols() == frame_length
@@ -155,7 +368,7 @@ int main(int argc, char *argv[]) {
                 }
                 if (target_freq != mfreq[c]) {
                     KALDI_WARN << "Sample frequency may be difference between"
-                        << "multiple channels, please check, skip for " << utt_key;
+                        << "multiple channels, please check(or use --target-samp-freq), skip for " << utt_key;
                     problem = true;
                     break;
                 }
@@ -174,56 +387,155 @@ int main(int argc, char *argv[]) {
                 continue;
             }
             
-            CMatrix<BaseFloat> stft_reshape(num_frames, num_bins * cur_ch), src_stft;
-            for (int32 c = 0; c < cur_ch; c++) {
-                stft_reshape.ColRange(c * num_bins, num_bins).CopyFromRealfft(mstft[c]);
+            memory_tracker.Add(kMemoryWave, wave_bytes);
+            for (int32 c = 0; c < cur_ch; c++)
+                memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(mstft[c]));
+
+            // in chunked mode, each enhanced segment is synthesized into output wave
+            // directly, unless features are required or wiener post-filter is used
+            // (which tracks noise over the whole utterance)
+            bool synthesize_segments = (cur_ch > 1 && feature_options.OutputWave() &&
+                                        post_filter_options.post_filter != "wiener");
+            int32 periods = update_periods;
+            if (cap_bytes > 0) {
+                // bytes of each frame: frame_bytes for stft of all channels(reshaped
+                // & trimmed copies), enh_bytes for enhanced stft & its realfft, which
+                // are kept for the whole utterance unless segments are synthesized
+                int64 frame_bytes = static_cast<int64>(num_bins) * cur_ch * 2 * sizeof(BaseFloat),
+                      enh_bytes = static_cast<int64>(num_bins * 2 + (num_bins - 1) * 2) * sizeof(BaseFloat),
+                      segment_bytes = 2 * frame_bytes + (synthesize_segments ? enh_bytes: 0),
+                      fixed_bytes = memory_tracker.LiveBytes() + (synthesize_segments ? 0: num_frames * enh_bytes)
+                                    + stft_computer.NumSamples(num_frames) * sizeof(BaseFloat)  // samples
+                                    + 3 * frame_bytes * cur_ch;   // psd & weights
+                int32 duration = (periods >= minimum_update_periods && num_frames > periods ? 
+                                  periods: num_frames);
+                if (fixed_bytes + duration * segment_bytes > cap_bytes) {
+                    int32 max_duration = std::max(static_cast<int64>(minimum_update_periods), 
+                                         (cap_bytes - fixed_bytes) / segment_bytes);
+                    if (fixed_bytes + max_duration * segment_bytes > cap_bytes)
+                        KALDI_WARN << "Utterance " << utt_key << " needs more memory than --memory-cap-mb="
+                                   << memory_options.memory_cap_mb << " even in chunked mode";
+                    if (max_duration < num_frames) {
+                        KALDI_VLOG(1) << "Switch to chunked processing per " << max_duration 
+                                      << " frames for " << utt_key << " to keep memory under cap";
+                        periods = max_duration;
+                    }
+                }
             }
 
-            CMatrix<BaseFloat> noise_psd, target_psd, steer_vector, beam_weights, enh_stft; 
-            int32 num_segments = (num_frames - minimum_update_periods) / update_periods + 1;
-
-            if (update_periods >= minimum_update_periods && num_segments > 1) {
-                KALDI_VLOG(1) << "Do mvdr beamforming, update power spectrum matrix estimation per " << update_periods << " frames";
-                int32 duration = 0, start_from = 0;
+            CMatrix<BaseFloat> stft_reshape, src_stft, noise_psd, target_psd, steer_vector,
+                               beam_weights, enh_stft;
+            Matrix<BaseFloat> rstft, enhan_speech, feats;
+            // frames [t, t + n) of all channels: (n, num_bins x cur_ch)
+            auto reshape_stft = [&](int32 t, int32 n) {
+                stft_reshape.Resize(n, num_bins * cur_ch, kUndefined);
+                for (int32 c = 0; c < cur_ch; c++)
+                    stft_reshape.ColRange(c * num_bins, num_bins).CopyFromRealfft(mstft[c].RowRange(t, n));
+                memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(stft_reshape));
+            };
+            auto estimate_weights = [&](const MatrixBase<BaseFloat> &mask) {
+                EstimatePsd(src_stft, mask, &target_psd, &noise_psd, psd_mask_floor);
+                memory_tracker.Add(kMemoryPsd, MemoryTracker::Bytes(target_psd) + MemoryTracker::Bytes(noise_psd));
+                EstimateSteerVector(target_psd, &steer_vector, weights_decimation);
+                ComputeMvdrBeamWeights(noise_psd, steer_vector, &beam_weights, weights_decimation);
+                memory_tracker.Add(kMemoryWeights, MemoryTracker::Bytes(steer_vector) + MemoryTracker::Bytes(beam_weights));
+            };
+            int32 num_segments = periods ? (num_frames - minimum_update_periods) / periods + 1: 1;
+            bool segmented = (cur_ch > 1 && periods >= minimum_update_periods && num_segments > 1);
+
+            if (cur_ch == 1) {
+                KALDI_VLOG(1) << "Do multi-frame mvdr on " << num_stacked_frames << " stacked frames";
+                reshape_stft(0, num_frames);
+                MultiFrameMvdr(stft_reshape, target_mask, num_stacked_frames, &enh_stft, psd_mask_floor);
+            } else if (segmented) {
+                KALDI_VLOG(1) << "Do mvdr beamforming, update power spectrum matrix estimation per " << periods << " frames";
+                int32 duration = 0, start_from = 0, shift = stft_computer.FrameShift();
                 CMatrix<BaseFloat> enh_stft_segment;
-                enh_stft.Resize(num_frames, num_bins);
+                Matrix<BaseFloat> rstft_segment;
+                if (synthesize_segments) {
+                    enhan_speech.Resize(1, stft_computer.NumSamples(num_frames));
+                    memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enhan_speech));
+                } else {
+                    enh_stft.Resize(num_frames, num_bins);
+                    memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enh_stft));
+                }
                 for (int32 i = 0; i < num_segments; i++) {
-                    start_from = i * update_periods;
-                    duration = (i == num_segments - 1 ? num_frames - start_from: update_periods); 
-                    TrimStft(num_bins, cur_ch, stft_reshape.RowRange(start_from, duration), &src_stft); 
-                    EstimatePsd(src_stft, target_mask.RowRange(start_from, duration), &target_psd, &noise_psd);
-                    EstimateSteerVector(target_psd, &steer_vector);
-                    ComputeMvdrBeamWeights(noise_psd, steer_vector, &beam_weights);
+                    start_from = i * periods;
+                    duration = (i == num_segments - 1 ? num_frames - start_from: periods); 
+                    reshape_stft(start_from, duration);
+                    TrimStft(num_bins, cur_ch, stft_reshape, &src_stft); 
+                    memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(src_stft));
+                    SubMatrix<BaseFloat> mask_segment(target_mask, start_from, duration, 0, num_bins);
+                    estimate_weights(mask_segment);
                     Beamform(src_stft, beam_weights, &enh_stft_segment);
-                    enh_stft.RowRange(start_from, duration).CopyFromMat(enh_stft_segment);
+                    memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enh_stft_segment));
+                    if (synthesize_segments) {
+                        ApplyPostFilter(post_filter_options, &mask_segment, &enh_stft_segment);
+                        CastIntoRealfft(enh_stft_segment, &rstft_segment);
+                        memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(rstft_segment));
+                        for (int32 t = 0; t < duration; t++) {
+                            SubVector<BaseFloat> frame(rstft_segment, t);
+                            stft_computer.SynthesisAdd(&frame, enhan_speech.RowData(0) + (start_from + t) * shift);
+                        }
+                    } else {
+                        enh_stft.RowRange(start_from, duration).CopyFromMat(enh_stft_segment);
+                    }
+                    // buffers of this segment are reused by the next one
+                    memory_tracker.Release(kMemoryStft, MemoryTracker::Bytes(stft_reshape) + MemoryTracker::Bytes(src_stft));
+                    memory_tracker.Release(kMemoryPsd, MemoryTracker::Bytes(target_psd) + MemoryTracker::Bytes(noise_psd));
+                    memory_tracker.Release(kMemoryWeights, MemoryTracker::Bytes(steer_vector) + MemoryTracker::Bytes(beam_weights));
+                    memory_tracker.Release(kMemoryOutput, MemoryTracker::Bytes(enh_stft_segment) + MemoryTracker::Bytes(rstft_segment));
                 }
-
             } else {
                 KALDI_VLOG(1) << "Do mvdr beamforming offline";
+                reshape_stft(0, num_frames);
                 TrimStft(num_bins, cur_ch, stft_reshape, &src_stft); 
-                EstimatePsd(src_stft, target_mask, &target_psd, &noise_psd);
-                EstimateSteerVector(target_psd, &steer_vector);
-                ComputeMvdrBeamWeights(noise_psd, steer_vector, &beam_weights);
+                memory_tracker.Add(kMemoryStft, MemoryTracker::Bytes(src_stft));
+                // reshaped copy is not used any more
+                memory_tracker.Release(kMemoryStft, MemoryTracker::Bytes(stft_reshape));
+                stft_reshape.Resize(0, 0);
+                estimate_weights(target_mask);
                 Beamform(src_stft, beam_weights, &enh_stft);
             }
 
-            Matrix<BaseFloat> rstft, enhan_speech;
-            CastIntoRealfft(enh_stft, &rstft);
-            stft_computer.InverseShortTimeFT(rstft, &enhan_speech, range / cur_ch - 1);
+            if (segmented && synthesize_segments) {
+                SubVector<BaseFloat> samples(enhan_speech, 0);
+                stft_computer.NormalizeRange(&samples, range / cur_ch - 1);
+            } else {
+                if (!segmented)
+                    memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enh_stft));
+                ApplyPostFilter(post_filter_options, &target_mask, &enh_stft);
+                CastIntoRealfft(enh_stft, &rstft);
+                memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(rstft));
+                if (feature_options.OutputWave())
+                    stft_computer.InverseShortTimeFT(rstft, &enhan_speech, range / cur_ch - 1);
+                else
+                    feature_computer.Compute(&rstft, target_freq, &feats);
+                memory_tracker.Add(kMemoryOutput, MemoryTracker::Bytes(enhan_speech) + MemoryTracker::Bytes(feats));
+            }
 
-            WaveData target_data(target_freq, enhan_speech);
-            wav_writer.Write(utt_key, target_data);
+            if (feature_options.OutputWave()) {
+                WaveData target_data(target_freq, enhan_speech);
+                { SETK_PROFILE("write"); wav_writer.Write(utt_key, target_data); }
+            } else {
+                SETK_PROFILE("write");
+                feats_writer.Write(utt_key, feats);
+            }
             num_done++;
+            memory_tracker.EndUtterance(utt_key);
+            profile_session.EndUtterance();
 
             if (num_done % 100 == 0)
                 KALDI_LOG << "Processed " << num_utts << " utterances.";
             KALDI_VLOG(2) << "Do mvdr beamforming for utterance-id " << utt_key << " done.";
         }
 
+        process_batch();
         KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts
                   << ", " << num_miss << " missing cause of some problems.";
+        KALDI_LOG << memory_tracker.Report();
 
-        return num_done == 0 ? 1: 0;
+        return num_done + wav_writer.NumDone() + feats_writer.NumDone() == 0 ? 1: 0;
 
     } catch(const std::exception& e) {
         std::cerr << e.what();
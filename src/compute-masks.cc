@@ -20,6 +20,11 @@
 
 
 #include "include/stft.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
@@ -73,6 +78,21 @@ int main(int argc, char *argv[]) {
         po.Register("frame-length", &frame_length, "Frame length in number of samples");
         po.Register("window", &window, "Type of window(\"hamming\"|\"hanning\"|\"blackman\"|\"rectangular\")");
 
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
@@ -80,6 +100,9 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         if (mask_type != "irm" && mask_type != "ibm" && mask_type != "wiener")
             KALDI_ERR << "Unknown arguments for --mask: " << mask_type;
 
@@ -105,18 +128,22 @@ int main(int argc, char *argv[]) {
         stft_options.frame_length = frame_length;
 
         ShortTimeFTComputer stft_computer(stft_options);
+        // samples of noise & clean are used together, one for each
+        WaveResampler noise_resampler(resample_options), clean_resampler(resample_options);
 
         if (noise_is_rspecifier) {
-            SequentialTableReader<WaveHolder> noise_reader(noise_in);
+            DistributedWaveReader noise_reader(noise_in, work_queue_options);
             RandomAccessTableReader<WaveHolder> clean_reader(clean_in);
 
-            BaseFloatMatrixWriter kaldi_writer;
-            if (!kaldi_writer.Open(mask_out))
+            ResumableMatrixWriter kaldi_writer;
+            if (!kaldi_writer.Open(mask_out, resume_options))
                 KALDI_ERR << "Could not initialize output with wspecifier " << mask_out;
             
             int num_utts = 0, num_no_tgt_utts = 0, num_done = 0;
             for (; !noise_reader.Done(); noise_reader.Next()) {
                 std::string utt_key = noise_reader.Key();
+                if (kaldi_writer.IsDone(utt_key))
+                    continue;
                 num_utts += 1;
 
                 if (!clean_reader.HasKey(utt_key)) {
@@ -132,10 +159,12 @@ int main(int argc, char *argv[]) {
                              noise_data.Data().NumRows() == 1);
 
                 Matrix<BaseFloat> mask;
-                ComputeMasks(stft_computer, noise_data.Data(), clean_data.Data(), mask_type, &mask);
+                ComputeMasks(stft_computer, noise_resampler.Resample(noise_data),
+                             clean_resampler.Resample(clean_data), mask_type, &mask);
 
-                kaldi_writer.Write(utt_key, mask);
+                { SETK_PROFILE("write"); kaldi_writer.Write(utt_key, mask); }
                 num_done++;
+                profile_session.EndUtterance();
 
                 if (num_done % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
@@ -143,7 +172,7 @@ int main(int argc, char *argv[]) {
             }
             KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts
                       << ", " << num_no_tgt_utts << " missing targets";
-            return num_done == 0 ? 1: 0;
+            return num_done + kaldi_writer.NumDone() == 0 ? 1: 0;
         } else {
             bool binary;
             Input kn(noise_in, &binary);
@@ -156,7 +185,8 @@ int main(int argc, char *argv[]) {
                          noise_data.Data().NumRows() == 1);
 
             Matrix<BaseFloat> mask;
-            ComputeMasks(stft_computer, noise_data.Data(), clean_data.Data(), mask_type, &mask);
+            ComputeMasks(stft_computer, noise_resampler.Resample(noise_data),
+                         clean_resampler.Resample(clean_data), mask_type, &mask);
             WriteKaldiObject(mask, mask_out, wx_binary);
             KALDI_LOG << "Done processed " << noise_in;
         }
@@ -20,7 +20,12 @@
 
 
 #include "include/srp-phat.h"
+#include "include/resampler.h"
 #include "include/stft.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
@@ -79,7 +84,22 @@ int main(int argc, char *argv[]) {
 
         stft_options.Register(&po);
         srp_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
         
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 2) {
@@ -87,6 +107,9 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         std::string chs_in = po.GetArg(1), srp_out = po.GetArg(2);
 
         bool in_is_rspecifier = (ClassifyRspecifier(chs_in, NULL, NULL) != kNoRspecifier),
@@ -95,24 +118,31 @@ int main(int argc, char *argv[]) {
         if (in_is_rspecifier != out_is_wspecifier)
             KALDI_ERR << "Cannot mix archives with regular files";
 
+        if (resample_options.target_samp_freq > 0 && resample_options.target_samp_freq != samp_frequency)
+            KALDI_ERR << "--target-samp-freq=" << resample_options.target_samp_freq
+                      << " should be same as --samp-frequency=" << samp_frequency;
+
         int32 num_bins = stft_options.PaddingLength() / 2 + 1;
 
         ShortTimeFTComputer stft_computer(stft_options);
         SrpPhatComputor srp_computor(srp_options, samp_frequency, num_bins);
 
         int32 config_num_chs = srp_computor.NumChannels();
+        WaveResampler resampler(resample_options);
 
         if (in_is_rspecifier) {
             
-            SequentialTableReader<WaveHolder> wave_reader(chs_in);
+            DistributedWaveReader wave_reader(chs_in, work_queue_options);
 
-            BaseFloatMatrixWriter kaldi_writer;
-            if (!kaldi_writer.Open(srp_out))
+            ResumableMatrixWriter kaldi_writer;
+            if (!kaldi_writer.Open(srp_out, resume_options))
                 KALDI_ERR << "Could not initialize output with wspecifier " << srp_out;
 
             int num_utts = 0;
             for (; !wave_reader.Done(); wave_reader.Next()) {
                 std::string utt_key = wave_reader.Key();
+                if (kaldi_writer.IsDone(utt_key))
+                    continue;
                 const WaveData &wave_data = wave_reader.Value();
 
                 Matrix<BaseFloat> rstft, srp_phat;
@@ -122,7 +152,7 @@ int main(int argc, char *argv[]) {
                     KALDI_ERR << "num_channels config from topo-descriptor is " << config_num_chs 
                               << " while " << ch_data.NumRows() << " channels in utterance " << utt_key;
                 }
-                stft_computer.Compute(wave_data.Data(), &rstft, NULL, NULL);
+                stft_computer.Compute(resampler.Resample(wave_data), &rstft, NULL, NULL);
 
                 CMatrix<BaseFloat> cstft(rstft.NumRows(), num_bins);
                 cstft.CopyFromRealfft(rstft);
@@ -131,16 +161,17 @@ int main(int argc, char *argv[]) {
                 // post-process
                 PostNormalize(&srp_phat, norm_srp, norm_time_axis, norm_tdoa_axis);
 
-                kaldi_writer.Write(utt_key, srp_phat);
+                { SETK_PROFILE("write"); kaldi_writer.Write(utt_key, srp_phat); }
 
                 num_utts += 1;
+                profile_session.EndUtterance();
                 if (num_utts % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
                 KALDI_VLOG(2) << "Processed features for key " << utt_key;
 
             }
             KALDI_LOG << "Done " << num_utts << " utterances";
-            return num_utts == 0 ? 1: 0;
+            return num_utts + kaldi_writer.NumDone() == 0 ? 1: 0;
 
         } else {
             bool read_binary;
@@ -152,7 +183,7 @@ int main(int argc, char *argv[]) {
 
             Matrix<BaseFloat> rstft, srp_phat;
             // only compute stft in realfft format
-            stft_computer.Compute(wave.Data(), &rstft, NULL, NULL);
+            stft_computer.Compute(resampler.Resample(wave), &rstft, NULL, NULL);
 
             CMatrix<BaseFloat> cstft(rstft.NumRows(), num_bins);
             cstft.CopyFromRealfft(rstft);
@@ -20,6 +20,10 @@
 
 
 #include "include/stft.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 
 using namespace kaldi;
@@ -36,6 +40,32 @@ void ComputeSTFTStats(ShortTimeFTComputer &stft_computer,
         stft_computer.Compute(wave_data, NULL, NULL, feature);
 }
 
+// Compute stats of a batch of utterances in one pass, and write them one by one
+void ComputeBatchedSTFTStats(ShortTimeFTComputer &stft_computer,
+                             const std::vector<std::string> &keys,
+                             const std::vector<Matrix<BaseFloat> > &waves,
+                             std::string &output,
+                             ResumableMatrixWriter *writer) {
+    int32 num_utts = keys.size();
+    if (!num_utts) return;
+    std::vector<const MatrixBase<BaseFloat>*> batch(num_utts);
+    for (int32 u = 0; u < num_utts; u++)
+        batch[u] = &waves[u];
+    Matrix<BaseFloat> feature, utt_feature;
+    std::vector<int32> frame_offsets;
+    if (output == "stft")
+        stft_computer.Compute(batch, &feature, NULL, NULL, &frame_offsets);
+    if (output == "spectra")
+        stft_computer.Compute(batch, NULL, &feature, NULL, &frame_offsets);
+    if (output == "angle")
+        stft_computer.Compute(batch, NULL, NULL, &feature, &frame_offsets);
+    for (int32 u = 0; u < num_utts; u++) {
+        CopyUtteranceFromBatch(feature, frame_offsets, waves[0].NumRows(), u, &utt_feature);
+        SETK_PROFILE("write");
+        writer->Write(keys[u], utt_feature);
+    }
+}
+
 int main(int argc, char *argv[]) {
     try{
         const char *usage = 
@@ -53,9 +83,24 @@ int main(int argc, char *argv[]) {
         po.Register("output", &output, 
                     "Type(\"stft\"|\"angle\"|\"spectra\") of output derived from short-time fourier transform.");
         po.Register("binary", &wx_binary, "Write in binary mode (only relevant if output is a wxfilename)");
+        int32 batch_size = 1;
+        po.Register("batch-size", &batch_size, "Number of utterances computed in one batch, "
+                    "which amortizes per-utterance overhead for short utterances");
 
         stft_options.Register(&po);
 
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 2) {
@@ -63,8 +108,18 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         if (output != "spectra" && output != "angle" && output != "stft")
             KALDI_ERR << "Unknown arguments for --output: " << output;
+        KALDI_ASSERT(batch_size >= 1);
+        // fetching next key acknowledges the previous one, which is not written yet
+        if (batch_size > 1 && !work_queue_options.work_queue.empty()) {
+            KALDI_WARN << "Batching defers writing of utterances, which could be lost "
+                       << "under work queue, ignore --batch-size";
+            batch_size = 1;
+        }
 
         std::string wave_in = po.GetArg(1), stft_out = po.GetArg(2);
         
@@ -77,33 +132,54 @@ int main(int argc, char *argv[]) {
         ShortTimeFTComputer stft_computer(stft_options);
 
         if (in_is_rspecifier) {
-            SequentialTableReader<WaveHolder> wave_reader(wave_in);
+            DistributedWaveReader wave_reader(wave_in, work_queue_options);
 
-            BaseFloatMatrixWriter kaldi_writer;
-            if (!kaldi_writer.Open(stft_out)) {
+            ResumableMatrixWriter kaldi_writer;
+            if (!kaldi_writer.Open(stft_out, resume_options)) {
                 KALDI_ERR << "Could not initialize output with wspecifier " << stft_out;
             }
             
             int num_utts = 0;
+            // utterances of current batch, waves keep their buffers between batches
+            std::vector<std::string> batch_keys;
+            std::vector<Matrix<BaseFloat> > batch_waves(batch_size);
             for (; !wave_reader.Done(); wave_reader.Next()) {
                 std::string utt_key = wave_reader.Key();
+                if (kaldi_writer.IsDone(utt_key))
+                    continue;
                 const WaveData &wave_data = wave_reader.Value();
                 
                 if (wave_data.Data().NumRows() != 1) 
                     KALDI_WARN << utt_key << ": MULTI-CHANNEL!";
 
-                Matrix<BaseFloat> feature;
-                ComputeSTFTStats(stft_computer, wave_data.Data(), output, &feature);
-
-                kaldi_writer.Write(utt_key, feature);
+                if (batch_size > 1) {
+                    // utterances of one batch should have same number of channels
+                    if (!batch_keys.empty() && batch_waves[0].NumRows() != wave_data.Data().NumRows()) {
+                        ComputeBatchedSTFTStats(stft_computer, batch_keys, batch_waves, output, &kaldi_writer);
+                        batch_keys.clear();
+                    }
+                    batch_waves[batch_keys.size()] = wave_data.Data();
+                    batch_keys.push_back(utt_key);
+                    if (static_cast<int32>(batch_keys.size()) == batch_size) {
+                        ComputeBatchedSTFTStats(stft_computer, batch_keys, batch_waves, output, &kaldi_writer);
+                        batch_keys.clear();
+                    }
+                } else {
+                    Matrix<BaseFloat> feature;
+                    ComputeSTFTStats(stft_computer, wave_data.Data(), output, &feature);
+
+                    { SETK_PROFILE("write"); kaldi_writer.Write(utt_key, feature); }
+                }
 
                 num_utts += 1;
+                profile_session.EndUtterance();
                 if (num_utts % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
                 KALDI_VLOG(2) << "Processed features for key " << utt_key;
             }
+            ComputeBatchedSTFTStats(stft_computer, batch_keys, batch_waves, output, &kaldi_writer);
             KALDI_LOG << "Done " << num_utts << " utterances";
-            return num_utts == 0 ? 1: 0;
+            return num_utts + kaldi_writer.NumDone() == 0 ? 1: 0;
         } else {
             bool binary;
             Input ki(wave_in, &binary);
@@ -20,6 +20,9 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "matrix/kaldi-matrix.h"
+#include "include/setk-profile.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 int main(int argc, char *argv[]) {
     try {
@@ -36,24 +39,38 @@ int main(int argc, char *argv[]) {
         BaseFloat power = 1;
         po.Register("apply-pow", &power, "Apply power after hadamard product");
 
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
             po.PrintUsage();
             exit(1);
         }
+
+        ProfileSession profile_session(profile_options);
+
         std::string input_rspecifier = po.GetArg(1);
         std::string scale_rspecifier = po.GetArg(2);
         std::string matrix_wspecifier = po.GetArg(3);
 
-        SequentialBaseFloatMatrixReader input_reader(input_rspecifier);
+        DistributedMatrixReader input_reader(input_rspecifier, work_queue_options);
         RandomAccessBaseFloatMatrixReader scale_reader(scale_rspecifier);
-        BaseFloatMatrixWriter mat_writer(matrix_wspecifier);
+        ResumableMatrixWriter mat_writer(matrix_wspecifier, resume_options);
 
         int32 num_done = 0, num_matrix = 0;
 
         for (; !input_reader.Done(); input_reader.Next()) {
             std::string key = input_reader.Key();
+            if (mat_writer.IsDone(key))
+                continue;
             num_matrix++;
 
             if (!scale_reader.HasKey(key))
@@ -64,14 +81,15 @@ int main(int argc, char *argv[]) {
             scale.MulElements(input);
             scale.ApplyPow(power);
 
-            mat_writer.Write(key, scale);
+            { SETK_PROFILE("write"); mat_writer.Write(key, scale); }
             num_done++;
+            profile_session.EndUtterance();
         }
 
         KALDI_LOG << "Scaled " << num_done << " matrices, "
                   << num_matrix << " matrix in total.";
 
-        return (num_done != 0 ? 0 : 1);
+        return (num_done + mat_writer.NumDone() != 0 ? 0 : 1);
     }
     catch (const std::exception &e) {
         std::cerr << e.what();
@@ -20,6 +20,9 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "matrix/kaldi-matrix.h"
+#include "include/setk-profile.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 int main(int argc, char *argv[])
 {
@@ -36,24 +39,38 @@ int main(int argc, char *argv[])
 
         ParseOptions po(usage);
 
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
             po.PrintUsage();
             exit(1);
         }
+
+        ProfileSession profile_session(profile_options);
+
         std::string vector_rspecifier = po.GetArg(1);
         std::string matrix_rspecifier = po.GetArg(2);
         std::string matrix_wspecifier = po.GetArg(3);
 
-        SequentialBaseFloatVectorReader vec_reader(vector_rspecifier);
+        DistributedVectorReader vec_reader(vector_rspecifier, work_queue_options);
         RandomAccessBaseFloatMatrixReader mat_reader(matrix_rspecifier);
-        BaseFloatMatrixWriter mat_writer(matrix_wspecifier);
+        ResumableMatrixWriter mat_writer(matrix_wspecifier, resume_options);
 
         int32 num_done = 0, num_matrix = 0;
 
         for (; !vec_reader.Done(); vec_reader.Next()) {
             std::string key = vec_reader.Key();
+            if (mat_writer.IsDone(key))
+                continue;
             num_matrix++;
 
             if (!mat_reader.HasKey(key))
@@ -71,14 +88,15 @@ int main(int argc, char *argv[])
             }
 
             mat.RowRange(0, num_scale_rows).MulRowsVec(scale.Range(0, num_scale_rows));
-            mat_writer.Write(key, mat);
+            { SETK_PROFILE("write"); mat_writer.Write(key, mat); }
             num_done++;
+            profile_session.EndUtterance();
         }
 
         KALDI_LOG << "Scaled " << num_done << " matrices, "
                   << num_matrix << " matrix in total.";
 
-        return (num_done != 0 ? 0 : 1);
+        return (num_done + mat_writer.NumDone() != 0 ? 0 : 1);
     }
     catch (const std::exception &e) {
         std::cerr << e.what();
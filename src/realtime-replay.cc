@@ -0,0 +1,249 @@
+// src/realtime-replay.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <thread>
+
+#include "include/online-enhancer.h"
+#include "include/realtime-stats.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
+
+using namespace kaldi;
+
+typedef std::chrono::steady_clock ReplayClock;
+
+double ElapsedMs(const ReplayClock::time_point &beg, const ReplayClock::time_point &end) {
+    return std::chrono::duration<double, std::milli>(end - beg).count();
+}
+
+// Feed wave chunk by chunk into streaming stft & beamformer, if realtime is true,
+// each chunk is fed when it "arrives", i.e. at the pace of audio time, otherwise
+// as fast as possible and latency is computed on a virtual clock.
+void ReplayUtterance(const ShortTimeFTOptions &stft_opts,
+                     const OnlineBeamformerOptions &beamformer_opts,
+                     const CMatrix<BaseFloat> *weights,
+                     const Matrix<BaseFloat> *mask,
+                     const WaveData &wave, int32 chunk_size, bool realtime,
+                     RealtimeStats *stats, Matrix<BaseFloat> *enhan) {
+    const Matrix<BaseFloat> &samples = wave.Data();
+    int32 num_channels = samples.NumRows(), num_samples = samples.NumCols();
+    BaseFloat samp_freq = wave.SampFreq();
+
+    OnlineEnhancer enhancer(stft_opts, beamformer_opts, num_channels);
+    if (weights)
+        enhancer.SetWeights(*weights);
+    int32 num_bins = enhancer.NumBins(),
+          frame_shift = enhancer.StftComputer().Computer().FrameShift(),
+          offset = enhancer.StftComputer().Computer().SynthesisOffset();
+    if (mask && mask->NumCols() != num_bins)
+        KALDI_ERR << "Dimention of masks mismatch with number of bins: " << mask->NumCols()
+                  << " vs " << num_bins;
+
+    // output of streaming stft starts from sample offset(non-zero for asymmetric
+    // window), leading samples are kept as zeros to stay aligned with input
+    enhan->Resize(1, num_samples);
+    int32 num_out = std::min(offset, num_samples);
+    CMatrix<BaseFloat> enh;
+    Matrix<BaseFloat> out, chunk_mask;
+
+    ReplayClock::time_point start = ReplayClock::now();
+    for (int32 beg = 0; beg < num_samples; beg += chunk_size) {
+        int32 len = std::min(chunk_size, num_samples - beg);
+        // audio time of the last sample in this chunk
+        double arrival_ms = (beg + len) * 1000.0 / samp_freq;
+        if (realtime)
+            std::this_thread::sleep_until(start + std::chrono::microseconds(
+                static_cast<int64>(arrival_ms * 1000)));
+
+        ReplayClock::time_point t0 = ReplayClock::now();
+        enhancer.AcceptWaveform(samples.ColRange(beg, len));
+        int32 num_ready = enhancer.NumFramesReady(), num_done = enhancer.NumFramesDone();
+        if (mask) {
+            // offline masks may be a bit shorter than frames in streaming mode
+            chunk_mask.Resize(num_ready, num_bins, kUndefined);
+            for (int32 t = 0; t < num_ready; t++)
+                chunk_mask.Row(t).CopyFromVec(mask->Row(std::min(num_done + t, mask->NumRows() - 1)));
+        }
+        int32 num_frames = enhancer.PopEnhanced(mask ? &chunk_mask: NULL, &enh);
+        enhancer.Synthesize(enh, &out);
+        ReplayClock::time_point t1 = ReplayClock::now();
+
+        double compute_ms = ElapsedMs(t0, t1),
+               produced_ms = realtime ? ElapsedMs(start, t1): arrival_ms + compute_ms;
+        for (int32 t = 0; t < num_frames; t++) {
+            // first sample of output of this frame arrived at
+            double first_ms = ((num_done + t) * frame_shift + offset) * 1000.0 / samp_freq;
+            stats->RecordFrame(compute_ms / num_frames, produced_ms - first_ms);
+        }
+        int32 num_copy = std::min(out.NumCols(), num_samples - num_out);
+        enhan->Row(0).Range(num_out, num_copy).CopyFromVec(out.Row(0).Range(0, num_copy));
+        num_out += num_copy;
+    }
+    enhancer.Flush(&out);
+    int32 num_copy = std::min(out.NumCols(), num_samples - num_out);
+    enhan->Row(0).Range(num_out, num_copy).CopyFromVec(out.Row(0).Range(0, num_copy));
+    num_out += num_copy;
+    enhan->Resize(1, num_out, kCopyData);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Replay wave files through streaming stft & beamformer(at real-time pace if --realtime=true),\n"
+            "and report real-time factor, per-frame latency and deadline misses\n"
+            "\n"
+            "Usage: realtime-replay [options...] <wav-rspecifier> <enhan-wav-wspecifier>\n"
+            "   or: realtime-replay [options...] <wav-rxfilename> <enhan-wav-wxfilename>\n"
+            "e.g.:\n"
+            " realtime-replay --beamformer=fixed --beam-weights=weight.cmat 4ch.wav enhan.wav\n"
+            " realtime-replay --beamformer=mvdr --mask=ark:mask.ark scp:wav.scp ark:enhan.ark\n";
+
+        ParseOptions po(usage);
+        ShortTimeFTOptions stft_options;
+        OnlineBeamformerOptions beamformer_options;
+
+        int32 chunk_size = 160;
+        bool realtime = true;
+        BaseFloat deadline_ms = 0;
+        std::string beam_weights = "", mask_in = "", stats_json = "";
+
+        po.Register("chunk-size", &chunk_size, "Number of samples fed in each chunk");
+        po.Register("realtime", &realtime, "If true, feed chunks at the pace of audio time, "
+                    "otherwise as fast as possible");
+        po.Register("deadline-ms", &deadline_ms, "Processing time budget of each frame, "
+                    "if non-positive, use duration of frame shift");
+        po.Register("beam-weights", &beam_weights, "Complex weights(in kaldi format) of fixed beamformer");
+        po.Register("mask", &mask_in, "Target masks(rspecifier or rxfilename, same as input waves) "
+                    "for adaptive beamformers");
+        po.Register("stats-json", &stats_json, "If not empty, write real-time statistics of all utterances in JSON");
+
+        stft_options.Register(&po);
+        beamformer_options.Register(&po);
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 2) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
+        KALDI_ASSERT(chunk_size > 0);
+        if (beamformer_options.beamformer != "fixed" && mask_in == "")
+            KALDI_ERR << "Option --mask is required for " << beamformer_options.beamformer << " beamformer";
+
+        std::string wave_in = po.GetArg(1), enhan_out = po.GetArg(2);
+
+        bool in_is_rspecifier = (ClassifyRspecifier(wave_in, NULL, NULL) != kNoRspecifier),
+             out_is_wspecifier = (ClassifyWspecifier(enhan_out, NULL, NULL, NULL) != kNoWspecifier);
+
+        if (in_is_rspecifier != out_is_wspecifier)
+            KALDI_ERR << "Cannot mix archives with regular files";
+
+        CMatrix<BaseFloat> weights;
+        if (beam_weights != "")
+            ReadKaldiObject(beam_weights, &weights);
+
+        // totals of all utterances, created on first utterance
+        RealtimeStats *total_stats = NULL;
+        Matrix<BaseFloat> enhan;
+
+        if (in_is_rspecifier) {
+            DistributedWaveReader wave_reader(wave_in, work_queue_options);
+            RandomAccessBaseFloatMatrixReader mask_reader;
+            if (mask_in != "" && !mask_reader.Open(mask_in))
+                KALDI_ERR << "Could not open masks with rspecifier " << mask_in;
+            ResumableWaveWriter wav_writer(enhan_out, resume_options);
+
+            int32 num_done = 0, num_miss = 0;
+            for (; !wave_reader.Done(); wave_reader.Next()) {
+                std::string utt_key = wave_reader.Key();
+                if (wav_writer.IsDone(utt_key))
+                    continue;
+                const WaveData &wave_data = wave_reader.Value();
+                if (mask_in != "" && !mask_reader.HasKey(utt_key)) {
+                    KALDI_WARN << utt_key << ", missing target masks";
+                    num_miss++;
+                    continue;
+                }
+                RealtimeStats stats(wave_data.SampFreq(), stft_options.frame_shift, deadline_ms);
+                ReplayUtterance(stft_options, beamformer_options, beam_weights != "" ? &weights: NULL,
+                                mask_in != "" ? &mask_reader.Value(utt_key): NULL,
+                                wave_data, chunk_size, realtime, &stats, &enhan);
+                KALDI_VLOG(1) << "Utterance " << utt_key << ": " << stats.Report();
+                if (!total_stats)
+                    total_stats = new RealtimeStats(stats);
+                else
+                    total_stats->Add(stats);
+
+                { SETK_PROFILE("write"); wav_writer.Write(utt_key, WaveData(wave_data.SampFreq(), enhan)); }
+                num_done++;
+                profile_session.EndUtterance();
+            }
+            KALDI_LOG << "Done " << num_done << " utterances, " << num_miss << " missing masks";
+            if (!num_done && !wav_writer.NumDone())
+                return 1;
+        } else {
+            bool binary;
+            Input ki(wave_in, &binary);
+            WaveData wave_data;
+            wave_data.Read(ki.Stream());
+            Matrix<BaseFloat> mask;
+            if (mask_in != "")
+                ReadKaldiObject(mask_in, &mask);
+            total_stats = new RealtimeStats(wave_data.SampFreq(), stft_options.frame_shift, deadline_ms);
+            ReplayUtterance(stft_options, beamformer_options, beam_weights != "" ? &weights: NULL,
+                            mask_in != "" ? &mask: NULL, wave_data, chunk_size, realtime,
+                            total_stats, &enhan);
+            Output ko(enhan_out, binary, false);
+            WaveData(wave_data.SampFreq(), enhan).Write(ko.Stream());
+        }
+
+        KALDI_LOG << "Real-time statistics(" << (realtime ? "real-time pace": "as fast as possible")
+                  << "): " << total_stats->Report();
+        if (stats_json != "") {
+            Output ko(stats_json, false);
+            total_stats->WriteJson(ko.Stream());
+        }
+        delete total_stats;
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
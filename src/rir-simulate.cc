@@ -21,6 +21,8 @@
 
 #include "feat/wave-reader.h"
 #include "include/rir-generator.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
 
 
 int main(int argc, char const *argv[]) {
@@ -45,6 +47,12 @@ int main(int argc, char const *argv[]) {
         RirGeneratorOptions generator_opts;
         generator_opts.Register(&po);
 
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
         po.Read(argc, argv);
         
         if (po.NumArgs() != 1) {
@@ -52,6 +60,9 @@ int main(int argc, char const *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         RirGenerator generator(generator_opts);
         Matrix<BaseFloat> rir;
         BaseFloat int16_max = static_cast<BaseFloat>(std::numeric_limits<int16>::max());
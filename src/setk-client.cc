@@ -0,0 +1,158 @@
+// src/setk-client.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "include/setk-server.h"
+#include "include/setk-profile.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
+
+using namespace kaldi;
+
+uint32 ParseRequestType(const std::string &request) {
+    if (request == "spectra")
+        return kRequestSpectrogram;
+    if (request == "beamform")
+        return kRequestFixedBeamform;
+    if (request == "srp-phat")
+        return kRequestSrpPhat;
+    KALDI_ERR << "Unknown request type: " << request;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Send requests to setk-server and write responses\n"
+            "\n"
+            "Usage: setk-client [options...] <wav-rspecifier> <wspecifier>\n"
+            "   or: setk-client [options...] <wav-rxfilename> <wxfilename>\n"
+            "e.g.:\n"
+            " setk-client --request=beamform scp:wav.scp ark:enhan.ark\n"
+            " setk-client --request=srp-phat 4ch.wav srp.mat\n";
+
+        ParseOptions po(usage);
+
+        std::string socket_path = "/tmp/setk.sock", request = "spectra";
+        bool binary = true;
+
+        po.Register("socket", &socket_path, "Path of unix domain socket which setk-server listens on");
+        po.Register("request", &request, "Type(\"spectra\"|\"beamform\"|\"srp-phat\") of requests");
+        po.Register("binary", &binary, "Write in binary mode (only relevant if output is a wxfilename)");
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 2) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        ProfileSession profile_session(profile_options);
+
+        std::string wave_in = po.GetArg(1), target_out = po.GetArg(2);
+
+        bool in_is_rspecifier = (ClassifyRspecifier(wave_in, NULL, NULL) != kNoRspecifier),
+             out_is_wspecifier = (ClassifyWspecifier(target_out, NULL, NULL, NULL) != kNoWspecifier);
+
+        if (in_is_rspecifier != out_is_wspecifier)
+            KALDI_ERR << "Cannot mix archives with regular files";
+
+        uint32 type = ParseRequestType(request);
+        // responses of beamform requests are waves, others are matrix
+        bool wave_out = (type == kRequestFixedBeamform);
+
+        SetkClient client(socket_path);
+        SetkRequestTiming timing;
+        std::string response;
+
+        if (in_is_rspecifier) {
+            DistributedWaveReader wave_reader(wave_in, work_queue_options);
+            ResumableWaveWriter wav_writer;
+            ResumableMatrixWriter mat_writer;
+            if (wave_out ? !wav_writer.Open(target_out, resume_options): !mat_writer.Open(target_out, resume_options))
+                KALDI_ERR << "Could not initialize output with wspecifier " << target_out;
+
+            int32 num_done = 0, num_err = 0;
+            double compute_ms = 0;
+            Timer timer;
+            for (; !wave_reader.Done(); wave_reader.Next()) {
+                std::string utt_key = wave_reader.Key();
+                if (wav_writer.IsDone(utt_key) || mat_writer.IsDone(utt_key))
+                    continue;
+                if (!client.Request(type, wave_reader.Value(), &response, &timing)) {
+                    KALDI_WARN << "Server failed on utterance " << utt_key << ": " << response;
+                    num_err++;
+                    continue;
+                }
+                std::istringstream iss(response);
+                if (wave_out) {
+                    WaveData target_data;
+                    target_data.Read(iss);
+                    { SETK_PROFILE("write"); wav_writer.Write(utt_key, target_data); }
+                } else {
+                    Matrix<BaseFloat> target_mat;
+                    target_mat.Read(iss, true);
+                    { SETK_PROFILE("write"); mat_writer.Write(utt_key, target_mat); }
+                }
+                compute_ms += timing.compute_ms;
+                num_done++;
+                profile_session.EndUtterance();
+                KALDI_VLOG(1) << "Utterance " << utt_key << ": " << timing.Report();
+            }
+            KALDI_LOG << "Done " << num_done << " utterances, " << num_err << " failed, "
+                      << "average compute time " << (num_done ? compute_ms / num_done: 0) << " ms, "
+                      << "average round trip time " << (num_done ? timer.Elapsed() * 1000 / num_done: 0) << " ms";
+            return num_done + wav_writer.NumDone() + mat_writer.NumDone() == 0 ? 1: 0;
+        } else {
+            bool read_binary;
+            Input wave_input(wave_in, &read_binary);
+            WaveData wave;
+            wave.Read(wave_input.Stream());
+            if (!client.Request(type, wave, &response, &timing))
+                KALDI_ERR << "Server failed on " << wave_in << ": " << response;
+            std::istringstream iss(response);
+            if (wave_out) {
+                WaveData target_data;
+                target_data.Read(iss);
+                Output ko(target_out, true, false);
+                target_data.Write(ko.Stream());
+            } else {
+                Matrix<BaseFloat> target_mat;
+                target_mat.Read(iss, true);
+                WriteKaldiObject(target_mat, target_out, binary);
+            }
+            KALDI_LOG << "Done processed " << wave_in << ": " << timing.Report();
+        }
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+// setk-coordinator.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <algorithm>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "include/work-queue.h"
+#include "include/setk-profile.h"
+
+using namespace kaldi;
+
+// Replace each "JOB" in pattern with index of worker
+std::string ExpandJob(const std::string &pattern, int32 job) {
+    std::string expanded = pattern;
+    for (size_t pos = 0; (pos = expanded.find("JOB", pos)) != std::string::npos; )
+        expanded.replace(pos, 3, std::to_string(job));
+    return expanded;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Distribute utterances to worker processes of any setk tool dynamically(longest first), instead\n"
+            "of splitting scp into static shards, then merge their outputs into one archive & scp.\n"
+            "Workers are spawned by /bin/sh and fetch keys over a unix domain socket($SETK_WORK_QUEUE),\n"
+            "reading their main input table by random access(so use scp). JOB in worker command and\n"
+            "worker scp is replaced by index of worker(1 based).\n"
+            "\n"
+            "Usage: setk-coordinator [options...] <key-scp> <worker-command> <worker-scp> <merged-wspecifier>\n"
+            "e.g.:\n"
+            " setk-coordinator --num-workers=40 --utt2dur=ark,t:data/utt2dur mask.scp \\\n"
+            "   \"apply-supervised-mvdr --config=conf/mvdr.conf scp:mask.scp wav.scp \\\n"
+            "    ark,scp:enh/enh.JOB.ark,enh/enh.JOB.scp 2> log/mvdr.JOB.log\" \\\n"
+            "   enh/enh.JOB.scp ark,scp:enh/enh.ark,enh/enh.scp\n";
+
+        ParseOptions po(usage);
+
+        int32 num_workers = 4, max_retries = 3;
+        std::string socket_path, utt2dur_rspecifier;
+        bool merge_archive = true;
+        po.Register("num-workers", &num_workers, "Number of worker processes");
+        po.Register("socket", &socket_path, "Path of unix domain socket for work queue, "
+                    "default is /tmp/setk-coordinator.<pid>.sock");
+        po.Register("utt2dur", &utt2dur_rspecifier, "Rspecifier of utterance durations, used to hand out "
+                    "longest utterances first. If empty, size of file in key-scp is used(if it's a regular file)");
+        po.Register("max-retries", &max_retries, "Max times a key is handed out again after its worker "
+                    "disconnects(egs. crashes), keys still failing after that are reported and given up");
+        po.Register("merge-archive", &merge_archive, "If true, copy outputs of workers into one archive, "
+                    "otherwise merged scp points to archives of workers");
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 4) {
+            po.PrintUsage();
+            exit(1);
+        }
+        KALDI_ASSERT(num_workers >= 1 && max_retries >= 0);
+
+        ProfileSession profile_session(profile_options);
+
+        std::string key_scp = po.GetArg(1), worker_command = po.GetArg(2),
+                    worker_scp = po.GetArg(3), merged_wspecifier = po.GetArg(4);
+        if (worker_command.find("JOB") == std::string::npos || worker_scp.find("JOB") == std::string::npos)
+            KALDI_ERR << "Both worker command and worker scp should contain JOB";
+
+        std::string merged_archive, merged_script;
+        WspecifierType wspecifier_type = ClassifyWspecifier(merged_wspecifier, &merged_archive,
+                                                            &merged_script, NULL);
+        if (merge_archive ? wspecifier_type != kBothWspecifier: merged_script.empty())
+            KALDI_ERR << "Merged wspecifier should be ark,scp:<ark>,<scp>(or scp:<scp> if "
+                      << "--merge-archive=false), but got " << merged_wspecifier;
+
+        std::vector<std::pair<std::string, std::string> > entries;
+        if (!ReadScriptFile(key_scp, true, &entries))
+            KALDI_ERR << "Failed to read keys from " << key_scp;
+        std::vector<std::string> keys;
+        std::vector<std::pair<double, int32> > lengths;
+        RandomAccessBaseFloatReader utt2dur_reader;
+        if (utt2dur_rspecifier != "" && !utt2dur_reader.Open(utt2dur_rspecifier))
+            KALDI_ERR << "Failed to open " << utt2dur_rspecifier;
+        for (int32 k = 0; k < entries.size(); k++) {
+            const std::string &key = entries[k].first, &rxfilename = entries[k].second;
+            double length = 0;
+            struct stat file_stat;
+            if (utt2dur_rspecifier != "") {
+                if (utt2dur_reader.HasKey(key))
+                    length = utt2dur_reader.Value(key);
+                else
+                    KALDI_WARN << "Missing duration of " << key;
+            } else if (ClassifyRxfilename(rxfilename) == kFileInput && !stat(rxfilename.c_str(), &file_stat)) {
+                length = file_stat.st_size;
+            }
+            keys.push_back(key);
+            lengths.push_back(std::make_pair(-length, k));
+        }
+        // longest first, others keep the order of scp
+        std::vector<std::string> sorted_keys;
+        std::stable_sort(lengths.begin(), lengths.end());
+        for (int32 k = 0; k < lengths.size(); k++)
+            sorted_keys.push_back(keys[lengths[k].second]);
+
+        if (socket_path == "")
+            socket_path = "/tmp/setk-coordinator." + std::to_string(getpid()) + ".sock";
+        std::vector<std::string> commands, scripts;
+        for (int32 j = 1; j <= num_workers; j++) {
+            commands.push_back(ExpandJob(worker_command, j));
+            scripts.push_back(ExpandJob(worker_scp, j));
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+        std::vector<int32> owners;
+        std::vector<bool> skipped, succeeded;
+        std::vector<std::string> poison_keys;
+        int32 num_failed = 0;
+        {
+            SETK_PROFILE("work-queue");
+            WorkQueueCoordinator coordinator(socket_path, sorted_keys, max_retries);
+            KALDI_LOG << "Distribute " << keys.size() << " utterances to " << num_workers
+                      << " workers on " << socket_path;
+            num_failed = coordinator.Run(commands);
+            owners = coordinator.Owners();
+            skipped = coordinator.Skipped();
+            succeeded = coordinator.Succeeded();
+            poison_keys = coordinator.PoisonKeys();
+        }
+        int32 num_acked = owners.size() - std::count(owners.begin(), owners.end(), 0),
+              num_skipped = std::count(skipped.begin(), skipped.end(), true);
+        for (const std::string &key: poison_keys)
+            KALDI_WARN << "Poison key " << key << " crashed workers " << max_retries + 1 << " times";
+        // owners in the order of scp
+        std::vector<int32> key_owners(keys.size());
+        for (int32 k = 0; k < lengths.size(); k++)
+            key_owners[lengths[k].second] = owners[k];
+
+        int32 num_merged = 0;
+        {
+            SETK_PROFILE("merge");
+            num_merged = MergeWorkerTables(keys, key_owners, scripts, succeeded, merged_archive,
+                                           merged_script, merge_archive);
+        }
+        KALDI_LOG << "Done " << num_acked << " utterances out of " << keys.size() << ", "
+                  << num_skipped << " skipped(missing in input), " << poison_keys.size()
+                  << " poison keys, " << num_merged << " written to " << merged_script << ", "
+                  << num_failed << " workers failed";
+        if (num_acked + num_skipped != keys.size() || num_merged != num_acked || num_failed) {
+            KALDI_WARN << "Some utterances are not processed, rerun workers with --resume to complete them";
+            return 1;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
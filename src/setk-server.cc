@@ -0,0 +1,90 @@
+// src/setk-server.cc
+// wujian@2018
+
+// Copyright 2018 Jian Wu
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <csignal>
+
+#include "include/setk-server.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+
+using namespace kaldi;
+
+SetkServer *server = NULL;
+
+void StopServer(int32 signum) {
+    if (server)
+        server->Interrupt();
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Run as a daemon, which holds pre-initialized stft/beamformer/srp-phat engines and serves\n"
+            "requests(wave in, enhanced wave or features out) over a unix domain socket.\n"
+            "Use setk-client to send requests.\n"
+            "\n"
+            "Usage: setk-server [options...]\n"
+            "e.g.:\n"
+            " setk-server --socket=/tmp/setk.sock --num-workers=8 --beam-weights=weight.cmat --config=conf/stft.conf\n";
+
+        ParseOptions po(usage);
+        ShortTimeFTOptions stft_options;
+        SrpPhatOptions srp_options;
+        SetkServerOptions server_options;
+
+        stft_options.Register(&po);
+        srp_options.Register(&po);
+        server_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 0) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
+        // srp-phat engine is optional, enabled by --topo-descriptor
+        server = new SetkServer(server_options, stft_options,
+                                srp_options.topo_descriptor != "" ? &srp_options: NULL);
+
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, StopServer);
+        signal(SIGTERM, StopServer);
+
+        server->Serve();
+        KALDI_LOG << server->Report();
+        delete server;
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
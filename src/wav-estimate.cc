@@ -20,6 +20,10 @@
 
 
 #include "include/stft.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
@@ -58,6 +62,18 @@ int main(int argc, char *argv[]) {
 
         stft_options.Register(&po);
 
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
@@ -65,6 +81,9 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         std::string spectrum_in = po.GetArg(1), refer_in = po.GetArg(2), target_out = po.GetArg(3);
         
         bool spectrum_is_rspecifier = (ClassifyRspecifier(spectrum_in, NULL, NULL) != kNoRspecifier),
@@ -80,13 +99,15 @@ int main(int argc, char *argv[]) {
         ShortTimeFTComputer stft_computer(stft_options);
 
         if (spectrum_is_rspecifier) {
-            SequentialBaseFloatMatrixReader spectrum_reader(spectrum_in);
+            DistributedMatrixReader spectrum_reader(spectrum_in, work_queue_options);
             RandomAccessTableReader<WaveHolder> refer_reader(refer_in);
-            TableWriter<WaveHolder> wav_writer(target_out);
+            ResumableWaveWriter wav_writer(target_out, resume_options);
 
             int num_utts = 0, num_no_tgt_utts = 0, num_done = 0;
             for (; !spectrum_reader.Done(); spectrum_reader.Next()) {
                 std::string utt_key = spectrum_reader.Key();
+                if (wav_writer.IsDone(utt_key))
+                    continue;
                 num_utts += 1;
 
                 if (!refer_reader.HasKey(utt_key)) {
@@ -95,7 +116,8 @@ int main(int argc, char *argv[]) {
                     continue;
                 }
 
-                Matrix<BaseFloat> &spectrum = spectrum_reader.Value();
+                // Polar() works in place
+                Matrix<BaseFloat> spectrum(spectrum_reader.Value());
                 const WaveData &refer_data = refer_reader.Value(utt_key);
                 BaseFloat target_freq = refer_data.SampFreq();
 
@@ -105,8 +127,9 @@ int main(int argc, char *argv[]) {
                 EstimateSpeech(stft_computer, refer_data.Data(), spectrum, &target_speech, track_volumn);
 
                 WaveData target_data(target_freq, target_speech);
-                wav_writer.Write(utt_key, target_data);
+                { SETK_PROFILE("write"); wav_writer.Write(utt_key, target_data); }
                 num_done++;
+                profile_session.EndUtterance();
 
                 if (num_done % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
@@ -114,7 +137,7 @@ int main(int argc, char *argv[]) {
             }
             KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts
                       << ", " << num_no_tgt_utts << " missing targets masks";
-            return num_done == 0 ? 1: 0;
+            return num_done + wav_writer.NumDone() == 0 ? 1: 0;
         } else {
             Matrix<BaseFloat> spectrum;
             ReadKaldiObject(spectrum_in, &spectrum);
@@ -20,14 +20,23 @@
 
 
 #include "include/stft.h"
+#include "include/stft-feature.h"
+#include "include/resampler.h"
+#include "include/setk-profile.h"
+#include "include/thread-pool.h"
+#include "include/table-resume.h"
+#include "include/work-queue.h"
 
 using namespace kaldi;
 
+// target_speech: separated waveform, or features if feature_computer is not NULL
 void SeparateSpeech(ShortTimeFTComputer &stft_computer,
                     const MatrixBase<BaseFloat> &noisy_data, 
                     const MatrixBase<BaseFloat> &target_mask, 
                     Matrix<BaseFloat>  *target_speech, 
-                    bool track_volumn) {
+                    bool track_volumn,
+                    StftFeatureComputer *feature_computer = NULL,
+                    BaseFloat samp_freq = 16000) {
     Matrix<BaseFloat> spectra, angle;
     stft_computer.Compute(noisy_data, NULL, &spectra, &angle);
     KALDI_ASSERT(SameDim(spectra, target_mask));
@@ -36,20 +45,20 @@ void SeparateSpeech(ShortTimeFTComputer &stft_computer,
     
     Matrix<BaseFloat> target_stft; 
     stft_computer.Polar(spectra, angle, &target_stft);   
-    if (track_volumn) {
-        BaseFloat range = noisy_data.LargestAbsElem();
+    BaseFloat range = track_volumn ? noisy_data.LargestAbsElem(): 0;
+    if (feature_computer)
+        feature_computer->Compute(&target_stft, samp_freq, target_speech);
+    else
         stft_computer.InverseShortTimeFT(target_stft, target_speech, range);
-    } else {
-        stft_computer.InverseShortTimeFT(target_stft, target_speech);
-    }
 }
 
 int main(int argc, char *argv[]) {
     try{
         const char *usage = 
             "Seperate target component of wave file based on TF mask approach\n"
-            "Usage:  wav-separate [options...] <wav-rspecifier> <mask-rspecifier> <target-wav-wspecifier>\n"
-            "   or:  wav-separate [options...] <wav-rxfilename> <mask-rxfilename> <target-wav-wxfilename>\n";
+            "Usage:  wav-separate [options...] <wav-rspecifier> <mask-rspecifier> <target-wspecifier>\n"
+            "   or:  wav-separate [options...] <wav-rxfilename> <mask-rxfilename> <target-wxfilename>\n"
+            "Targets are waves, or features computed on separated stft if --output-feature is not \"wave\"\n";
 
         ParseOptions po(usage);
         ShortTimeFTOptions stft_options;
@@ -59,6 +68,24 @@ int main(int argc, char *argv[]) {
 
         stft_options.Register(&po);
 
+        StftFeatureOptions feature_options;
+        feature_options.Register(&po);
+
+        ResampleOptions resample_options;
+        resample_options.Register(&po);
+
+        ProfileOptions profile_options;
+        profile_options.Register(&po);
+
+        ThreadPoolOptions thread_options;
+        thread_options.Register(&po);
+
+        ResumeOptions resume_options;
+        resume_options.Register(&po);
+
+        WorkQueueOptions work_queue_options;
+        work_queue_options.Register(&po);
+
         po.Read(argc, argv);
 
         if (po.NumArgs() != 3) {
@@ -66,6 +93,9 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
+        ProfileSession profile_session(profile_options);
+        ThreadPool::Get().Configure(thread_options);
+
         std::string noisy_in = po.GetArg(1), mask_in = po.GetArg(2), target_out = po.GetArg(3);
         
         bool noisy_is_rspecifier = (ClassifyRspecifier(noisy_in, NULL, NULL) != kNoRspecifier),
@@ -83,15 +113,25 @@ int main(int argc, char *argv[]) {
         stft_options.apply_pow = false;
 
         ShortTimeFTComputer stft_computer(stft_options);
+        StftFeatureComputer feature_computer(feature_options, &stft_computer);
+        StftFeatureComputer *feature_out = feature_options.OutputWave() ? NULL: &feature_computer;
+        WaveResampler resampler(resample_options);
 
         if (noisy_is_rspecifier) {
-            SequentialTableReader<WaveHolder> noisy_reader(noisy_in);
+            DistributedWaveReader noisy_reader(noisy_in, work_queue_options);
             RandomAccessBaseFloatMatrixReader mask_reader(mask_in);
-            TableWriter<WaveHolder> wav_writer(target_out);
+            ResumableWaveWriter wav_writer;
+            ResumableMatrixWriter feats_writer;
+            if (feature_out)
+                feats_writer.Open(target_out, resume_options);
+            else
+                wav_writer.Open(target_out, resume_options);
 
             int num_utts = 0, num_no_tgt_utts = 0, num_done = 0;
             for (; !noisy_reader.Done(); noisy_reader.Next()) {
                 std::string utt_key = noisy_reader.Key();
+                if (wav_writer.IsDone(utt_key) || feats_writer.IsDone(utt_key))
+                    continue;
                 num_utts++;
 
                 if (!mask_reader.HasKey(utt_key)) {
@@ -101,16 +141,23 @@ int main(int argc, char *argv[]) {
                 }
 
                 const WaveData &noisy_data = noisy_reader.Value();
-                BaseFloat target_freq = noisy_data.SampFreq();
+                BaseFloat target_freq = resampler.SampFreq(noisy_data);
                 KALDI_ASSERT(noisy_data.Data().NumRows() == 1);
 
                 const Matrix<BaseFloat> &target_mask = mask_reader.Value(utt_key);
                 Matrix<BaseFloat> target_speech;
-                SeparateSpeech(stft_computer, noisy_data.Data(), target_mask, &target_speech, track_volumn);
-
-                WaveData target_data(target_freq, target_speech);
-                wav_writer.Write(utt_key, target_data);
+                SeparateSpeech(stft_computer, resampler.Resample(noisy_data), target_mask, &target_speech,
+                               track_volumn, feature_out, target_freq);
+
+                if (feature_out) {
+                    SETK_PROFILE("write");
+                    feats_writer.Write(utt_key, target_speech);
+                } else {
+                    WaveData target_data(target_freq, target_speech);
+                    { SETK_PROFILE("write"); wav_writer.Write(utt_key, target_data); }
+                }
                 num_done++;
+                profile_session.EndUtterance();
 
                 if (num_done % 100 == 0)
                     KALDI_LOG << "Processed " << num_utts << " utterances";
@@ -118,7 +165,7 @@ int main(int argc, char *argv[]) {
             }
             KALDI_LOG << "Done " << num_done << " utterances out of " << num_utts
                       << ", " << num_no_tgt_utts << " missing targets masks";
-            return num_done == 0 ? 1: 0;
+            return num_done + wav_writer.NumDone() + feats_writer.NumDone() == 0 ? 1: 0;
 
         } else {
             bool binary;
@@ -128,15 +175,20 @@ int main(int argc, char *argv[]) {
 
             WaveData noisy_data;
             noisy_data.Read(ki.Stream());
-            BaseFloat target_freq = noisy_data.SampFreq();
+            BaseFloat target_freq = resampler.SampFreq(noisy_data);
             KALDI_ASSERT(noisy_data.Data().NumRows() == 1);
 
             Matrix<BaseFloat> target_speech;
-            SeparateSpeech(stft_computer, noisy_data.Data(), target_mask, &target_speech, track_volumn);
+            SeparateSpeech(stft_computer, resampler.Resample(noisy_data), target_mask, &target_speech,
+                           track_volumn, feature_out, target_freq);
 
-            Output ko(target_out, binary, false);
-            WaveData target_data(target_freq, target_speech);
-            target_data.Write(ko.Stream());
+            if (feature_out) {
+                WriteKaldiObject(target_speech, target_out, true);
+            } else {
+                Output ko(target_out, binary, false);
+                WaveData target_data(target_freq, target_speech);
+                target_data.Write(ko.Stream());
+            }
 
             KALDI_LOG << "Done processed " << noisy_in;
         }
@@ -0,0 +1,475 @@
+// accuracy-setk.cc
+// wujian@18.5.28
+
+// Accuracy versus speed of approximate paths in libsetk. For each utterance of
+// a local corpus, runs reference and fast configurations of the same kernel,
+// and reports numerical error, task metrics and speedup of each fast mode.
+
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/srp-phat.h"
+#include "include/online-enhancer.h"
+#include "include/fixed-point.h"
+
+using namespace kaldi;
+
+// Median cost of fn in ms
+double TimeMs(int32 num_repeats, std::function<void()> fn) {
+    std::vector<double> cost(num_repeats);
+    for (int32 i = 0; i < num_repeats; i++) {
+        auto beg = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        cost[i] = std::chrono::duration<double, std::milli>(end - beg).count();
+    }
+    std::sort(cost.begin(), cost.end());
+    return cost[num_repeats / 2];
+}
+
+// max |ref - est|
+double MaxAbsError(const CMatrixBase<BaseFloat> &ref, const CMatrixBase<BaseFloat> &est) {
+    KALDI_ASSERT(ref.NumRows() == est.NumRows() && ref.NumCols() == est.NumCols());
+    double err = 0;
+    for (int32 r = 0; r < ref.NumRows(); r++)
+        for (int32 c = 0; c < ref.NumCols(); c++)
+            err = std::max(err, static_cast<double>(std::abs(std::complex<BaseFloat>(
+                ref(r, c, kReal) - est(r, c, kReal), ref(r, c, kImag) - est(r, c, kImag)))));
+    return err;
+}
+
+// 10 * log10(|ref|^2 / |ref - est|^2)
+double Snr(const CMatrixBase<BaseFloat> &ref, const CMatrixBase<BaseFloat> &est) {
+    double sig = 0, err = 0;
+    for (int32 r = 0; r < ref.NumRows(); r++) {
+        for (int32 c = 0; c < ref.NumCols(); c++) {
+            BaseFloat er = ref(r, c, kReal) - est(r, c, kReal), ei = ref(r, c, kImag) - est(r, c, kImag);
+            sig += ref(r, c, kReal) * ref(r, c, kReal) + ref(r, c, kImag) * ref(r, c, kImag);
+            err += er * er + ei * ei;
+        }
+    }
+    return 10 * std::log10((sig + 1e-20) / (err + 1e-20));
+}
+
+// Scale-invariant SDR of est against ref(output of reference configuration)
+double SiSdr(const VectorBase<BaseFloat> &ref, const VectorBase<BaseFloat> &est) {
+    int32 n = std::min(ref.Dim(), est.Dim());
+    double dot = 0, energy = 0;
+    for (int32 i = 0; i < n; i++)
+        dot += ref(i) * est(i), energy += ref(i) * ref(i);
+    double alpha = dot / (energy + 1e-20), sig = 0, err = 0;
+    for (int32 i = 0; i < n; i++) {
+        double s = alpha * ref(i);
+        sig += s * s, err += (est(i) - s) * (est(i) - s);
+    }
+    return 10 * std::log10((sig + 1e-20) / (err + 1e-20));
+}
+
+// Log spectral distance(dB) between two stft, used as a cheap proxy of
+// perceptual quality(PESQ) degradation
+double LogSpectralDistance(const CMatrixBase<BaseFloat> &ref, const CMatrixBase<BaseFloat> &est) {
+    double sum = 0;
+    for (int32 r = 0; r < ref.NumRows(); r++) {
+        double frame = 0;
+        for (int32 c = 0; c < ref.NumCols(); c++) {
+            double pr = ref(r, c, kReal) * ref(r, c, kReal) + ref(r, c, kImag) * ref(r, c, kImag),
+                   pe = est(r, c, kReal) * est(r, c, kReal) + est(r, c, kImag) * est(r, c, kImag);
+            double d = 10 * std::log10((pr + 1e-10) / (pe + 1e-10));
+            frame += d * d;
+        }
+        sum += std::sqrt(frame / ref.NumCols());
+    }
+    return ref.NumRows() ? sum / ref.NumRows(): 0;
+}
+
+typedef std::vector<std::pair<std::string, double> > TaskMetrics;
+
+struct AccuracyResult {
+    std::string name, params;
+    int32 num_utts;
+    // maximum of max_abs_err, sum of others
+    double max_abs_err, snr_db, ref_ms, fast_ms;
+    TaskMetrics task_metrics;
+};
+
+class AccuracyRunner {
+public:
+    AccuracyRunner(const std::string &filter) {
+        if (filter != "")
+            SplitStringToVector(filter, ",", true, &filters_);
+    }
+
+    bool Enabled(const std::string &name) {
+        if (filters_.empty()) return true;
+        for (int32 i = 0; i < filters_.size(); i++)
+            if (name.find(filters_[i]) != std::string::npos)
+                return true;
+        return false;
+    }
+
+    // task_metrics: metrics of task(egs. sdr, doa error) of fast one against reference one
+    void Add(const std::string &name, const std::string &params, double max_abs_err,
+             double snr_db, const TaskMetrics &task_metrics, double ref_ms, double fast_ms) {
+        std::string key = name + "[" + params + "]";
+        if (results_.find(key) == results_.end()) {
+            AccuracyResult r;
+            r.name = name, r.params = params, r.task_metrics = task_metrics;
+            r.num_utts = 0, r.max_abs_err = r.snr_db = r.ref_ms = r.fast_ms = 0;
+            for (int32 i = 0; i < r.task_metrics.size(); i++)
+                r.task_metrics[i].second = 0;
+            results_[key] = r;
+            keys_.push_back(key);
+        }
+        AccuracyResult &r = results_[key];
+        KALDI_ASSERT(r.task_metrics.size() == task_metrics.size());
+        r.num_utts++;
+        r.max_abs_err = std::max(r.max_abs_err, max_abs_err);
+        r.snr_db += snr_db, r.ref_ms += ref_ms, r.fast_ms += fast_ms;
+        for (int32 i = 0; i < task_metrics.size(); i++)
+            r.task_metrics[i].second += task_metrics[i].second;
+    }
+
+    void Report() {
+        for (int32 i = 0; i < keys_.size(); i++) {
+            const AccuracyResult &r = results_[keys_[i]];
+            std::ostringstream oss;
+            for (int32 j = 0; j < r.task_metrics.size(); j++)
+                oss << ", " << r.task_metrics[j].first << " = " << r.task_metrics[j].second / r.num_utts;
+            KALDI_LOG << r.name << "[" << r.params << "]: max-abs-err = " << r.max_abs_err
+                      << ", snr = " << r.snr_db / r.num_utts << " dB" << oss.str()
+                      << ", speedup = " << Speedup(r) << "x (" << r.num_utts << " utterances)";
+        }
+    }
+
+    void WriteJson(std::ostream &os) {
+        os << "{\n  \"modes\": [\n";
+        for (int32 i = 0; i < keys_.size(); i++) {
+            const AccuracyResult &r = results_[keys_[i]];
+            os << "    {\"name\": \"" << r.name << "\", \"params\": \"" << r.params
+               << "\", \"num_utts\": " << r.num_utts << ", \"max_abs_err\": " << r.max_abs_err
+               << ", \"snr_db\": " << r.snr_db / r.num_utts;
+            for (int32 j = 0; j < r.task_metrics.size(); j++)
+                os << ", \"" << r.task_metrics[j].first << "\": " << r.task_metrics[j].second / r.num_utts;
+            os << ", \"ref_ms\": " << r.ref_ms << ", \"fast_ms\": " << r.fast_ms
+               << ", \"speedup\": " << Speedup(r) << "}" << (i + 1 == keys_.size() ? "\n": ",\n");
+        }
+        os << "  ]\n}\n";
+    }
+
+private:
+    std::vector<std::string> filters_, keys_;
+    std::map<std::string, AccuracyResult> results_;
+
+    double Speedup(const AccuracyResult &r) { return r.fast_ms > 0 ? r.ref_ms / r.fast_ms: 0; }
+};
+
+std::string FormatParam(const std::string &key, BaseFloat value) {
+    std::ostringstream oss;
+    oss << key << "=" << value;
+    return oss.str();
+}
+
+// Wiener like mask of first channel, using 10% quantile of each bin as noise floor
+void EstimateMask(const CMatrixBase<BaseFloat> &ref_stft, Matrix<BaseFloat> *mask) {
+    int32 num_frames = ref_stft.NumRows(), num_bins = ref_stft.NumCols();
+    mask->Resize(num_frames, num_bins);
+    std::vector<BaseFloat> power(num_frames);
+    for (int32 f = 0; f < num_bins; f++) {
+        for (int32 t = 0; t < num_frames; t++)
+            power[t] = ref_stft(t, f, kReal) * ref_stft(t, f, kReal) + ref_stft(t, f, kImag) * ref_stft(t, f, kImag);
+        std::vector<BaseFloat> sorted(power);
+        std::nth_element(sorted.begin(), sorted.begin() + num_frames / 10, sorted.end());
+        BaseFloat floor = sorted[num_frames / 10];
+        for (int32 t = 0; t < num_frames; t++)
+            (*mask)(t, f) = std::max(static_cast<BaseFloat>(0), 1 - floor / (power[t] + 1e-10f));
+    }
+}
+
+void EvalStft(AccuracyRunner *runner, const ShortTimeFTOptions &stft_opts,
+              const Matrix<BaseFloat> &wave, int32 num_repeats) {
+    if (!runner->Enabled("stft/approx-trig")) return;
+    ShortTimeFTOptions fast_opts(stft_opts);
+    fast_opts.approx_trig = true;
+    ShortTimeFTComputer ref_computer(stft_opts), fast_computer(fast_opts);
+    Matrix<BaseFloat> stft, spectra, ref_angle, fast_angle;
+    ref_computer.ShortTimeFT(wave.RowRange(0, 1), &stft);
+    ref_computer.ComputeSpectrogram(stft, &spectra);
+
+    double ref_ms = TimeMs(num_repeats, [&] { ref_computer.ComputePhaseAngle(stft, &ref_angle); });
+    double fast_ms = TimeMs(num_repeats, [&] { fast_computer.ComputePhaseAngle(stft, &fast_angle); });
+    double max_err = 0;
+    for (int32 t = 0; t < ref_angle.NumRows(); t++)
+        for (int32 f = 0; f < ref_angle.NumCols(); f++) {
+            // wrap into [-pi, pi]
+            double d = std::abs(ref_angle(t, f) - fast_angle(t, f));
+            max_err = std::max(max_err, std::min(d, 2 * M_PI - d));
+        }
+    // reconstruct stft with approximated phase
+    Matrix<BaseFloat> ref_rstft, fast_rstft, spectra_copy(spectra);
+    ref_computer.Polar(spectra, ref_angle, &ref_rstft);
+    ref_computer.Polar(spectra_copy, fast_angle, &fast_rstft);
+    int32 num_bins = stft.NumCols() / 2 + 1;
+    CMatrix<BaseFloat> ref_cstft(stft.NumRows(), num_bins), fast_cstft(stft.NumRows(), num_bins);
+    ref_cstft.CopyFromRealfft(ref_rstft);
+    fast_cstft.CopyFromRealfft(fast_rstft);
+    TaskMetrics metrics = {{"lsd_db", LogSpectralDistance(ref_cstft, fast_cstft)}};
+    runner->Add("stft/approx-trig", "", max_err, Snr(ref_cstft, fast_cstft), metrics, ref_ms, fast_ms);
+}
+
+// beamformer: "mvdr" or "gevd"
+void Enhance(const std::string &beamformer, const CMatrixBase<BaseFloat> &src_stft,
+             const MatrixBase<BaseFloat> &mask, BaseFloat mask_floor, int32 decimation,
+             CMatrix<BaseFloat> *enh_stft) {
+    CMatrix<BaseFloat> target_psd, noise_psd, steer_vector, weights;
+    EstimatePsd(src_stft, mask, &target_psd, &noise_psd, mask_floor);
+    int32 num_channels = src_stft.NumCols();
+    // diagonal loading to keep psd invertible on short or silent utterances
+    for (int32 r = 0; r < noise_psd.NumRows(); r++)
+        noise_psd(r, r % num_channels, kReal) += 1e-6;
+    if (beamformer == "mvdr") {
+        EstimateSteerVector(target_psd, &steer_vector, decimation);
+        ComputeMvdrBeamWeights(noise_psd, steer_vector, &weights, decimation);
+    } else {
+        ComputeGevdBeamWeights(target_psd, noise_psd, &weights, decimation);
+    }
+    Beamform(src_stft, weights, enh_stft);
+}
+
+void EvalBeamformer(AccuracyRunner *runner, const ShortTimeFTOptions &stft_opts,
+                    const Matrix<BaseFloat> &wave, const Matrix<BaseFloat> *in_mask,
+                    int32 num_repeats) {
+    int32 num_channels = wave.NumRows();
+    if (num_channels < 2) return;
+    ShortTimeFTComputer computer(stft_opts);
+    Matrix<BaseFloat> rstft;
+    computer.ShortTimeFT(wave, &rstft);
+    int32 num_frames = rstft.NumRows() / num_channels, num_bins = rstft.NumCols() / 2 + 1;
+    CMatrix<BaseFloat> cstft(rstft.NumRows(), num_bins), src_stft;
+    cstft.CopyFromRealfft(rstft);
+    TrimStft(num_bins, num_channels, cstft, &src_stft);
+
+    Matrix<BaseFloat> mask;
+    if (in_mask) {
+        if (in_mask->NumRows() != num_frames || in_mask->NumCols() != num_bins)
+            KALDI_ERR << "Shape of mask mismatch with stft";
+        mask = *in_mask;
+    } else {
+        EstimateMask(cstft.RowRange(0, num_frames), &mask);
+    }
+
+    for (const auto &beamformer: {std::string("mvdr"), std::string("gevd")}) {
+        CMatrix<BaseFloat> ref_enh, fast_enh;
+        double ref_ms = TimeMs(num_repeats, [&] { Enhance(beamformer, src_stft, mask, 0, 1, &ref_enh); });
+        Matrix<BaseFloat> ref_rstft, ref_wave;
+        CastIntoRealfft(ref_enh, &ref_rstft);
+        computer.InverseShortTimeFT(ref_rstft, &ref_wave, -1);
+
+        std::vector<std::pair<std::string, std::pair<BaseFloat, int32> > > modes;
+        for (int32 d: {2, 4, 8})
+            modes.push_back(std::make_pair(FormatParam("decimation", d), std::make_pair(0.0f, d)));
+        for (BaseFloat floor: {0.05f, 0.1f, 0.2f})
+            modes.push_back(std::make_pair(FormatParam("mask-floor", floor), std::make_pair(floor, 1)));
+
+        for (int32 i = 0; i < modes.size(); i++) {
+            std::string name = "beamformer/" + beamformer + "/" +
+                (modes[i].second.second > 1 ? "decimated-weights": "sparse-psd");
+            if (!runner->Enabled(name)) continue;
+            BaseFloat floor = modes[i].second.first;
+            int32 d = modes[i].second.second;
+            double fast_ms = TimeMs(num_repeats, [&] { Enhance(beamformer, src_stft, mask, floor, d, &fast_enh); });
+            Matrix<BaseFloat> fast_rstft, fast_wave;
+            CastIntoRealfft(fast_enh, &fast_rstft);
+            computer.InverseShortTimeFT(fast_rstft, &fast_wave, -1);
+            TaskMetrics metrics = {{"sdr_db", SiSdr(ref_wave.Row(0), fast_wave.Row(0))},
+                                   {"lsd_db", LogSpectralDistance(ref_enh, fast_enh)}};
+            runner->Add(name, modes[i].first, MaxAbsError(ref_enh, fast_enh), Snr(ref_enh, fast_enh),
+                        metrics, ref_ms, fast_ms);
+        }
+    }
+}
+
+// Mean absolute error(degree) of per-frame DoA, which is peak of angular spectrum
+double DoaError(const MatrixBase<BaseFloat> &ref, const MatrixBase<BaseFloat> &est) {
+    int32 num_frames = ref.NumRows(), samp_rate = ref.NumCols();
+    double sum = 0;
+    for (int32 t = 0; t < num_frames; t++) {
+        int32 r, e;
+        ref.Row(t).Max(&r);
+        est.Row(t).Max(&e);
+        sum += std::abs(r - e) * 180.0 / samp_rate;
+    }
+    return num_frames ? sum / num_frames: 0;
+}
+
+void EvalSrpPhat(AccuracyRunner *runner, const ShortTimeFTOptions &stft_opts,
+                 const SrpPhatOptions &srp_opts, BaseFloat samp_freq,
+                 const Matrix<BaseFloat> &wave, int32 num_repeats) {
+    int32 num_channels = wave.NumRows();
+    if (srp_opts.topo_descriptor == "" || !runner->Enabled("srp-phat/freq-decimation")) return;
+    ShortTimeFTComputer computer(stft_opts);
+    Matrix<BaseFloat> rstft;
+    computer.ShortTimeFT(wave, &rstft);
+    int32 num_bins = rstft.NumCols() / 2 + 1;
+    CMatrix<BaseFloat> cstft(rstft.NumRows(), num_bins);
+    cstft.CopyFromRealfft(rstft);
+
+    SrpPhatOptions ref_opts(srp_opts);
+    ref_opts.samp_doa = true, ref_opts.samp_tdoa = false, ref_opts.freq_decimation = 1;
+    SrpPhatComputor ref_computor(ref_opts, samp_freq, num_bins);
+    if (ref_computor.NumChannels() != num_channels)
+        KALDI_ERR << "--topo-descriptor describes " << ref_computor.NumChannels()
+                  << " microphones, but wave has " << num_channels << " channels";
+    Matrix<BaseFloat> ref_spectra, fast_spectra;
+    double ref_ms = TimeMs(num_repeats, [&] { ref_computor.Compute(cstft, &ref_spectra); });
+
+    for (int32 d: {2, 4, 8}) {
+        SrpPhatOptions fast_opts(ref_opts);
+        fast_opts.freq_decimation = d;
+        SrpPhatComputor fast_computor(fast_opts, samp_freq, num_bins);
+        double fast_ms = TimeMs(num_repeats, [&] { fast_computor.Compute(cstft, &fast_spectra); });
+        CMatrix<BaseFloat> ref_c(ref_spectra.NumRows(), ref_spectra.NumCols()),
+                           fast_c(fast_spectra.NumRows(), fast_spectra.NumCols());
+        // normalize each frame before comparing, scale differs with number of bins
+        Matrix<BaseFloat> ref_n(ref_spectra), fast_n(fast_spectra);
+        for (int32 t = 0; t < ref_n.NumRows(); t++) {
+            ref_n.Row(t).Scale(1.0 / (ref_n.Row(t).Sum() + 1e-10));
+            fast_n.Row(t).Scale(1.0 / (fast_n.Row(t).Sum() + 1e-10));
+        }
+        ref_c.CopyFromMat(ref_n, kReal);
+        fast_c.CopyFromMat(fast_n, kReal);
+        TaskMetrics metrics = {{"doa_err_deg", DoaError(ref_spectra, fast_spectra)}};
+        runner->Add("srp-phat/freq-decimation", FormatParam("decimation", d), MaxAbsError(ref_c, fast_c),
+                    Snr(ref_c, fast_c), metrics, ref_ms, fast_ms);
+    }
+}
+
+// Streaming delay-and-sum(uniform weights), fixed-point against float path
+void EvalFixedPoint(AccuracyRunner *runner, const ShortTimeFTOptions &stft_opts,
+                    const Matrix<BaseFloat> &wave, int32 num_repeats) {
+    int32 num_channels = wave.NumRows(), frame_length = stft_opts.frame_length,
+          shift = stft_opts.frame_shift;
+    if (num_channels < 2 || !runner->Enabled("fixed-point/online-enhancer")) return;
+    if ((frame_length & (frame_length - 1)) || frame_length % shift ||
+        stft_opts.PaddingLength() != frame_length) {
+        KALDI_WARN << "Skip fixed-point, which needs frame length of power of 2 and multiple of shift";
+        return;
+    }
+    OnlineBeamformerOptions beamformer_opts;
+    beamformer_opts.beamformer = "fixed";
+    int32 num_bins = frame_length / 2 + 1, num_chunks = wave.NumCols() / shift;
+    CMatrix<BaseFloat> weights(num_bins, num_channels);
+    weights.Add(1.0 / num_channels, 0);
+
+    Matrix<BaseFloat> ref_wave(1, num_chunks * shift), fast_wave(1, num_chunks * shift);
+    double ref_ms = TimeMs(num_repeats, [&] {
+        OnlineEnhancer enhancer(stft_opts, beamformer_opts, num_channels);
+        enhancer.SetWeights(weights);
+        CMatrix<BaseFloat> enh;
+        Matrix<BaseFloat> out;
+        int32 num_done = 0;
+        for (int32 i = 0; i < num_chunks; i++) {
+            enhancer.AcceptWaveform(wave.ColRange(i * shift, shift));
+            enhancer.PopEnhanced(NULL, &enh);
+            enhancer.Synthesize(enh, &out);
+            ref_wave.Row(0).Range(num_done, out.NumCols()).CopyFromVec(out.Row(0));
+            num_done += out.NumCols();
+        }
+    });
+    // int16 samples in chunks, as on devices
+    std::vector<int16> samples(num_channels * num_chunks * shift), out(shift);
+    for (int32 i = 0; i < num_chunks; i++)
+        for (int32 c = 0; c < num_channels; c++)
+            for (int32 n = 0; n < shift; n++)
+                samples[(i * num_channels + c) * shift + n] = SaturateQ15(std::llround(wave(c, i * shift + n)));
+    double fast_ms = TimeMs(num_repeats, [&] {
+        FixedPointEnhancer enhancer(stft_opts, weights);
+        int32 num_done = 0;
+        for (int32 i = 0; i < num_chunks; i++) {
+            int32 num_out = enhancer.AcceptChunk(&samples[i * num_channels * shift], out.data());
+            for (int32 n = 0; n < num_out; n++)
+                fast_wave(0, num_done + n) = out[n];
+            num_done += num_out;
+        }
+    });
+    CMatrix<BaseFloat> ref_c(1, ref_wave.NumCols()), fast_c(1, fast_wave.NumCols());
+    ref_c.CopyFromMat(ref_wave, kReal);
+    fast_c.CopyFromMat(fast_wave, kReal);
+    TaskMetrics metrics = {{"sdr_db", SiSdr(ref_wave.Row(0), fast_wave.Row(0))}};
+    runner->Add("fixed-point/online-enhancer", FormatParam("channels", num_channels),
+                MaxAbsError(ref_c, fast_c), Snr(ref_c, fast_c), metrics, ref_ms, fast_ms);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Evaluate accuracy versus speed of approximate paths(fast trig, decimated beam weights,\n"
+            "sparse psd, decimated srp-phat, fixed-point front-end) against reference ones on a local corpus\n"
+            "\n"
+            "Usage: accuracy-setk [options...] <wav-rspecifier> <json-wxfilename>\n"
+            "e.g.:\n"
+            " accuracy-setk --topo-descriptor=0,0.05,0.1,0.15 scp:wav.scp accuracy.json\n"
+            " accuracy-setk --mask=ark:mask.ark --modes=beamformer scp:wav.scp accuracy.json\n";
+
+        ParseOptions po(usage);
+        ShortTimeFTOptions stft_options;
+        SrpPhatOptions srp_options;
+
+        int32 num_repeats = 3;
+        std::string modes = "", mask_rspecifier = "";
+
+        po.Register("num-repeats", &num_repeats, "Number of timed runs of each configuration");
+        po.Register("modes", &modes, "Comma separated substrings of mode names to evaluate, "
+                    "egs: --modes=stft,beamformer/mvdr, evaluate all if empty");
+        po.Register("mask", &mask_rspecifier, "Target masks for beamformers, if empty, estimate from "
+                    "noise floor of the first channel");
+        stft_options.Register(&po);
+        srp_options.Register(&po);
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 2) {
+            po.PrintUsage();
+            exit(1);
+        }
+        KALDI_ASSERT(num_repeats >= 1);
+
+        AccuracyRunner runner(modes);
+        SequentialTableReader<WaveHolder> wave_reader(po.GetArg(1));
+        RandomAccessBaseFloatMatrixReader mask_reader;
+        if (mask_rspecifier != "" && !mask_reader.Open(mask_rspecifier))
+            KALDI_ERR << "Could not open masks with rspecifier " << mask_rspecifier;
+
+        int32 num_done = 0;
+        for (; !wave_reader.Done(); wave_reader.Next()) {
+            std::string utt_key = wave_reader.Key();
+            const WaveData &wave_data = wave_reader.Value();
+            const Matrix<BaseFloat> *mask = NULL;
+            if (mask_rspecifier != "") {
+                if (!mask_reader.HasKey(utt_key)) {
+                    KALDI_WARN << utt_key << ", missing target masks";
+                    continue;
+                }
+                mask = &mask_reader.Value(utt_key);
+            }
+            EvalStft(&runner, stft_options, wave_data.Data(), num_repeats);
+            EvalBeamformer(&runner, stft_options, wave_data.Data(), mask, num_repeats);
+            EvalSrpPhat(&runner, stft_options, srp_options, wave_data.SampFreq(),
+                        wave_data.Data(), num_repeats);
+            EvalFixedPoint(&runner, stft_options, wave_data.Data(), num_repeats);
+            num_done++;
+        }
+        KALDI_LOG << "Evaluated " << num_done << " utterances";
+        runner.Report();
+
+        Output ko(po.GetArg(2), false);
+        runner.WriteJson(ko.Stream());
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
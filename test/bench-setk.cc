@@ -0,0 +1,409 @@
+// bench-setk.cc
+// wujian@18.5.22
+
+// Benchmarks of hot kernels in libsetk, results are written in JSON and could be
+// compared with a stored baseline using bench_compare.py
+
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "include/stft.h"
+#include "include/beamformer.h"
+#include "include/srp-phat.h"
+#include "include/rir-generator.h"
+#include "include/online-enhancer.h"
+#include "include/realtime-stats.h"
+#include "include/fixed-point.h"
+#include "include/echo-canceller.h"
+
+using namespace kaldi;
+
+struct BenchResult {
+    std::string name, params, unit;
+    int32 repeats;
+    double items, mean_ms, p50_ms, p90_ms, p99_ms, throughput;
+};
+
+class BenchRunner {
+public:
+    BenchRunner(int32 num_repeats, int32 num_warmups, const std::string &filter):
+        num_repeats_(num_repeats), num_warmups_(num_warmups) {
+        if (filter != "")
+            SplitStringToVector(filter, ",", true, &filters_);
+    }
+
+    bool Enabled(const std::string &name) {
+        if (filters_.empty()) return true;
+        for (int32 i = 0; i < filters_.size(); i++)
+            if (name.find(filters_[i]) != std::string::npos)
+                return true;
+        return false;
+    }
+
+    // items: number of items(samples, frames, matrices...) processed in each call of fn
+    // setup: if given, called before each call of fn and not timed, egs. to restore
+    //        inputs which fn modifies in place
+    void Run(const std::string &name, const std::string &params,
+             double items, const std::string &unit, std::function<void()> fn,
+             std::function<void()> setup = nullptr) {
+        if (!Enabled(name)) return;
+        for (int32 i = 0; i < num_warmups_; i++) {
+            if (setup) setup();
+            fn();
+        }
+        std::vector<double> cost(num_repeats_);
+        for (int32 i = 0; i < num_repeats_; i++) {
+            if (setup) setup();
+            auto beg = std::chrono::steady_clock::now();
+            fn();
+            auto end = std::chrono::steady_clock::now();
+            cost[i] = std::chrono::duration<double, std::milli>(end - beg).count();
+        }
+        std::sort(cost.begin(), cost.end());
+        BenchResult r;
+        r.name = name, r.params = params, r.unit = unit + "/s";
+        r.repeats = num_repeats_, r.items = items;
+        double sum = 0;
+        for (int32 i = 0; i < cost.size(); i++)
+            sum += cost[i];
+        r.mean_ms = sum / num_repeats_;
+        r.p50_ms = Percentile(cost, 0.50);
+        r.p90_ms = Percentile(cost, 0.90);
+        r.p99_ms = Percentile(cost, 0.99);
+        r.throughput = r.p50_ms > 0 ? items * 1000 / r.p50_ms: 0;
+        KALDI_LOG << name << "[" << params << "]: p50 = " << r.p50_ms << " ms, p99 = "
+                  << r.p99_ms << " ms, throughput = " << r.throughput << " " << r.unit;
+        results_.push_back(r);
+    }
+
+    // Results of streaming benchmarks, percentiles are of compute time of each
+    // frame, throughput is reciprocal of real-time factor
+    void AddRealtime(const std::string &name, const std::string &params,
+                     const RealtimeStats &stats) {
+        if (!Enabled(name)) return;
+        BenchResult r;
+        r.name = name, r.params = params, r.unit = "x-realtime";
+        r.repeats = stats.NumFrames(), r.items = stats.NumFrames();
+        r.mean_ms = stats.RealtimeFactor() * stats.BudgetMs();
+        r.p50_ms = stats.ComputePercentile(0.50);
+        r.p90_ms = stats.ComputePercentile(0.90);
+        r.p99_ms = stats.ComputePercentile(0.99);
+        r.throughput = stats.RealtimeFactor() > 0 ? 1.0 / stats.RealtimeFactor(): 0;
+        KALDI_LOG << name << "[" << params << "]: " << stats.Report();
+        results_.push_back(r);
+    }
+
+    void WriteJson(std::ostream &os) {
+        os << "{\n  \"benchmarks\": [\n";
+        for (int32 i = 0; i < results_.size(); i++) {
+            const BenchResult &r = results_[i];
+            os << "    {\"name\": \"" << r.name << "\", \"params\": \"" << r.params
+               << "\", \"repeats\": " << r.repeats << ", \"items\": " << r.items
+               << ", \"unit\": \"" << r.unit << "\", \"throughput\": " << r.throughput
+               << ", \"mean_ms\": " << r.mean_ms << ", \"p50_ms\": " << r.p50_ms
+               << ", \"p90_ms\": " << r.p90_ms << ", \"p99_ms\": " << r.p99_ms << "}"
+               << (i + 1 == results_.size() ? "\n": ",\n");
+        }
+        os << "  ]\n}\n";
+    }
+
+private:
+    int32 num_repeats_, num_warmups_;
+    std::vector<std::string> filters_;
+    std::vector<BenchResult> results_;
+
+    double Percentile(const std::vector<double> &sorted, double p) {
+        int32 index = static_cast<int32>(std::ceil(p * sorted.size())) - 1;
+        return sorted[std::min(std::max(index, 0), static_cast<int32>(sorted.size()) - 1)];
+    }
+};
+
+std::string FormatParams(const std::string &k1, int32 v1,
+                         const std::string &k2 = "", int32 v2 = 0) {
+    std::ostringstream oss;
+    oss << k1 << "=" << v1;
+    if (k2 != "")
+        oss << "," << k2 << "=" << v2;
+    return oss.str();
+}
+
+// Random hermite positive definite matrices, (num_bins x num_channels, num_channels)
+void RandomPsd(int32 num_bins, int32 num_channels, CMatrix<BaseFloat> *psd) {
+    psd->Resize(num_bins * num_channels, num_channels);
+    CMatrix<BaseFloat> obs(num_channels, num_channels * 4);
+    for (int32 f = 0; f < num_bins; f++) {
+        obs.SetRandn();
+        SubCMatrix<BaseFloat> p(*psd, f * num_channels, num_channels, 0, num_channels);
+        p.AddMatMat(1, 0, obs, kNoTrans, obs, kConjTrans, 0, 0);
+        for (int32 c = 0; c < num_channels; c++)
+            p(c, c, kReal) += 1;
+    }
+}
+
+// stft:    (num_bins x num_frames, num_channels)
+void RandomStft(int32 num_bins, int32 num_frames, int32 num_channels,
+                CMatrix<BaseFloat> *stft) {
+    stft->Resize(num_bins * num_frames, num_channels);
+    stft->SetRandn();
+}
+
+void BenchStft(BenchRunner *runner, int32 frame_length) {
+    ShortTimeFTOptions opts;
+    opts.frame_length = frame_length;
+    opts.frame_shift = frame_length / 4;
+    ShortTimeFTComputer computer(opts);
+    int32 num_channels = 4;
+    for (int32 seconds: {1, 4, 16}) {
+        Matrix<BaseFloat> wave(num_channels, seconds * 16000), stft, recon;
+        wave.SetRandn();
+        std::string params = FormatParams("frame_length", frame_length, "seconds", seconds);
+        runner->Run("stft/ShortTimeFT", params, wave.NumRows() * wave.NumCols(), "samples",
+                    [&] { computer.ShortTimeFT(wave, &stft); });
+        computer.ShortTimeFT(wave, &stft);
+        // InverseShortTimeFT consumes single channel, and transforms it in place,
+        // so it's restored before each call
+        Matrix<BaseFloat> stft_ch0(stft.RowRange(0, stft.NumRows() / num_channels)), input;
+        runner->Run("stft/InverseShortTimeFT", params, seconds * 16000, "samples",
+                    [&] { computer.InverseShortTimeFT(input, &recon); },
+                    [&] { input = stft_ch0; });
+    }
+}
+
+void BenchComplexMatrix(BenchRunner *runner) {
+    for (int32 dim: {64, 128, 256, 512}) {
+        CMatrix<BaseFloat> a(dim, dim), b(dim, dim), c(dim, dim);
+        a.SetRandn(), b.SetRandn();
+        runner->Run("complex/AddMatMat", FormatParams("dim", dim), 8.0 * dim * dim * dim, "flops",
+                    [&] { c.AddMatMat(1, 0, a, kNoTrans, b, kConjTrans, 0, 0); });
+    }
+    for (int32 dim: {64, 256, 1024}) {
+        CVector<BaseFloat> a(dim), b(dim);
+        CMatrix<BaseFloat> c(dim, dim);
+        a.SetRandn(), b.SetRandn();
+        runner->Run("complex/AddVecVec", FormatParams("dim", dim), 8.0 * dim * dim, "flops",
+                    [&] { c.AddVecVec(1, 0, a, b, kConj); });
+    }
+    // decompositions are performed on each frequency bin, so benchmark on 257 bins
+    int32 num_bins = 257;
+    for (int32 num_channels: {2, 4, 6, 8, 16}) {
+        CMatrix<BaseFloat> psd, noise_psd, work, work2, V(num_channels, num_channels);
+        Vector<BaseFloat> D(num_channels);
+        RandomPsd(num_bins, num_channels, &psd);
+        RandomPsd(num_bins, num_channels, &noise_psd);
+        std::string params = FormatParams("channels", num_channels, "bins", num_bins);
+        // decompositions work in place, inputs are restored by setup(not timed)
+        runner->Run("complex/Hed", params, num_bins, "matrices", [&] {
+            for (int32 f = 0; f < num_bins; f++) {
+                SubCMatrix<BaseFloat> A(work, f * num_channels, num_channels, 0, num_channels);
+                A.Hed(&D, &V);
+            }
+        }, [&] { work = psd; });
+        runner->Run("complex/Hged", params, num_bins, "matrices", [&] {
+            for (int32 f = 0; f < num_bins; f++) {
+                SubCMatrix<BaseFloat> A(work, f * num_channels, num_channels, 0, num_channels),
+                                      B(work2, f * num_channels, num_channels, 0, num_channels);
+                A.Hged(&B, &D, &V);
+            }
+        }, [&] { work = psd, work2 = noise_psd; });
+        runner->Run("complex/Invert", params, num_bins, "matrices", [&] {
+            for (int32 f = 0; f < num_bins; f++) {
+                SubCMatrix<BaseFloat> A(work, f * num_channels, num_channels, 0, num_channels);
+                A.Invert();
+            }
+        }, [&] { work = psd; });
+    }
+}
+
+void BenchBeamformer(BenchRunner *runner) {
+    int32 num_bins = 257;
+    for (int32 num_channels: {2, 4, 8}) {
+        for (int32 num_frames: {100, 500}) {
+            CMatrix<BaseFloat> stft, target_psd, noise_psd, weights(num_bins, num_channels), enh;
+            RandomStft(num_bins, num_frames, num_channels, &stft);
+            Matrix<BaseFloat> mask(num_frames, num_bins);
+            mask.SetRandUniform();
+            weights.SetRandn();
+            std::string params = FormatParams("channels", num_channels, "frames", num_frames);
+            runner->Run("beamformer/EstimatePsd", params, num_frames, "frames",
+                        [&] { EstimatePsd(stft, mask, &target_psd, &noise_psd); });
+            runner->Run("beamformer/Beamform", params, num_frames, "frames",
+                        [&] { Beamform(stft, weights, &enh); });
+        }
+    }
+}
+
+void BenchSrpPhat(BenchRunner *runner) {
+    int32 num_bins = 257;
+    for (int32 num_channels: {2, 4, 8}) {
+        SrpPhatOptions opts;
+        std::ostringstream topo;
+        for (int32 c = 0; c < num_channels; c++)
+            topo << (c ? ",": "") << c * 0.05;
+        opts.topo_descriptor = topo.str();
+        SrpPhatComputor computor(opts, 16000, num_bins);
+        for (int32 num_frames: {100, 500}) {
+            // (num_channels x num_frames, num_bins)
+            CMatrix<BaseFloat> stft(num_channels * num_frames, num_bins);
+            Matrix<BaseFloat> spectra;
+            stft.SetRandn();
+            runner->Run("srp-phat/Compute", FormatParams("channels", num_channels, "frames", num_frames),
+                        num_frames, "frames", [&] { computor.Compute(stft, &spectra); });
+        }
+    }
+}
+
+void BenchRirGenerator(BenchRunner *runner) {
+    for (int32 num_mics: {1, 4, 8}) {
+        RirGeneratorOptions opts;
+        opts.room_topo = "5,4,3";
+        opts.source_location = "2,3,1.5";
+        opts.beta = "0.3";
+        opts.num_samples = 4096;
+        std::ostringstream receivers;
+        for (int32 m = 0; m < num_mics; m++)
+            receivers << (m ? ";": "") << 1 + m * 0.05 << ",1.5,1.5";
+        opts.receiver_location = receivers.str();
+        RirGenerator generator(opts);
+        Matrix<BaseFloat> rir;
+        runner->Run("rir/GenerateRir", FormatParams("mics", num_mics, "samples", opts.num_samples),
+                    num_mics, "rirs", [&] { generator.GenerateRir(&rir); });
+    }
+}
+
+// Streaming stft & fixed beamformer, fed as fast as possible, frame by frame
+void BenchRealtime(BenchRunner *runner) {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 512;
+    stft_opts.frame_shift = 128;
+    OnlineBeamformerOptions beamformer_opts;
+    beamformer_opts.beamformer = "fixed";
+    int32 seconds = 10;
+    for (int32 num_channels: {2, 4, 8}) {
+        OnlineEnhancer enhancer(stft_opts, beamformer_opts, num_channels);
+        CMatrix<BaseFloat> weights(enhancer.NumBins(), num_channels), enh;
+        weights.SetRandn();
+        enhancer.SetWeights(weights);
+        Matrix<BaseFloat> wave(num_channels, seconds * 16000), out;
+        wave.SetRandn();
+        RealtimeStats stats(16000, stft_opts.frame_shift);
+        for (int32 beg = 0; beg + stft_opts.frame_shift <= wave.NumCols(); beg += stft_opts.frame_shift) {
+            auto t0 = std::chrono::steady_clock::now();
+            enhancer.AcceptWaveform(wave.ColRange(beg, stft_opts.frame_shift));
+            int32 num_frames = enhancer.PopEnhanced(NULL, &enh);
+            enhancer.Synthesize(enh, &out);
+            double compute_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - t0).count();
+            // algorithmic latency: frame_length samples
+            for (int32 t = 0; t < num_frames; t++)
+                stats.RecordFrame(compute_ms / num_frames, stft_opts.frame_length / 16.0 + compute_ms);
+        }
+        runner->AddRealtime("realtime/OnlineEnhancer", FormatParams("channels", num_channels, "seconds", seconds),
+                            stats);
+    }
+}
+
+// Same as BenchRealtime, in fixed-point, int16 chunks of frame_shift samples
+void BenchFixedPoint(BenchRunner *runner) {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 512;
+    stft_opts.frame_shift = 128;
+    int32 seconds = 10, shift = 128, num_bins = 257;
+    for (int32 num_channels: {2, 4, 8}) {
+        CMatrix<BaseFloat> weights(num_bins, num_channels);
+        weights.SetRandn();
+        FixedPointEnhancer enhancer(stft_opts, weights);
+        std::vector<int16> wave(num_channels * seconds * 16000), chunk(num_channels * shift), out(shift);
+        for (int32 i = 0; i < wave.size(); i++)
+            wave[i] = static_cast<int16>(RandInt(-8192, 8192));
+        RealtimeStats stats(16000, shift);
+        int32 num_samples = seconds * 16000;
+        for (int32 beg = 0; beg + shift <= num_samples; beg += shift) {
+            for (int32 c = 0; c < num_channels; c++)
+                std::copy(wave.begin() + c * num_samples + beg, wave.begin() + c * num_samples + beg + shift,
+                          chunk.begin() + c * shift);
+            auto t0 = std::chrono::steady_clock::now();
+            int32 num_out = enhancer.AcceptChunk(chunk.data(), out.data());
+            double compute_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - t0).count();
+            if (num_out)
+                stats.RecordFrame(compute_ms, stft_opts.frame_length / 16.0 + compute_ms);
+        }
+        runner->AddRealtime("realtime/FixedPointEnhancer", FormatParams("channels", num_channels, "seconds", seconds),
+                            stats);
+    }
+}
+
+// Echo canceller ahead of beamformer, one block per chunk
+void BenchEchoCanceller(BenchRunner *runner) {
+    EchoCancellerOptions opts;
+    int32 seconds = 10, block = opts.block_size;
+    for (int32 num_channels: {1, 4, 8}) {
+        EchoCanceller echo_canceller(opts, num_channels);
+        Matrix<BaseFloat> mic(num_channels, seconds * 16000), out;
+        Vector<BaseFloat> ref(seconds * 16000);
+        mic.SetRandn();
+        ref.SetRandn();
+        mic.Scale(1000), ref.Scale(4000);
+        RealtimeStats stats(16000, block);
+        for (int32 beg = 0; beg + block <= ref.Dim(); beg += block) {
+            auto t0 = std::chrono::steady_clock::now();
+            echo_canceller.AcceptWaveform(mic.ColRange(beg, block), ref.Range(beg, block), &out);
+            double compute_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - t0).count();
+            stats.RecordFrame(compute_ms, block / 16.0 + compute_ms);
+        }
+        runner->AddRealtime("realtime/EchoCanceller", FormatParams("channels", num_channels, "seconds", seconds),
+                            stats);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        const char *usage =
+            "Benchmark hot kernels of libsetk and write results(throughput & latency percentiles) in JSON\n"
+            "\n"
+            "Usage: bench-setk [options...] <json-wxfilename>\n"
+            "e.g.:\n"
+            " bench-setk --kernels=stft,beamformer bench.json\n"
+            " python bench_compare.py baseline.json bench.json\n";
+
+        ParseOptions po(usage);
+
+        int32 num_repeats = 20, num_warmups = 2;
+        std::string kernels = "";
+
+        po.Register("num-repeats", &num_repeats, "Number of timed runs of each benchmark");
+        po.Register("num-warmups", &num_warmups, "Number of untimed runs before timing");
+        po.Register("kernels", &kernels, "Comma separated substrings of benchmark names to run, "
+                    "egs: --kernels=stft,complex/Hed, run all if empty");
+
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 1) {
+            po.PrintUsage();
+            exit(1);
+        }
+        KALDI_ASSERT(num_repeats >= 1 && num_warmups >= 0);
+
+        BenchRunner runner(num_repeats, num_warmups, kernels);
+
+        for (int32 frame_length: {256, 512, 1024})
+            BenchStft(&runner, frame_length);
+        BenchComplexMatrix(&runner);
+        BenchBeamformer(&runner);
+        BenchSrpPhat(&runner);
+        BenchRirGenerator(&runner);
+        BenchRealtime(&runner);
+        BenchFixedPoint(&runner);
+        BenchEchoCanceller(&runner);
+
+        Output ko(po.GetArg(1), false);
+        runner.WriteJson(ko.Stream());
+
+    } catch(const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+    return 0;
+}
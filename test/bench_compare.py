@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+# coding=utf-8
+# wujian@2018
+"""
+Compare benchmark results(in JSON, produced by bench-setk) with a stored baseline,
+exit with non-zero status if any benchmark regressed more than threshold
+"""
+
+import argparse
+import json
+import sys
+
+
+def load_benchmarks(json_file):
+    with open(json_file, "r") as f:
+        results = json.load(f)
+    return {(b["name"], b["params"]): b for b in results["benchmarks"]}
+
+
+def run(args):
+    baseline = load_benchmarks(args.baseline)
+    current = load_benchmarks(args.current)
+    num_regressed = 0
+    print("{:<30} {:<28} {:>12} {:>12} {:>8}".format(
+        "name", "params", "baseline", "current", "ratio"))
+    for key in sorted(current):
+        if key not in baseline:
+            print("{:<30} {:<28} {:>12} {:>12.3f} {:>8}".format(
+                key[0], key[1], "-", current[key][args.metric], "new"))
+            continue
+        base = baseline[key][args.metric]
+        cur = current[key][args.metric]
+        ratio = cur / base if base > 0 else 1.0
+        # for latency, larger is worse; for throughput, smaller is worse
+        regressed = ratio > 1 + args.threshold if args.metric != "throughput" \
+            else ratio < 1 - args.threshold
+        if regressed:
+            num_regressed += 1
+        print("{:<30} {:<28} {:>12.3f} {:>12.3f} {:>7.2f}x{}".format(
+            key[0], key[1], base, cur, ratio, " REGRESSED" if regressed else ""))
+    missing = [k for k in baseline if k not in current]
+    for key in missing:
+        print("Missing in current results: {} [{}]".format(key[0], key[1]))
+    print("{:d} benchmarks compared, {:d} regressed(threshold = {:.0f}%)".format(
+        len(current), num_regressed, args.threshold * 100))
+    sys.exit(1 if num_regressed else 0)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Command to compare benchmark results with a baseline. "
+        "Baseline is produced by bench-setk as well, egs: "
+        "bench-setk baseline.json")
+    parser.add_argument("baseline", type=str, help="JSON results of baseline")
+    parser.add_argument("current", type=str, help="JSON results to compare")
+    parser.add_argument(
+        "--metric",
+        type=str,
+        default="p50_ms",
+        choices=["mean_ms", "p50_ms", "p90_ms", "p99_ms", "throughput"],
+        help="Metric used for comparison")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="Relative threshold to report regressions")
+    args = parser.parse_args()
+    run(args)
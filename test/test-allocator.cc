@@ -0,0 +1,196 @@
+// test-allocator.cc
+// wujian@18.2.12
+
+#include <atomic>
+#include <cerrno>
+#include <thread>
+
+#include "include/setk-allocator.h"
+#include "include/complex-matrix.h"
+#include "include/online-enhancer.h"
+#include "include/srp-phat.h"
+
+using namespace kaldi;
+
+#ifdef __GLIBC__
+
+// Count real heap allocations of the process: Kaldi's Matrix/Vector use
+// posix_memalign, std containers use operator new, all of them end up here.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+static std::atomic<int64> num_heap_allocs(0);
+
+extern "C" {
+void *malloc(size_t size) __THROW {
+    num_heap_allocs++;
+    return __libc_malloc(size);
+}
+void *calloc(size_t num, size_t size) __THROW {
+    num_heap_allocs++;
+    return __libc_calloc(num, size);
+}
+void *realloc(void *ptr, size_t size) __THROW {
+    num_heap_allocs++;
+    return __libc_realloc(ptr, size);
+}
+void *memalign(size_t alignment, size_t size) __THROW {
+    num_heap_allocs++;
+    return __libc_memalign(alignment, size);
+}
+void *aligned_alloc(size_t alignment, size_t size) __THROW {
+    num_heap_allocs++;
+    return __libc_memalign(alignment, size);
+}
+int posix_memalign(void **ptr, size_t alignment, size_t size) __THROW {
+    num_heap_allocs++;
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0: ENOMEM;
+}
+}
+
+static int64 NumHeapAllocs() { return num_heap_allocs.load(); }
+#else
+// not counted
+static int64 NumHeapAllocs() { return 0; }
+#endif
+
+void test_scratch_pool() {
+    ReleaseScratchPool();
+    int64 num_system = ThreadAllocationStats().num_system_allocs;
+    for (int32 i = 0; i < 10; i++) {
+        CMatrix<BaseFloat> cm(257, 4);
+        cm.SetRandn();
+    }
+    // only the first one hits the system allocator
+    KALDI_ASSERT(ThreadAllocationStats().num_system_allocs == num_system + 1);
+    ResetScratchPool();
+    ResetScratchPool();
+    KALDI_ASSERT(ThreadAllocationStats().bytes_cached == 0);
+    std::cout << "test_scratch_pool: done" << std::endl;
+}
+
+void test_no_allocation_scope() {
+    SetAllocationCheck(true);
+    bool failed = false;
+    try {
+        SETK_NO_ALLOC("test");
+        CVector<BaseFloat> cv(10);
+    } catch (const std::exception &e) {
+        failed = true;
+    }
+    SetAllocationCheck(false);
+    KALDI_ASSERT(failed);
+    std::cout << "test_no_allocation_scope: done" << std::endl;
+}
+
+void test_arena_blocks() {
+    for (int32 huge = 0; huge <= 1; huge++) {
+        SetHugePages(huge);
+        // small & large(mapped) blocks
+        for (int32 rows: {4, 4096}) {
+            int64 cached = ThreadAllocationStats().bytes_cached;
+            {
+                CMatrix<BaseFloat> cm(rows, 257);
+                KALDI_ASSERT(reinterpret_cast<uintptr_t>(cm.Data()) % 64 == 0);
+                cm.SetRandn();
+            }
+            // large blocks are returned to system, not cached
+            if (rows == 4096)
+                KALDI_ASSERT(ThreadAllocationStats().bytes_cached == cached);
+        }
+        ReleaseScratchPool();
+    }
+    SetHugePages(false);
+    std::cout << "test_arena_blocks: done" << std::endl;
+}
+
+// thread_local objects constructed before the scratch pool of a thread are
+// destroyed after it, their blocks should go back to system
+struct LateRelease {
+    CMatrix<BaseFloat> *cm;
+    LateRelease(): cm(NULL) {}
+    ~LateRelease() { delete cm; }
+};
+
+void test_free_after_pool_destroyed() {
+    std::thread worker([] {
+        static thread_local LateRelease late;
+        late.cm = new CMatrix<BaseFloat>(16, 16);
+        late.cm->SetRandn();
+    });
+    worker.join();
+    std::cout << "test_free_after_pool_destroyed: done" << std::endl;
+}
+
+// after warm-up, per-frame & per-bin loops should not allocate anything
+void test_online_enhancer_steady_state(const std::string &beamformer) {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 512;
+    stft_opts.frame_shift = 128;
+    OnlineBeamformerOptions beamformer_opts;
+    beamformer_opts.beamformer = beamformer;
+    beamformer_opts.update_periods = 4;
+    int32 num_channels = 4, chunk_size = 256;
+
+    OnlineEnhancer enhancer(stft_opts, beamformer_opts, num_channels);
+    int32 num_bins = enhancer.NumBins();
+    Matrix<BaseFloat> chunk(num_channels, chunk_size), masks, samples;
+    CMatrix<BaseFloat> enh;
+
+    int64 num_requests = 0, num_allocs = 0;
+    for (int32 i = 0; i < 50; i++) {
+        // warm up with first 10 chunks
+        if (i == 10) {
+            SetAllocationCheck(true);
+            num_requests = ThreadAllocationStats().num_requests;
+            num_allocs = NumHeapAllocs();
+        }
+        chunk.SetRandn();
+        enhancer.AcceptWaveform(chunk);
+        masks.Resize(enhancer.NumFramesReady(), num_bins, kUndefined);
+        masks.SetRandUniform();
+        enhancer.PopEnhanced(beamformer == "fixed" ? NULL: &masks, &enh);
+        enhancer.Synthesize(enh, &samples);
+    }
+    SetAllocationCheck(false);
+    // requests served by scratch pool(egs. temporaries of weights update) are
+    // fine, but nothing should reach the heap
+    int64 allocs = NumHeapAllocs() - num_allocs,
+          requests = ThreadAllocationStats().num_requests - num_requests;
+    KALDI_ASSERT(allocs == 0);
+    std::cout << "test_online_enhancer_steady_state(" << beamformer << "): "
+              << allocs << " heap allocations & " << requests << " pool requests after warm-up, "
+              << ThreadAllocationStats().num_system_allocs << " system allocations" << std::endl;
+}
+
+void test_srp_phat_steady_state() {
+    SrpPhatOptions opts;
+    opts.topo_descriptor = "0,0.1,0.2,0.3";
+    int32 num_bins = 257, num_frames = 50;
+    SrpPhatComputor computor(opts, 16000, num_bins);
+    CMatrix<BaseFloat> stft(num_frames * 4, num_bins);
+    Matrix<BaseFloat> spectra;
+    stft.SetRandn();
+    computor.Compute(stft, &spectra);
+    SetAllocationCheck(true);
+    for (int32 i = 0; i < 5; i++)
+        computor.Compute(stft, &spectra);
+    SetAllocationCheck(false);
+    std::cout << "test_srp_phat_steady_state: done" << std::endl;
+}
+
+int main() {
+    test_scratch_pool();
+    test_no_allocation_scope();
+    test_arena_blocks();
+    test_free_after_pool_destroyed();
+    test_online_enhancer_steady_state("fixed");
+    test_online_enhancer_steady_state("mvdr");
+    test_srp_phat_steady_state();
+    return 0;
+}
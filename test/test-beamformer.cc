@@ -6,6 +6,7 @@
 #include "include/beamformer.h"
 #include "include/complex-vector.h"
 #include "include/complex-matrix.h"
+#include "include/beam-weight-table.h"
 
 using namespace kaldi;
 
@@ -49,6 +50,29 @@ void test_estimate_psd() {
     }
 }
 
+// accumulated chunk by chunk should be same as EstimatePsd()
+void test_psd_accumulator() {
+    for (int32 i = 0; i < 10; i++) {
+        int32 f = Rand() % 6 + 4, t = Rand() % 20 + 10, c = Rand() % 5 + 3;
+        CMatrix<BaseFloat> src_stft(f * t, c), target_psd, noise_psd, target_ref, noise_ref;
+        Matrix<BaseFloat> mask(t, f);
+        src_stft.SetRandn();
+        mask.SetRandUniform();
+        EstimatePsd(src_stft, mask, &target_ref, &noise_ref);
+        PsdAccumulator accumulator(f, c);
+        for (int32 beg = 0, chunk = Rand() % 5 + 1; beg < t; beg += chunk)
+            accumulator.Accumulate(src_stft, beg, mask.RowRange(beg, std::min(chunk, t - beg)));
+        accumulator.GetPsd(&target_psd, &noise_psd);
+        target_psd.AddMat(-1, 0, target_ref);
+        noise_psd.AddMat(-1, 0, noise_ref);
+        for (int32 r = 0; r < f * c; r++)
+            for (int32 j = 0; j < c; j++)
+                KALDI_ASSERT(std::abs(target_psd(r, j, kReal)) < 1e-4 && std::abs(target_psd(r, j, kImag)) < 1e-4 &&
+                             std::abs(noise_psd(r, j, kReal)) < 1e-4 && std::abs(noise_psd(r, j, kImag)) < 1e-4);
+    }
+    std::cout << "test_psd_accumulator: done" << std::endl;
+}
+
 void test_beamform() {
     for (int32 i = 0; i < 10; i++) {
         int32 f = Rand() % 6 + 4, t = Rand() % 6 + 4, c = Rand() % 5 + 3;
@@ -105,6 +129,124 @@ void test_trim_stft() {
 }
 
 
+// fixed-size kernels should agree with ComputeMvdrBeamWeights() on inter-frame correlation
+void test_multi_frame_mvdr() {
+    for (int32 order = 1; order <= 10; order++) {
+        int32 f = Rand() % 6 + 4, t = Rand() % 20 + 20;
+        CMatrix<BaseFloat> stft(t, f), stacked, target_psd, noise_psd, correlation, weights, weights_ref;
+        Matrix<BaseFloat> mask(t, f);
+        stft.SetRandn();
+        mask.SetRandUniform();
+        StackFrames(stft, order, &stacked);
+        for (int32 j = 0; j < f; j++)
+            for (int32 i = 0; i < t; i++)
+                for (int32 k = 0; k < order; k++)
+                    KALDI_ASSERT(stacked(j * t + i, k, kReal) == (i >= k ? stft(i - k, j, kReal): 0) &&
+                                 stacked(j * t + i, k, kImag) == (i >= k ? stft(i - k, j, kImag): 0));
+        EstimatePsd(stacked, mask, &target_psd, &noise_psd);
+        for (int32 j = 0; j < f; j++)
+            noise_psd.Range(j * order, order, 0, order).AddToDiag(0.1, 0);
+        EstimateInterframeCorrelation(target_psd, &correlation);
+        ComputeMultiFrameMvdrWeights(noise_psd, correlation, &weights);
+        ComputeMvdrBeamWeights(noise_psd, correlation, &weights_ref);
+        for (int32 j = 0; j < f; j++) {
+            // distortionless on target: w^H * gamma = 1
+            std::complex<BaseFloat> s = VecVec(weights.Row(j), correlation.Row(j), kConj);
+            KALDI_ASSERT(std::abs(std::real(s) - 1) < 1e-3 && std::abs(std::imag(s)) < 1e-3);
+            for (int32 k = 0; k < order; k++)
+                KALDI_ASSERT(std::abs(weights(j, k, kReal) - weights_ref(j, k, kReal)) < 1e-3 &&
+                             std::abs(weights(j, k, kImag) - weights_ref(j, k, kImag)) < 1e-3);
+        }
+    }
+    std::cout << "test_multi_frame_mvdr: done" << std::endl;
+}
+
+
+// batched psd & beamforming should be same as unbatched ones of each utterance
+void test_batched_beamform(BaseFloat mask_floor) {
+    int32 num_utts = 4, f = Rand() % 6 + 4, c = Rand() % 4 + 2;
+    std::vector<int32> frame_offsets(1, 0);
+    for (int32 u = 0; u < num_utts; u++)
+        frame_offsets.push_back(frame_offsets.back() + Rand() % 20 + 10);
+    int32 t = frame_offsets.back();
+    CMatrix<BaseFloat> src_stft(f * t, c), target_psd, noise_psd, weights(num_utts * f, c), enh_stft;
+    Matrix<BaseFloat> mask(t, f);
+    src_stft.SetRandn();
+    mask.SetRandUniform();
+    weights.SetRandn();
+    EstimatePsd(src_stft, mask, frame_offsets, &target_psd, &noise_psd, mask_floor);
+    Beamform(src_stft, weights, frame_offsets, &enh_stft);
+    for (int32 u = 0; u < num_utts; u++) {
+        int32 offset = frame_offsets[u], n = frame_offsets[u + 1] - offset;
+        CMatrix<BaseFloat> utt_stft(f * n, c), target_ref, noise_ref, enh_ref;
+        for (int32 j = 0; j < f; j++)
+            utt_stft.RowRange(j * n, n).CopyFromMat(src_stft.RowRange(j * t + offset, n));
+        EstimatePsd(utt_stft, mask.RowRange(offset, n), &target_ref, &noise_ref, mask_floor);
+        Beamform(utt_stft, weights.RowRange(u * f, f), &enh_ref);
+        target_ref.AddMat(-1, 0, target_psd.RowRange(u * f * c, f * c));
+        noise_ref.AddMat(-1, 0, noise_psd.RowRange(u * f * c, f * c));
+        enh_ref.AddMat(-1, 0, enh_stft.RowRange(offset, n));
+        for (int32 r = 0; r < f * c; r++)
+            for (int32 j = 0; j < c; j++)
+                KALDI_ASSERT(std::abs(target_ref(r, j, kReal)) < 1e-4 && std::abs(target_ref(r, j, kImag)) < 1e-4 &&
+                             std::abs(noise_ref(r, j, kReal)) < 1e-4 && std::abs(noise_ref(r, j, kImag)) < 1e-4);
+        for (int32 r = 0; r < n; r++)
+            for (int32 j = 0; j < f; j++)
+                KALDI_ASSERT(std::abs(enh_ref(r, j, kReal)) < 1e-4 && std::abs(enh_ref(r, j, kImag)) < 1e-4);
+    }
+    std::cout << "test_batched_beamform(mask_floor = " << mask_floor << "): done" << std::endl;
+}
+
+
+void test_beam_weight_table() {
+    {
+        TableWriter<CMatrixHolder> weight_writer("ark,scp:weights.ark,weights.scp");
+        for (std::string key: {"a", "b", "c"}) {
+            CMatrix<BaseFloat> weight(257, 4);
+            weight.SetRandn();
+            weight_writer.Write(key, weight);
+        }
+    }
+    BeamWeightTable weight_table("scp:weights.scp", 2);
+    KALDI_ASSERT(weight_table.Value("d") == NULL);
+    // cache: [a] -> [b, a] -> [a, b] -> [c, a] -> [a, c] -> [b, a]
+    for (std::string key: {"a", "b", "a", "c", "a", "b"}) {
+        const CMatrix<BaseFloat> *weight = weight_table.Value(key);
+        KALDI_ASSERT(weight && weight->NumRows() == 257 && weight->NumCols() == 4);
+    }
+    KALDI_ASSERT(weight_table.NumLoads() == 4 && weight_table.NumCached() == 2);
+    std::cout << "test_beam_weight_table: done" << std::endl;
+}
+
+void test_post_filter() {
+    int32 num_frames = 400, num_bins = 64;
+    // unit power noise, with a strong target on [150, 250) x [10, 30)
+    CMatrix<BaseFloat> stft(num_frames, num_bins), enh_stft;
+    stft.SetRandn();
+    stft.Scale(std::sqrt(0.5), 0);
+    for (int32 t = 150; t < 250; t++)
+        for (int32 f = 10; f < 30; f++)
+            stft(t, f, kReal) += 5;
+    Matrix<BaseFloat> gain;
+    EstimateWienerGain(stft, 0.98, 0.1, &gain);
+    BaseFloat noise_gain = gain.RowRange(300, 100).Sum() / (100 * num_bins),
+              speech_gain = gain.Range(160, 90, 10, 20).Sum() / (90 * 20);
+    std::cout << "wiener gain: noise " << noise_gain << ", speech " << speech_gain << std::endl;
+    KALDI_ASSERT(noise_gain < 0.2 && speech_gain > 0.7 && gain.Min() >= 0.1);
+
+    PostFilterOptions opts;
+    opts.post_filter = "mask";
+    Matrix<BaseFloat> mask(num_frames, num_bins);
+    mask.SetRandUniform();
+    enh_stft = stft;
+    ApplyPostFilter(opts, &mask, &enh_stft);
+    for (int32 t = 0; t < num_frames; t++)
+        for (int32 f = 0; f < num_bins; f++)
+            KALDI_ASSERT(std::abs(enh_stft(t, f, kImag) - std::max(mask(t, f), opts.gain_floor) *
+                                  stft(t, f, kImag)) < 1e-5);
+    std::cout << "test_post_filter: done" << std::endl;
+}
+
 int main() {
     // test_estimate_psd();
     // test_beamform();
@@ -112,5 +254,11 @@ int main() {
     // test_compute_mvdr_beamweights();
     // test_trim_stft();
     test_string_spliter();
+    test_psd_accumulator();
+    test_multi_frame_mvdr();
+    test_batched_beamform(0);
+    test_batched_beamform(0.3);
+    test_beam_weight_table();
+    test_post_filter();
     return 0;
 }
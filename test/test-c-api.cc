@@ -0,0 +1,107 @@
+// test-c-api.cc
+// wujian@18.5.20
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <iostream>
+
+#include "include/setk-c-api.h"
+
+void test_stft_roundtrip() {
+    int num_samples = 16000, frame_length = 400, frame_shift = 160;
+    std::vector<float> wave(num_samples);
+    for (int n = 0; n < num_samples; n++)
+        wave[n] = 0.5 * std::sin(0.01 * n) + 0.1 * std::cos(0.37 * n);
+
+    setk_stft_t *stft = setk_stft_create(frame_length, frame_shift, "hamming", 1);
+    if (!stft) {
+        std::cerr << setk_last_error() << std::endl;
+        return;
+    }
+    int num_bins = setk_stft_num_bins(stft);
+    std::vector<float> spectrum(num_bins * 2), recon, chunk(frame_shift);
+    // push in chunks of irregular size
+    for (int beg = 0; beg < num_samples; beg += 123) {
+        int len = std::min(123, num_samples - beg);
+        setk_stft_push(stft, wave.data() + beg, len);
+        while (setk_stft_pull(stft, spectrum.data()) == 1) {
+            setk_stft_synthesize(stft, spectrum.data(), chunk.data());
+            recon.insert(recon.end(), chunk.begin(), chunk.end());
+        }
+    }
+    // ignore heads & tails which are not fully overlapped
+    float err = 0;
+    for (int n = frame_length; n < recon.size() - frame_length; n++)
+        err = std::max(err, std::abs(recon[n] - wave[n]));
+    std::cout << "Reconstruct " << recon.size() << " samples, max error: " << err << std::endl;
+    // ripple of hamming overlapadd is 4e-2 here, while 0.2 if scale is not kept
+    // (frame length is not power of 2)
+    if (err > 6e-2) {
+        std::cerr << "Scale of streaming synthesis is not kept" << std::endl;
+        std::exit(1);
+    }
+    setk_stft_destroy(stft);
+}
+
+void test_beamformer() {
+    int num_bins = 257, num_channels = 4;
+    setk_beamformer_t *beamformer = setk_beamformer_create("fixed", num_bins, num_channels, 0.98, 20);
+    std::vector<float> weights(num_bins * num_channels * 2, 0), 
+                       spectrum(num_bins * num_channels * 2), enh(num_bins * 2);
+    // average of all channels
+    for (int f = 0; f < num_bins * num_channels; f++)
+        weights[f * 2] = 1.0 / num_channels;
+    setk_beamformer_set_weights(beamformer, weights.data());
+    for (int i = 0; i < spectrum.size(); i++)
+        spectrum[i] = i % 7;
+    setk_beamformer_push(beamformer, spectrum.data(), NULL);
+    if (setk_beamformer_pull(beamformer, enh.data()) == 1)
+        std::cout << "Enhanced bin 10: (" << enh[20] << ", " << enh[21] << ")" << std::endl;
+    if (setk_beamformer_create("unknown", num_bins, num_channels, 0.98, 20) == NULL)
+        std::cout << "Expected error: " << setk_last_error() << std::endl;
+    // bad arguments are reported, not aborted
+    if (setk_beamformer_create("mvdr", 0, num_channels, 0.98, 20) != NULL) {
+        std::cerr << "Invalid number of bins is accepted" << std::endl;
+        std::exit(1);
+    }
+    std::cout << "Expected error: " << setk_last_error() << std::endl;
+    setk_beamformer_destroy(beamformer);
+}
+
+// whole utterance APIs, as NumPy bindings use
+void test_utterance_api() {
+    int num_samples = 16000, num_channels = 2;
+    std::vector<float> wave(num_samples * num_channels);
+    for (int n = 0; n < num_samples; n++) {
+        wave[n] = 0.5 * std::sin(0.01 * n);
+        wave[num_samples + n] = 0.5 * std::sin(0.01 * n + 0.3);
+    }
+    setk_stft_t *stft = setk_stft_create(400, 160, "hamming", num_channels);
+    int num_bins = setk_stft_num_bins(stft), num_frames = setk_stft_num_frames(stft, num_samples);
+    std::vector<float> spectrum(num_channels * num_frames * num_bins * 2),
+                       mask(num_frames * num_bins, 0.8), enh(num_frames * num_bins * 2),
+                       recon((num_frames - 1) * 160 + 400);
+    setk_stft_forward(stft, wave.data(), num_samples, spectrum.data());
+    setk_stft_inverse(stft, spectrum.data(), num_frames, recon.data());
+    float err = 0;
+    for (int n = 400; n < recon.size() - 400; n++)
+        err = std::max(err, std::abs(recon[n] - wave[n]));
+    std::cout << "Inverse " << num_frames << " frames, max error: " << err << std::endl;
+
+    setk_beamformer_t *mvdr = setk_beamformer_create("mvdr", num_bins, num_channels, 0.98, 20);
+    if (setk_beamformer_estimate(mvdr, spectrum.data(), mask.data(), num_frames) != SETK_OK ||
+        setk_beamformer_apply(mvdr, spectrum.data(), num_frames, enh.data()) != SETK_OK)
+        std::cerr << setk_last_error() << std::endl;
+    else
+        std::cout << "MVDR enhanced bin 10 of frame 0: (" << enh[20] << ", " << enh[21] << ")" << std::endl;
+    setk_beamformer_destroy(mvdr);
+    setk_stft_destroy(stft);
+}
+
+int main() {
+    test_stft_roundtrip();
+    test_beamformer();
+    test_utterance_api();
+    return 0;
+}
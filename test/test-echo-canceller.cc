@@ -0,0 +1,125 @@
+// test-echo-canceller.cc
+// wujian@18.6.9
+
+#include "include/echo-canceller.h"
+#include "include/online-enhancer.h"
+
+using namespace kaldi;
+
+// 10 * log10(|echo|^2 / |residual|^2)
+double Erle(const VectorBase<BaseFloat> &echo, const VectorBase<BaseFloat> &residual) {
+    return 10 * std::log10(VecVec(echo, echo) / (VecVec(residual, residual) + 1e-20));
+}
+
+// far-end: coloured noise, echo paths: random decaying impulse responses(-10 dB)
+void simulate_echo(int32 num_channels, int32 num_samples, Matrix<BaseFloat> *echo,
+                   Vector<BaseFloat> *ref) {
+    Vector<BaseFloat> noise(num_samples);
+    noise.SetRandn();
+    ref->Resize(num_samples);
+    for (int32 n = 0; n < num_samples; n++)
+        (*ref)(n) = 3000 * (noise(n) + (n ? 0.7 * noise(n - 1): 0));
+    int32 length = 800, delay = 100;
+    echo->Resize(num_channels, num_samples);
+    for (int32 c = 0; c < num_channels; c++) {
+        Vector<BaseFloat> rir(length);
+        for (int32 n = delay; n < length; n++)
+            rir(n) = RandGauss() * std::exp(-n / 200.0);
+        rir.Scale(0.3 / rir.Norm(2));
+        for (int32 n = 0; n < num_samples; n++)
+            for (int32 k = 0; k < length && k <= n; k++)
+                (*echo)(c, n) += rir(k) * (*ref)(n - k);
+    }
+}
+
+void test_echo_canceller(int32 num_channels) {
+    int32 samp_freq = 16000, num_samples = samp_freq * 6;
+    Matrix<BaseFloat> echo, mic, out;
+    Vector<BaseFloat> ref;
+    simulate_echo(num_channels, num_samples, &echo, &ref);
+    // near-end speaker talks in 4th second
+    Matrix<BaseFloat> near(num_channels, num_samples);
+    near.ColRange(samp_freq * 3, samp_freq).SetRandn();
+    near.Scale(4000);
+    mic = echo;
+    mic.AddMat(1.0, near);
+
+    EchoCancellerOptions opts;
+    CancelEcho(opts, mic, ref, &out);
+    KALDI_ASSERT(out.NumRows() == num_channels && out.NumCols() == num_samples);
+    out.AddMat(-1.0, near);
+    for (int32 c = 0; c < num_channels; c++) {
+        for (int32 s = 2; s < 6; s++) {
+            // converged, and not diverged by double talk
+            double erle = Erle(echo.Row(c).Range(s * samp_freq, samp_freq),
+                               out.Row(c).Range(s * samp_freq, samp_freq));
+            KALDI_ASSERT(erle > 15);
+            std::cout << "channel " << c << ", second " << s << ": erle = " << erle << " dB" << std::endl;
+        }
+    }
+
+    // streaming in random chunks is same as offline
+    EchoCanceller echo_canceller(opts, num_channels);
+    Matrix<BaseFloat> chunk_out;
+    int32 num_done = 0;
+    for (int32 beg = 0; beg < num_samples; ) {
+        int32 chunk = std::min(RandInt(1, 1000), num_samples - beg);
+        echo_canceller.AcceptWaveform(mic.ColRange(beg, chunk), ref.Range(beg, chunk), &chunk_out);
+        for (int32 n = 0; n < chunk_out.NumCols(); n++)
+            for (int32 c = 0; c < num_channels; c++)
+                KALDI_ASSERT(std::abs(chunk_out(c, n) - out(c, num_done + n) - near(c, num_done + n)) < 1e-2);
+        num_done += chunk_out.NumCols();
+        beg += chunk;
+    }
+    echo_canceller.Flush(&chunk_out);
+    KALDI_ASSERT(num_done + chunk_out.NumCols() == num_samples);
+    std::cout << "test_echo_canceller(" << num_channels << "): done" << std::endl;
+}
+
+// samples kept in echo canceller are enhanced on Flush(), none is lost, and
+// adaptive beamformer does not need masks for them
+void test_online_enhancer_flush(int32 num_channels, const std::string &beamformer) {
+    int32 num_samples = 16000 + 77;
+    Matrix<BaseFloat> echo, mic, out, masks;
+    Vector<BaseFloat> ref;
+    simulate_echo(num_channels, num_samples, &echo, &ref);
+    mic = echo;
+
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 512;
+    stft_opts.frame_shift = 128;
+    OnlineBeamformerOptions beamformer_opts;
+    beamformer_opts.beamformer = beamformer;
+    int32 num_out[2] = {0, 0};
+    for (int32 aec = 0; aec <= 1; aec++) {
+        OnlineEnhancer enhancer(stft_opts, beamformer_opts, num_channels);
+        if (aec)
+            enhancer.EnableEchoCanceller(EchoCancellerOptions());
+        CMatrix<BaseFloat> enh;
+        for (int32 beg = 0; beg < num_samples; beg += 160) {
+            int32 chunk = std::min(160, num_samples - beg);
+            if (aec)
+                enhancer.AcceptWaveform(mic.ColRange(beg, chunk), ref.Range(beg, chunk));
+            else
+                enhancer.AcceptWaveform(mic.ColRange(beg, chunk));
+            masks.Resize(enhancer.NumFramesReady(), enhancer.NumBins());
+            masks.Set(0.5);
+            enhancer.PopEnhanced(&masks, &enh);
+            enhancer.Synthesize(enh, &out);
+            num_out[aec] += out.NumCols();
+        }
+        enhancer.Flush(&out);
+        num_out[aec] += out.NumCols();
+    }
+    KALDI_ASSERT(num_out[0] == num_out[1]);
+    std::cout << "test_online_enhancer_flush(" << num_channels << ", " << beamformer << "): "
+              << num_out[1] << " samples out" << std::endl;
+}
+
+int main() {
+    for (int32 c: {1, 2})
+        test_echo_canceller(c);
+    test_online_enhancer_flush(1, "mvdr");
+    test_online_enhancer_flush(2, "mvdr");
+    return 0;
+}
@@ -0,0 +1,94 @@
+// test-fixed-point.cc
+// wujian@18.6.2
+
+#include "include/fixed-point.h"
+#include "include/online-enhancer.h"
+
+using namespace kaldi;
+
+// 10 * log10(|ref|^2 / |ref - est|^2)
+double Snr(const std::vector<double> &ref, const std::vector<double> &est) {
+    double sig = 0, err = 0;
+    for (int32 i = 0; i < ref.size(); i++)
+        sig += ref[i] * ref[i], err += (ref[i] - est[i]) * (ref[i] - est[i]);
+    return 10 * std::log10(sig / (err + 1e-20));
+}
+
+void test_fixed_point_fft(int32 n) {
+    FixedPointRealFFT fft(n);
+    std::vector<int32> frame(n), spectrum(n + 2), recon(n);
+    for (int32 i = 0; i < n; i++)
+        frame[i] = static_cast<int32>(RandInt(-32768, 32767)) * RandInt(0, 32767);
+    int32 exponent, recon_exponent;
+    fft.Forward(frame.data(), -15, spectrum.data(), &exponent);
+
+    std::vector<double> ref, est;
+    for (int32 k = 0; k <= n / 2; k++) {
+        double re = 0, im = 0;
+        for (int32 t = 0; t < n; t++) {
+            re += frame[t] * std::cos(M_2PI * k * t / n) / 32768;
+            im -= frame[t] * std::sin(M_2PI * k * t / n) / 32768;
+        }
+        ref.push_back(re), ref.push_back(im);
+        est.push_back(std::ldexp(spectrum[2 * k], exponent));
+        est.push_back(std::ldexp(spectrum[2 * k + 1], exponent));
+    }
+    KALDI_ASSERT(Snr(ref, est) > 80);
+
+    fft.Inverse(spectrum.data(), exponent, recon.data(), &recon_exponent);
+    ref.clear(), est.clear();
+    for (int32 t = 0; t < n; t++) {
+        ref.push_back(frame[t] / 32768.0);
+        est.push_back(std::ldexp(recon[t], recon_exponent));
+    }
+    KALDI_ASSERT(Snr(ref, est) > 80);
+    std::cout << "test_fixed_point_fft(" << n << "): done" << std::endl;
+}
+
+// against OnlineEnhancer with fixed beamformer
+void test_fixed_point_enhancer(int32 num_channels) {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 256;
+    stft_opts.frame_shift = 64;
+    OnlineBeamformerOptions beamformer_opts;
+    beamformer_opts.beamformer = "fixed";
+    OnlineEnhancer ref_enhancer(stft_opts, beamformer_opts, num_channels);
+    int32 num_bins = ref_enhancer.NumBins(), shift = 64;
+    CMatrix<BaseFloat> weights(num_bins, num_channels), enh;
+    weights.SetRandn();
+    weights.Scale(0.5 / num_channels, 0);
+    ref_enhancer.SetWeights(weights);
+    FixedPointEnhancer fixed_enhancer(stft_opts, weights);
+
+    Matrix<BaseFloat> wave(num_channels, 100 * shift), out;
+    wave.SetRandn();
+    wave.Scale(2000);
+    wave.ApplyFloor(-32768), wave.ApplyCeiling(32767);
+    std::vector<int16> chunk(num_channels * shift), fixed_out(shift);
+    std::vector<double> ref, est;
+    for (int32 beg = 0; beg < wave.NumCols(); beg += shift) {
+        ref_enhancer.AcceptWaveform(wave.ColRange(beg, shift));
+        ref_enhancer.PopEnhanced(NULL, &enh);
+        ref_enhancer.Synthesize(enh, &out);
+        for (int32 c = 0; c < num_channels; c++)
+            for (int32 n = 0; n < shift; n++)
+                chunk[c * shift + n] = static_cast<int16>(std::round(wave(c, beg + n)));
+        int32 num_samples = fixed_enhancer.AcceptChunk(chunk.data(), fixed_out.data());
+        KALDI_ASSERT(num_samples == out.NumCols());
+        for (int32 n = 0; n < num_samples; n++)
+            ref.push_back(out(0, n)), est.push_back(fixed_out[n]);
+    }
+    // bounded by rounding of int16 output
+    double snr = Snr(ref, est);
+    KALDI_ASSERT(snr > 40);
+    std::cout << "test_fixed_point_enhancer(" << num_channels << "): snr = " << snr
+              << " dB, done" << std::endl;
+}
+
+int main() {
+    for (int32 n: {64, 512})
+        test_fixed_point_fft(n);
+    for (int32 c: {2, 4})
+        test_fixed_point_enhancer(c);
+    return 0;
+}
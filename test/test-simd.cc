@@ -0,0 +1,67 @@
+// test-simd.cc
+// wujian@18.2.12
+
+#include "include/setk-simd.h"
+#include "include/stft.h"
+
+using namespace kaldi;
+
+BaseFloat MaxAbsDiff(const VectorBase<BaseFloat> &a, const VectorBase<BaseFloat> &b) {
+    Vector<BaseFloat> diff(a);
+    diff.AddVec(-1, b);
+    return diff.Norm(std::numeric_limits<BaseFloat>::infinity());
+}
+
+// each variant should agree with baseline(up to rounding of FMA)
+void test_kernels(SimdLevel level) {
+    const SimdKernels &base = SimdKernelsOf(kSimdBaseline), &simd = SimdKernelsOf(level);
+    // odd size to cover remainder loops
+    int32 n = 257;
+    Vector<BaseFloat> a(2 * n), b(2 * n), w(2 * n), ref(2 * n), out(2 * n);
+    a.SetRandn(); b.SetRandn(); w.SetRandn();
+
+    for (int32 conj = 0; conj <= 1; conj++) {
+        ref.CopyFromVec(a); out.CopyFromVec(a);
+        base.complex_mul(ref.Data(), b.Data(), n, conj);
+        simd.complex_mul(out.Data(), b.Data(), n, conj);
+        KALDI_ASSERT(MaxAbsDiff(ref, out) < 1e-4);
+    }
+    base.gcc_phat(a.Data(), b.Data(), ref.Data(), n);
+    simd.gcc_phat(a.Data(), b.Data(), out.Data(), n);
+    KALDI_ASSERT(MaxAbsDiff(ref, out) < 1e-5);
+
+    base.window_frame(a.Data(), w.Data(), ref.Data(), 2 * n);
+    simd.window_frame(a.Data(), w.Data(), out.Data(), 2 * n);
+    KALDI_ASSERT(MaxAbsDiff(ref, out) < 1e-5);
+
+    ref.SetZero(); out.SetZero();
+    base.window_add(a.Data(), w.Data(), 0.5, ref.Data(), 2 * n);
+    simd.window_add(a.Data(), w.Data(), 0.5, out.Data(), 2 * n);
+    base.axpy(2, b.Data(), ref.Data(), 2 * n);
+    simd.axpy(2, b.Data(), out.Data(), 2 * n);
+    KALDI_ASSERT(MaxAbsDiff(ref, out) < 1e-4);
+
+    SubVector<BaseFloat> ref_bins(ref, 0, n), out_bins(out, 0, n);
+    base.power_spectrum(a.Data(), ref.Data(), n);
+    simd.power_spectrum(a.Data(), out.Data(), n);
+    KALDI_ASSERT(MaxAbsDiff(ref_bins, out_bins) < 1e-4);
+
+    // 3 channels of length 165, with stride 171
+    base.multi_dot(w.Data(), a.Data(), 171, 3, 165, ref.Data());
+    simd.multi_dot(w.Data(), a.Data(), 171, 3, 165, out.Data());
+    KALDI_ASSERT(MaxAbsDiff(SubVector<BaseFloat>(ref, 0, 3), SubVector<BaseFloat>(out, 0, 3)) < 1e-3);
+
+    simd.approx_phase(a.Data(), out.Data(), n);
+    KALDI_ASSERT(std::abs(out(0) - ApproxAtan2(0, a(0))) < 1e-5);
+    for (int32 f = 1; f < n - 1; f++)
+        KALDI_ASSERT(std::abs(out(f) - std::atan2(a(2 * f + 1), a(2 * f))) < 1e-4);
+    std::cout << "test_kernels(" << SimdLevelName(level) << "): done" << std::endl;
+}
+
+int main() {
+    std::cout << "Detected " << SimdLevelName(DetectSimdLevel()) << ", selected "
+              << SimdLevelName(SelectedSimdLevel()) << std::endl;
+    for (int32 level = 0; level <= DetectSimdLevel(); level++)
+        test_kernels(static_cast<SimdLevel>(level));
+    return 0;
+}
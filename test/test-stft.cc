@@ -2,6 +2,9 @@
 // wujian@18.2.12
 
 #include "include/stft.h"
+#include "include/stft-feature.h"
+#include "include/online-enhanced-feature.h"
+#include "include/resampler.h"
 
 using namespace kaldi;
     
@@ -89,8 +92,219 @@ void test_istft() {
     // std:: cout << vec << std::endl;
 }
 
+// features on stft should agree with Kaldi's, when framing is same
+void test_stft_feature() {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 400;
+    stft_opts.frame_shift = 160;
+    ShortTimeFTComputer stft_computer(stft_opts);
+    Matrix<BaseFloat> wave(1, 16000), rstft;
+    wave.SetRandn();
+    wave.Scale(1000);
+    stft_computer.ShortTimeFT(wave, &rstft);
+
+    StftFeatureOptions feat_opts;
+    feat_opts.output_feature = "fbank";
+    FrameExtractionOptions &frame_opts = feat_opts.fbank_opts.frame_opts;
+    frame_opts.window_type = "hamming";
+    frame_opts.dither = 0;
+    frame_opts.preemph_coeff = 0;
+    frame_opts.remove_dc_offset = false;
+    StftFeatureComputer feat_computer(feat_opts, &stft_computer);
+    KALDI_ASSERT(feat_computer.MatchFraming(16000));
+
+    Matrix<BaseFloat> feats, ref;
+    feat_computer.Compute(&rstft, 16000, &feats);
+    Fbank fbank(feat_opts.fbank_opts);
+    fbank.ComputeFeatures(wave.Row(0), 16000, 1.0, &ref);
+    KALDI_ASSERT(SameDim(feats, ref));
+    ref.AddMat(-1, feats);
+    KALDI_ASSERT(ref.LargestAbsElem() < 1e-3);
+
+    // not same, fall back to resynthesis
+    frame_opts.preemph_coeff = 0.97;
+    StftFeatureComputer resynth_computer(feat_opts, &stft_computer);
+    KALDI_ASSERT(!resynth_computer.MatchFraming(16000));
+    std::cout << "test_stft_feature: done" << std::endl;
+}
+
+// fbank on resynthesized waveform is in same scale as the one on stft frames
+void test_stft_feature_fallback(bool normalize_input) {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 400;
+    stft_opts.frame_shift = 100;
+    stft_opts.normalize_input = normalize_input;
+    ShortTimeFTComputer stft_computer(stft_opts);
+    Matrix<BaseFloat> wave(1, 16000), rstft;
+    wave.SetRandn();
+    wave.Scale(1000);
+    stft_computer.ShortTimeFT(wave, &rstft);
+
+    StftFeatureOptions feat_opts;
+    feat_opts.output_feature = "fbank";
+    FrameExtractionOptions &frame_opts = feat_opts.fbank_opts.frame_opts;
+    frame_opts.frame_shift_ms = 6.25;
+    frame_opts.window_type = "hamming";
+    frame_opts.dither = 0;
+    frame_opts.preemph_coeff = 0;
+    frame_opts.remove_dc_offset = false;
+    StftFeatureComputer direct_computer(feat_opts, &stft_computer);
+    KALDI_ASSERT(direct_computer.MatchFraming(16000));
+    // tiny dither(no effect in int16 range) makes it fall back to resynthesis
+    frame_opts.dither = 1e-3;
+    StftFeatureComputer resynth_computer(feat_opts, &stft_computer);
+    KALDI_ASSERT(!resynth_computer.MatchFraming(16000));
+
+    Matrix<BaseFloat> direct_feats, resynth_feats;
+    direct_computer.Compute(&rstft, 16000, &direct_feats);
+    resynth_computer.Compute(&rstft, 16000, &resynth_feats);
+    KALDI_ASSERT(SameDim(direct_feats, resynth_feats));
+    // edge frames are not fully overlapped in resynthesis
+    int32 num_edges = stft_opts.frame_length / stft_opts.frame_shift,
+          num_frames = direct_feats.NumRows() - 2 * num_edges;
+    SubMatrix<BaseFloat> diff(resynth_feats, num_edges, num_frames, 0, resynth_feats.NumCols());
+    diff.AddMat(-1, direct_feats.RowRange(num_edges, num_frames));
+    KALDI_ASSERT(diff.LargestAbsElem() < 1e-2);
+    std::cout << "test_stft_feature_fallback(" << normalize_input << "): max difference = "
+              << diff.LargestAbsElem() << std::endl;
+}
+
+void test_online_enhanced_feature() {
+    ShortTimeFTOptions stft_opts;
+    stft_opts.frame_length = 400;
+    stft_opts.frame_shift = 160;
+    ShortTimeFTComputer stft_computer(stft_opts);
+    Matrix<BaseFloat> wave(1, 16000), rstft, ref;
+    wave.SetRandn();
+    wave.Scale(1000);
+    stft_computer.ShortTimeFT(wave, &rstft);
+
+    StftFeatureOptions feat_opts;
+    feat_opts.output_feature = "log-power";
+    StftFeatureComputer feat_computer(feat_opts, &stft_computer);
+    feat_computer.Compute(&rstft, 16000, &ref);
+
+    // masks of ones, lag behind waveform
+    OnlineBeamformerOptions beamformer_opts;
+    OnlineEnhancedFeature online_feature(stft_opts, beamformer_opts, feat_opts, 16000, 1, true);
+    int32 num_bins = online_feature.Dim(), num_masks = 0, chunk = 1000;
+    for (int32 s = 0; s < wave.NumCols(); s += chunk) {
+        online_feature.AcceptWaveform(16000, wave.ColRange(s, std::min(chunk, wave.NumCols() - s)));
+        KALDI_ASSERT(online_feature.NumFramesReady() == num_masks);
+        Matrix<BaseFloat> masks(std::max(ref.NumRows() * (s + chunk) / wave.NumCols() - num_masks, 0), num_bins);
+        masks.Set(1.0);
+        online_feature.AcceptMasks(masks);
+        num_masks += masks.NumRows();
+    }
+    Matrix<BaseFloat> masks(ref.NumRows() - num_masks, num_bins);
+    masks.Set(1.0);
+    online_feature.AcceptMasks(masks);
+    KALDI_ASSERT(!online_feature.IsLastFrame(ref.NumRows() - 1));
+    online_feature.InputFinished();
+    KALDI_ASSERT(online_feature.NumFramesReady() == ref.NumRows());
+    KALDI_ASSERT(online_feature.IsLastFrame(ref.NumRows() - 1));
+
+    Vector<BaseFloat> frame(num_bins);
+    for (int32 t = 0; t < ref.NumRows(); t++) {
+        online_feature.GetFrame(t, &frame);
+        frame.AddVec(-1, ref.Row(t));
+        KALDI_ASSERT(frame.Max() < 1e-3 && frame.Min() > -1e-3);
+    }
+    std::cout << "test_online_enhanced_feature: done" << std::endl;
+}
+
+// sine of 1kHz in two channels(2nd is scaled), resampled in one pass
+void test_resampler(int32 freq_in, int32 freq_out) {
+    PolyphaseResampler resampler(freq_in, freq_out);
+    int32 num_samples = freq_in / 10;
+    Matrix<BaseFloat> wave(2, num_samples), resampled;
+    for (int32 n = 0; n < num_samples; n++) {
+        wave(0, n) = std::sin(2 * M_PI * 1000 * n / freq_in);
+        wave(1, n) = 0.5 * wave(0, n);
+    }
+    resampler.Resample(wave, &resampled);
+    KALDI_ASSERT(resampled.NumCols() == num_samples * freq_out / freq_in);
+    // skip edges
+    for (int32 n = 200; n < resampled.NumCols() - 200; n++) {
+        BaseFloat ref = std::sin(2 * M_PI * 1000 * n / freq_out);
+        KALDI_ASSERT(std::abs(resampled(0, n) - ref) < 1e-3);
+        KALDI_ASSERT(std::abs(resampled(1, n) - 0.5 * ref) < 1e-3);
+    }
+    std::cout << "test_resampler(" << freq_in << " => " << freq_out << "): done" << std::endl;
+}
+
+// batched stft should be same as unbatched one of each utterance
+void test_batched_stft() {
+    ShortTimeFTOptions opts;
+    opts.frame_length = 400, opts.frame_shift = 160;
+    opts.normalize_input = true;
+    ShortTimeFTComputer stft_computer(opts);
+    int32 num_utts = 5, num_channels = 3;
+    std::vector<Matrix<BaseFloat> > waves(num_utts);
+    std::vector<const MatrixBase<BaseFloat>*> batch;
+    for (int32 u = 0; u < num_utts; u++) {
+        waves[u].Resize(num_channels, RandInt(400, 16000));
+        waves[u].SetRandn();
+        waves[u].Scale(1000);
+        batch.push_back(&waves[u]);
+    }
+    Matrix<BaseFloat> batched_spectra, spectra, utt_spectra;
+    std::vector<int32> frame_offsets;
+    stft_computer.Compute(batch, NULL, &batched_spectra, NULL, &frame_offsets);
+    KALDI_ASSERT(frame_offsets.size() == num_utts + 1);
+    for (int32 u = 0; u < num_utts; u++) {
+        stft_computer.Compute(waves[u], NULL, &spectra, NULL);
+        CopyUtteranceFromBatch(batched_spectra, frame_offsets, num_channels, u, &utt_spectra);
+        KALDI_ASSERT(utt_spectra.ApproxEqual(spectra, 1e-5));
+    }
+    std::cout << "test_batched_stft: done" << std::endl;
+}
+
+// online analysis & synthesis with asymmetric window reconstructs input perfectly,
+// with latency of 2 x frame_shift
+void test_asymmetric_window(int32 frame_length, int32 frame_shift) {
+    ShortTimeFTOptions opts;
+    opts.frame_length = frame_length, opts.frame_shift = frame_shift;
+    opts.window = "asymmetric";
+    OnlineShortTimeFTComputer computer(opts, 1);
+    int32 offset = computer.Computer().SynthesisOffset();
+    KALDI_ASSERT(offset == frame_length - 2 * frame_shift);
+    KALDI_ASSERT(computer.Latency() == 2 * frame_shift);
+
+    Matrix<BaseFloat> wave(1, 16000), stft, chunk_out;
+    wave.SetRandn();
+    wave.Scale(1000);
+    Vector<BaseFloat> out;
+    for (int32 beg = 0; beg < wave.NumCols(); ) {
+        int32 chunk = std::min(RandInt(1, 1000), wave.NumCols() - beg);
+        computer.AcceptWaveform(wave.ColRange(beg, chunk));
+        computer.PopFrames(&stft);
+        computer.OverlapAdd(stft, &chunk_out);
+        // samples out so far are finished once input reaches them plus latency
+        KALDI_ASSERT(offset + out.Dim() + chunk_out.NumCols() + computer.Latency() > beg + chunk);
+        out.Resize(out.Dim() + chunk_out.NumCols(), kCopyData);
+        out.Range(out.Dim() - chunk_out.NumCols(), chunk_out.NumCols()).CopyFromVec(chunk_out.Row(0));
+        beg += chunk;
+    }
+    // output starts from sample offset of input, and the first frame_shift ones are faded in
+    for (int32 n = frame_shift; n < out.Dim(); n++)
+        KALDI_ASSERT(std::abs(out(n) - wave(0, offset + n)) < 0.1);
+    computer.Flush(&chunk_out);
+    KALDI_ASSERT(chunk_out.NumCols() == frame_shift);
+    std::cout << "test_asymmetric_window(" << frame_length << ", " << frame_shift << "): done" << std::endl;
+}
+
 int main() {
     test_istft();
+    test_batched_stft();
+    test_stft_feature();
+    test_stft_feature_fallback(false);
+    test_stft_feature_fallback(true);
+    test_online_enhanced_feature();
+    test_resampler(44100, 16000);
+    test_resampler(16000, 48000);
+    test_asymmetric_window(512, 128);
+    test_asymmetric_window(1024, 64);
     // test_stft();
     return 0;
 }
@@ -0,0 +1,62 @@
+// test-table-resume.cc
+// wujian@18.6.12
+
+#include <fstream>
+
+#include "include/table-resume.h"
+
+using namespace kaldi;
+
+void write_matrices(const std::vector<std::string> &keys, bool resume,
+                    std::vector<std::string> *written) {
+    ResumeOptions opts;
+    opts.resume = resume;
+    ResumableMatrixWriter writer("ark,scp:resume.ark,resume.scp", opts);
+    written->clear();
+    for (const std::string &key: keys) {
+        if (writer.IsDone(key))
+            continue;
+        Matrix<BaseFloat> mat(10, key.size());
+        mat.Set(key.size());
+        writer.Write(key, mat);
+        written->push_back(key);
+    }
+}
+
+void test_table_resume() {
+    for (const char *filename: {"resume.ark", "resume.scp", "resume.ark.1",
+                                "resume.ark.2", "resume.ark.3"})
+        std::remove(filename);
+    std::vector<std::string> written;
+    // first run, stopped after two utterances
+    write_matrices({"a", "bb"}, false, &written);
+    KALDI_ASSERT(written.size() == 2);
+    // entry whose object is broken should be redone
+    {
+        std::ofstream os("resume.scp", std::ios::app);
+        os << "ccc resume.ark:1000000" << std::endl;
+    }
+    write_matrices({"a", "bb", "ccc", "dddd"}, true, &written);
+    KALDI_ASSERT(written.size() == 2 && written[0] == "ccc" && written[1] == "dddd");
+    // nothing left
+    write_matrices({"a", "bb", "ccc", "dddd"}, true, &written);
+    KALDI_ASSERT(written.empty());
+    // and no empty part is left
+    KALDI_ASSERT(std::ifstream("resume.ark.1").good() && !std::ifstream("resume.ark.2").good() &&
+                 !std::ifstream("resume.scp.2").good());
+
+    int32 num_mats = 0;
+    SequentialBaseFloatMatrixReader reader("scp:resume.scp");
+    for (; !reader.Done(); reader.Next()) {
+        const Matrix<BaseFloat> &mat = reader.Value();
+        KALDI_ASSERT(mat.NumCols() == reader.Key().size() && mat(0, 0) == mat.NumCols());
+        num_mats++;
+    }
+    KALDI_ASSERT(num_mats == 4);
+    std::cout << "test_table_resume: done" << std::endl;
+}
+
+int main() {
+    test_table_resume();
+    return 0;
+}
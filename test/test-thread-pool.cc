@@ -0,0 +1,106 @@
+// test-thread-pool.cc
+// wujian@18.2.12
+
+#include "include/thread-pool.h"
+#include "include/stft.h"
+#include "include/beamformer.h"
+
+using namespace kaldi;
+
+void test_parallel_for(int32 num_threads) {
+    ThreadPoolOptions opts;
+    opts.num_threads = num_threads;
+    ThreadPool::Get().Configure(opts);
+
+    std::vector<int32> hits(10000, 0);
+    ParallelFor(0, hits.size(), [&hits](int32 b, int32 e) {
+        for (int32 i = b; i < e; i++) hits[i]++;
+    });
+    for (size_t i = 0; i < hits.size(); i++)
+        KALDI_ASSERT(hits[i] == 1);
+
+    // nested regions should not deadlock
+    std::atomic<int32> sum(0);
+    ParallelFor(0, 16, [&sum](int32 b, int32 e) {
+        for (int32 i = b; i < e; i++)
+            ParallelFor(0, 100, [&sum](int32 bb, int32 ee) { sum += ee - bb; });
+    });
+    KALDI_ASSERT(sum == 1600);
+
+    // exceptions are passed to the waiting thread
+    bool failed = false;
+    try {
+        TaskGroup group;
+        for (int32 i = 0; i < 8; i++)
+            group.Run([i] { if (i == 5) KALDI_ERR << "task " << i << " failed"; });
+        group.Wait();
+    } catch (const std::exception &e) {
+        failed = true;
+    }
+    KALDI_ASSERT(failed);
+
+    // ... also from pieces of ParallelFor() on other threads
+    failed = false;
+    try {
+        ParallelFor(0, 64, [](int32 b, int32 e) {
+            if (b > 0) KALDI_ERR << "piece from " << b << " failed";
+        });
+    } catch (const std::exception &e) {
+        failed = true;
+    }
+    KALDI_ASSERT(failed || num_threads == 1);
+
+    // caller leaving before Wait() still waits for its tasks
+    std::atomic<int32> finished(0);
+    try {
+        TaskGroup group;
+        for (int32 i = 0; i < 8; i++)
+            group.Run([&finished] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                finished++;
+            });
+        KALDI_ERR << "caller failed";
+    } catch (const std::exception &e) {}
+    KALDI_ASSERT(finished == 8);
+    std::cout << "test_parallel_for(" << num_threads << "): done" << std::endl;
+}
+
+// results should not depend on number of threads
+void test_parallel_components() {
+    ShortTimeFTOptions opts;
+    ShortTimeFTComputer computer(opts);
+    Matrix<BaseFloat> wave(4, 16000), stft[2];
+    wave.SetRandn();
+    CMatrix<BaseFloat> cstft, trim, psd, steer[2], weights[2];
+    Matrix<BaseFloat> mask;
+
+    for (int32 n = 0; n < 2; n++) {
+        ThreadPoolOptions pool_opts;
+        pool_opts.num_threads = n ? 4: 1;
+        ThreadPool::Get().Configure(pool_opts);
+        computer.ShortTimeFT(wave, &stft[n]);
+        int32 num_bins = opts.PaddingLength() / 2 + 1, num_frames = stft[n].NumRows() / 4;
+        cstft.Resize(stft[n].NumRows(), num_bins);
+        cstft.CopyFromRealfft(stft[n]);
+        TrimStft(num_bins, 4, cstft, &trim);
+        mask.Resize(num_frames, num_bins);
+        mask.Set(0.5);
+        EstimatePsd(trim, mask, &psd, NULL);
+        EstimateSteerVector(psd, &steer[n]);
+        ComputeMvdrBeamWeights(psd, steer[n], &weights[n]);
+    }
+    stft[0].AddMat(-1, stft[1]);
+    KALDI_ASSERT(stft[0].LargestAbsElem() < 1e-3);
+    weights[0].AddMat(-1, 0, weights[1]);
+    for (int32 f = 0; f < weights[0].NumRows(); f++)
+        for (int32 c = 0; c < weights[0].NumCols(); c++)
+            KALDI_ASSERT(std::abs(weights[0](f, c, kReal)) < 1e-4 && std::abs(weights[0](f, c, kImag)) < 1e-4);
+    std::cout << "test_parallel_components: done" << std::endl;
+}
+
+int main() {
+    test_parallel_for(1);
+    test_parallel_for(4);
+    test_parallel_components();
+    return 0;
+}
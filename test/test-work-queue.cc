@@ -0,0 +1,118 @@
+// test-work-queue.cc
+// wujian@18.6.14
+
+#include <unistd.h>
+
+#include "include/work-queue.h"
+
+using namespace kaldi;
+
+// worker: scale matrices fetched from work queue by 2
+int32 run_worker() {
+    std::string job = std::getenv("SETK_WORKER_ID");
+    DistributedMatrixReader reader("scp:wq-input.scp", WorkQueueOptions());
+    BaseFloatMatrixWriter writer("ark,scp:wq-output." + job + ".ark,wq-output." + job + ".scp");
+    for (; !reader.Done(); reader.Next()) {
+        Matrix<BaseFloat> mat(reader.Value());
+        mat.Scale(2);
+        writer.Write(reader.Key(), mat);
+    }
+    return 0;
+}
+
+// worker: crash on utt-1
+int32 run_poison_worker() {
+    DistributedMatrixReader reader("scp:wq-input.scp", WorkQueueOptions());
+    for (; !reader.Done(); reader.Next()) {
+        if (reader.Key() == "utt-1")
+            _exit(1);
+        // keep others busy until utt-1 is given up
+        usleep(10000);
+    }
+    return 0;
+}
+
+void test_work_queue(const std::string &program) {
+    int32 num_keys = 50, num_workers = 3;
+    std::vector<std::string> keys;
+    {
+        BaseFloatMatrixWriter writer("ark,scp:wq-input.ark,wq-input.scp");
+        for (int32 k = 0; k < num_keys; k++) {
+            keys.push_back("utt-" + std::to_string(k));
+            Matrix<BaseFloat> mat(RandInt(10, 100), 10);
+            mat.SetRandn();
+            writer.Write(keys.back(), mat);
+        }
+    }
+    std::vector<std::string> commands, scripts;
+    for (int32 j = 1; j <= num_workers; j++) {
+        commands.push_back(program + " worker");
+        scripts.push_back("wq-output." + std::to_string(j) + ".scp");
+    }
+    // missing in input table, skipped by workers
+    keys.push_back("utt-missing");
+    std::vector<int32> owners;
+    std::vector<bool> succeeded;
+    {
+        WorkQueueCoordinator coordinator("wq-test.sock", keys);
+        KALDI_ASSERT(coordinator.Run(commands) == 0);
+        owners = coordinator.Owners();
+        succeeded = coordinator.Succeeded();
+        KALDI_ASSERT(coordinator.Skipped()[num_keys] && owners[num_keys] == 0);
+        KALDI_ASSERT(std::count(coordinator.Skipped().begin(), coordinator.Skipped().end(), true) == 1);
+    }
+    for (int32 k = 0; k < num_keys; k++)
+        KALDI_ASSERT(owners[k] >= 1 && owners[k] <= num_workers);
+    KALDI_ASSERT(MergeWorkerTables(keys, owners, scripts, succeeded, "wq-merged.ark", "wq-merged.scp", true) == num_keys);
+
+    SequentialBaseFloatMatrixReader merged_reader("scp:wq-merged.scp");
+    RandomAccessBaseFloatMatrixReader input_reader("scp:wq-input.scp");
+    int32 k = 0;
+    for (; !merged_reader.Done(); merged_reader.Next(), k++) {
+        KALDI_ASSERT(merged_reader.Key() == keys[k]);
+        Matrix<BaseFloat> mat(input_reader.Value(keys[k]));
+        mat.Scale(2);
+        KALDI_ASSERT(mat.ApproxEqual(merged_reader.Value()));
+    }
+    KALDI_ASSERT(k == num_keys);
+
+    // last object of worker 1 is not trusted if it crashed, truncated archive
+    // of worker 2 is used until its last complete object
+    std::vector<std::pair<std::string, std::string> > entries;
+    KALDI_ASSERT(ReadScriptFile(scripts[1], true, &entries));
+    int32 num_dropped = std::min<int32>(std::count(owners.begin(), owners.end(), 1), 1);
+    if (entries.size() >= 2) {
+        num_dropped += 2;
+        const std::string &last = entries.back().second;
+        int64 offset;
+        KALDI_ASSERT(ConvertStringToInteger(last.substr(last.find_last_of(':') + 1), &offset));
+        KALDI_ASSERT(truncate("wq-output.2.ark", offset - entries.back().first.size() - 3) == 0);
+    }
+    succeeded[0] = false;
+    KALDI_ASSERT(MergeWorkerTables(keys, owners, scripts, succeeded, "wq-merged.ark", "wq-merged.scp", true)
+                 == num_keys - num_dropped);
+    std::cout << "test_work_queue: done" << std::endl;
+}
+
+void test_poison_key(const std::string &program) {
+    std::vector<std::string> keys, commands(3, program + " poison");
+    for (int32 k = 0; k < 20; k++)
+        keys.push_back("utt-" + std::to_string(k));
+    WorkQueueCoordinator coordinator("wq-poison.sock", keys, 1);
+    // utt-1 crashes 2 workers then is given up
+    KALDI_ASSERT(coordinator.Run(commands) == 2);
+    KALDI_ASSERT(coordinator.PoisonKeys().size() == 1 && coordinator.PoisonKeys()[0] == "utt-1");
+    for (int32 k = 0; k < keys.size(); k++)
+        KALDI_ASSERT((coordinator.Owners()[k] == 0) == (k == 1));
+    std::cout << "test_poison_key: done" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && std::string(argv[1]) == "worker")
+        return run_worker();
+    if (argc == 2 && std::string(argv[1]) == "poison")
+        return run_poison_worker();
+    test_work_queue(argv[0]);
+    test_poison_key(argv[0]);
+    return 0;
+}